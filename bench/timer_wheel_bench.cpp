@@ -0,0 +1,85 @@
+// Scheduler timer wheel benchmark: 100k timers, half of them cancelled.
+// Reports insert and cancel cost and how late the remaining timers fire.
+
+#include "common/scheduler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t TIMER_COUNT = 100000;
+constexpr int MAX_DELAY_MS = 2000;
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main() {
+    Logger::setLogLevel(LogLevel::ERROR);
+
+    Scheduler scheduler(4, std::chrono::milliseconds(1));
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> delayDist(1, MAX_DELAY_MS);
+
+    std::vector<Clock::time_point> deadlines(TIMER_COUNT);
+    std::atomic<size_t> fired{0};
+    std::atomic<int64_t> totalLateUs{0};
+    std::atomic<int64_t> maxLateUs{0};
+
+    auto insertStart = Clock::now();
+    for (size_t i = 0; i < TIMER_COUNT; i++) {
+        auto delay = std::chrono::milliseconds(delayDist(rng));
+        deadlines[i] = Clock::now() + delay;
+        scheduler.scheduleTaskAfter("timer-" + std::to_string(i), delay, [&, i]() {
+            auto late = std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - deadlines[i]).count();
+            totalLateUs += late;
+            int64_t previous = maxLateUs.load();
+            while (late > previous && !maxLateUs.compare_exchange_weak(previous, late)) {
+            }
+            fired++;
+        });
+    }
+    double insertMs = elapsedMs(insertStart);
+
+    auto cancelStart = Clock::now();
+    size_t cancelled = 0;
+    for (size_t i = 0; i < TIMER_COUNT; i += 2) {
+        if (scheduler.cancelTask("timer-" + std::to_string(i))) {
+            cancelled++;
+        }
+    }
+    double cancelMs = elapsedMs(cancelStart);
+
+    // Timers that came due while inserting are measured from start(), not from their deadline
+    auto startTime = Clock::now();
+    for (auto& deadline : deadlines) {
+        deadline = std::max(deadline, startTime);
+    }
+    scheduler.start();
+    size_t expected = TIMER_COUNT - cancelled;
+    auto waitStart = Clock::now();
+    while (fired < expected && elapsedMs(waitStart) < MAX_DELAY_MS * 3) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    scheduler.stop();
+
+    std::cout << "timers:        " << TIMER_COUNT << "\n"
+              << "insert:        " << insertMs << " ms (" << insertMs * 1e6 / TIMER_COUNT << " ns/timer)\n"
+              << "cancel:        " << cancelMs << " ms (" << cancelMs * 1e6 / cancelled << " ns/timer)\n"
+              << "fired:         " << fired << " / " << expected << "\n";
+    if (fired > 0) {
+        std::cout << "avg lateness:  " << totalLateUs / static_cast<int64_t>(fired.load()) << " us\n"
+                  << "max lateness:  " << maxLateUs << " us\n";
+    }
+    return fired == expected ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common/backup_status.hpp"
+#include "common/file_utils.hpp"
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <limits>
+#include <cstdint>
+#include <sys/types.h>
+
+struct CatalogEntry {
+    std::string vmId;
+    std::string backupId;   // Backup directory
+    int64_t timestamp{0};   // Completion time, seconds since the epoch
+    BackupType type{BackupType::FULL};
+    uint64_t size{0};       // Bytes stored
+};
+
+// Catalog of the backups in one repository, kept in <repository>/.catalog so
+// listing and retention never scan backup directories.
+//
+// Every change is appended to a log as one checksummed, fsync'ed record. A
+// sorted index of all entries up to some log offset is memory mapped and
+// binary searched by (vmId, timestamp); the log tail past that offset is
+// replayed into memory. Once the tail grows past a threshold it is folded
+// into a new index, and the log is rewritten to one add per live entry;
+// both are replaced atomically. Appends by other processes are picked up on
+// the next query. Files use host byte order.
+class BackupCatalog {
+public:
+    explicit BackupCatalog(const std::string& repository);
+    ~BackupCatalog();
+
+    // Shared, opened instance per repository; a new catalog imports the
+    // backups already in the repository. Null when the repository does not exist.
+    static std::shared_ptr<BackupCatalog> forRepository(const std::string& repository);
+
+    bool open();
+    void close();
+
+    bool add(const CatalogEntry& entry);
+    bool remove(const std::string& vmId, const std::string& backupId);
+
+    std::optional<CatalogEntry> latest(const std::string& vmId);
+    // Backups of a VM completed in [from, to], newest first
+    std::vector<CatalogEntry> list(const std::string& vmId,
+                                   int64_t from = std::numeric_limits<int64_t>::min(),
+                                   int64_t to = std::numeric_limits<int64_t>::max());
+    // Every backup, by VM and then time
+    std::vector<CatalogEntry> listAll();
+
+    // Fold the log tail into a new index
+    bool compact();
+    // Add backup directories with a metadata.json that are not cataloged yet
+    size_t importDirectory();
+
+    std::string getRepository() const { return repository_; }
+    std::string getLastError() const;
+
+private:
+    struct EntryOrder {
+        bool operator()(const CatalogEntry& a, const CatalogEntry& b) const;
+    };
+
+    // Called with mutex_ held
+    bool refresh();
+    // (Re)open the log at logPath_, replacing logFd_
+    bool openLog();
+    bool mapIndex();
+    bool replayLog(bool truncateTorn);
+    bool append(uint8_t op, const std::vector<CatalogEntry>& entries);
+    void apply(uint8_t op, const CatalogEntry& entry);
+    bool contains(const std::string& vmId, const std::string& backupId) const;
+    std::vector<CatalogEntry> collect(const std::string* vmId, int64_t from, int64_t to) const;
+    bool compactLocked();
+    // First index position whose (vmId, timestamp) is not less than the key
+    // (or, with after, greater than it)
+    size_t indexBound(const std::string& vmId, int64_t timestamp, bool after) const;
+    CatalogEntry indexEntry(size_t position) const;
+    bool isRemoved(const CatalogEntry& entry) const;
+
+    std::string repository_;
+    std::string directory_;
+    std::string logPath_;
+    std::string indexPath_;
+    std::string lockPath_;
+    int lockFd_{-1};   // flock'ed by every reader and writer
+    int logFd_{-1};
+    uint64_t replayed_{0};  // Log bytes reflected in the index and tail
+
+    MappedFile index_;
+    uint64_t indexCount_{0};
+    ino_t indexInode_{0};
+    const uint8_t* indexRecords_{nullptr};
+    const char* indexStrings_{nullptr};
+
+    std::set<CatalogEntry, EntryOrder> tail_;                  // Added since the index was built
+    std::set<std::pair<std::string, std::string>> removed_;   // Index entries removed since (vmId, backupId)
+
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
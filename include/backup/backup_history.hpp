@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <chrono>
+#include <cstdint>
+
+// Learned runtime profile of one VM's backups
+struct BackupHistoryRecord {
+    std::string vmId;
+    uint32_t samples{0};
+    double durationSeconds{0.0};    // Moving average of the run time
+    double durationDeviation{0.0};  // Moving average of |run time - average|
+    double bytes{0.0};              // Moving average of bytes written (changed bytes for incrementals)
+    double throughput{0.0};         // Moving average of bytes written per second of run time
+    int64_t lastRun{0};             // Seconds since epoch
+};
+
+// Per-VM backup duration and size history used to predict run times.
+// Recent runs weigh more (exponential moving average), so the estimate
+// follows a VM whose change rate drifts. With a path the history is kept
+// in a JSON lines file: a snapshot of every VM, then one line per update.
+// Once the updates outnumber the VMs the file is replaced atomically by a
+// new snapshot.
+class BackupHistory {
+public:
+    explicit BackupHistory(const std::string& path = "");
+    ~BackupHistory() = default;
+
+    // Load the history from disk (a missing file is an empty history)
+    bool load();
+
+    bool record(const std::string& vmId, std::chrono::milliseconds duration, uint64_t bytes);
+    std::optional<BackupHistoryRecord> get(const std::string& vmId) const;
+    bool remove(const std::string& vmId);
+
+    // Conservative run time estimate: the expected bytes at the observed
+    // throughput plus two deviations of the run time; fallback for a VM
+    // that has not completed a backup yet
+    std::chrono::seconds predictDuration(const std::string& vmId, std::chrono::seconds fallback) const;
+
+    std::string getPath() const { return path_; }
+    std::string getLastError() const;
+
+private:
+    // Called with mutex_ held
+    bool append(const std::string& line);
+    bool persist();
+
+    std::string path_;
+    std::map<std::string, BackupHistoryRecord> records_;
+    size_t journalLines_{0};  // Updates appended since the last snapshot
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
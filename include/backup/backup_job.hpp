@@ -5,17 +5,20 @@
 #include "backup/vm_config.hpp"
 #include "common/parallel_task_manager.hpp"
 #include "common/logger.hpp"
+#include "common/backup_status.hpp"
 #include <memory>
 #include <string>
 #include <vector>
 #include <functional>
 #include <mutex>
+#include <chrono>
 
 class BackupJob : public Job {
 public:
     BackupJob(BackupProvider* provider,
              std::shared_ptr<ParallelTaskManager> taskManager,
-             const BackupConfig& config);
+             const BackupConfig& config,
+             const BackupContext& context = {});
     ~BackupJob() override;
 
     // Job interface implementation
@@ -32,6 +35,7 @@ public:
     std::string getStatus() const override;
     std::string getError() const override;
     std::string getId() const override;
+    ThrottleTimes getThrottleTimes() const override;
 
     // Backup-specific methods
     bool verifyBackup();
@@ -41,6 +45,12 @@ public:
     // Configuration
     BackupConfig getConfig() const { return config_; }
     void setConfig(const BackupConfig& config) { config_ = config; }
+    // Set when the job is created and fixed from then on
+    std::shared_ptr<RateLimiter> getRateLimiter() const { return context_.rateLimiter; }
+    std::shared_ptr<AdaptiveStreamController> getStreamController() const { return context_.streamController; }
+
+    // Snapshot create/open/remove times of the last run
+    SnapshotTimings getSnapshotTimings() const;
 
 private:
     void executeBackup();
@@ -49,12 +59,23 @@ private:
     void handleBackupError(const std::string& error);
     bool validateBackupConfig() const;
     bool createBackupDirectory() const;
-    bool writeBackupMetadata() const;
+    // Of the backup or one of its copies
+    bool writeBackupMetadata(const std::string& backupPath) const;
+    // Add the finished backup or copy to the catalog of the repository holding it
+    bool recordInCatalog(const std::string& backupDirectory);
+    // Metadata and catalog entries of the copies; removes the dropped ones
+    void finishCopies();
     bool readBackupMetadata() const;
     bool cleanupBackupDirectory() const;
+    // Largest disks first; sizes come from the provider before the snapshot is taken
+    void orderDisksForBackup(std::vector<std::string>& diskPaths);
+    bool releaseSnapshot(const std::string& snapshotId,
+                         std::chrono::steady_clock::time_point createdAt);
 
     BackupProvider* provider_;  // Not owned by BackupJob
     std::shared_ptr<ParallelTaskManager> taskManager_;
     BackupConfig config_;
+    BackupContext context_;
+    SnapshotTimings snapshotTimings_;
     mutable std::mutex mutex_;
 }; 
\ No newline at end of file
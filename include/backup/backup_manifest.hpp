@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common/file_utils.hpp"
+#include <string>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// One range of a disk stored in the backup, in bytes
+struct ManifestExtent {
+    uint64_t offset{0};
+    uint64_t length{0};
+    std::array<uint8_t, 32> digest{};  // SHA-256 of the range, when the manifest carries digests
+};
+
+struct ManifestDisk {
+    std::string path;         // Source disk
+    std::string file;         // Backup file in the backup directory
+    // Backup directory in the same repository the extents of an incremental
+    // disk apply on top of; empty for a full disk
+    std::string parent;
+    uint64_t capacity{0};
+    uint64_t extentCount{0};
+    uint64_t bytes{0};        // Sum of the extent lengths
+};
+
+// Binary manifest of one backup (manifest.bin), written next to the
+// metadata.json summary. Extents of a disk are cut into blocks of up to
+// 4096: a block holds (gap, length) varints relative to the end of the
+// previous extent, then fixed-width digests, and is deflated when that
+// makes it smaller. The disk and block tables are fixed-width records, so
+// a reader maps the file and decodes only the blocks it needs.
+class ManifestWriter {
+public:
+    // compressionLevel 0 stores blocks as is, 1-9 deflates them with zlib
+    explicit ManifestWriter(int compressionLevel = 0, bool digests = false);
+
+    size_t addDisk(const std::string& path, const std::string& file, uint64_t capacity,
+                   const std::string& parent = "");
+    // Extents of a disk have to come in ascending order without overlaps
+    bool addExtent(size_t disk, const ManifestExtent& extent);
+
+    bool write(const std::string& path, std::string& error);
+
+    size_t getDiskCount() const;
+    bool isIncremental() const;  // Any disk has a parent
+    uint64_t getExtentCount() const;
+    uint64_t getBytes() const;
+
+private:
+    struct Block {
+        uint64_t firstOffset{0};
+        uint64_t end{0};
+        uint32_t extentCount{0};
+        uint32_t rawSize{0};
+        uint32_t crc{0};
+        std::string data;
+    };
+
+    struct Disk {
+        ManifestDisk info;
+        std::vector<Block> blocks;
+        Block pending;
+        std::string varints;
+        std::string digests;
+        uint64_t end{0};  // End of the last extent added
+    };
+
+    void sealBlock(Disk& disk);  // Called with mutex_ held
+
+    int compressionLevel_;
+    bool digests_;
+    std::vector<Disk> disks_;
+    mutable std::mutex mutex_;
+};
+
+class ManifestReader {
+public:
+    bool open(const std::string& path);
+    void close();
+
+    size_t getDiskCount() const { return diskCount_; }
+    ManifestDisk getDisk(size_t disk) const;
+    bool hasDigests() const;
+
+    // Extents of a disk overlapping [offset, offset + length)
+    bool findExtents(size_t disk, uint64_t offset, uint64_t length, std::vector<ManifestExtent>& extents);
+    // Every extent of a disk in order, until visit returns false
+    bool forEachExtent(size_t disk, const std::function<bool(const ManifestExtent&)>& visit);
+
+    std::string getLastError() const { return lastError_; }
+
+private:
+    bool decodeBlock(uint64_t block, std::vector<ManifestExtent>& extents);
+
+    MappedFile file_;
+    uint32_t flags_{0};
+    size_t diskRecordSize_{0};  // Depends on the version
+    uint64_t diskCount_{0};
+    uint64_t blockCount_{0};
+    const uint8_t* disks_{nullptr};
+    const uint8_t* blocks_{nullptr};
+    const char* strings_{nullptr};
+    std::string lastError_;
+};
@@ -5,12 +5,46 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <map>
+#include <cstdint>
 #include <functional>
 
+class RateLimiter;
+class AdaptiveStreamController;
+class LatencyThrottle;
+class ManifestWriter;
+class BackupCopies;
+
 // Type definitions
 using ProgressCallback = std::function<void(int)>;
 using StatusCallback = std::function<void(const std::string&)>;
 
+// State of one running backup, handed to the provider beside its configuration
+struct BackupContext {
+    // Set by JobManager: this job's bucket chained to its endpoint's and the global one
+    std::shared_ptr<RateLimiter> rateLimiter;
+    // Set by JobManager: stream count, fixed or adapted to the observed throughput and latency
+    std::shared_ptr<AdaptiveStreamController> streamController;
+    // Set by JobManager: pauses this job's I/O on datastores over their latency SLO
+    std::shared_ptr<LatencyThrottle> latencyThrottle;
+    // Set by BackupJob: the snapshot the disks are read from
+    std::string snapshotId;
+    // Set by BackupJob: collects the extents each disk copy stored, for manifest.bin
+    std::shared_ptr<ManifestWriter> manifest;
+    // Set by BackupJob: the copies still written and the ones dropped
+    std::shared_ptr<BackupCopies> copies;
+    // Set by BackupJob: disks go to the chunk store, as configured or because
+    // the repository is tiered
+    bool chunkStore{false};
+};
+
+// State of one running restore, set by JobManager as for backups
+struct RestoreContext {
+    std::shared_ptr<RateLimiter> rateLimiter;
+    std::shared_ptr<AdaptiveStreamController> streamController;
+    std::shared_ptr<LatencyThrottle> latencyThrottle;
+};
+
 class BackupProvider {
 public:
     virtual ~BackupProvider() = default;
@@ -22,18 +56,27 @@ public:
 
     // VM operations
     virtual bool getVMDiskPaths(const std::string& vmId, std::vector<std::string>& diskPaths) = 0;
+    // Size of each disk of the VM, keyed by disk path; answered without a snapshot
+    virtual bool getDiskCapacities(const std::string& vmId, std::map<std::string, uint64_t>& capacities) = 0;
     virtual bool createSnapshot(const std::string& vmId, std::string& snapshotId) = 0;
     virtual bool removeSnapshot(const std::string& vmId, const std::string& snapshotId) = 0;
     virtual bool getChangedBlocks(const std::string& vmId, const std::string& diskPath,
                                 std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks) = 0;
     
     // Backup operations
-    virtual bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config) = 0;
+    virtual bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config,
+                            const BackupContext& context) = 0;
+    // Called once per backup after its last disk, or when it failed. State
+    // the next backup builds on (change IDs) is only kept for a backup that
+    // succeeded as a whole
+    virtual bool finishBackup(const std::string& vmId, const BackupConfig& config, const BackupContext& context,
+                              bool succeeded) = 0;
     virtual bool verifyDisk(const std::string& diskPath) = 0;
     virtual bool listBackups(std::vector<std::string>& backupDirs) = 0;
     virtual bool deleteBackup(const std::string& backupDir) = 0;
     virtual bool verifyBackup(const std::string& backupId) = 0;
-    virtual bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config) = 0;
+    virtual bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config,
+                             const RestoreContext& context) = 0;
     
     // Error handling
     virtual std::string getLastError() const = 0;
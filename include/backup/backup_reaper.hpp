@@ -0,0 +1,59 @@
+#pragma once
+
+#include "backup/backup_catalog.hpp"
+#include <string>
+#include <deque>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+struct ReaperConfig {
+    size_t batchSize{32};                        // Files unlinked per batch
+    std::chrono::milliseconds batchInterval{100}; // Pause between batches
+};
+
+// Deletes expired backups in the background. retire() only renames the
+// backup directory into <repository>/.trash and drops its catalog entry,
+// so retention never waits on the file system; a worker thread then
+// unlinks the trash in small, paced batches so deletions do not compete
+// with running jobs for metadata I/O. Trash left by a previous process is
+// picked up once its repository is seen again.
+class BackupReaper {
+public:
+    explicit BackupReaper(const ReaperConfig& config = ReaperConfig());
+    ~BackupReaper();
+
+    // Process-wide reaper shared by the scheduler and backup jobs
+    static std::shared_ptr<BackupReaper> getDefault();
+
+    void setConfig(const ReaperConfig& config);
+    ReaperConfig getConfig() const;
+
+    bool retire(BackupCatalog& catalog, const CatalogEntry& entry);
+    // Queue trash left in a repository by an earlier run (once per repository)
+    void recover(const std::string& repository);
+
+    void stop();
+
+    size_t getPending() const;
+    std::string getLastError() const;
+
+private:
+    void run();
+    void startLocked();  // Called with mutex_ held
+    // Unlink up to batchSize files below path; true once path itself is gone
+    bool reapBatch(const std::string& path, size_t batchSize);
+
+    ReaperConfig config_;
+    std::deque<std::string> queue_;
+    std::set<std::string> recovered_;
+    uint64_t sequence_{0};
+    bool stopRequested_{false};
+    std::thread worker_;
+    std::string lastError_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+};
@@ -3,6 +3,8 @@
 #include "backup/vm_config.hpp"
 #include "common/job_manager.hpp"
 #include "backup/backup_job.hpp"
+#include "backup/backup_history.hpp"
+#include "backup/backup_reaper.hpp"
 #include "common/logger.hpp"
 #include <string>
 #include <vector>
@@ -11,8 +13,38 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <optional>
+#include <random>
+#include <unordered_map>
+#include <memory>
+
+// Daily window that scheduled backups are packed into
+struct BackupWindow {
+    int startHour{0};
+    int startMinute{0};
+    int durationMinutes{0};          // 0 = no window, every run starts at its scheduled time
+    size_t maxConcurrentJobs{4};     // Backups running at once inside the window
+    int warningLeadMinutes{60};      // How long before the window opens its plan is checked
+    int defaultDurationMinutes{30};  // Assumed run time of a VM without history
+};
+
+// Predicted placement of one run in a backup window
+struct WindowPlanEntry {
+    std::string vmId;
+    std::chrono::system_clock::time_point start;
+    std::chrono::system_clock::time_point finish;
+    bool fits{true};  // Finishes before the window closes
+};
+
+struct WindowPlan {
+    std::chrono::system_clock::time_point windowStart;
+    std::chrono::system_clock::time_point windowEnd;
+    std::vector<WindowPlanEntry> entries;  // In start order
+    bool fits{true};
+};
 
 class BackupScheduler {
 public:
@@ -28,16 +60,36 @@ public:
     std::vector<BackupConfig> getScheduledBackups() const;
     BackupConfig getBackupConfig(const std::string& backupId) const;
     std::chrono::system_clock::time_point getNextRunTime(const BackupConfig& config) const;
+    // First run of the schedule strictly after the given time
+    std::chrono::system_clock::time_point getNextRunTime(const BackupConfig& config,
+                                                         std::chrono::system_clock::time_point after) const;
+
+    // Due time of the VM's pending run including its stagger offset
+    std::optional<std::chrono::system_clock::time_point> getScheduledRunTime(const std::string& vmId) const;
+
+    // How late a run may start before it counts as missed and its catch-up policy applies
+    void setMissedRunGrace(std::chrono::seconds grace);
+
+    // Runs due inside the backup window queue up and start longest predicted
+    // first, preferring runs that still finish before the window closes
+    void setBackupWindow(const BackupWindow& window);
+    BackupWindow getBackupWindow() const;
+    // Keep learned run times in a file; without one they only live in memory
+    bool setHistoryFile(const std::string& path);
+    std::chrono::seconds predictDuration(const std::string& vmId) const;
+    // Predicted packing of the open or next backup window
+    WindowPlan getWindowPlan() const;
 
     // Schedule management
     void addSchedule(const std::string& vmId, const BackupConfig& config);
     void removeSchedule(const std::string& vmId);
     void updateSchedule(const std::string& vmId, const BackupConfig& config);
 
-    // Retention and cleanup
+    // Retention and cleanup; expired backups are handed to the background reaper
     void applyRetentionPolicy(const std::string& vmId);
     void cleanupOldBackups(const std::string& vmId);
     std::vector<std::string> getBackupPaths(const std::string& vmId) const;
+    // Whether retention, with retentionDays as its keep-within age, would retire the VM's oldest backup
     bool isBackupExpired(const std::string& vmId, int retentionDays) const;
     bool isBackupNeeded(const std::string& vmId, const BackupConfig& config) const;
     std::string getBackupPath(const std::string& vmId, const BackupConfig& config) const;
@@ -49,14 +101,91 @@ public:
     bool isRunning() const { return running_; }
 
 private:
-    void executeBackup(const std::string& vmId, const BackupConfig& config);
+    // Next due run of one schedule, kept in a min-heap ordered by due time
+    struct ScheduledRun {
+        std::chrono::system_clock::time_point due;
+        std::chrono::system_clock::time_point slot;  // Unstaggered schedule time the run belongs to
+        std::string vmId;
+        bool offsetPending{false};  // "spread" run queued at its slot; the offset is added when the slot arrives
+    };
+
+    // VMs sharing a "spread" stagger slot, in VM ID order, with each one's rank
+    struct StaggerSlot {
+        std::vector<std::string> members;
+        std::unordered_map<std::string, size_t> ranks;
+    };
+
+    // Run waiting for a free slot in the backup window
+    struct QueuedRun {
+        std::string vmId;
+        BackupConfig config;
+        std::chrono::system_clock::time_point due;
+        std::chrono::system_clock::time_point deadline;  // End of the window the run belongs to
+    };
+
+    // Due run handed from the scheduler thread to the submission thread
+    struct Submission {
+        std::string vmId;
+        BackupConfig config;
+        bool windowed{false};
+    };
+
+    void executeBackup(const std::string& vmId, const BackupConfig& config, bool windowed);
+    // Submission thread: creates and submits the queued runs in order
+    void submitBackups();
+    void onBackupFinished(const std::string& vmId, bool windowed, const Job& job);
     void checkSchedules();
-    bool shouldRunBackup(const BackupConfig& config) const;
+    void collectDueRuns(std::chrono::system_clock::time_point now,
+                        std::vector<std::pair<std::string, BackupConfig>>& runs);
+
+    // Stagger support; all called with mutex_ held.
+    // First run due after `after` whose slot is not earlier than minSlot.
+    ScheduledRun getStaggeredRun(const std::string& vmId, const BackupConfig& config,
+                                 std::chrono::system_clock::time_point after,
+                                 std::chrono::system_clock::time_point minSlot);
+    std::chrono::seconds getStaggerOffset(const std::string& vmId, const BackupConfig& config);
+    std::chrono::seconds getSpreadOffset(const std::string& vmId, const BackupConfig& config) const;
+    // When the run starts, counting an offset still pending
+    std::chrono::system_clock::time_point getDueTime(const ScheduledRun& run) const;
+    // Membership of "spread" schedules in the slot they start in
+    void joinStaggerSlot(const std::string& vmId, const BackupConfig& config);
+    void leaveStaggerSlot(const std::string& vmId, const BackupConfig& config);
+
+    // Backup window support; all called with mutex_ held
+    std::optional<std::chrono::system_clock::time_point> getWindowStart(std::chrono::system_clock::time_point at) const;
+    std::chrono::system_clock::time_point getNextWindowStart(std::chrono::system_clock::time_point after) const;
+    WindowPlan planWindow(std::chrono::system_clock::time_point windowStart,
+                          std::chrono::system_clock::time_point now) const;
+    void checkWindowPlan(std::chrono::system_clock::time_point now);
+    void takeWindowRuns(std::chrono::system_clock::time_point now,
+                        std::vector<std::pair<std::string, BackupConfig>>& runs);
+
+    // Indexed binary heap; all called with mutex_ held
+    void upsertRun(const ScheduledRun& run);
+    void removeRun(const std::string& vmId);
+    void swapRuns(size_t a, size_t b);
+    void siftUp(size_t index);
+    void siftDown(size_t index);
 
     JobManager* jobManager_;
     std::map<std::string, BackupConfig> schedules_;
+    std::vector<ScheduledRun> runQueue_;
+    std::unordered_map<std::string, size_t> runIndex_;  // VM ID -> position in runQueue_
+    std::chrono::seconds missedRunGrace_{60};
+    std::mt19937 staggerRng_{std::random_device{}()};
+    std::map<std::string, StaggerSlot> staggerSlots_;  // Slot key -> members
+    BackupWindow window_;
+    std::shared_ptr<BackupHistory> history_;
+    std::shared_ptr<BackupReaper> reaper_;
+    std::vector<QueuedRun> windowQueue_;
+    size_t windowRunning_{0};
+    std::chrono::system_clock::time_point nextPlanCheck_;
     mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
     std::thread schedulerThread_;
+    std::deque<Submission> submissions_;
+    std::condition_variable submitReady_;
+    std::thread submitThread_;
     std::atomic<bool> running_;
     std::atomic<bool> stopRequested_;
 }; 
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// rsync-style deltas: a file is rebuilt at a destination from an older file
+// there (the basis) plus whatever the signature of the basis cannot match.
+//
+// The signature holds a rolling checksum and a truncated SHA-256 of every
+// full basis block. The source is scanned with the rolling checksum one
+// byte at a time, so blocks that moved are found as well; a window whose
+// checksum matches and whose hash agrees is sent as a block reference,
+// everything else as literal bytes. Signatures and deltas are byte buffers
+// in host byte order, so they can cross any transport.
+
+// Adler-style checksum that slides over a window in O(1)
+class RollingChecksum {
+public:
+    void reset(const uint8_t* data, size_t size);
+    // Slide the window one byte: out leaves at the front, in enters at the back
+    void roll(uint8_t out, uint8_t in);
+    uint32_t value() const { return (b_ << 16) | (a_ & 0xFFFF); }
+
+private:
+    uint32_t a_{0};
+    uint32_t b_{0};
+    size_t size_{0};
+};
+
+using BlockHash = std::array<uint8_t, 16>;
+
+BlockHash computeBlockHash(const void* data, size_t size);
+
+struct BlockSignature {
+    uint32_t blockSize{0};
+    uint64_t basisSize{0};
+    std::vector<uint32_t> weak;     // Per full block of the basis
+    std::vector<BlockHash> strong;
+
+    std::string serialize() const;
+    bool parse(const std::string& data, std::string& error);
+};
+
+// Of the file at path; a missing file has an empty signature
+bool computeSignature(const std::string& path, uint32_t blockSize, BlockSignature& signature, std::string& error);
+
+struct DeltaStats {
+    uint64_t matchedBytes{0};  // Sent as block references
+    uint64_t literalBytes{0};  // Sent as data, before compression
+};
+
+// Looks up signature blocks by rolling checksum
+class BlockMatcher {
+public:
+    explicit BlockMatcher(const BlockSignature& signature);
+
+    // Basis block equal to the window at data with checksum weak, or -1
+    int64_t find(uint32_t weak, const uint8_t* data) const;
+    bool empty() const { return byWeak_.empty(); }
+
+private:
+    const BlockSignature& signature_;
+    std::vector<uint64_t> filter_;                      // Bit per weak checksum hash
+    std::vector<std::pair<uint32_t, uint32_t>> byWeak_;  // (weak, block), sorted
+};
+
+// Delta of bytes [offset, offset + length) of the file open as fd against
+// the matcher's signature. Literal runs are deflated at compressionLevel
+// (0 = stored). A match may run past the end of the range; it rebuilds the
+// same bytes the following range does.
+bool computeDelta(int fd, uint64_t fileSize, uint64_t offset, uint64_t length, const BlockMatcher& matcher,
+                  uint32_t blockSize, int compressionLevel, std::string& delta, DeltaStats& stats,
+                  std::string& error);
+
+// Write what a delta describes into outputFd, copying matched blocks from
+// basisFd (-1 without a basis)
+bool applyDelta(const std::string& delta, int basisFd, uint32_t blockSize, int outputFd, std::string& error);
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "backup/chunk_repository.hpp"
+#include "common/rate_limiter.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <optional>
+#include <chrono>
+
+struct GcConfig {
+    size_t markBatch{65536};                // Root entries marked per step
+    size_t sweepBatch{8};                   // Packs examined per step
+    std::chrono::milliseconds stepPause{20}; // Between the steps of a background collection
+    double compactBelow{0.5};               // Rewrite packs with a smaller live share of bytes (0 = never)
+    uint64_t compactStepBytes{8ULL << 20};  // Chunk bytes copied per step
+    uint64_t compactBytesPerSecond{0};      // Read plus write budget of compaction (0 = unlimited)
+};
+
+// Live and dead bytes of a pack the sweep kept
+struct PackUsage {
+    uint64_t liveBytes{0};
+    uint64_t deadBytes{0};
+    size_t liveChunks{0};
+    size_t deadChunks{0};
+};
+
+struct GcStats {
+    std::string repository;
+    uint64_t epoch{0};
+    size_t roots{0};
+    size_t liveChunks{0};
+    size_t packsScanned{0};
+    size_t packsDeleted{0};
+    uint64_t chunksReclaimed{0};
+    uint64_t bytesReclaimed{0};
+    uint64_t deadBytesRemaining{0};  // In packs that still hold live chunks
+    size_t packsCompacted{0};
+    uint64_t bytesRewritten{0};      // Live chunk bytes compaction copied
+    std::chrono::milliseconds duration{0};
+    bool completed{false};
+};
+
+// One incremental mark-and-sweep collection of a chunk repository. It starts
+// a new epoch and lists the roots and sealed packs; marking then reads the
+// roots markBatch ids at a time, and sweeping examines sweepBatch packs at a
+// time, deleting those in which no chunk is marked or was put at or after
+// the sweep epoch (the new epoch, or the start of the oldest open session if
+// that is older). Backups keep running in between: what they store or
+// deduplicate is never swept, and packs sealed after the start are left for
+// the next collection. Packs that are only partly dead are reported in
+// getPackUsage().
+//
+// Packs whose live share of bytes is below compactBelow are then compacted:
+// their live chunks are copied, compactStepBytes per step and within the
+// I/O budget, into new packs in the order the roots list them, so a
+// restore reads them sequentially. Roots are named after backup
+// directories (<vm>_<time> for scheduled backups) and are taken newest
+// first, so a chunk shared by several backups of a VM follows the layout of
+// the latest one, the one restores usually read. The index switches to the copies as each
+// new pack is sealed, after which the old packs are deleted.
+class GcCycle {
+public:
+    GcCycle(std::shared_ptr<ChunkRepository> repository, const GcConfig& config = GcConfig());
+
+    // One bounded batch of work; false once the collection has finished
+    bool step();
+    bool isDone() const { return phase_ == Phase::DONE; }
+
+    const GcStats& getStats() const { return stats_; }
+    const std::map<uint64_t, PackUsage>& getPackUsage() const { return usage_; }
+    std::string getLastError() const { return lastError_; }
+
+private:
+    enum class Phase { START, MARK, SWEEP, COMPACT, RECLAIM, DONE };
+
+    void start();
+    void mark();
+    void sweep();
+    void planCompaction();
+    void compact();
+    void reclaim();
+    void finish(bool completed);
+    bool isDead(const ChunkLocation& chunk) const;
+
+    std::shared_ptr<ChunkRepository> repository_;
+    GcConfig config_;
+    Phase phase_{Phase::START};
+    std::chrono::steady_clock::time_point started_;
+    uint64_t sweepEpoch_{0};
+
+    std::vector<std::string> roots_;
+    size_t nextRoot_{0};
+    std::vector<ChunkId> rootChunks_;  // Of the root being marked
+    size_t nextChunk_{0};
+    std::unordered_map<ChunkId, uint64_t, ChunkIdHash> live_;  // Order in which marking reached each chunk
+
+    std::vector<PackInfo> packs_;
+    size_t nextPack_{0};
+    std::map<uint64_t, PackUsage> usage_;
+
+    std::vector<PackInfo> compacted_;   // Packs being compacted
+    std::vector<ChunkLocation> moves_;  // Their live chunks, in restore order
+    size_t nextMove_{0};
+    TokenBucket budget_;
+
+    GcStats stats_;
+    std::string lastError_;
+};
+
+// Runs collections requested for chunk repositories on a background thread,
+// pausing between steps so they stay out of the way of running backups.
+class GarbageCollector {
+public:
+    explicit GarbageCollector(const GcConfig& config = GcConfig());
+    ~GarbageCollector();
+
+    // Process-wide collector shared by the reaper and the daemon
+    static std::shared_ptr<GarbageCollector> getDefault();
+
+    void setConfig(const GcConfig& config);
+    GcConfig getConfig() const;
+
+    // Queue a collection unless one of the repository is already waiting
+    void request(const std::shared_ptr<ChunkRepository>& repository);
+    // Collect on the calling thread
+    GcStats collect(const std::shared_ptr<ChunkRepository>& repository);
+
+    // Of the last finished collection of a repository directory
+    std::optional<GcStats> getLastStats(const std::string& directory) const;
+    size_t getPending() const;
+
+    void stop();
+
+private:
+    void run();
+    void startLocked();  // Called with mutex_ held
+    void report(const GcCycle& cycle);
+
+    GcConfig config_;
+    std::deque<std::shared_ptr<ChunkRepository>> queue_;
+    std::map<std::string, GcStats> lastStats_;
+    bool collecting_{false};  // The front of queue_ is being collected
+    bool stopRequested_{false};
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+};
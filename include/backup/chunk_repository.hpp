@@ -0,0 +1,239 @@
+#pragma once
+
+#include "backup/storage_backend.hpp"
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+// SHA-256 of a chunk's content
+using ChunkId = std::array<uint8_t, 32>;
+
+struct ChunkIdHash {
+    size_t operator()(const ChunkId& id) const;
+};
+
+ChunkId computeChunkId(const void* data, size_t size);
+std::string chunkIdToHex(const ChunkId& id);
+
+struct ChunkRepositoryConfig {
+    uint64_t packSize{32ULL << 20};  // A pack is sealed once it grows past this
+    size_t maxPendingPacks{4};       // Sealed packs held in memory for upload; put() waits beyond this
+    size_t uploadThreads{2};         // Packs uploaded at once
+};
+
+struct ChunkLocation {
+    ChunkId id{};
+    uint64_t pack{0};
+    uint64_t offset{0};  // Of the chunk data in the pack
+    uint32_t length{0};
+    uint32_t crc{0};
+    uint64_t epoch{0};   // Of the last put() that stored or found the chunk
+};
+
+struct PackInfo {
+    uint64_t id{0};
+    uint64_t size{0};    // Bytes in the pack object
+    size_t chunkCount{0};
+    bool sealed{false};  // Stored with its index
+    bool offloaded{false};  // On the capacity tier
+    int64_t sealedAt{0};    // Seconds since the epoch; the open time for packs found at open
+};
+
+class ChunkRepository;
+
+// Held by a writer while it stores chunks that no committed root references
+// yet. Must not outlive its repository.
+class ChunkSession {
+public:
+    ~ChunkSession();
+    ChunkSession(const ChunkSession&) = delete;
+    ChunkSession& operator=(const ChunkSession&) = delete;
+
+    uint64_t getEpoch() const { return epoch_; }
+
+private:
+    friend class ChunkRepository;
+    ChunkSession(ChunkRepository* repository, uint64_t epoch);
+
+    ChunkRepository* repository_;
+    uint64_t epoch_;
+};
+
+// Content-addressed chunk store on a storage backend, owned by one process
+// at a time.
+//
+// Chunks are packed into pack objects (packs/<id>.pack) as checksummed
+// records, so an object store sees few multi-MB objects instead of one per
+// chunk. A pack is sealed once it reaches packSize or on flush() and then
+// uploaded in the background together with its index (packs/<id>.idx);
+// until then its chunks are served from memory. At most maxPendingPacks
+// wait for upload. Single chunks are read with ranged reads. A pack stored
+// without its index is rescanned at open. All pack indexes are held in
+// memory, so storing a chunk that is already present only refreshes its
+// epoch.
+//
+// Backups reference chunks through roots (roots/<name>.root), lists of chunk
+// ids committed once the chunks are stored. Chunks no root reaches are
+// garbage and are reclaimed by the GarbageCollector; epochs and sessions
+// keep it from sweeping chunks a running backup has stored or deduplicated
+// but not committed yet. Should a crash leave a chunk in two packs
+// (compaction copies), the pack loaded first is read and the other copy is
+// garbage.
+//
+// With a capacity tier attached, the backend the repository was created on
+// is the landing tier: new packs and roots are stored there, and a
+// TierMover later moves sealed packs to the capacity tier. Each pack is read
+// from the tier that holds it; which one that is follows from where its
+// index is stored.
+class ChunkRepository {
+public:
+    // A local directory, locked against other processes
+    explicit ChunkRepository(const std::string& directory,
+                             const ChunkRepositoryConfig& config = ChunkRepositoryConfig());
+    ChunkRepository(std::shared_ptr<StorageBackend> backend,
+                    const ChunkRepositoryConfig& config = ChunkRepositoryConfig());
+    ~ChunkRepository();
+
+    // Shared, opened chunk store of a backup repository. Null when the
+    // repository has none, unless create is set. Roots are named after the
+    // backup directories that reference them.
+    static std::shared_ptr<ChunkRepository> forRepository(const std::string& repository, bool create = false);
+    // Keep the chunk store of a repository on backend (an S3 bucket, say)
+    // rather than in <repository>/.chunks. Lookups of the repository return
+    // it from then on, so this has to come before any backup opens it.
+    static std::shared_ptr<ChunkRepository> forRepository(const std::string& repository,
+                                                          std::shared_ptr<StorageBackend> backend,
+                                                          std::string& error);
+    // Pack settings of the chunk stores forRepository() opens from now on
+    static void setRepositoryConfig(const ChunkRepositoryConfig& config);
+    static ChunkRepositoryConfig getRepositoryConfig();
+
+    bool open();
+    void close();
+
+    std::unique_ptr<ChunkSession> beginSession();
+
+    // Store a chunk unless it is already present; stored tells which
+    bool put(const ChunkSession& session, const void* data, size_t size, ChunkId& id, bool* stored = nullptr);
+    bool get(const ChunkId& id, std::vector<uint8_t>& data);
+    bool contains(const ChunkId& id) const;
+    // Seal the open pack and wait until every chunk stored so far is uploaded
+    bool flush();
+
+    // Fails if any of the chunks is not stored
+    bool commitRoot(const ChunkSession& session, const std::string& name, const std::vector<ChunkId>& chunks);
+    bool dropRoot(const std::string& name);
+    std::vector<std::string> listRoots() const;
+    bool readRoot(const std::string& name, std::vector<ChunkId>& chunks);
+
+    // Used by the garbage collector. advanceEpoch() starts a new epoch and
+    // returns it; chunks put at or after getSweepEpoch(epoch) are not swept.
+    uint64_t advanceEpoch();
+    uint64_t getSweepEpoch(uint64_t epoch) const;
+    std::vector<PackInfo> listPacks() const;
+    // Chunks read from the pack, which leaves out copies of chunks that are
+    // read from another pack
+    std::vector<ChunkLocation> getPackChunks(uint64_t pack) const;
+    // Delete a sealed pack if dead holds for every chunk in it, which is
+    // checked under the repository lock so a concurrent put() cannot revive
+    // a chunk that is being deleted
+    bool deletePackIf(uint64_t pack, const std::function<bool(const ChunkLocation&)>& dead, bool& deleted);
+
+    // Used by compaction. copyChunk() appends a chunk to a compaction pack;
+    // once that pack is full, or on finishCompaction(), it is sealed and
+    // uploaded, and then the index is switched to the copies in one step
+    // under the lock. Readers keep reading the old packs until then and
+    // never wait for the copying.
+    bool copyChunk(const ChunkLocation& chunk);
+    bool finishCompaction();
+
+    // Attach a capacity tier before any chunk is stored; packs already on
+    // it are loaded. Compaction packs are stored there directly.
+    bool attachCapacityTier(std::shared_ptr<StorageBackend> capacity);
+    bool hasCapacityTier() const;
+    // Used by the TierMover. Copy a sealed pack to the capacity tier, then
+    // delete it from the landing tier; readers switch over in between.
+    bool offloadPack(uint64_t pack, bool& moved);
+
+    std::string getDirectory() const { return directory_; }
+    std::shared_ptr<StorageBackend> getBackend() const { return backend_; }
+    std::string getLastError() const;
+
+private:
+    friend class ChunkSession;
+
+    struct Pack {
+        uint64_t size{0};
+        bool sealed{false};
+        std::vector<ChunkLocation> chunks;   // In pack order
+        std::shared_ptr<std::string> data;   // Contents until uploaded
+        std::vector<ChunkLocation> sources;  // Of a compaction pack: where each chunk was copied from
+        bool offloaded{false};
+        bool moving{false};  // Being copied to the capacity tier
+        int64_t sealedAt{0};
+    };
+    struct Slot {
+        uint64_t pack{0};
+        uint32_t position{0};  // In Pack::chunks
+    };
+
+    // Called with mutex_ held
+    bool loadPack(uint64_t id, bool indexed, bool offloaded);
+    void unloadPack(uint64_t id);
+    bool scanPack(uint64_t id, Pack& pack);
+    void appendLocked(uint64_t& id, const ChunkLocation& chunk, const void* data, ChunkLocation& stored);
+    void sealLocked(uint64_t& id);
+    bool waitForUploads(std::unique_lock<std::mutex>& lock);
+    void switchToCopies(uint64_t id);
+    void indexChunk(uint64_t id, uint32_t position, const ChunkLocation& chunk);
+    std::string buildIndex(const Pack& pack) const;
+    std::shared_ptr<StorageBackend> tierOf(const Pack& pack) const;
+    static std::string packKey(uint64_t id);
+    static std::string indexKey(uint64_t id);
+    static std::string rootKey(const std::string& name);
+    void endSession(uint64_t epoch);
+
+    // A chunk of a stored pack from backend, which is retried once should
+    // the pack have moved to the other tier meanwhile
+    bool readStored(const ChunkLocation& chunk, std::shared_ptr<StorageBackend> backend, std::vector<uint8_t>& data);
+
+    void runUploads();
+
+    std::shared_ptr<StorageBackend> backend_;
+    std::shared_ptr<StorageBackend> capacity_;  // Null without tiering
+    std::string directory_;
+    std::string lockPath_;  // Local repositories only
+    ChunkRepositoryConfig config_;
+    int lockFd_{-1};
+    bool open_{false};
+
+    std::map<uint64_t, Pack> packs_;
+    std::unordered_map<ChunkId, Slot, ChunkIdHash> index_;
+    uint64_t nextPack_{1};
+    uint64_t writePack_{0};    // Pack being filled by put(), 0 if none
+    uint64_t compactPack_{0};  // Pack being filled by copyChunk(), 0 if none
+
+    std::deque<uint64_t> uploadQueue_;
+    size_t pendingUploads_{0};  // Sealed packs not stored yet
+    std::string uploadError_;   // Set once an upload failed; the repository then refuses new chunks
+    std::vector<std::thread> uploaders_;
+    bool stopping_{false};
+    std::condition_variable uploadReady_;
+    std::condition_variable uploadDone_;
+
+    uint64_t epoch_{1};
+    std::multiset<uint64_t> sessions_;  // Start epochs of open sessions
+
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
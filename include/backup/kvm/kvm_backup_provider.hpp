@@ -25,15 +25,20 @@ public:
     bool isConnected() const override;
 
     bool getVMDiskPaths(const std::string& vmId, std::vector<std::string>& diskPaths) override;
+    bool getDiskCapacities(const std::string& vmId, std::map<std::string, uint64_t>& capacities) override;
     bool createSnapshot(const std::string& vmId, std::string& snapshotId) override;
     bool removeSnapshot(const std::string& vmId, const std::string& snapshotId) override;
     bool getChangedBlocks(const std::string& vmId, const std::string& diskPath, std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks) override;
-    bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config) override;
+    bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config,
+                    const BackupContext& context) override;
+    bool finishBackup(const std::string& vmId, const BackupConfig& config, const BackupContext& context,
+                      bool succeeded) override;
     bool verifyDisk(const std::string& diskPath) override;
     bool listBackups(std::vector<std::string>& backupDirs) override;
     bool deleteBackup(const std::string& backupDir) override;
     bool verifyBackup(const std::string& backupId) override;
-    bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config) override;
+    bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config,
+                     const RestoreContext& context) override;
     std::string getLastError() const override;
     void clearLastError() override;
     double getProgress() const override;
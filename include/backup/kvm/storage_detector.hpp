@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+class StorageDetector {
+public:
+    enum class StorageType {
+        UNKNOWN,
+        QCOW2,
+        LVM,
+        RAW
+    };
+
+    struct StorageInfo {
+        std::string path;
+        StorageType type;
+        uint64_t size;
+        bool isReadOnly;
+    };
+
+    // Queue characteristics of one physical block device, from sysfs
+    struct DeviceTopology {
+        std::string name;            // Kernel name, e.g. "sda", "nvme0n1"
+        bool rotational{false};
+        bool nvme{false};
+        uint64_t optimalIoSize{0};   // Bytes, 0 = not reported
+        uint64_t maxSectorsKb{0};    // Largest request the kernel issues
+        uint64_t logicalBlockSize{512};
+        uint64_t requestQueueSize{0};  // nr_requests
+        int numaNode{-1};            // -1 = unknown or no NUMA
+    };
+
+    // How a copy engine should drive a set of devices. The engines issue one
+    // synchronous I/O per stream, so queueDepth is their stream count.
+    struct IoProfile {
+        uint64_t blockSize{1024 * 1024};
+        size_t queueDepth{0};        // 0 = no recommendation
+        int numaNode{-1};            // Node all devices hang off, -1 = mixed or unknown
+        std::string description;     // For logs, e.g. "nvme x2"
+    };
+
+    StorageDetector() = default;
+    ~StorageDetector() = default;
+
+    std::vector<StorageInfo> detectStorageDevices();
+    void detectLVMDevices(std::vector<StorageInfo>& devices);
+    void detectQCOW2Devices(std::vector<StorageInfo>& devices);
+    bool isLVMDevice(const std::string& path);
+    bool isQCOW2Device(const std::string& path);
+    static StorageType detectStorageType(const std::string& path);
+    static bool isQCOW2(const std::string& path);
+    static bool isLVM(const std::string& path);
+    static bool isRaw(const std::string& path);
+    static uint64_t getDeviceSize(const std::string& path);
+
+    // Physical devices behind a file, block device, partition or device
+    // mapper stack (LVM, RAID, multipath); empty when sysfs does not know it
+    static std::vector<DeviceTopology> resolveDevices(const std::string& path,
+                                                      const std::string& sysfsRoot = "/sys");
+    // Large sequential I/O for spinning disks, deeper queues for NVMe
+    static IoProfile recommendIoProfile(const std::vector<DeviceTopology>& devices);
+    // Profile for the devices behind all paths (e.g. source and target of a copy)
+    static IoProfile probeIoProfile(const std::vector<std::string>& paths, const std::string& sysfsRoot = "/sys");
+    // CPUs of a NUMA node, from its cpulist
+    static std::vector<int> getNodeCpus(int node, const std::string& sysfsRoot = "/sys");
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "backup/storage_backend.hpp"
+#include <mutex>
+
+// Objects are files below a directory. Writes go to a temporary file that
+// is fsync'ed and renamed over the key on commit.
+class LocalBackend : public StorageBackend {
+public:
+    explicit LocalBackend(const std::string& root);
+
+    std::string describe() const override { return root_; }
+
+    bool put(const std::string& key, const void* data, size_t size) override;
+    std::unique_ptr<ObjectWriter> createWriter(const std::string& key) override;
+    bool read(const std::string& key, uint64_t offset, uint64_t length, std::vector<uint8_t>& data) override;
+    bool stat(const std::string& key, bool& exists, uint64_t& size) override;
+    bool remove(const std::string& key) override;
+    bool list(const std::string& prefix, std::vector<std::string>& keys) override;
+
+    std::string getLastError() const override;
+
+private:
+    friend class LocalObjectWriter;
+
+    std::string pathOf(const std::string& key) const;
+    void setError(const std::string& error);
+
+    std::string root_;
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common/job.hpp"
+#include "common/rate_limiter.hpp"
+#include "backup/vm_config.hpp"
+#include "backup/backup_catalog.hpp"
+#include "backup/chunk_repository.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+
+struct ReplicationStats {
+    size_t backupsReplicated{0};
+    size_t backupsSkipped{0};   // Already at the destination
+    uint64_t sourceBytes{0};    // Of the files replicated
+    uint64_t matchedBytes{0};   // Rebuilt from files already at the destination
+    uint64_t sentBytes{0};      // Signatures, deltas and chunks as sent
+    size_t chunksSent{0};
+    size_t chunksPresent{0};    // Referenced by a replicated root and already at the destination
+};
+
+// Copies the backups of one repository that another one lacks, oldest
+// first, sending only what the destination cannot rebuild itself.
+//
+// Chunk roots are compared by chunk id and only missing chunks are sent.
+// Every other file is rebuilt from the file of the same name in the
+// destination's newest backup of the VM: the destination sends block
+// signatures of it, the source answers with a delta (block references and
+// deflated literals). Files are split into segments, and segments, files
+// and chunk batches go out in parallel streams. Signatures, deltas and
+// chunk batches are byte buffers, so the source and the destination only
+// meet through them; both are local directories for now.
+//
+// A backup is staged in <destination>/.replicating and moved into place and
+// cataloged once complete, so a destination never lists a partial backup.
+class ReplicationJob : public Job {
+public:
+    explicit ReplicationJob(const ReplicationConfig& config);
+    ~ReplicationJob() override;
+
+    // Job interface implementation
+    bool start() override;
+    bool pause() override;
+    bool resume() override;
+    bool cancel() override;
+    bool isRunning() const override;
+    bool isPaused() const override;
+    bool isCompleted() const override;
+    bool isFailed() const override;
+    bool isCancelled() const override;
+    int getProgress() const override;
+    std::string getStatus() const override;
+    std::string getError() const override;
+    std::string getId() const override;
+
+    ReplicationConfig getConfig() const { return config_; }
+    ReplicationStats getStats() const;
+
+private:
+    void executeReplication();
+    bool replicateBackup(const CatalogEntry& entry);
+    bool replicateRoot(const std::string& name);
+    bool replicateFiles(const std::string& sourceDir, const std::string& basisDir, const std::string& stagingDir);
+    // Run tasks 0..count-1 on up to config_.streams threads; stops at the
+    // first task that fails
+    bool runStreams(size_t count, const std::function<bool(size_t)>& task);
+    // Account for a buffer crossing to the destination, within the bandwidth limit
+    void send(uint64_t bytes);
+    // False once cancelled; waits while paused
+    bool checkpoint();
+    void fail(const std::string& error);
+
+    ReplicationConfig config_;
+    std::shared_ptr<BackupCatalog> sourceCatalog_;
+    std::shared_ptr<BackupCatalog> destinationCatalog_;
+    std::shared_ptr<ChunkRepository> sourceChunks_;
+    std::shared_ptr<ChunkRepository> destinationChunks_;
+    TokenBucket budget_;
+    ReplicationStats stats_;
+    std::string failure_;  // First task error of the current backup
+    mutable std::mutex mutex_;
+};
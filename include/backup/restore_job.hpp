@@ -16,7 +16,8 @@ class RestoreJob : public Job {
 public:
     RestoreJob(BackupProvider* provider,
                std::shared_ptr<ParallelTaskManager> taskManager,
-               const RestoreConfig& config);
+               const RestoreConfig& config,
+               const RestoreContext& context = {});
     ~RestoreJob() override;
 
     // Job interface implementation
@@ -33,10 +34,14 @@ public:
     std::string getStatus() const override;
     std::string getError() const override;
     std::string getId() const override;
+    ThrottleTimes getThrottleTimes() const override;
 
     // Configuration
     RestoreConfig getConfig() const { return config_; }
     void setConfig(const RestoreConfig& config) { config_ = config; }
+    // Set when the job is created and fixed from then on
+    std::shared_ptr<RateLimiter> getRateLimiter() const { return context_.rateLimiter; }
+    std::shared_ptr<AdaptiveStreamController> getStreamController() const { return context_.streamController; }
 
     // Status and information
     std::string getVMId() const;
@@ -50,6 +55,7 @@ private:
     BackupProvider* provider_;  // Not owned by RestoreJob
     std::shared_ptr<ParallelTaskManager> taskManager_;
     RestoreConfig config_;
+    RestoreContext context_;
     std::vector<std::string> diskPaths_;
     std::unordered_map<std::string, std::future<bool>> diskTasks_;
     std::unordered_map<std::string, int> diskProgress_;
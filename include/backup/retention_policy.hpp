@@ -0,0 +1,30 @@
+#pragma once
+
+#include "backup/backup_catalog.hpp"
+#include "backup/vm_config.hpp"
+#include <vector>
+#include <chrono>
+
+// Which backups of a VM to keep. A backup is kept when any rule keeps it:
+// it is among the newest keepLast, it is the newest of one of the last
+// keepDaily days (keepWeekly weeks, ...), or it is younger than
+// keepWithinDays. The newest backup and everything a kept incremental or
+// differential backup depends on are always kept.
+struct RetentionPolicy {
+    int keepLast{0};
+    int keepDaily{0};
+    int keepWeekly{0};     // Weeks start on Monday, local time
+    int keepMonthly{0};
+    int keepYearly{0};
+    int keepWithinDays{0};
+
+    // maxBackups, the GFS tiers and retentionDays of a backup config
+    static RetentionPolicy fromConfig(const BackupConfig& config);
+
+    // Only count and calendar rules ever let a backup expire
+    bool isEnabled() const;
+};
+
+// Backups of one VM the policy no longer keeps, oldest first
+std::vector<CatalogEntry> selectExpired(const RetentionPolicy& policy, std::vector<CatalogEntry> backups,
+                                        std::chrono::system_clock::time_point now);
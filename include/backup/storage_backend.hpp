@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Where a repository keeps its objects. url is a local directory or
+// s3://bucket[/prefix]; the remaining fields only apply to S3.
+struct StorageConfig {
+    std::string url;
+    std::string endpoint;            // e.g. http://minio:9000; empty for AWS in region
+    std::string region{"us-east-1"};
+    std::string accessKey;           // Default to AWS_ACCESS_KEY_ID / AWS_SECRET_ACCESS_KEY /
+    std::string secretKey;           // AWS_SESSION_TOKEN from the environment
+    std::string sessionToken;
+    bool pathStyle{true};            // bucket in the path rather than the host name, as MinIO expects
+    bool verifyTls{true};
+    uint64_t partSize{16ULL << 20};  // Objects larger than this are uploaded in parts
+    size_t uploadThreads{4};         // Parts uploaded in parallel
+    uint64_t maxInFlightBytes{128ULL << 20};  // Part buffers held at once by all writers
+    int retries{3};                  // Of a request failing with a network error, 429 or 5xx
+};
+
+// Streams one object into a backend. Nothing is visible under the key until
+// commit() succeeds; a writer destroyed without commit() aborts.
+class ObjectWriter {
+public:
+    virtual ~ObjectWriter() = default;
+
+    virtual bool write(const void* data, size_t size) = 0;
+    virtual bool commit() = 0;
+    virtual void abort() = 0;
+    virtual std::string getLastError() const = 0;
+};
+
+// Object storage behind a repository. Keys are relative, '/'-separated
+// paths. Implementations are safe to use from several threads; writers must
+// not outlive their backend.
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+
+    // Backend for config.url; null with error set when it cannot be used
+    static std::unique_ptr<StorageBackend> create(const StorageConfig& config, std::string& error);
+
+    virtual std::string describe() const = 0;
+
+    virtual bool put(const std::string& key, const void* data, size_t size) = 0;
+    virtual std::unique_ptr<ObjectWriter> createWriter(const std::string& key) = 0;
+    // length bytes from offset, or everything after it when length is 0
+    virtual bool read(const std::string& key, uint64_t offset, uint64_t length, std::vector<uint8_t>& data) = 0;
+    virtual bool stat(const std::string& key, bool& exists, uint64_t& size) = 0;
+    // Removing a missing object succeeds
+    virtual bool remove(const std::string& key) = 0;
+    // Keys starting with prefix, sorted
+    virtual bool list(const std::string& prefix, std::vector<std::string>& keys) = 0;
+
+    virtual std::string getLastError() const = 0;
+};
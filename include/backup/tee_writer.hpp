@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+// Destination of a TeeWriter; written from its own writer thread only
+class TeeTarget {
+public:
+    virtual ~TeeTarget() = default;
+    virtual std::string describe() const = 0;
+    virtual bool write(uint64_t offset, const uint8_t* data, size_t size, std::string& error) = 0;
+};
+
+enum class TeePolicy {
+    FAIL,    // A failed or stalled target fails the copy
+    DEGRADE  // It is dropped and the copy goes on while minTargets remain
+};
+
+struct TeeConfig {
+    uint64_t queueBytes{64ULL << 20};                // Queued per target; writers wait beyond this
+    std::chrono::milliseconds stallTimeout{60000};   // Longest a full target may keep writers waiting
+    TeePolicy policy{TeePolicy::FAIL};
+    size_t minTargets{1};                            // Fewest targets DEGRADE drops down to
+};
+
+struct TeeTargetStatus {
+    std::string target;
+    bool required{false};
+    uint64_t bytesWritten{0};
+    uint64_t queuedBytes{0};
+    std::chrono::milliseconds blockedTime{0};  // Writers spent waiting for its queue
+    bool dropped{false};
+    std::string error;                         // Why it failed or was dropped
+};
+
+// Fans one stream of writes out to several targets so the source is read
+// once however many copies are made. Every target has its own bounded queue
+// and writer thread: a slow target holds writers back only once its queue
+// is full, not before. A target that fails a write, or keeps its queue full
+// for stallTimeout, fails the whole copy, or under DEGRADE is dropped while
+// the others go on. Required targets are never dropped. write() may be
+// called from several threads, with areas in any order.
+class TeeWriter {
+public:
+    explicit TeeWriter(const TeeConfig& config = TeeConfig());
+    ~TeeWriter();
+
+    TeeWriter(const TeeWriter&) = delete;
+    TeeWriter& operator=(const TeeWriter&) = delete;
+
+    // Before the first write
+    void addTarget(std::unique_ptr<TeeTarget> target, bool required = false);
+
+    // Queue a copy of the data for every active target; false once the
+    // copy has failed
+    bool write(uint64_t offset, const void* data, size_t size);
+    // Wait until the active targets wrote everything queued and stop the
+    // writer threads. A dropped target still finishes the write it is in.
+    bool finish();
+
+    std::vector<TeeTargetStatus> getStatus() const;
+    bool hasFailed() const;
+    std::string getLastError() const;
+
+private:
+    struct Block {
+        uint64_t offset{0};
+        std::shared_ptr<const std::vector<uint8_t>> data;  // Shared by all targets
+    };
+    struct Target {
+        std::unique_ptr<TeeTarget> sink;
+        bool required{false};
+        std::deque<Block> queue;
+        uint64_t queued{0};  // Including the block being written
+        uint64_t written{0};
+        std::chrono::steady_clock::duration blocked{};
+        bool dropped{false};
+        std::string error;
+        std::condition_variable ready;    // Queued a block, or stopping
+        std::condition_variable drained;  // Room in the queue
+        std::thread thread;
+    };
+
+    // Called with mutex_ held
+    void startLocked();
+    void dropLocked(Target& target, const std::string& reason);
+    size_t activeLocked() const;
+    void failLocked(const std::string& reason);
+
+    void run(Target& target);
+
+    TeeConfig config_;
+    std::vector<std::unique_ptr<Target>> targets_;
+    bool started_{false};
+    bool stopping_{false};
+    bool failed_{false};
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
+
+// Copies of one backup in other repositories, shared by the copies of its
+// disks. A copy dropped while one disk is copied is left out of the rest.
+class BackupCopies {
+public:
+    BackupCopies(std::vector<std::string> paths, const TeeConfig& config);
+
+    const TeeConfig& getConfig() const { return config_; }
+    // Backup directories of the copies not dropped
+    std::vector<std::string> getActive() const;
+    void drop(const std::string& path, const std::string& reason);
+    // Path and reason of each dropped copy
+    std::vector<std::pair<std::string, std::string>> getDropped() const;
+
+private:
+    std::vector<std::string> paths_;
+    std::vector<std::pair<std::string, std::string>> dropped_;
+    TeeConfig config_;
+    mutable std::mutex mutex_;
+};
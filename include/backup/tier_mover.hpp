@@ -0,0 +1,76 @@
+#pragma once
+
+#include "backup/chunk_repository.hpp"
+#include "common/rate_limiter.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <optional>
+#include <chrono>
+
+struct TierPolicy {
+    std::chrono::seconds moveAfter{std::chrono::hours(24)};  // Packs sealed longer ago leave the landing tier
+    uint64_t landingLimit{0};               // Bytes kept on the landing tier before packs move early (0 = no limit)
+    uint64_t bytesPerSecond{0};             // Budget of the moves (0 = unlimited)
+    std::chrono::seconds scanInterval{60};  // Between passes
+};
+
+struct TierStats {
+    std::string repository;
+    size_t packsMoved{0};
+    uint64_t bytesMoved{0};
+    size_t landingPacks{0};    // Left on the landing tier
+    uint64_t landingBytes{0};
+    size_t capacityPacks{0};
+    uint64_t capacityBytes{0};
+    std::chrono::milliseconds duration{0};
+    bool completed{false};     // False when a move failed or the pass was stopped
+};
+
+// Moves the sealed packs of chunk repositories with a capacity tier off
+// their landing tier on a background thread. Every scanInterval it moves,
+// oldest first, the packs sealed more than moveAfter ago, and younger ones
+// as long as the landing tier holds more than landingLimit bytes. A failed
+// move ends the pass; the pack is retried on the next one.
+class TierMover {
+public:
+    explicit TierMover(const TierPolicy& policy = TierPolicy());
+    ~TierMover();
+
+    // Process-wide mover set up by the daemon
+    static std::shared_ptr<TierMover> getDefault();
+
+    void setPolicy(const TierPolicy& policy);
+    TierPolicy getPolicy() const;
+
+    // Fails unless the repository has a capacity tier
+    bool add(const std::shared_ptr<ChunkRepository>& repository);
+    void remove(const std::shared_ptr<ChunkRepository>& repository);
+
+    // One pass over a repository on the calling thread
+    TierStats moveDue(const std::shared_ptr<ChunkRepository>& repository);
+
+    // Of the last pass over a repository directory
+    std::optional<TierStats> getLastStats(const std::string& directory) const;
+
+    void stop();
+
+private:
+    void run();
+    TierStats pass(const std::shared_ptr<ChunkRepository>& repository, const TierPolicy& policy);
+    bool pause(std::chrono::nanoseconds delay);  // False once stopped
+    void report(const TierStats& stats);
+
+    TierPolicy policy_;
+    std::vector<std::shared_ptr<ChunkRepository>> repositories_;
+    std::map<std::string, TierStats> lastStats_;
+    TokenBucket budget_;
+    bool stopRequested_{false};
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+};
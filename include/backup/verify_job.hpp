@@ -10,6 +10,8 @@
 #include <functional>
 #include <mutex>
 
+// Verifies one backup through its provider. Pausing holds a job that has
+// not started verifying yet; once the provider has begun, pause() fails.
 class VerifyJob : public Job {
 public:
     VerifyJob(BackupProvider* provider,
@@ -48,5 +50,6 @@ private:
     BackupProvider* provider_;  // Not owned by VerifyJob
     std::shared_ptr<ParallelTaskManager> taskManager_;
     VerifyConfig config_;
+    bool verifying_{false};  // Handed to the provider
     mutable std::mutex mutex_;
 }; 
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <cstdint>
 
 // Disk configuration for both backup and restore operations
 struct DiskConfig {
@@ -16,6 +17,8 @@ struct DiskConfig {
 // Configuration for backup operations
 struct BackupConfig {
     std::string vmId;
+    std::string endpoint;    // vCenter/hypervisor serving the VM (empty = default provider)
+    std::string host;        // ESXi/KVM host running the VM, for admission limits (empty = unknown)
     std::string sourcePath;  // Path to source disk
     std::string backupPath;  // Path to backup disk
     std::string backupDir;  // Directory to store backups
@@ -25,27 +28,68 @@ struct BackupConfig {
         int minute = 0;
         int day = 1;  // Day of week (0-6) for weekly, day of month (1-31) for monthly
     } schedule;
+    // Runs the scheduler could not start on time: "once" runs one late catch-up,
+    // "skip" waits for the next regular run
+    std::string catchUpPolicy{"once"};
+    int catchUpWindowMinutes{0};  // Latest a "once" catch-up may start (0 = no limit)
+    // Spreads runs that share a start time over staggerWindowMinutes: "none", "hash"
+    // (fixed per-VM offset), "jitter" (random offset per run) or "spread" (evenly
+    // across all VMs with the same schedule)
+    std::string staggerPolicy{"none"};
+    int staggerWindowMinutes{0};
     int maxBackups{0};
+    // Grandfather-father-son retention: the newest backup of each of the last
+    // N days, weeks, months and years is kept as well (0 = tier unused)
+    int keepDaily{0};
+    int keepWeekly{0};
+    int keepMonthly{0};
+    int keepYearly{0};
     bool incremental{false};
     int compressionLevel{0};
-    int maxConcurrentDisks{1};
+    int maxConcurrentDisks{1};  // Concurrent read streams per disk (0 = adaptive)
     bool enableCBT{true};
     int retentionDays{7};
     std::vector<std::string> excludedDisks;
+    uint64_t bandwidthLimit{0};  // Bytes per second for this job (0 = unlimited)
+    // Further copies of the backup, written from the same source reads into
+    // a backup directory of the same name in each of these repositories
+    std::vector<std::string> copyRepositories;
+    // A copy that fails or falls behind fails the backup ("fail") or is
+    // dropped while the backup goes on ("degrade")
+    std::string copyPolicy{"fail"};
+    int copyStallSeconds{60};              // Longest a copy may hold the source reads back
+    uint64_t copyQueueBytes{64ULL << 20};  // Buffered per copy before it holds them back
+    // Store disks as deduplicated chunks in the repository's chunk store
+    // (<repository>/.chunks) instead of one backup file per disk
+    bool chunkStore{false};
 };
 
 // Configuration for verify operations
 struct VerifyConfig {
     std::string backupId;
+    std::string endpoint;    // vCenter/hypervisor to verify against (empty = default provider)
     bool verifyChecksums = true;
     bool verifyMetadata = true;
     bool verifyData = true;
     int maxConcurrentDisks = 1;
 };
 
+// Configuration for replicating the backups of one repository to another
+struct ReplicationConfig {
+    std::string source;               // Repository replicated from
+    std::string destination;          // Repository replicated to
+    std::vector<std::string> vmIds;   // Backups of these VMs only (empty = all)
+    int streams{4};                   // Files, file segments and chunk batches sent at once
+    int compressionLevel{1};          // Deflate level of the data sent (0 = none)
+    uint32_t blockSize{64 * 1024};    // Granularity at which files are matched against the destination
+    uint64_t segmentSize{16ULL << 20};  // Bytes of a file one stream diffs at a time
+    uint64_t bandwidthLimit{0};       // Bytes per second sent (0 = unlimited)
+};
+
 // Configuration for restore operations
 struct RestoreConfig {
     std::string vmId;
+    std::string endpoint;         // vCenter/hypervisor to restore to (empty = vsphereHost or default provider)
     std::string backupId;
     std::string vmName;           // Name of the VM to create
     std::string datastore;        // Target datastore
@@ -57,8 +101,9 @@ struct RestoreConfig {
     bool verifyAfterRestore{true};
     bool powerOnAfterRestore{false};
     std::vector<DiskConfig> diskConfigs;
-    int maxConcurrentDisks{1};
+    int maxConcurrentDisks{1};  // Concurrent write streams per disk (0 = adaptive)
     std::vector<std::string> excludedDisks;
+    uint64_t bandwidthLimit{0};  // Bytes per second for this job (0 = unlimited)
     // vSphere connection parameters
     std::string vsphereHost;
     std::string vsphereUsername;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <optional>
+#include <cstdint>
+
+// Last successful CBT checkpoint of one VM disk
+struct ChangeIdRecord {
+    std::string vmId;
+    std::string diskPath;
+    std::string changeId;   // VMware change ID ("<instance uuid>/<sequence>")
+    std::string backupId;   // Backup that captured this change ID
+    uint64_t capacity{0};   // Disk capacity in bytes when the change ID was taken
+    int64_t timestamp{0};   // Seconds since epoch
+};
+
+// Durable per-VM/per-disk change ID store for VMware incremental chains.
+// The store is a single JSON file; every update is written to a temporary
+// file, fsync'ed and renamed over the previous one, so a crash leaves either
+// the old or the new state, never a torn file.
+class ChangeIdStore {
+public:
+    explicit ChangeIdStore(const std::string& path);
+    ~ChangeIdStore() = default;
+
+    // Load the store from disk (a missing file is an empty store)
+    bool load();
+
+    std::optional<ChangeIdRecord> get(const std::string& vmId, const std::string& diskPath) const;
+    bool update(const ChangeIdRecord& record);
+    // All records or none, in one write
+    bool update(const std::vector<ChangeIdRecord>& records);
+    bool remove(const std::string& vmId, const std::string& diskPath);
+    bool removeVM(const std::string& vmId);
+
+    // Decide whether the stored checkpoint can seed an incremental backup.
+    // A full backup is required if there is no checkpoint, CBT is disabled,
+    // the disk was resized or the change tracking instance was reset.
+    static bool requiresFullBackup(const std::optional<ChangeIdRecord>& record,
+                                   const std::string& currentChangeId,
+                                   uint64_t currentCapacity,
+                                   std::string& reason);
+
+    std::string getPath() const { return path_; }
+    std::string getLastError() const;
+
+private:
+    bool persist();
+    static std::string makeKey(const std::string& vmId, const std::string& diskPath);
+    static bool parseChangeId(const std::string& changeId, std::string& instance, uint64_t& sequence);
+
+    std::string path_;
+    std::map<std::string, ChangeIdRecord> records_;
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
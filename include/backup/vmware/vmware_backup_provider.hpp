@@ -6,9 +6,13 @@
 #include <vector>
 #include <functional>
 #include <mutex>
+#include <atomic>
 #include <optional>
 #include <map>
 #include "backup/backup_provider.hpp"
+#include "backup/vmware/change_id_store.hpp"
+#include "backup/chunk_repository.hpp"
+#include "backup/kvm/storage_detector.hpp"
 #include "common/vmware_connection.hpp"
 #include "vddk_wrapper/vddk_wrapper.h"
 #include "common/logger.hpp"
@@ -17,6 +21,10 @@
 // Forward declarations
 class BackupJob;
 class ParallelTaskManager;
+class ManifestWriter;
+class TeeWriter;
+struct ManifestExtent;
+struct RestoreLayer;
 
 class VMwareBackupProvider : public BackupProvider, public std::enable_shared_from_this<VMwareBackupProvider> {
 public:
@@ -38,12 +46,17 @@ public:
     std::vector<std::string> listVMs() const;
     bool getVMInfo(const std::string& vmId, std::string& name, std::string& status) const;
     bool getVMDiskPaths(const std::string& vmId, std::vector<std::string>& diskPaths) override;
-    bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config) override;
+    bool getDiskCapacities(const std::string& vmId, std::map<std::string, uint64_t>& capacities) override;
+    bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config,
+                    const BackupContext& context) override;
+    bool finishBackup(const std::string& vmId, const BackupConfig& config, const BackupContext& context,
+                      bool succeeded) override;
     bool verifyDisk(const std::string& diskPath) override;
     bool listBackups(std::vector<std::string>& backupDirs) override;
     bool deleteBackup(const std::string& backupDir) override;
     bool verifyBackup(const std::string& backupId) override;
-    bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config);
+    bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config,
+                     const RestoreContext& context);
     bool getChangedBlocks(const std::string& vmId, const std::string& diskPath,
                          std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks) override;
 
@@ -53,14 +66,14 @@ public:
     void cleanupSnapshot();
 
     // Backup management
-    bool startBackup(const std::string& vmId, const BackupConfig& config);
+    bool startBackup(const std::string& vmId, const BackupConfig& config, const BackupContext& context = {});
     bool cancelBackup(const std::string& vmId);
     bool pauseBackup(const std::string& backupId);
     bool resumeBackup(const std::string& backupId);
     bool getBackupStatus(const std::string& backupId, BackupStatus& status);
     bool verifyBackupIntegrity(const std::string& backupId);
     bool saveBackupMetadata(const std::string& backupId, const std::string& vmId,
-                           const std::vector<std::string>& diskPaths);
+                           const std::vector<std::string>& diskPaths, ManifestWriter* manifest = nullptr);
     std::optional<BackupMetadata> getLatestBackupInfo(const std::string& vmId);
     std::string calculateChecksum(const std::string& filePath);
 
@@ -94,16 +107,62 @@ public:
 private:
     VMwareConnection* connection_;  // Not owned by VMwareBackupProvider
     mutable std::mutex mutex_;  // Made mutable for const member functions
-    double progress_;
+    std::atomic<double> progress_;  // Written by restore copies without the lock
     std::string lastError_;
     ProgressCallback progressCallback_;
     StatusCallback statusCallback_;
     std::map<std::string, std::unique_ptr<BackupJob>> activeOperations_;
     std::string currentSnapshotName_;
     std::string currentVmId_;  // Added missing member
+    std::map<std::string, std::unique_ptr<ChangeIdStore>> changeIdStores_;  // Keyed by store path
+    // Chunks a backup stored in one repository, committed as a root by finishBackup
+    struct PendingRoot {
+        std::string backupDir;  // Names the root
+        std::shared_ptr<ChunkRepository> chunks;
+        std::unique_ptr<ChunkSession> session;
+        std::vector<ChunkId> ids;
+    };
+    // What a backup leaves for finishBackup to save once all its disks are in
+    struct PendingBackup {
+        std::vector<std::pair<ChangeIdStore*, ChangeIdRecord>> changeIds;
+        std::vector<PendingRoot> roots;  // Primary repository first
+    };
+    std::map<std::string, PendingBackup> pendingBackups_;  // Keyed by backup path
 
     void updateProgress(double progress, const std::string& status);
     void handleError(int32_t error);
+    // Takes mutex_; for the disk copies, which run without it
+    void setError(const std::string& error);
+    // Called with mutex_ held
+    ChangeIdStore* getChangeIdStore(const BackupConfig& config);
+    bool queryChangedAreas(const std::string& vmId, const std::string& diskPath,
+                           const std::string& changeId, uint64_t capacity,
+                           std::vector<std::pair<uint64_t, uint64_t>>& changedAreas);
+    // Copies byte areas between a production disk and its backup disk.
+    // Runs as many streams as controller allows (one without a controller);
+    // each extra stream opens its own handle on productionPath, while the
+    // backup handle is shared. Production-side I/O is timed and reported to
+    // the controller and the latency throttle, which may pause it while its
+    // datastore misses the latency SLO; reads are throttled through limiter.
+    // Block size and the NUMA node of extra streams come from io. fromProduction
+    // selects backup (true) or restore (false); progress, when given, is
+    // updated from the calling thread only. Runs without mutex_. A backup given tee writes through
+    // it instead of backupHandle and finishes it before returning.
+    bool copyAreas(VDDKConnection connection, const std::string& productionPath, uint32_t productionFlags,
+                   VDDKHandle productionHandle, VDDKHandle backupHandle, bool fromProduction,
+                   const std::vector<std::pair<uint64_t, uint64_t>>& areas,
+                   RateLimiter* limiter, AdaptiveStreamController* controller,
+                   LatencyThrottle* throttle, const StorageDetector::IoProfile& io,
+                   std::atomic<double>* progress = nullptr, TeeWriter* tee = nullptr);
+    // Stores areas of a disk as chunks in the chunk store of the backup's
+    // repository and of each copy's; extents get the chunk ids as digests
+    bool storeDiskChunks(VDDKConnection connection, const std::string& diskPath, VDDKHandle sourceHandle,
+                         const std::vector<std::pair<uint64_t, uint64_t>>& areas, const BackupConfig& config,
+                         const BackupContext& context, std::vector<ManifestExtent>& extents);
+    // Writes a chunk-stored backup layer to the target disk
+    bool restoreChunks(VDDKHandle targetHandle, const RestoreLayer& layer, const RestoreContext& context);
+    // Profile of the local side of a copy; caps the job's streams at its queue depth
+    StorageDetector::IoProfile probeLocalStorage(const std::string& path, AdaptiveStreamController* controller);
     //bool initializeVDDK();
 };
 
@@ -3,6 +3,8 @@
 #include "common/job_manager.hpp"
 #include "backup/backup_scheduler.hpp"
 #include "common/logger.hpp"
+#include "common/control_protocol.hpp"
+#include <nlohmann/json.hpp>
 #include <memory>
 #include <string>
 #include <vector>
@@ -24,10 +26,20 @@ private:
     void handleListCommand(int argc, char** argv);
     bool handleVerifyCommand(int argc, char* argv[]);
     bool handleRestoreCommand(int argc, char* argv[]);
+    bool handleReplicateCommand(int argc, char* argv[]);
+    bool handleDaemonCommand(int argc, char* argv[]);
+    bool handleStatusCommand(int argc, char* argv[]);
+    bool handleCancelCommand(int argc, char* argv[]);
+    bool handleWatchCommand(int argc, char* argv[]);
+    bool handleBandwidthCommand(int argc, char* argv[]);
+    bool submitToDaemon(const std::string& command, const nlohmann::json& config,
+                        const EndpointCredentials& credentials);
     void parseBackupOptions(int argc, char* argv[], BackupConfig& config);
     std::string formatTime(time_t time) const;
     time_t parseTime(const std::string& timeStr) const;
 
     JobManager* jobManager_;
     BackupScheduler* scheduler_;
+    std::string socketPath_;  // Non-empty: forward jobs to the daemon listening here
+    bool detach_{false};      // Return after submitting instead of following the job
 }; 
\ No newline at end of file
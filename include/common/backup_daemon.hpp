@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common/job_manager.hpp"
+#include "common/control_protocol.hpp"
+#include "common/control_server.hpp"
+#include "backup/backup_provider.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct DaemonConfig {
+    std::string socketPath{DEFAULT_CONTROL_SOCKET};
+    std::string endpointsFile;      // Optional JSON file of endpoints to connect at startup
+    EndpointLimits defaultLimits;   // Limits for endpoints registered on demand
+};
+
+// Long-running process that keeps providers, VDDK and REST sessions warm and
+// accepts job requests over the control socket.
+class BackupDaemon {
+public:
+    explicit BackupDaemon(const DaemonConfig& config);
+    ~BackupDaemon();
+
+    bool start();
+    void stop();
+
+    // Block until stop() is called or SIGINT/SIGTERM is received
+    void run();
+
+    JobManager& getJobManager() { return jobManager_; }
+    std::string getLastError() const { return lastError_; }
+
+private:
+    bool handleRequest(const nlohmann::json& request, const ControlReply& reply);
+    nlohmann::json handleBackup(const nlohmann::json& request);
+    nlohmann::json handleVerify(const nlohmann::json& request);
+    nlohmann::json handleRestore(const nlohmann::json& request);
+    nlohmann::json handleStatus(const nlohmann::json& request);
+    nlohmann::json handleCancel(const nlohmann::json& request);
+    nlohmann::json handleBandwidth(const nlohmann::json& request);
+    bool handleSubscribe(const nlohmann::json& request, const ControlReply& reply);
+
+    bool loadEndpoints(const std::string& path);
+    // Global/per-source limits and profiles from a request or the endpoints file
+    bool applyBandwidthSettings(const nlohmann::json& settings, std::string& error);
+    bool resolveEndpoint(const nlohmann::json& request, std::string& endpoint, std::string& error);
+    // Connects without holding mutex_
+    bool registerEndpoint(const EndpointCredentials& credentials, const EndpointLimits& limits,
+                          std::string& error);
+    // Admits the job without holding mutex_, as admission talks to the endpoint
+    nlohmann::json submitJob(const std::shared_ptr<Job>& job, const std::string& type);
+    std::shared_ptr<Job> findJob(const std::string& jobId, std::string& type) const;
+
+    DaemonConfig config_;
+    std::map<std::string, std::unique_ptr<BackupProvider>> providers_;  // Must outlive jobManager_
+    std::map<std::string, EndpointCredentials> credentials_;            // Of the registered endpoints
+    JobManager jobManager_;
+    std::unique_ptr<ControlServer> server_;
+    mutable std::mutex mutex_;  // Serializes JobManager and provider registration
+
+    std::atomic<bool> stopRequested_{false};
+    std::mutex stopMutex_;
+    std::condition_variable stopCv_;
+    std::string lastError_;
+};
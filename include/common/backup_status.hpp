@@ -54,4 +54,12 @@ struct BackupMetadata {
     int64_t size;
     std::vector<std::string> disks;
     std::string checksum;
+};
+
+// Snapshot lifetime of a single backup run. The open duration is what grows
+// the delta disks (and the consolidation stun), so it is reported per VM.
+struct SnapshotTimings {
+    std::chrono::milliseconds createTime{0};    // createSnapshot() round trip
+    std::chrono::milliseconds openDuration{0};  // snapshot created -> removed
+    std::chrono::milliseconds removeTime{0};    // removeSnapshot() round trip
 }; 
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <string>
+
+// Client side of the daemon control socket, used by the CLI
+class ControlClient {
+public:
+    ControlClient() = default;
+    ~ControlClient();
+
+    ControlClient(const ControlClient&) = delete;
+    ControlClient& operator=(const ControlClient&) = delete;
+
+    bool connect(const std::string& socketPath);
+    void disconnect();
+    bool isConnected() const { return fd_ >= 0; }
+
+    // Send a request and wait for its first response
+    bool request(const nlohmann::json& request, nlohmann::json& response);
+
+    // Low level access for commands that stream several responses
+    bool send(const nlohmann::json& message);
+    bool receive(nlohmann::json& message);
+
+    std::string getLastError() const { return lastError_; }
+
+private:
+    int fd_{-1};
+    std::string buffer_;
+    std::string lastError_;
+};
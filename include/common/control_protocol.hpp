@@ -0,0 +1,50 @@
+#pragma once
+
+#include "backup/vm_config.hpp"
+#include "common/job.hpp"
+#include "common/job_event_ring.hpp"
+#include <nlohmann/json.hpp>
+#include <string>
+
+// Control socket protocol shared by the daemon and the CLI client.
+//
+// Every message is a single JSON object terminated by '\n' (JSON lines).
+// Requests carry a "command" (backup, restore, verify, status, cancel, ping)
+// and the daemon answers with {"ok": true, ...} or {"ok": false, "error": ...}.
+//
+// "subscribe" (optionally for one "jobId") turns the connection into an event
+// stream: the current job snapshot first, then {"event": {...}} messages,
+// {"dropped": n} when the subscriber fell behind the event ring, and
+// {"end": true} once a single subscribed job has finished.
+
+constexpr const char* DEFAULT_CONTROL_SOCKET = "/tmp/genievm.sock";
+constexpr size_t MAX_CONTROL_MESSAGE_SIZE = 1024 * 1024;
+
+// Connection parameters a client sends so the daemon can reach the endpoint
+struct EndpointCredentials {
+    std::string type{"vmware"};
+    std::string host;
+    std::string port{"443"};
+    std::string username;
+    std::string password;
+};
+
+// Read one '\n' terminated message; buffer keeps bytes read past the newline
+bool readControlMessage(int fd, std::string& buffer, std::string& message);
+bool writeControlMessage(int fd, const nlohmann::json& message);
+
+// Config <-> JSON conversion
+nlohmann::json backupConfigToJson(const BackupConfig& config);
+bool backupConfigFromJson(const nlohmann::json& j, BackupConfig& config);
+nlohmann::json verifyConfigToJson(const VerifyConfig& config);
+bool verifyConfigFromJson(const nlohmann::json& j, VerifyConfig& config);
+nlohmann::json restoreConfigToJson(const RestoreConfig& config);
+bool restoreConfigFromJson(const nlohmann::json& j, RestoreConfig& config);
+nlohmann::json credentialsToJson(const EndpointCredentials& credentials);
+bool credentialsFromJson(const nlohmann::json& j, EndpointCredentials& credentials);
+
+// Job state snapshot as sent to clients
+nlohmann::json jobToJson(const Job& job, const std::string& type);
+std::string jobStateToString(Job::State state);
+nlohmann::json jobEventToJson(const JobEvent& event);
+bool isTerminalJobState(Job::State state);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+// Sends one message back to the client; returns false once the client is gone
+using ControlReply = std::function<bool(const nlohmann::json& message)>;
+
+// Handles one request; may reply any number of times. Returning false closes the connection.
+using ControlHandler = std::function<bool(const nlohmann::json& request, const ControlReply& reply)>;
+
+// Unix domain socket server speaking the JSON-lines control protocol.
+// Each client connection is served by its own thread; requests on one
+// connection are handled in order.
+class ControlServer {
+public:
+    ControlServer(const std::string& socketPath, ControlHandler handler);
+    ~ControlServer();
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running_; }
+
+    std::string getSocketPath() const { return socketPath_; }
+    std::string getLastError() const { return lastError_; }
+
+private:
+    void acceptLoop();
+    void serveConnection(int fd);
+
+    std::string socketPath_;
+    ControlHandler handler_;
+    int listenFd_{-1};
+    std::atomic<bool> running_{false};
+    std::thread acceptThread_;
+
+    // Open client connections, so stop() can unblock and wait for them
+    std::mutex connectionsMutex_;
+    std::condition_variable connectionsCv_;
+    std::set<int> connections_;
+
+    std::string lastError_;
+};
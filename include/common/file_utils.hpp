@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Replace the file at path with data so that a crash leaves either the old or
+// the new content: the data goes to "<path>.tmp", is fsync'ed, renamed over
+// path and the directory is fsync'ed. Missing parent directories are created.
+bool writeFileAtomic(const std::string& path, const std::string& data, std::string& error);
+
+// CRC-32 (IEEE) of a buffer; pass the previous result as crc to continue it
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+// Read-only memory map of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    void close();
+
+    bool isOpen() const { return fd_ >= 0; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    int fd_{-1};
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+};
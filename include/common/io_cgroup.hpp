@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
+
+// cgroup v2 I/O limits for one block device (0 = no limit)
+struct IoDeviceLimits {
+    std::string device;  // "/dev/sda" or "MAJ:MIN"
+    uint64_t readBytesPerSecond{0};
+    uint64_t writeBytesPerSecond{0};
+    uint64_t readIops{0};
+    uint64_t writeIops{0};
+    std::chrono::microseconds latencyTarget{0};  // io.latency target
+};
+
+struct IoCgroupConfig {
+    std::string path;  // Relative to the cgroup v2 mount, e.g. "genievm-backup"
+    std::vector<IoDeviceLimits> devices;
+};
+
+// A cgroup v2 group whose io.max and io.latency protect the devices backing
+// production VMs on a KVM host. The io controller is not threaded, so the
+// limits apply to whole processes: a daemon that moves itself in is
+// limited on the listed devices in every thread, whichever endpoint the
+// thread works for.
+class IoCgroup {
+public:
+    explicit IoCgroup(const IoCgroupConfig& config, const std::string& root = "/sys/fs/cgroup");
+
+    // Create the group, enable the io controller in its parent and write the limits
+    bool apply();
+    // Move a process into the group
+    bool attach(pid_t pid);
+
+    std::string getPath() const { return path_; }
+    std::string getLastError() const { return lastError_; }
+
+private:
+    bool resolveDevice(const std::string& device, std::string& majorMinor);
+    bool writeFile(const std::string& file, const std::string& value);
+
+    IoCgroupConfig config_;
+    std::string root_;
+    std::string path_;
+    std::string lastError_;
+};
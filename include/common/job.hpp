@@ -6,6 +6,33 @@
 #include <mutex>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <vector>
+
+class JobEventRing;
+
+// What changed in a job event
+enum class JobEventKind {
+    PROGRESS,
+    STATUS,
+    STATE,
+    THROUGHPUT
+};
+
+// Scheduling class of a job, in ascending urgency. Higher classes get a
+// larger share of the endpoint worker pools and can hold back lower ones.
+enum class JobClass {
+    SCRUB,
+    BACKUP,
+    VERIFY,
+    RESTORE
+};
+
+// Time a job's copy streams spent held back
+struct ThrottleTimes {
+    std::chrono::milliseconds bandwidth{0};  // Waiting for bandwidth tokens
+    std::chrono::milliseconds latency{0};    // Paused while a source missed its latency SLO
+};
 
 // Callback type definitions
 using ProgressCallback = std::function<void(int progress)>;
@@ -44,10 +71,25 @@ public:
 
     // Common status queries
     State getState() const { return state_; }
+    JobClass getJobClass() const { return jobClass_; }
+    uint64_t getBytesTransferred() const;
+    // Time spent running, up to now or until the job finished
+    std::chrono::milliseconds getRunTime() const;
+    // Jobs that copy disk data report how long they were throttled
+    virtual ThrottleTimes getThrottleTimes() const { return ThrottleTimes(); }
 
     // Callbacks
     void setProgressCallback(ProgressCallback callback) { progressCallback_ = callback; }
     void setStatusCallback(StatusCallback callback) { statusCallback_ = callback; }
+    // Called once, outside the job lock, when the job completes, fails or is cancelled
+    void addCompletionCallback(std::function<void(const Job& job)> callback);
+    // Called once when the job's worker thread returns. A cancelled job is
+    // CANCELLED at once but goes on until its worker notices, so resources
+    // the worker uses are released here rather than on completion
+    void addExitCallback(std::function<void(const Job& job)> callback);
+
+    // Publish progress/status/state changes to a shared event ring
+    void setEventRing(std::shared_ptr<JobEventRing> ring, const std::string& jobType);
 
 protected:
     void updateProgress(int progress);
@@ -55,9 +97,13 @@ protected:
     void setState(State state);
     void setStatus(const std::string& status);
     void setId(const std::string& id) { id_ = id; }
+    void addBytesTransferred(uint64_t bytes);
     std::string generateId() const;
+    // Run the job on a detached thread that calls the exit callbacks when done
+    void startWorker(std::function<void()> body);
 
     std::string id_;
+    JobClass jobClass_{JobClass::BACKUP};
     State state_{State::PENDING};
     std::string status_{"pending"};
     int progress_{0};
@@ -65,4 +111,16 @@ protected:
     ProgressCallback progressCallback_;
     StatusCallback statusCallback_;
     mutable std::mutex mutex_;
+
+private:
+    // Called with mutex_ held
+    void publishEvent(JobEventKind kind);
+
+    std::shared_ptr<JobEventRing> eventRing_;
+    std::string jobType_;
+    uint64_t bytesTransferred_{0};
+    std::chrono::steady_clock::time_point runningSince_;
+    std::chrono::steady_clock::time_point finishedAt_;
+    std::vector<std::function<void(const Job& job)>> completionCallbacks_;
+    std::vector<std::function<void(const Job& job)>> exitCallbacks_;
 }; 
\ No newline at end of file
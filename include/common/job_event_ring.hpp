@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common/job.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One job progress/status/state change as seen by subscribers
+struct JobEvent {
+    uint64_t sequence{0};
+    JobEventKind kind{JobEventKind::PROGRESS};
+    std::string jobId;
+    std::string jobType;
+    Job::State state{Job::State::PENDING};
+    int progress{0};
+    std::string status;
+    uint64_t bytesTransferred{0};
+    double throughput{0.0};   // Bytes per second since the job started running
+    int64_t timestamp{0};     // Milliseconds since epoch
+};
+
+// Fixed-size ring of job events shared by all jobs of a JobManager.
+// Publishing never waits for readers: when a subscriber falls more than
+// capacity events behind, the oldest events are overwritten and the
+// subscriber is told how many it missed.
+class JobEventRing {
+public:
+    explicit JobEventRing(size_t capacity = 4096);
+
+    // Store an event and return its sequence number
+    uint64_t publish(JobEvent event);
+
+    // Copy up to maxEvents events starting at nextSequence and advance it.
+    // dropped receives the number of requested events already overwritten.
+    size_t read(uint64_t& nextSequence, std::vector<JobEvent>& events,
+                size_t maxEvents, uint64_t& dropped) const;
+
+    // Wait until an event with sequence >= nextSequence exists
+    bool wait(uint64_t nextSequence, std::chrono::milliseconds timeout) const;
+
+    uint64_t getNextSequence() const;
+    // Sequence of the oldest event still held
+    uint64_t getOldestSequence() const;
+    size_t getCapacity() const { return slots_.size(); }
+
+private:
+    // Called with mutex_ held
+    uint64_t oldestSequence() const;
+
+    std::vector<JobEvent> slots_;
+    uint64_t nextSequence_{0};
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cv_;
+};
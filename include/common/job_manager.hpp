@@ -1,18 +1,70 @@
 #pragma once
 
 #include "common/job.hpp"
+#include "common/job_event_ring.hpp"
+#include "common/rate_limiter.hpp"
+#include "common/stream_controller.hpp"
+#include "common/latency_monitor.hpp"
 #include "backup/backup_job.hpp"
 #include "backup/verify_job.hpp"
 #include "backup/restore_job.hpp"
 #include "backup/backup_provider.hpp"
 #include "backup/vm_config.hpp"
 #include "common/logger.hpp"
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
 #include <map>
+#include <set>
+
+// Per-endpoint resources of a vCenter/hypervisor served by a JobManager
+struct EndpointLimits {
+    size_t workerThreads{4};       // Threads in the endpoint's shared task pool
+    size_t maxConcurrentJobs{4};   // Jobs allowed to run against the endpoint at once (0 = unlimited)
+};
+
+// Caps on concurrent disk streams per shared resource (0 = unlimited).
+// A job takes as many streams as its maxConcurrentDisks, or the initial
+// count of its stream controller when that is 0 (adaptive).
+struct AdmissionLimits {
+    size_t streamsPerDatastore{4};   // Source datastore (restore: target datastore)
+    size_t streamsPerHost{8};        // ESXi/KVM host running the VM
+    size_t streamsPerRepository{8};  // Backup directory jobs read from or write to
+};
+
+// How job classes share the endpoint pools (and the pool of jobs without an
+// endpoint). Weights split worker time
+// between classes with queued work; while a restore runs, lower classes
+// are treated according to lowerClassAction:
+//   "none"  - no preference beyond the weights
+//   "hold"  - queued lower-class jobs wait until no restore is running
+//   "throttle" - as "hold", and running lower-class jobs are slowed to
+//                throttledBytesPerSecond through their own bandwidth limiter
+//                until the last restore ends. A backup keeps copying, so its
+//                snapshot does not stay open any longer than the slowdown
+//                requires; jobs without a limiter (verify) hold no snapshot
+//                and are paused instead, unless already verifying
+struct QosPolicy {
+    unsigned restoreWeight{8};
+    unsigned verifyWeight{4};
+    unsigned backupWeight{2};
+    unsigned scrubWeight{1};
+    std::string lowerClassAction{"throttle"};
+    uint64_t throttledBytesPerSecond{4ULL << 20};
+};
+
+// How long finished jobs stay registered for status queries. The oldest
+// finished job is dropped once it is older than maxAge or more than
+// maxFinishedJobs jobs are finished, but not before its last event has
+// left the event ring, so subscribers never see events of unknown jobs
+struct JobRetention {
+    std::chrono::seconds maxAge{3600};
+    size_t maxFinishedJobs{256};
+};
 
 class JobManager {
 public:
@@ -26,6 +78,16 @@ public:
     void disconnect();
     bool isConnected() const;
 
+    // Endpoint management; jobs pick their provider through the config's endpoint,
+    // an empty one falls back to the provider set with setProvider() and an
+    // unregistered one is an error
+    bool addProvider(const std::string& endpoint, BackupProvider* provider,
+                     const EndpointLimits& limits = EndpointLimits());
+    bool removeProvider(const std::string& endpoint);
+    BackupProvider* getProvider(const std::string& endpoint) const;  // nullptr if not registered
+    std::vector<std::string> getEndpoints() const;
+    size_t getRunningJobCount(const std::string& endpoint) const;
+
     // Job management
     std::shared_ptr<BackupJob> createBackupJob(const BackupConfig& config);
     std::shared_ptr<VerifyJob> createVerifyJob(const VerifyConfig& config);
@@ -43,19 +105,133 @@ public:
     // Job lifecycle management
     bool removeJob(const std::string& jobId);
     void cleanupCompletedJobs();
+    // Drop finished jobs past their retention; returns how many were dropped
+    size_t pruneFinishedJobs();
+    void setJobRetention(const JobRetention& retention);
+    JobRetention getJobRetention() const;
     void stopAllJobs();
     bool addJob(const std::shared_ptr<Job>& job);
+    // Start now if the endpoint and every resource of the job have room, fail otherwise
+    bool startJob(const std::string& jobId);
+    // Start now or queue until the job's resources free up; queued jobs are
+    // admitted least-loaded datastore first, then in submission order
+    bool submitJob(const std::string& jobId);
+    // Cancel a running job or drop a queued one
+    bool cancelJob(const std::string& jobId);
+
+    // Admission control
+    void setAdmissionLimits(const AdmissionLimits& limits);
+    AdmissionLimits getAdmissionLimits() const;
+    size_t getQueuedJobCount() const;
+    bool isJobQueued(const std::string& jobId) const;
+    std::map<std::string, size_t> getResourceUsage() const;  // "datastore:<name>" etc. -> streams
+
+    // Job class QoS; fails on an unknown lowerClassAction
+    bool setQosPolicy(const QosPolicy& policy);
+    QosPolicy getQosPolicy() const;
+    size_t getPreemptedJobCount() const;  // Jobs throttled or paused on behalf of a restore
+
+    // Bandwidth limits: backup and restore jobs read through a limiter chained
+    // job -> endpoint -> global; the manager adjusts the upper levels at runtime
+    std::shared_ptr<BandwidthManager> getBandwidthManager() const { return bandwidth_; }
+    // Per-datastore read latency and the SLO that throttles streams on slow datastores
+    std::shared_ptr<LatencyMonitor> getLatencyMonitor() const { return latency_; }
+    bool setJobBandwidth(const std::string& jobId, uint64_t bytesPerSecond);
+
+    // Bounds and targets of the stream controller given to jobs with
+    // maxConcurrentDisks 0; other jobs run their fixed stream count
+    void setStreamControllerConfig(const StreamControllerConfig& config);
+    StreamControllerConfig getStreamControllerConfig() const;
+
+    // Progress/status/state events of all jobs, for live subscribers
+    std::shared_ptr<JobEventRing> getEventRing() const { return events_; }
 
     // Changed block tracking
     bool getChangedBlocks(const std::string& vmId, const std::string& backupId, 
                          std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks);
 
     // Error handling
-    std::string getLastError() const { return lastError_; }
-    void clearLastError() { lastError_.clear(); }
+    std::string getLastError() const;
+    void clearLastError();
 
 private:
+    struct Endpoint {
+        BackupProvider* provider{nullptr};  // Not owned by JobManager
+        std::shared_ptr<ParallelTaskManager> taskManager;
+        EndpointLimits limits;
+    };
+
+    // Resources a job holds while it runs
+    struct Admission {
+        std::vector<std::string> resources;
+        size_t streams{1};
+        JobClass jobClass{JobClass::BACKUP};
+        bool running{false};
+    };
+
+    // For paths that do not hold mutex_
+    void setLastError(const std::string& error);
+
+    // Called with mutex_ held
+    Endpoint* findEndpoint(const std::string& endpoint);
+    std::shared_ptr<Job> findJob(const std::string& jobId) const;
+    size_t countRunningJobs(const std::string& endpoint, const JobClass* onlyClass = nullptr) const;
+
+    // Admission control; all but resolveAdmission called with mutex_ held
+    Admission resolveAdmission(const std::shared_ptr<Job>& job);
+    bool canAdmit(const std::string& jobId, const Admission& admission, std::string& reason);
+    void claimResources(Admission& admission);
+    void releaseResources(const std::string& jobId);
+    void takeAdmittableJobs(std::vector<std::shared_ptr<Job>>& jobs);
+    size_t getResourceLimit(const std::string& resource) const;
+    void launchJobs(const std::vector<std::shared_ptr<Job>>& jobs);
+    void onJobFinished(const std::string& jobId);
+    // Called with mutex_ held
+    size_t pruneFinishedJobsLocked();
+
+    // Job class QoS; the first three called with mutex_ held
+    void applyShareWeights(ParallelTaskManager& pool) const;
+    bool isRestoreRunning() const;
+    size_t getClassUsage(const std::string& resource, JobClass jobClass) const;
+    void preemptLowerClasses();
+    void resumePreemptedJobs();
+
+    // Called with mutex_ held
+    std::shared_ptr<AdaptiveStreamController> createStreamController(int maxConcurrentDisks) const;
+
     BackupProvider* provider_;      // Not owned by JobManager
+    std::map<std::string, Endpoint> endpoints_;
+    std::unordered_map<std::string, std::string> jobEndpoints_;  // Job ID -> endpoint
+    std::shared_ptr<JobEventRing> events_;
+    std::shared_ptr<BandwidthManager> bandwidth_;
+    std::shared_ptr<LatencyMonitor> latency_;
+    std::shared_ptr<ParallelTaskManager> defaultPool_;  // Shared by jobs of the default provider
+    StreamControllerConfig streamDefaults_;
+
+    AdmissionLimits admissionLimits_;
+    std::unordered_map<std::string, Admission> admissions_;  // Job ID -> queued or running claim
+    std::vector<std::string> admissionQueue_;                 // Queued job IDs in submission order
+    std::map<std::string, size_t> resourceUsage_;             // Resource -> streams in use
+
+    // A lower-class job slowed down for a restore, with the rate its limiter
+    // goes back to; paused instead when it has no limiter
+    struct Preemption {
+        std::shared_ptr<RateLimiter> limiter;
+        uint64_t rate{0};
+    };
+
+    QosPolicy qos_;
+    std::map<std::string, Preemption> preemptedJobs_;
+
+    // A job whose worker has returned, with the ring sequence its events end before
+    struct FinishedJob {
+        std::string jobId;
+        std::chrono::steady_clock::time_point finishedAt;
+        uint64_t eventsEnd{0};
+    };
+
+    JobRetention retention_;
+    std::deque<FinishedJob> finishedJobs_;  // In the order they finished
     
     // Job registries
     std::unordered_map<std::string, std::shared_ptr<BackupJob>> backupJobs_;
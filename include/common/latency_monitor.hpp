@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Latency objective for reads from production storage. While the smoothed
+// latency of a datastore is above target, every stream touching it pauses
+// before each I/O; the pause doubles while the SLO is missed and shrinks
+// again once latency is back under it.
+struct LatencySlo {
+    std::chrono::milliseconds target{0};      // 0 = off
+    std::chrono::milliseconds maxDelay{1000}; // Longest pause before one I/O
+};
+
+// Latency seen on one datastore/device, shared by every job using it
+class SourceLatency {
+public:
+    explicit SourceLatency(std::string name);
+
+    void record(std::chrono::microseconds latency);
+    void setSlo(const LatencySlo& slo);
+
+    const std::string& getName() const { return name_; }
+    std::chrono::microseconds getDelay() const { return std::chrono::microseconds(delayUs_.load(std::memory_order_relaxed)); }
+    std::chrono::microseconds getLatency() const;  // Smoothed
+
+private:
+    std::string name_;
+    LatencySlo slo_;
+    double latencyUs_{0.0};
+    std::chrono::steady_clock::time_point lastAdjust_;
+    std::atomic<int64_t> delayUs_{0};
+    mutable std::mutex mutex_;
+};
+
+class LatencyMonitor;
+
+// One job's handle on the monitor. Copy engines look up the source of each
+// disk once, then call pace() before and record() after every production
+// I/O.
+class LatencyThrottle {
+public:
+    explicit LatencyThrottle(std::shared_ptr<LatencyMonitor> monitor);
+
+    // Source of a disk path (see datastoreOf)
+    std::shared_ptr<SourceLatency> getSource(const std::string& diskPath);
+
+    // False while no SLO is set, so engines that cannot be paced may skip it
+    bool isEnabled() const;
+
+    void pace(SourceLatency& source);
+    void record(SourceLatency& source, std::chrono::microseconds latency) { source.record(latency); }
+
+    // Time this job spent paused for the SLO so far
+    std::chrono::milliseconds getThrottledTime() const;
+
+private:
+    std::shared_ptr<LatencyMonitor> monitor_;
+    std::atomic<int64_t> throttledNs_{0};
+};
+
+struct SourceLatencyStatus {
+    std::string source;
+    std::chrono::microseconds latency{0};
+    std::chrono::microseconds delay{0};
+};
+
+// Owns the per-datastore latency state. The SLO can be set globally and
+// overridden per datastore; changes apply to running jobs at once.
+class LatencyMonitor : public std::enable_shared_from_this<LatencyMonitor> {
+public:
+    void setSlo(const LatencySlo& slo);
+    LatencySlo getSlo() const;
+    bool isEnabled() const;  // Any target set, globally or per datastore
+
+    // Target for one datastore regardless of the global SLO (0 = remove the override)
+    void setSourceTarget(const std::string& source, std::chrono::milliseconds target);
+    std::map<std::string, std::chrono::milliseconds> getSourceTargets() const;
+
+    std::shared_ptr<LatencyThrottle> createThrottle();
+    std::shared_ptr<SourceLatency> getSource(const std::string& source);
+
+    std::vector<SourceLatencyStatus> getStatus() const;
+
+private:
+    LatencySlo sloFor(const std::string& source) const;  // Called with mutex_ held
+
+    LatencySlo slo_;
+    std::map<std::string, std::chrono::milliseconds> sourceTargets_;
+    std::map<std::string, std::shared_ptr<SourceLatency>> sources_;
+    mutable std::mutex mutex_;
+};
+
+// "[datastore1] vm/vm.vmdk" -> "datastore1"; local disk images map to their directory
+std::string datastoreOf(const std::string& diskPath);
@@ -11,6 +11,7 @@
 #include <atomic>
 #include <chrono>
 #include <unordered_map>
+#include <map>
 
 class TaskProgress {
 public:
@@ -70,6 +71,14 @@ public:
     std::pair<std::future<typename std::result_of<F(Args...)>::type>, TaskHandle>
     addCancellableTask(F&& f, Args&&... args);
 
+    // Add a task to a share class; classes with queued work get worker
+    // time in proportion to their weight (stride scheduling)
+    template<typename F>
+    auto addSharedTask(size_t shareClass, F&& f)
+        -> std::future<typename std::result_of<F()>::type>;
+
+    void setShareWeight(size_t shareClass, unsigned weight);
+
     // Add a task with dependencies
     template<typename F, typename... Args>
     auto addDependentTask(F&& f, Args&&... args,
@@ -93,16 +102,34 @@ private:
         TaskProgress* progress;
         TaskHandle* handle;
         std::vector<std::future<void>> dependencies;
+        size_t shareClass{0};
+    };
+
+    using TaskQueue = std::priority_queue<Task, std::vector<Task>,
+        std::function<bool(const Task&, const Task&)>>;
+
+    // Queued tasks of one share class
+    struct ShareQueue {
+        TaskQueue tasks{taskOrder};
+        unsigned weight{1};
+        double pass{0.0};  // Virtual time; advances by 1/weight for every task taken
     };
 
+    static bool taskOrder(const Task& a, const Task& b);
+
     void workerThread();
     void stop();
     void updateStats(const Task& task, bool success, bool cancelled);
     bool checkDependencies(const Task& task);
 
+    // Called with queueMutex_ held
+    void enqueue(Task task);
+    std::function<void()> dequeue();
+
     std::vector<std::thread> workers_;
-    std::priority_queue<Task, std::vector<Task>, 
-        std::function<bool(const Task&, const Task&)>> tasks_;
+    std::map<size_t, ShareQueue> queues_;
+    size_t queuedTasks_{0};
+    double globalPass_{0.0};
     std::mutex queueMutex_;
     std::condition_variable condition_;
     bool stop_;
@@ -140,7 +167,7 @@ auto ParallelTaskManager::addTask(F&& f, Args&&... args, TaskPriority priority)
             {}
         };
         
-        tasks_.push(std::move(t));
+        enqueue(std::move(t));
         stats_.totalTasks++;
         stats_.currentQueueSize++;
     }
@@ -176,7 +203,7 @@ ParallelTaskManager::addTaskWithProgress(F&& f, Args&&... args) {
             {}
         };
         
-        tasks_.push(std::move(t));
+        enqueue(std::move(t));
         stats_.totalTasks++;
         stats_.currentQueueSize++;
     }
@@ -217,7 +244,7 @@ ParallelTaskManager::addCancellableTask(F&& f, Args&&... args) {
             {}
         };
         
-        tasks_.push(std::move(t));
+        enqueue(std::move(t));
         stats_.totalTasks++;
         stats_.currentQueueSize++;
     }
@@ -226,6 +253,39 @@ ParallelTaskManager::addCancellableTask(F&& f, Args&&... args) {
     return {std::move(result), *handle};
 }
 
+template<typename F>
+auto ParallelTaskManager::addSharedTask(size_t shareClass, F&& f)
+    -> std::future<typename std::result_of<F()>::type> {
+    using return_type = typename std::result_of<F()>::type;
+
+    auto task = std::make_shared<std::packaged_task<return_type()>>(std::forward<F>(f));
+    std::future<return_type> result = task->get_future();
+
+    {
+        std::unique_lock<std::mutex> lock(queueMutex_);
+        if (stop_) {
+            throw std::runtime_error("Cannot add task to stopped task manager");
+        }
+
+        Task t{
+            [task](){ (*task)(); },
+            TaskPriority::NORMAL,
+            std::chrono::steady_clock::now(),
+            nullptr,
+            nullptr,
+            {},
+            shareClass
+        };
+
+        enqueue(std::move(t));
+        stats_.totalTasks++;
+        stats_.currentQueueSize++;
+    }
+
+    condition_.notify_one();
+    return result;
+}
+
 template<typename F, typename... Args>
 auto ParallelTaskManager::addDependentTask(F&& f, Args&&... args,
                                          const std::vector<std::future<void>>& dependencies)
@@ -253,7 +313,7 @@ auto ParallelTaskManager::addDependentTask(F&& f, Args&&... args,
             dependencies
         };
         
-        tasks_.push(std::move(t));
+        enqueue(std::move(t));
         stats_.totalTasks++;
         stats_.currentQueueSize++;
     }
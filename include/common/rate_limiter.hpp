@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Token bucket metering bytes. A rate of 0 means unlimited and costs one
+// atomic load per reservation.
+class TokenBucket {
+public:
+    explicit TokenBucket(uint64_t bytesPerSecond = 0);
+
+    // Burst defaults to a quarter second worth of tokens
+    void setRate(uint64_t bytesPerSecond, uint64_t burstBytes = 0);
+    uint64_t getRate() const { return rate_.load(std::memory_order_relaxed); }
+    bool isUnlimited() const { return getRate() == 0; }
+
+    // Take bytes from the bucket, going into debt if needed; returns how long
+    // the caller has to wait until the debt is paid off
+    std::chrono::nanoseconds reserve(uint64_t bytes);
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);  // Called with mutex_ held
+
+    std::atomic<uint64_t> rate_{0};
+    double burst_{0.0};
+    double tokens_{0.0};
+    std::chrono::steady_clock::time_point lastRefill_;
+    std::mutex mutex_;
+};
+
+class BandwidthManager;
+
+// The chain of buckets one job's copy streams draw from: its own bucket,
+// then its endpoint's and the global one. Copy engines call acquire()
+// before every read.
+class RateLimiter {
+public:
+    RateLimiter(std::shared_ptr<BandwidthManager> manager,
+                std::vector<std::shared_ptr<TokenBucket>> parents,
+                uint64_t bytesPerSecond);
+
+    // Block until bytes may be read under every bucket of the chain
+    void acquire(uint64_t bytes);
+
+    // True when no bucket of the chain currently has a limit
+    bool isUnlimited() const;
+
+    // Limit of the job's own bucket (0 = unlimited)
+    void setRate(uint64_t bytesPerSecond);
+    uint64_t getRate() const { return own_->getRate(); }
+
+    // Time spent waiting for tokens so far
+    std::chrono::milliseconds getThrottledTime() const;
+
+private:
+    std::shared_ptr<BandwidthManager> manager_;
+    std::shared_ptr<TokenBucket> own_;
+    std::vector<std::shared_ptr<TokenBucket>> chain_;  // own_ first, global last
+    std::atomic<int64_t> throttledNs_{0};
+};
+
+// Rates in bytes per second (0 = unlimited)
+struct BandwidthLimits {
+    uint64_t globalBytesPerSecond{0};
+    uint64_t perSourceBytesPerSecond{0};  // Default for each vCenter/KVM host
+};
+
+// Limits that replace the base limits during a daily time window (local
+// time). The window may wrap past midnight; the first matching profile wins.
+// Unnamed profiles are named "profile-<n>" by position.
+struct BandwidthProfile {
+    std::string name;
+    int startHour{0};
+    int startMinute{0};
+    int endHour{0};
+    int endMinute{0};
+    BandwidthLimits limits;
+};
+
+// Owns the global and per-source buckets and hands out per-job limiters.
+// Limits can be changed at any time; running jobs see the new rates on
+// their next read. Profiles are re-evaluated at most once a minute from
+// the copy path, and on every change.
+class BandwidthManager : public std::enable_shared_from_this<BandwidthManager> {
+public:
+    BandwidthManager();
+
+    // Limits outside any profile
+    void setLimits(const BandwidthLimits& limits);
+    BandwidthLimits getLimits() const;
+    // Limits in force right now (base or active profile)
+    BandwidthLimits getActiveLimits() const;
+    std::string getActiveProfile() const;  // Empty when no profile matches
+
+    // Fixed limit for one source regardless of profile (0 = remove the override)
+    void setSourceLimit(const std::string& source, uint64_t bytesPerSecond);
+    std::map<std::string, uint64_t> getSourceLimits() const;
+
+    bool setProfiles(const std::vector<BandwidthProfile>& profiles);
+    std::vector<BandwidthProfile> getProfiles() const;
+
+    // Limiter for one job reading from source (empty = the default source)
+    std::shared_ptr<RateLimiter> createLimiter(const std::string& source, uint64_t jobBytesPerSecond);
+
+    void refresh();
+    void refreshIfDue();
+
+    std::string getLastError() const;
+
+private:
+    // Called with mutex_ held
+    std::shared_ptr<TokenBucket> getSourceBucket(const std::string& source);
+    const BandwidthLimits& currentLimits() const;
+    void applyLimits();
+
+    BandwidthLimits limits_;
+    std::vector<BandwidthProfile> profiles_;
+    std::string activeProfile_;
+    std::map<std::string, uint64_t> sourceOverrides_;
+    std::shared_ptr<TokenBucket> global_;
+    std::map<std::string, std::shared_ptr<TokenBucket>> sources_;
+    std::atomic<int64_t> nextRefresh_{0};  // Steady clock nanoseconds
+    std::string lastError_;
+    mutable std::mutex mutex_;
+};
+
+// "100M", "1.5G", "512K" or plain bytes, per second; suffixes are powers of 1024
+bool parseByteRate(const std::string& text, uint64_t& bytesPerSecond);
+std::string formatByteRate(uint64_t bytesPerSecond);
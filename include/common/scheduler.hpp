@@ -4,27 +4,44 @@
 #include <functional>
 #include <mutex>
 #include <map>
+#include <array>
+#include <list>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
 #include <atomic>
 #include <ctime>
 #include <thread>
 #include <condition_variable>
 #include "common/logger.hpp"
 #include "common/thread_utils.hpp"
+#include "common/parallel_task_manager.hpp"
 
+// Timer service backed by a hierarchical timer wheel (4 levels of 64 slots).
+// Scheduling and cancelling a task is O(1); the timer thread only moves
+// expired tasks to a worker pool, callbacks never run on the timer thread.
 class Scheduler {
 public:
     using TaskCallback = std::function<void()>;
     using TimePoint = time_t;  // Using time_t instead of chrono time_point
     using Duration = int;      // Using seconds as int instead of chrono duration
 
-    Scheduler();
+    explicit Scheduler(size_t workerThreads = 2,
+                       std::chrono::milliseconds tick = std::chrono::milliseconds(1000));
     ~Scheduler();
 
     // Schedule a task to run at a specific time
-    bool scheduleTask(const std::string& taskId, 
+    bool scheduleTask(const std::string& taskId,
                      TimePoint scheduledTime,
                      TaskCallback callback);
 
+    // Schedule a task to run once after a delay (rounded up to the tick)
+    bool scheduleTaskAfter(const std::string& taskId,
+                           std::chrono::milliseconds delay,
+                           TaskCallback callback);
+
     // Schedule a task to run periodically
     bool schedulePeriodicTask(const std::string& taskId,
                             Duration interval,
@@ -39,24 +56,54 @@ public:
     // Stop the scheduler
     void stop();
 
-    // Process pending tasks - should be called periodically from main thread
+    // Process pending tasks - for callers that drive the scheduler without start()
     void processTasks();
 
+    size_t getTaskCount() const;
+
 private:
+    static constexpr int WHEEL_BITS = 6;
+    static constexpr size_t WHEEL_SIZE = size_t(1) << WHEEL_BITS;
+    static constexpr int WHEEL_LEVELS = 4;
+
+    using Slot = std::list<std::string>;
+
     struct Task {
-        TimePoint scheduledTime;
-        Duration interval;
+        uint64_t expiryTick{0};
+        uint64_t intervalTicks{0};  // 0 for one-shot tasks
+        TaskCallback callback;
+        std::shared_ptr<std::atomic<bool>> running;  // A periodic run is still executing
+        int level{0};
+        size_t slot{0};
+        Slot::iterator position;
+    };
+
+    struct DueTask {
+        std::string taskId;
         TaskCallback callback;
-        bool isPeriodic;
+        std::shared_ptr<std::atomic<bool>> running;
     };
 
-    void executeTask(const std::string& taskId, const Task& task);
-    TimePoint getNextExecutionTime(const Task& task);
+    bool addTask(const std::string& taskId, uint64_t delayTicks, uint64_t intervalTicks,
+                 TaskCallback callback);
+    void placeTask(const std::string& taskId, Task& task);
+    void unlinkTask(Task& task);
+    void cascade(int level);
+    void advanceTo(uint64_t tick, std::vector<DueTask>& due);
+    void dispatch(std::vector<DueTask>& due);
+    void executeTask(const std::string& taskId, const TaskCallback& callback);
+    uint64_t currentClockTick() const;
+    uint64_t toTicks(std::chrono::milliseconds duration) const;
     void schedulerLoop();
 
-    std::map<std::string, Task> tasks_;
-    std::mutex tasksMutex_;
+    std::array<std::array<Slot, WHEEL_SIZE>, WHEEL_LEVELS> wheel_;
+    std::unordered_map<std::string, Task> tasks_;
+    uint64_t currentTick_{0};
+    std::chrono::steady_clock::time_point epoch_;
+    std::chrono::milliseconds tick_;
+    std::unique_ptr<ParallelTaskManager> workers_;
+    mutable std::mutex tasksMutex_;
     std::condition_variable condition_;
     std::thread schedulerThread_;
     std::atomic<bool> running_;
-}; 
\ No newline at end of file
+};
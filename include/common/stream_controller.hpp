@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+struct StreamControllerConfig {
+    size_t initialStreams{2};
+    size_t minStreams{1};
+    size_t maxStreams{8};
+    // Mean read latency above this is taken as the source suffering and halves the streams
+    std::chrono::milliseconds latencyTarget{50};
+    std::chrono::milliseconds interval{2000};  // One decision per window
+    double minGain{0.05};       // Throughput gain that justifies another stream
+    int probeAfterWindows{5};   // Retry an increase after this many steady windows
+};
+
+// AIMD controller for the number of concurrent read streams of one job.
+// Copy engines report every read; once per window the controller adds a
+// stream while aggregate throughput keeps rising and latency stays under
+// target, takes the last one back when it did not pay off, and halves the
+// count when latency exceeds the target.
+class AdaptiveStreamController {
+public:
+    explicit AdaptiveStreamController(const StreamControllerConfig& config = StreamControllerConfig());
+
+    // Fixed count, for jobs that set --parallel by hand
+    static StreamControllerConfig fixed(size_t streams);
+
+    size_t getStreamCount() const { return streams_.load(std::memory_order_relaxed); }
+    size_t getMaxStreams() const;
+    bool isAdaptive() const;
+
+    // Lower the ceiling to what the storage can use; fixed counts set by hand are kept
+    void limitMaxStreams(size_t streams);
+
+    void recordRead(uint64_t bytes, std::chrono::microseconds latency);
+
+    // Figures of the last completed window
+    double getThroughput() const;  // Bytes per second
+    std::chrono::microseconds getLatency() const;
+
+private:
+    // Called with mutex_ held
+    void decide(std::chrono::steady_clock::time_point now);
+    bool adaptive() const { return config_.minStreams < config_.maxStreams; }
+
+    StreamControllerConfig config_;
+    std::atomic<size_t> streams_;
+
+    std::chrono::steady_clock::time_point windowStart_;
+    uint64_t windowBytes_{0};
+    uint64_t windowReads_{0};
+    int64_t windowLatencyUs_{0};
+
+    double lastThroughput_{0.0};
+    int64_t lastLatencyUs_{0};
+    double baselineThroughput_{0.0};  // Throughput before the last increase
+    bool increased_{false};
+    int steadyWindows_{0};
+    mutable std::mutex mutex_;
+};
@@ -72,6 +72,8 @@ public:
     bool cleanupVMAfterBackup(const std::string& vmName);
     bool getChangedDiskAreas(const std::string& vmName, const std::string& diskName, 
                             int64_t startOffset, int64_t length, nlohmann::json& response);
+    bool getChangedDiskAreas(const std::string& vmName, const std::string& diskName, const std::string& changeId,
+                            int64_t startOffset, int64_t length, nlohmann::json& response);
     bool getDiskLayout(const std::string& vmName, const std::string& diskName, nlohmann::json& response);
     bool getDiskChainInfo(const std::string& vmName, const std::string& diskName, nlohmann::json& response);
     bool consolidateDisks(const std::string& vmName, const std::string& diskName, nlohmann::json& response);
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <memory>
 #include <curl/curl.h>
 #include <nlohmann/json.hpp>
@@ -35,6 +36,9 @@ public:
     bool getVMInfo(const std::string& vmId, nlohmann::json& vmInfo);
     bool getVMDiskPaths(const std::string& vmId, std::vector<std::string>& diskPaths);
     bool getVMDiskInfo(const std::string& vmId, const std::string& diskPath, nlohmann::json& diskInfo);
+    // Capacity in bytes of each disk, keyed by its vmdk path
+    bool getVMDiskCapacities(const std::string& vmName, std::map<std::string, uint64_t>& capacities);
+    bool getVMDiskId(const std::string& vmName, const std::string& diskPath, std::string& vmId, std::string& diskId);
     bool enableCBT(const std::string& vmId);
     bool disableCBT(const std::string& vmId);
     bool isCBTEnabled(const std::string& vmId);
@@ -66,6 +70,9 @@ public:
     bool removeSnapshot(const std::string& vmId, const std::string& snapshotId);
     bool revertToSnapshot(const std::string& vmId, const std::string& snapshotId);
     bool getSnapshots(const std::string& vmId, nlohmann::json& snapshots);
+    // Change ID of a disk as captured by a snapshot, from the snapshot's disk backing
+    bool getSnapshotDiskChangeId(const std::string& vmId, const std::string& snapshot,
+                                 const std::string& diskId, std::string& changeId);
 
     // Resource Operations
     bool getVMNetworks(const std::string& vmId, std::vector<std::string>& networks);
@@ -79,6 +86,8 @@ public:
     bool cleanupVMAfterBackup(const std::string& vmId);
     bool getChangedDiskAreas(const std::string& vmId, const std::string& diskId, 
                             int64_t startOffset, int64_t length, nlohmann::json& response);
+    bool getChangedDiskAreas(const std::string& vmId, const std::string& diskId, const std::string& changeId,
+                            int64_t startOffset, int64_t length, nlohmann::json& response);
     bool getDiskLayout(const std::string& vmId, const std::string& diskId, nlohmann::json& response);
     bool getDiskChainInfo(const std::string& vmId, const std::string& diskId, nlohmann::json& response);
     bool consolidateDisks(const std::string& vmId, const std::string& diskId, nlohmann::json& response);
@@ -0,0 +1,792 @@
+#include "backup/backup_catalog.hpp"
+#include "common/logger.hpp"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char INDEX_MAGIC[8] = {'G', 'V', 'C', 'A', 'T', 'I', 'D', 'X'};
+constexpr uint32_t INDEX_VERSION = 2;
+
+constexpr uint8_t OP_ADD = 1;
+constexpr uint8_t OP_REMOVE = 2;
+
+// Log tail size (adds plus removals) at which it is folded into the index
+constexpr size_t COMPACT_THRESHOLD = 4096;
+
+// Larger log records can only be garbage
+constexpr uint32_t MAX_RECORD_SIZE = 64 * 1024;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+    uint64_t logOffset;  // Log bytes folded into this index
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t logInode;   // Of the log logOffset refers to
+    uint64_t reserved;
+};
+static_assert(sizeof(IndexHeader) == 64, "index header layout");
+
+// Sorted by (vmId, timestamp, backupId); strings live in a blob after the records
+struct IndexRecord {
+    uint64_t vmOffset;
+    uint64_t backupOffset;
+    int64_t timestamp;
+    uint64_t size;
+    uint32_t vmLength;
+    uint32_t backupLength;
+    uint32_t type;
+    uint32_t reserved;
+};
+static_assert(sizeof(IndexRecord) == 48, "index record layout");
+
+// A log record is a LogHeader, then a LogPayload followed by the vmId and
+// backupId bytes; the crc covers everything after the header
+struct LogHeader {
+    uint32_t length;
+    uint32_t crc;
+};
+
+struct LogPayload {
+    uint8_t op;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t vmLength;
+    uint32_t backupLength;
+    uint32_t reserved2;
+    int64_t timestamp;
+    uint64_t size;
+};
+static_assert(sizeof(LogPayload) == 32, "log payload layout");
+
+// metadata.json timestamps are system_clock ticks of whatever resolution wrote them
+int64_t toSeconds(int64_t timestamp) {
+    while (timestamp > 100000000000LL) {
+        timestamp /= 1000;
+    }
+    return timestamp;
+}
+
+// Appends one log record per entry; false if an entry is too large
+bool encodeRecords(uint8_t op, const std::vector<CatalogEntry>& entries, std::string& records, std::string& error) {
+    for (const auto& entry : entries) {
+        LogPayload payload{};
+        payload.op = op;
+        payload.type = static_cast<uint8_t>(entry.type);
+        payload.vmLength = static_cast<uint32_t>(entry.vmId.size());
+        payload.backupLength = static_cast<uint32_t>(entry.backupId.size());
+        payload.timestamp = entry.timestamp;
+        payload.size = entry.size;
+
+        std::string body(reinterpret_cast<const char*>(&payload), sizeof(payload));
+        body += entry.vmId;
+        body += entry.backupId;
+        if (body.size() > MAX_RECORD_SIZE) {
+            error = "Catalog entry too large: " + entry.backupId;
+            return false;
+        }
+
+        LogHeader header{static_cast<uint32_t>(body.size()), crc32(body.data(), body.size())};
+        records.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        records += body;
+    }
+    return true;
+}
+
+class FileLock {
+public:
+    FileLock(int fd, int operation) : fd_(fd) { while (flock(fd_, operation) != 0 && errno == EINTR) {} }
+    ~FileLock() { flock(fd_, LOCK_UN); }
+
+private:
+    int fd_;
+};
+
+} // namespace
+
+bool BackupCatalog::EntryOrder::operator()(const CatalogEntry& a, const CatalogEntry& b) const {
+    return std::tie(a.vmId, a.timestamp, a.backupId) < std::tie(b.vmId, b.timestamp, b.backupId);
+}
+
+BackupCatalog::BackupCatalog(const std::string& repository)
+    : repository_(repository)
+    , directory_(repository + "/.catalog")
+    , logPath_(directory_ + "/catalog.log")
+    , indexPath_(directory_ + "/catalog.idx")
+    , lockPath_(directory_ + "/catalog.lock") {
+}
+
+BackupCatalog::~BackupCatalog() {
+    close();
+}
+
+std::shared_ptr<BackupCatalog> BackupCatalog::forRepository(const std::string& repository) {
+    static std::mutex registryMutex;
+    static std::map<std::string, std::shared_ptr<BackupCatalog>> registry;
+
+    std::error_code ec;
+    if (repository.empty() || !fs::is_directory(repository, ec)) {
+        return nullptr;
+    }
+    std::string key = fs::absolute(repository, ec).lexically_normal().string();
+    while (key.size() > 1 && key.back() == '/') {
+        key.pop_back();
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto it = registry.find(key);
+    if (it != registry.end()) {
+        return it->second;
+    }
+
+    bool fresh = !fs::exists(key + "/.catalog", ec);
+    auto catalog = std::make_shared<BackupCatalog>(key);
+    if (!catalog->open()) {
+        return nullptr;
+    }
+    if (fresh) {
+        size_t imported = catalog->importDirectory();
+        if (imported > 0) {
+            Logger::info("Imported " + std::to_string(imported) + " existing backup(s) into the catalog of " + key);
+        }
+    }
+    registry[key] = catalog;
+    return catalog;
+}
+
+bool BackupCatalog::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ >= 0) {
+        return true;
+    }
+
+    std::error_code ec;
+    fs::create_directories(directory_, ec);
+    if (ec) {
+        lastError_ = "Failed to create catalog directory " + directory_ + ": " + ec.message();
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // Compaction replaces the log, so processes lock a file that stays put
+    lockFd_ = ::open(lockPath_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd_ < 0) {
+        lastError_ = "Failed to open catalog lock " + lockPath_ + ": " + std::strerror(errno);
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // Exclusive so a record torn by a crash can be cut off safely
+    FileLock fileLock(lockFd_, LOCK_EX);
+    if (!openLog() || !mapIndex() || !replayLog(true)) {
+        if (logFd_ >= 0) {
+            ::close(logFd_);
+            logFd_ = -1;
+        }
+        ::close(lockFd_);
+        lockFd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+void BackupCatalog::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ >= 0) {
+        ::close(logFd_);
+        logFd_ = -1;
+    }
+    if (lockFd_ >= 0) {
+        ::close(lockFd_);
+        lockFd_ = -1;
+    }
+    index_.close();
+    indexCount_ = 0;
+    indexInode_ = 0;
+    indexRecords_ = nullptr;
+    indexStrings_ = nullptr;
+    tail_.clear();
+    removed_.clear();
+    replayed_ = 0;
+}
+
+bool BackupCatalog::add(const CatalogEntry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        lastError_ = "Catalog is not open";
+        return false;
+    }
+
+    FileLock fileLock(lockFd_, LOCK_EX);
+    if (!refresh()) {
+        return false;
+    }
+    if (contains(entry.vmId, entry.backupId)) {
+        return true;
+    }
+    if (!append(OP_ADD, {entry})) {
+        return false;
+    }
+    if (tail_.size() + removed_.size() >= COMPACT_THRESHOLD) {
+        compactLocked();
+    }
+    return true;
+}
+
+bool BackupCatalog::remove(const std::string& vmId, const std::string& backupId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        lastError_ = "Catalog is not open";
+        return false;
+    }
+
+    FileLock fileLock(lockFd_, LOCK_EX);
+    if (!refresh()) {
+        return false;
+    }
+    if (!contains(vmId, backupId)) {
+        return true;
+    }
+    CatalogEntry entry;
+    entry.vmId = vmId;
+    entry.backupId = backupId;
+    if (!append(OP_REMOVE, {entry})) {
+        return false;
+    }
+    if (tail_.size() + removed_.size() >= COMPACT_THRESHOLD) {
+        compactLocked();
+    }
+    return true;
+}
+
+std::optional<CatalogEntry> BackupCatalog::latest(const std::string& vmId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        return std::nullopt;
+    }
+    {
+        FileLock fileLock(lockFd_, LOCK_SH);
+        refresh();
+    }
+
+    std::optional<CatalogEntry> result;
+    size_t begin = indexBound(vmId, std::numeric_limits<int64_t>::min(), false);
+    for (size_t position = indexBound(vmId, std::numeric_limits<int64_t>::max(), true); position > begin; position--) {
+        CatalogEntry entry = indexEntry(position - 1);
+        if (!isRemoved(entry)) {
+            result = std::move(entry);
+            break;
+        }
+    }
+
+    CatalogEntry key;
+    key.vmId = vmId;
+    key.timestamp = std::numeric_limits<int64_t>::min();
+    for (auto it = tail_.lower_bound(key); it != tail_.end() && it->vmId == vmId; ++it) {
+        if (!result || EntryOrder()(*result, *it)) {
+            result = *it;
+        }
+    }
+    return result;
+}
+
+std::vector<CatalogEntry> BackupCatalog::list(const std::string& vmId, int64_t from, int64_t to) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        return {};
+    }
+    {
+        FileLock fileLock(lockFd_, LOCK_SH);
+        refresh();
+    }
+
+    auto entries = collect(&vmId, from, to);
+    std::reverse(entries.begin(), entries.end());
+    return entries;
+}
+
+std::vector<CatalogEntry> BackupCatalog::listAll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        return {};
+    }
+    {
+        FileLock fileLock(lockFd_, LOCK_SH);
+        refresh();
+    }
+    return collect(nullptr, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+}
+
+bool BackupCatalog::compact() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        lastError_ = "Catalog is not open";
+        return false;
+    }
+
+    FileLock fileLock(lockFd_, LOCK_EX);
+    return refresh() && compactLocked();
+}
+
+size_t BackupCatalog::importDirectory() {
+    std::vector<CatalogEntry> found;
+    std::error_code ec;
+    for (fs::directory_iterator it(repository_, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.empty() || name[0] == '.' || !it->is_directory(ec)) {
+            continue;
+        }
+        fs::path metadataPath = it->path() / "metadata.json";
+        std::ifstream file(metadataPath);
+        if (!file.is_open()) {
+            continue;
+        }
+
+        try {
+            json metadata;
+            file >> metadata;
+
+            CatalogEntry entry;
+            entry.vmId = metadata.value("vmId", "");
+            entry.backupId = it->path().string();
+            if (entry.vmId.empty()) {
+                continue;
+            }
+            entry.timestamp = toSeconds(metadata.value("timestamp", static_cast<int64_t>(0)));
+            if (metadata.contains("type")) {
+                entry.type = static_cast<BackupType>(metadata["type"].get<int>());
+            } else if (metadata.contains("config") && metadata["config"].value("incremental", false)) {
+                entry.type = BackupType::INCREMENTAL;
+            }
+            for (fs::directory_iterator fileIt(it->path(), ec), fileEnd; !ec && fileIt != fileEnd; fileIt.increment(ec)) {
+                if (fileIt->is_regular_file(ec)) {
+                    entry.size += fileIt->file_size(ec);
+                }
+            }
+            found.push_back(std::move(entry));
+        } catch (const std::exception& e) {
+            Logger::warning("Skipping " + metadataPath.string() + " in catalog import: " + e.what());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (logFd_ < 0) {
+        return 0;
+    }
+
+    FileLock fileLock(lockFd_, LOCK_EX);
+    if (!refresh()) {
+        return 0;
+    }
+    found.erase(std::remove_if(found.begin(), found.end(),
+                               [this](const CatalogEntry& entry) { return contains(entry.vmId, entry.backupId); }),
+                found.end());
+    if (found.empty() || !append(OP_ADD, found)) {
+        return 0;
+    }
+    if (tail_.size() + removed_.size() >= COMPACT_THRESHOLD) {
+        compactLocked();
+    }
+    return found.size();
+}
+
+std::string BackupCatalog::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool BackupCatalog::openLog() {
+    int fd = ::open(logPath_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        lastError_ = "Failed to open catalog log " + logPath_ + ": " + std::strerror(errno);
+        Logger::error(lastError_);
+        return false;
+    }
+    if (logFd_ >= 0) {
+        ::close(logFd_);
+    }
+    logFd_ = fd;
+    return true;
+}
+
+bool BackupCatalog::refresh() {
+    // Another process may have compacted the catalog into a new log and index
+    struct stat st;
+    struct stat logStat;
+    if (stat(logPath_.c_str(), &st) == 0 && fstat(logFd_, &logStat) == 0 && st.st_ino != logStat.st_ino) {
+        return openLog() && mapIndex() && replayLog(false);
+    }
+    bool hasIndex = stat(indexPath_.c_str(), &st) == 0;
+    if (hasIndex ? st.st_ino != indexInode_ : indexInode_ != 0) {
+        if (!mapIndex()) {
+            return false;
+        }
+    }
+    return replayLog(false);
+}
+
+bool BackupCatalog::mapIndex() {
+    index_.close();
+    indexCount_ = 0;
+    indexInode_ = 0;
+    indexRecords_ = nullptr;
+    indexStrings_ = nullptr;
+    tail_.clear();
+    removed_.clear();
+    replayed_ = 0;
+
+    struct stat st;
+    if (stat(indexPath_.c_str(), &st) != 0) {
+        return true;
+    }
+    std::string error;
+    if (!index_.open(indexPath_, error)) {
+        lastError_ = error;
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // A damaged index, or one of a log since replaced, is ignored; the whole
+    // log is replayed instead and the next compaction writes a good one
+    const uint8_t* data = index_.data();
+    size_t size = index_.size();
+    IndexHeader header{};
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, data, sizeof(header));
+        uint64_t recordsEnd = sizeof(header) + header.count * sizeof(IndexRecord);
+        struct stat logStat;
+        valid = std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                header.version == INDEX_VERSION && header.recordSize == sizeof(IndexRecord) &&
+                header.count <= size / sizeof(IndexRecord) && recordsEnd <= header.stringsOffset &&
+                header.stringsOffset <= size && header.stringsSize <= size - header.stringsOffset &&
+                fstat(logFd_, &logStat) == 0 && header.logInode == static_cast<uint64_t>(logStat.st_ino) &&
+                header.logOffset <= static_cast<uint64_t>(logStat.st_size);
+    }
+    if (valid) {
+        const auto* records = reinterpret_cast<const IndexRecord*>(data + sizeof(header));
+        for (uint64_t i = 0; i < header.count && valid; i++) {
+            valid = records[i].vmOffset + records[i].vmLength <= header.stringsSize &&
+                    records[i].backupOffset + records[i].backupLength <= header.stringsSize;
+        }
+    }
+    if (!valid) {
+        Logger::warning("Ignoring stale or damaged catalog index " + indexPath_ + ", rebuilding it from the log");
+        index_.close();
+        return true;
+    }
+
+    indexInode_ = st.st_ino;
+    indexCount_ = header.count;
+    indexRecords_ = data + sizeof(header);
+    indexStrings_ = reinterpret_cast<const char*>(data + header.stringsOffset);
+    replayed_ = header.logOffset;
+    return true;
+}
+
+bool BackupCatalog::replayLog(bool truncateTorn) {
+    struct stat st;
+    if (fstat(logFd_, &st) != 0) {
+        lastError_ = "Failed to stat catalog log " + logPath_ + ": " + std::strerror(errno);
+        Logger::error(lastError_);
+        return false;
+    }
+    uint64_t end = static_cast<uint64_t>(st.st_size);
+    if (end <= replayed_) {
+        return true;
+    }
+
+    std::vector<uint8_t> buffer(end - replayed_);
+    size_t read = 0;
+    while (read < buffer.size()) {
+        ssize_t n = ::pread(logFd_, buffer.data() + read, buffer.size() - read, static_cast<off_t>(replayed_ + read));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            lastError_ = "Failed to read catalog log " + logPath_;
+            Logger::error(lastError_);
+            return false;
+        }
+        read += static_cast<size_t>(n);
+    }
+
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+        LogHeader header{};
+        LogPayload payload{};
+        bool valid = buffer.size() - offset >= sizeof(header);
+        if (valid) {
+            std::memcpy(&header, buffer.data() + offset, sizeof(header));
+            valid = header.length >= sizeof(payload) && header.length <= MAX_RECORD_SIZE &&
+                    header.length <= buffer.size() - offset - sizeof(header) &&
+                    crc32(buffer.data() + offset + sizeof(header), header.length) == header.crc;
+        }
+        if (valid) {
+            std::memcpy(&payload, buffer.data() + offset + sizeof(header), sizeof(payload));
+            valid = sizeof(payload) + static_cast<uint64_t>(payload.vmLength) + payload.backupLength == header.length;
+        }
+        if (!valid) {
+            // Only the last record can be torn, by a crash mid-append; a
+            // reader without the exclusive lock leaves it for the writer
+            if (truncateTorn) {
+                Logger::warning("Discarding torn record at offset " + std::to_string(replayed_ + offset) +
+                                " of catalog log " + logPath_);
+                if (::ftruncate(logFd_, static_cast<off_t>(replayed_ + offset)) != 0) {
+                    lastError_ = "Failed to truncate catalog log " + logPath_ + ": " + std::strerror(errno);
+                    Logger::error(lastError_);
+                    return false;
+                }
+            }
+            break;
+        }
+
+        const char* strings = reinterpret_cast<const char*>(buffer.data() + offset + sizeof(header) + sizeof(payload));
+        CatalogEntry entry;
+        entry.vmId.assign(strings, payload.vmLength);
+        entry.backupId.assign(strings + payload.vmLength, payload.backupLength);
+        entry.timestamp = payload.timestamp;
+        entry.type = static_cast<BackupType>(payload.type);
+        entry.size = payload.size;
+        apply(payload.op, entry);
+
+        offset += sizeof(header) + header.length;
+    }
+    replayed_ += offset;
+    return true;
+}
+
+bool BackupCatalog::append(uint8_t op, const std::vector<CatalogEntry>& entries) {
+    std::string records;
+    if (!encodeRecords(op, entries, records, lastError_)) {
+        Logger::error(lastError_);
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < records.size()) {
+        ssize_t n = ::write(logFd_, records.data() + written, records.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            lastError_ = "Failed to append to catalog log " + logPath_ + ": " + std::strerror(errno);
+            Logger::error(lastError_);
+            // Cut off the partial record so later appends stay readable
+            struct stat st;
+            if (written > 0 && fstat(logFd_, &st) == 0) {
+                if (::ftruncate(logFd_, st.st_size - static_cast<off_t>(written)) != 0) {
+                    Logger::warning("Failed to discard partial catalog record in " + logPath_);
+                }
+            }
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (::fdatasync(logFd_) != 0) {
+        lastError_ = "Failed to sync catalog log " + logPath_ + ": " + std::strerror(errno);
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // The exclusive lock is held and the log was replayed up to its end before
+    for (const auto& entry : entries) {
+        apply(op, entry);
+    }
+    replayed_ += records.size();
+    return true;
+}
+
+void BackupCatalog::apply(uint8_t op, const CatalogEntry& entry) {
+    if (op == OP_ADD) {
+        removed_.erase({entry.vmId, entry.backupId});
+        tail_.insert(entry);
+        return;
+    }
+    if (op != OP_REMOVE) {
+        return;
+    }
+
+    CatalogEntry key;
+    key.vmId = entry.vmId;
+    key.timestamp = std::numeric_limits<int64_t>::min();
+    for (auto it = tail_.lower_bound(key); it != tail_.end() && it->vmId == entry.vmId; ++it) {
+        if (it->backupId == entry.backupId) {
+            tail_.erase(it);
+            return;
+        }
+    }
+    removed_.insert({entry.vmId, entry.backupId});
+}
+
+bool BackupCatalog::contains(const std::string& vmId, const std::string& backupId) const {
+    CatalogEntry key;
+    key.vmId = vmId;
+    key.timestamp = std::numeric_limits<int64_t>::min();
+    for (auto it = tail_.lower_bound(key); it != tail_.end() && it->vmId == vmId; ++it) {
+        if (it->backupId == backupId) {
+            return true;
+        }
+    }
+    if (removed_.count({vmId, backupId})) {
+        return false;
+    }
+
+    size_t end = indexBound(vmId, std::numeric_limits<int64_t>::max(), true);
+    for (size_t position = indexBound(vmId, std::numeric_limits<int64_t>::min(), false); position < end; position++) {
+        const auto* record = reinterpret_cast<const IndexRecord*>(indexRecords_) + position;
+        if (backupId.compare(0, std::string::npos, indexStrings_ + record->backupOffset, record->backupLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<CatalogEntry> BackupCatalog::collect(const std::string* vmId, int64_t from, int64_t to) const {
+    std::vector<CatalogEntry> indexed;
+    size_t begin = vmId ? indexBound(*vmId, from, false) : 0;
+    size_t end = vmId ? indexBound(*vmId, to, true) : indexCount_;
+    for (size_t position = begin; position < end; position++) {
+        CatalogEntry entry = indexEntry(position);
+        if (!isRemoved(entry)) {
+            indexed.push_back(std::move(entry));
+        }
+    }
+
+    auto tailBegin = tail_.begin();
+    auto tailEnd = tail_.end();
+    if (vmId) {
+        CatalogEntry key;
+        key.vmId = *vmId;
+        key.timestamp = from;
+        tailBegin = tail_.lower_bound(key);
+        tailEnd = tailBegin;
+        while (tailEnd != tail_.end() && tailEnd->vmId == *vmId && tailEnd->timestamp <= to) {
+            ++tailEnd;
+        }
+    }
+
+    std::vector<CatalogEntry> entries;
+    entries.reserve(indexed.size() + static_cast<size_t>(std::distance(tailBegin, tailEnd)));
+    std::merge(indexed.begin(), indexed.end(), tailBegin, tailEnd, std::back_inserter(entries), EntryOrder());
+    return entries;
+}
+
+bool BackupCatalog::compactLocked() {
+    auto entries = collect(nullptr, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+
+    // The log is replaced by one add per live entry, so it stays as large as
+    // the catalog rather than its history and can still rebuild the index.
+    // A crash before the new index is in place leaves an index naming the
+    // old log's inode, which is then ignored.
+    std::string log;
+    std::string error;
+    if (!encodeRecords(OP_ADD, entries, log, error) || !writeFileAtomic(logPath_, log, error)) {
+        lastError_ = "Failed to rewrite catalog log " + logPath_ + ": " + error;
+        Logger::error(lastError_);
+        return false;
+    }
+    struct stat logStat;
+    if (!openLog() || fstat(logFd_, &logStat) != 0) {
+        lastError_ = "Failed to reopen catalog log " + logPath_;
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // Entries are sorted by VM, so each VM name is stored once
+    std::string strings;
+    std::vector<IndexRecord> records;
+    records.reserve(entries.size());
+    uint64_t vmOffset = 0;
+    const std::string* previousVm = nullptr;
+    for (const auto& entry : entries) {
+        if (!previousVm || *previousVm != entry.vmId) {
+            vmOffset = strings.size();
+            strings += entry.vmId;
+            previousVm = &entry.vmId;
+        }
+        IndexRecord record{};
+        record.vmOffset = vmOffset;
+        record.vmLength = static_cast<uint32_t>(entry.vmId.size());
+        record.backupOffset = strings.size();
+        record.backupLength = static_cast<uint32_t>(entry.backupId.size());
+        record.timestamp = entry.timestamp;
+        record.size = entry.size;
+        record.type = static_cast<uint32_t>(entry.type);
+        strings += entry.backupId;
+        records.push_back(record);
+    }
+
+    IndexHeader header{};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.recordSize = sizeof(IndexRecord);
+    header.count = records.size();
+    header.logOffset = log.size();
+    header.logInode = static_cast<uint64_t>(logStat.st_ino);
+    header.stringsOffset = sizeof(header) + records.size() * sizeof(IndexRecord);
+    header.stringsSize = strings.size();
+
+    std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(IndexRecord));
+    data += strings;
+
+    if (!writeFileAtomic(indexPath_, data, error)) {
+        lastError_ = "Failed to write catalog index " + indexPath_ + ": " + error;
+        Logger::error(lastError_);
+        // The old index is now stale; the new log alone has every entry
+        mapIndex();
+        replayLog(false);
+        return false;
+    }
+    Logger::debug("Compacted catalog of " + repository_ + " to " + std::to_string(records.size()) + " entries");
+    return mapIndex() && replayLog(false);
+}
+
+size_t BackupCatalog::indexBound(const std::string& vmId, int64_t timestamp, bool after) const {
+    size_t low = 0;
+    size_t high = indexCount_;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const auto* record = reinterpret_cast<const IndexRecord*>(indexRecords_) + middle;
+        int order = vmId.compare(0, std::string::npos, indexStrings_ + record->vmOffset, record->vmLength);
+        bool keyFirst = order < 0 || (order == 0 && (after ? timestamp < record->timestamp : timestamp <= record->timestamp));
+        if (keyFirst) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+CatalogEntry BackupCatalog::indexEntry(size_t position) const {
+    const auto* record = reinterpret_cast<const IndexRecord*>(indexRecords_) + position;
+    CatalogEntry entry;
+    entry.vmId.assign(indexStrings_ + record->vmOffset, record->vmLength);
+    entry.backupId.assign(indexStrings_ + record->backupOffset, record->backupLength);
+    entry.timestamp = record->timestamp;
+    entry.type = static_cast<BackupType>(record->type);
+    entry.size = record->size;
+    return entry;
+}
+
+bool BackupCatalog::isRemoved(const CatalogEntry& entry) const {
+    return !removed_.empty() && removed_.count({entry.vmId, entry.backupId}) > 0;
+}
@@ -0,0 +1,223 @@
+#include "backup/backup_history.hpp"
+#include "common/file_utils.hpp"
+#include "common/logger.hpp"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
+
+using json = nlohmann::json;
+
+namespace {
+
+// Weight of the newest run in the moving averages
+constexpr double HISTORY_WEIGHT = 0.3;
+
+// Updates appended before the file is rewritten, at least
+constexpr size_t MIN_JOURNAL_LINES = 64;
+
+json toJson(const BackupHistoryRecord& record) {
+    return {
+        {"vmId", record.vmId},
+        {"samples", record.samples},
+        {"durationSeconds", record.durationSeconds},
+        {"durationDeviation", record.durationDeviation},
+        {"bytes", record.bytes},
+        {"throughput", record.throughput},
+        {"lastRun", record.lastRun}
+    };
+}
+
+BackupHistoryRecord fromJson(const json& entry) {
+    BackupHistoryRecord record;
+    record.vmId = entry["vmId"].get<std::string>();
+    record.samples = entry.value("samples", 0u);
+    record.durationSeconds = entry.value("durationSeconds", 0.0);
+    record.durationDeviation = entry.value("durationDeviation", 0.0);
+    record.bytes = entry.value("bytes", 0.0);
+    record.throughput = entry.value("throughput", 0.0);
+    record.lastRun = entry.value("lastRun", static_cast<int64_t>(0));
+    return record;
+}
+
+} // namespace
+
+BackupHistory::BackupHistory(const std::string& path)
+    : path_(path) {
+}
+
+bool BackupHistory::load() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.clear();
+    journalLines_ = 0;
+
+    if (path_.empty() || !std::filesystem::exists(path_)) {
+        return true;
+    }
+
+    try {
+        std::ifstream file(path_);
+        if (!file.is_open()) {
+            lastError_ = "Failed to open backup history: " + path_;
+            return false;
+        }
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        // A single document is a snapshot, possibly pretty-printed by an older version
+        json snapshot = json::parse(content, nullptr, false);
+        if (!snapshot.is_discarded()) {
+            for (const auto& entry : snapshot["vms"]) {
+                auto record = fromJson(entry);
+                records_[record.vmId] = record;
+            }
+            return true;
+        }
+
+        std::istringstream lines(content);
+        std::string line;
+        size_t number = 0;
+        bool unreadable = false;
+        while (std::getline(lines, line)) {
+            number++;
+            if (line.empty()) {
+                continue;
+            }
+            json entry = json::parse(line, nullptr, false);
+            if (entry.is_discarded()) {
+                // Most likely the last update, cut short by a crash
+                Logger::warning("Ignoring unreadable line " + std::to_string(number) + " of backup history " + path_);
+                unreadable = true;
+                continue;
+            }
+            if (entry.contains("vms")) {
+                records_.clear();
+                for (const auto& vm : entry["vms"]) {
+                    auto record = fromJson(vm);
+                    records_[record.vmId] = record;
+                }
+                journalLines_ = 0;
+                continue;
+            }
+            if (entry.value("removed", false)) {
+                records_.erase(entry["vmId"].get<std::string>());
+            } else {
+                auto record = fromJson(entry);
+                records_[record.vmId] = record;
+            }
+            journalLines_++;
+        }
+        // Rewritten, so the next update does not land behind the broken line
+        return !unreadable || persist();
+    } catch (const std::exception& e) {
+        lastError_ = std::string("Failed to load backup history: ") + e.what();
+        Logger::error(lastError_);
+        return false;
+    }
+}
+
+bool BackupHistory::record(const std::string& vmId, std::chrono::milliseconds duration, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& record = records_[vmId];
+    record.vmId = vmId;
+
+    double seconds = duration.count() / 1000.0;
+    double throughput = seconds > 0.0 ? static_cast<double>(bytes) / seconds : 0.0;
+    if (record.samples == 0) {
+        record.durationSeconds = seconds;
+        record.durationDeviation = 0.0;
+        record.bytes = static_cast<double>(bytes);
+        record.throughput = throughput;
+    } else {
+        double deviation = std::fabs(seconds - record.durationSeconds);
+        record.durationDeviation += HISTORY_WEIGHT * (deviation - record.durationDeviation);
+        record.durationSeconds += HISTORY_WEIGHT * (seconds - record.durationSeconds);
+        record.bytes += HISTORY_WEIGHT * (static_cast<double>(bytes) - record.bytes);
+        // Runs that wrote nothing say nothing about speed
+        if (throughput > 0.0) {
+            record.throughput = record.throughput > 0.0
+                ? record.throughput + HISTORY_WEIGHT * (throughput - record.throughput)
+                : throughput;
+        }
+    }
+    record.samples++;
+    record.lastRun = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    return path_.empty() || append(toJson(record).dump());
+}
+
+std::optional<BackupHistoryRecord> BackupHistory::get(const std::string& vmId) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = records_.find(vmId);
+    if (it == records_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+bool BackupHistory::remove(const std::string& vmId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (records_.erase(vmId) == 0) {
+        return true;
+    }
+    return path_.empty() || append(json{{"vmId", vmId}, {"removed", true}}.dump());
+}
+
+std::chrono::seconds BackupHistory::predictDuration(const std::string& vmId, std::chrono::seconds fallback) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = records_.find(vmId);
+    if (it == records_.end() || it->second.samples == 0) {
+        return fallback;
+    }
+    const auto& record = it->second;
+    // Size and speed drift apart (a VM changing more, a busier datastore), so
+    // the bytes expected are timed at the speed observed
+    double expected = record.durationSeconds;
+    if (record.bytes > 0.0 && record.throughput > 0.0) {
+        expected = record.bytes / record.throughput;
+    }
+    return std::chrono::seconds(static_cast<int64_t>(std::ceil(expected + 2.0 * record.durationDeviation)));
+}
+
+std::string BackupHistory::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool BackupHistory::append(const std::string& line) {
+    if (journalLines_ >= std::max(MIN_JOURNAL_LINES, records_.size()) || !std::filesystem::exists(path_)) {
+        return persist();
+    }
+
+    std::ofstream file(path_, std::ios::app);
+    file << line << '\n';
+    file.flush();
+    if (!file) {
+        lastError_ = "Failed to append to backup history: " + path_;
+        Logger::error(lastError_);
+        return false;
+    }
+    journalLines_++;
+    return true;
+}
+
+bool BackupHistory::persist() {
+    json j;
+    j["version"] = 2;
+    j["vms"] = json::array();
+    for (const auto& pair : records_) {
+        j["vms"].push_back(toJson(pair.second));
+    }
+
+    std::string error;
+    if (!writeFileAtomic(path_, j.dump() + "\n", error)) {
+        lastError_ = "Failed to persist backup history: " + error;
+        Logger::error(lastError_);
+        return false;
+    }
+    journalLines_ = 0;
+    return true;
+}
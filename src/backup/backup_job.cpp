@@ -1,25 +1,72 @@
 #include "backup/backup_job.hpp"
 #include "backup/backup_provider.hpp"
+#include "backup/backup_catalog.hpp"
+#include "backup/backup_manifest.hpp"
+#include "backup/backup_reaper.hpp"
+#include "backup/chunk_repository.hpp"
+#include "backup/retention_policy.hpp"
+#include "backup/tee_writer.hpp"
 #include "common/parallel_task_manager.hpp"
 #include "common/logger.hpp"
+#include "common/rate_limiter.hpp"
+#include "common/latency_monitor.hpp"
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <chrono>
 #include <thread>
+#include <map>
+#include <algorithm>
 #include <nlohmann/json.hpp>
 
 using namespace std::filesystem;
 using json = nlohmann::json;
 
+namespace {
+
+// Backup directory as the catalog of its repository (the parent directory) records it
+path catalogPath(const std::string& backupPath) {
+    path normalized = absolute(path(backupPath)).lexically_normal();
+    if (normalized.filename().empty()) {
+        normalized = normalized.parent_path();
+    }
+    return normalized;
+}
+
+} // namespace
+
 BackupJob::BackupJob(BackupProvider* provider,
                     std::shared_ptr<ParallelTaskManager> taskManager,
-                    const BackupConfig& config)
+                    const BackupConfig& config,
+                    const BackupContext& context)
     : provider_(provider)
     , taskManager_(taskManager)
-    , config_(config) {
+    , config_(config)
+    , context_(context) {
     // Generate a unique job ID using our own implementation
     setId(generateId());
+    jobClass_ = JobClass::BACKUP;
+    // Only chunk packs move between tiers, so a tiered repository always
+    // takes its backups into the chunk store
+    context_.chunkStore = config_.chunkStore;
+    if (!context_.chunkStore) {
+        auto chunks = ChunkRepository::forRepository(catalogPath(config_.backupPath).parent_path().string());
+        context_.chunkStore = chunks && chunks->hasCapacityTier();
+    }
+    // Chunk-stored disks are found through the chunk ids in the manifest
+    context_.manifest = std::make_shared<ManifestWriter>(config_.compressionLevel, context_.chunkStore);
+    if (!config_.copyRepositories.empty()) {
+        // Each copy is a backup directory of the same name in its own repository
+        std::vector<std::string> copyPaths;
+        for (const auto& repository : config_.copyRepositories) {
+            copyPaths.push_back((path(repository) / catalogPath(config_.backupPath).filename()).string());
+        }
+        TeeConfig tee;
+        tee.policy = config_.copyPolicy == "degrade" ? TeePolicy::DEGRADE : TeePolicy::FAIL;
+        tee.stallTimeout = std::chrono::seconds(std::max(1, config_.copyStallSeconds));
+        tee.queueBytes = config_.copyQueueBytes;
+        context_.copies = std::make_shared<BackupCopies>(copyPaths, tee);
+    }
     setStatus("pending");
 }
 
@@ -60,7 +107,7 @@ bool BackupJob::start() {
     updateProgress(0);
 
     // Start backup in a separate thread
-    std::thread([this]() {
+    startWorker([this]() {
         try {
             Logger::info("Starting backup execution thread");
             executeBackup();
@@ -70,7 +117,7 @@ bool BackupJob::start() {
             setError(std::string("Backup failed: ") + e.what());
             setState(State::FAILED);
         }
-    }).detach();
+    });
 
     return true;
 }
@@ -88,7 +135,7 @@ bool BackupJob::pause() {
 
 bool BackupJob::resume() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning() || !isPaused()) {
+    if (!isPaused()) {
         setError("Cannot resume job in current state");
         return false;
     }
@@ -99,7 +146,7 @@ bool BackupJob::resume() {
 
 bool BackupJob::cancel() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning()) {
+    if (!isRunning() && !isPaused()) {
         setError("Cannot cancel job in current state");
         return false;
     }
@@ -201,23 +248,21 @@ bool BackupJob::cleanupOldBackups() {
     }
 
     try {
-        // Get list of backup directories
-        std::vector<std::string> backupDirs;
-        if (!provider_->listBackups(backupDirs)) {
-            setError("Failed to list backups: " + provider_->getLastError());
+        path repository = catalogPath(config_.backupPath).parent_path();
+        auto catalog = BackupCatalog::forRepository(repository.string());
+        if (!catalog) {
+            setError("No backup catalog for " + repository.string());
             return false;
         }
 
-        // Sort backups by date
-        std::sort(backupDirs.begin(), backupDirs.end());
-
-        // Keep only the most recent N backups
-        if (backupDirs.size() > config_.maxBackups) {
-            for (size_t i = 0; i < backupDirs.size() - config_.maxBackups; ++i) {
-                if (!provider_->deleteBackup(backupDirs[i])) {
-                    setError("Failed to delete old backup: " + provider_->getLastError());
-                    return false;
-                }
+        // Expired backups only move to the trash; the reaper deletes them in the background
+        auto reaper = BackupReaper::getDefault();
+        auto expired = selectExpired(RetentionPolicy::fromConfig(config_), catalog->list(config_.vmId),
+                                     std::chrono::system_clock::now());
+        for (const auto& backup : expired) {
+            if (!reaper->retire(*catalog, backup)) {
+                setError("Failed to retire old backup: " + reaper->getLastError());
+                return false;
             }
         }
 
@@ -229,68 +274,106 @@ bool BackupJob::cleanupOldBackups() {
 }
 
 void BackupJob::executeBackup() {
+    // Outside the try, so a throw after the snapshot was taken still drops it
+    std::string snapshotId;
+    std::chrono::steady_clock::time_point snapshotCreated;
+    bool snapshotOpen = false;
     try {
         Logger::info("Starting backup execution for VM: " + config_.vmId);
         
-        // Create snapshot before backup
-        std::string snapshotId;
-        Logger::info("Creating snapshot for VM: " + config_.vmId);
-        if (!provider_->createSnapshot(config_.vmId, snapshotId)) {
-            Logger::error("Failed to create snapshot: " + provider_->getLastError());
-            setError("Failed to create snapshot: " + provider_->getLastError());
-            setState(State::FAILED);
-            return;
-        }
-        Logger::info("Snapshot created successfully with ID: " + snapshotId);
-
-        // Get VM disk paths
+        // Disks are listed and ordered before the snapshot, so none of it
+        // adds to the time the snapshot stays open
         std::vector<std::string> diskPaths;
         Logger::info("Getting disk paths for VM: " + config_.vmId);
         if (!provider_->getVMDiskPaths(config_.vmId, diskPaths)) {
             Logger::error("Failed to get VM disk paths: " + provider_->getLastError());
-            provider_->removeSnapshot(config_.vmId, snapshotId); // Cleanup snapshot
             setError("Failed to get VM disk paths: " + provider_->getLastError());
             setState(State::FAILED);
             return;
         }
         Logger::info("Found " + std::to_string(diskPaths.size()) + " disk(s) to backup");
 
+        // Largest disks first, so the long tail does not keep the snapshot open
+        orderDisksForBackup(diskPaths);
+
+        // Create snapshot before backup
+        Logger::info("Creating snapshot for VM: " + config_.vmId);
+        auto createStart = std::chrono::steady_clock::now();
+        if (!provider_->createSnapshot(config_.vmId, snapshotId)) {
+            Logger::error("Failed to create snapshot: " + provider_->getLastError());
+            setError("Failed to create snapshot: " + provider_->getLastError());
+            setState(State::FAILED);
+            return;
+        }
+        snapshotCreated = std::chrono::steady_clock::now();
+        snapshotOpen = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            snapshotTimings_ = SnapshotTimings();
+            snapshotTimings_.createTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                snapshotCreated - createStart);
+        }
+        Logger::info("Snapshot created successfully with ID: " + snapshotId);
+        context_.snapshotId = snapshotId;
+
         // Backup each disk
         int totalDisks = diskPaths.size();
         int backedUpDisks = 0;
+        uint64_t manifestBytes = context_.manifest ? context_.manifest->getBytes() : 0;
 
         for (const auto& diskPath : diskPaths) {
+            // Hold at the disk boundary while paused; the disk is backed up on resume
+            if (isPaused()) {
+                Logger::info("Backup paused, waiting...");
+                while (isPaused()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+            }
+
             if (isCancelled()) {
                 Logger::info("Backup cancelled, cleaning up snapshot");
-                provider_->removeSnapshot(config_.vmId, snapshotId); // Cleanup snapshot
+                snapshotOpen = false;
+                releaseSnapshot(snapshotId, snapshotCreated); // Cleanup snapshot
+                provider_->finishBackup(config_.vmId, config_, context_, false);
                 setError("Backup cancelled");
                 setState(State::CANCELLED);
                 return;
             }
 
-            if (isPaused()) {
-                Logger::info("Backup paused, waiting...");
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-                continue;
-            }
-
             Logger::info("Starting backup of disk: " + diskPath);
-            if (!provider_->backupDisk(config_.vmId, diskPath, config_)) {
+            // Disk copies share the endpoint pool with other jobs, weighted by job class
+            bool backedUp = taskManager_->addSharedTask(static_cast<size_t>(getJobClass()), [&]() {
+                return provider_->backupDisk(config_.vmId, diskPath, config_, context_);
+            }).get();
+            if (!backedUp) {
                 Logger::error("Failed to backup disk " + diskPath + ": " + provider_->getLastError());
-                provider_->removeSnapshot(config_.vmId, snapshotId); // Cleanup snapshot
                 setError("Failed to backup disk " + diskPath + ": " + provider_->getLastError());
+                snapshotOpen = false;
+                releaseSnapshot(snapshotId, snapshotCreated); // Cleanup snapshot
+                provider_->finishBackup(config_.vmId, config_, context_, false);
                 setState(State::FAILED);
                 return;
             }
             Logger::info("Successfully backed up disk: " + diskPath);
 
+            // Report what the disk copy stored for throughput subscribers; a
+            // chunk-stored disk has no backup file, but both record their
+            // extents in the manifest
+            if (context_.manifest) {
+                uint64_t stored = context_.manifest->getBytes();
+                addBytesTransferred(stored - manifestBytes);
+                manifestBytes = stored;
+            }
+
             backedUpDisks++;
             updateProgress((backedUpDisks * 100) / totalDisks);
         }
 
-        // Remove snapshot after successful backup
+        // The last disk read is done: drop the snapshot before any metadata
+        // or verification work so it does not age any further
         Logger::info("Removing snapshot after successful backup");
-        if (!provider_->removeSnapshot(config_.vmId, snapshotId)) {
+        snapshotOpen = false;
+        if (!releaseSnapshot(snapshotId, snapshotCreated)) {
             Logger::warning("Failed to remove snapshot: " + provider_->getLastError());
             setError("Warning: Failed to remove snapshot: " + provider_->getLastError());
             // Continue anyway as the backup was successful
@@ -298,17 +381,102 @@ void BackupJob::executeBackup() {
             Logger::info("Snapshot removed successfully");
         }
 
+        // The next backup may only build on this one once its manifest is written
+        bool metadataWritten = writeBackupMetadata(config_.backupPath);
+        if (!metadataWritten) {
+            Logger::warning("Failed to write backup metadata for VM: " + config_.vmId);
+        }
+        if (!provider_->finishBackup(config_.vmId, config_, context_, metadataWritten)) {
+            Logger::error("Failed to finish backup of VM " + config_.vmId + ": " + provider_->getLastError());
+            setError("Failed to finish backup: " + provider_->getLastError());
+            setState(State::FAILED);
+            return;
+        }
+        if (!recordInCatalog(config_.backupPath)) {
+            Logger::warning("Failed to add backup of VM " + config_.vmId + " to the catalog");
+        }
+        if (context_.copies) {
+            finishCopies();
+        }
+
         setState(State::COMPLETED);
         setStatus("Backup completed successfully");
         updateProgress(100);
         Logger::info("Backup completed successfully for VM: " + config_.vmId);
     } catch (const std::exception& e) {
         Logger::error("Backup execution failed: " + std::string(e.what()));
+        if (snapshotOpen) {
+            Logger::info("Cleaning up snapshot of failed backup");
+            releaseSnapshot(snapshotId, snapshotCreated);
+        }
+        provider_->finishBackup(config_.vmId, config_, context_, false);
         setError(std::string("Backup failed: ") + e.what());
         setState(State::FAILED);
     }
 }
 
+void BackupJob::orderDisksForBackup(std::vector<std::string>& diskPaths) {
+    if (diskPaths.size() < 2) {
+        return;
+    }
+
+    std::map<std::string, uint64_t> capacities;
+    if (!provider_->getDiskCapacities(config_.vmId, capacities)) {
+        Logger::warning("Failed to get disk sizes, keeping original disk order: " + provider_->getLastError());
+        return;
+    }
+
+    std::stable_sort(diskPaths.begin(), diskPaths.end(),
+        [&capacities](const std::string& a, const std::string& b) {
+            return capacities[a] > capacities[b];
+        });
+
+    for (const auto& diskPath : diskPaths) {
+        Logger::debug("Disk " + diskPath + " size: " + std::to_string(capacities[diskPath]));
+    }
+}
+
+bool BackupJob::releaseSnapshot(const std::string& snapshotId,
+                                std::chrono::steady_clock::time_point createdAt) {
+    auto removeStart = std::chrono::steady_clock::now();
+    bool removed = provider_->removeSnapshot(config_.vmId, snapshotId);
+    auto removeEnd = std::chrono::steady_clock::now();
+
+    SnapshotTimings timings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshotTimings_.removeTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+            removeEnd - removeStart);
+        snapshotTimings_.openDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            removeEnd - createdAt);
+        timings = snapshotTimings_;
+    }
+
+    Logger::info("Snapshot stats for VM " + config_.vmId +
+                 ": create=" + std::to_string(timings.createTime.count()) + "ms" +
+                 ", open=" + std::to_string(timings.openDuration.count()) + "ms" +
+                 ", remove=" + std::to_string(timings.removeTime.count()) + "ms" +
+                 (removed ? "" : " (removal failed)"));
+    return removed;
+}
+
+SnapshotTimings BackupJob::getSnapshotTimings() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshotTimings_;
+}
+
+ThrottleTimes BackupJob::getThrottleTimes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThrottleTimes times;
+    if (context_.rateLimiter) {
+        times.bandwidth = context_.rateLimiter->getThrottledTime();
+    }
+    if (context_.latencyThrottle) {
+        times.latency = context_.latencyThrottle->getThrottledTime();
+    }
+    return times;
+}
+
 void BackupJob::handleBackupProgress(int progress) {
     updateProgress(progress);
 }
@@ -335,20 +503,62 @@ bool BackupJob::validateBackupConfig() const {
 bool BackupJob::createBackupDirectory() const {
     try {
         create_directories(config_.backupPath);
-        return true;
     } catch (const std::exception& e) {
         return false;
     }
+    if (!context_.copies) {
+        return true;
+    }
+
+    for (const auto& copyPath : context_.copies->getActive()) {
+        std::error_code error;
+        create_directories(copyPath, error);
+        if (!error) {
+            continue;
+        }
+        std::string reason = "Failed to create backup directory " + copyPath + ": " + error.message();
+        if (context_.copies->getConfig().policy != TeePolicy::DEGRADE) {
+            Logger::error(reason);
+            return false;
+        }
+        Logger::warning(reason + ", dropping the copy");
+        context_.copies->drop(copyPath, reason);
+    }
+    return true;
 }
 
-bool BackupJob::writeBackupMetadata() const {
+void BackupJob::finishCopies() {
+    for (const auto& copyPath : context_.copies->getActive()) {
+        if (!writeBackupMetadata(copyPath)) {
+            Logger::warning("Failed to write backup metadata of the copy in " + copyPath);
+        }
+        if (!recordInCatalog(copyPath)) {
+            Logger::warning("Failed to add the copy in " + copyPath + " to the catalog");
+        }
+    }
+
+    // A dropped copy misses disks, so nothing of it is kept
+    auto dropped = context_.copies->getDropped();
+    for (const auto& copy : dropped) {
+        std::error_code error;
+        remove_all(copy.first, error);
+        Logger::warning("Copy of VM " + config_.vmId + " in " + copy.first + " was dropped: " + copy.second);
+    }
+    if (!dropped.empty()) {
+        setError("Warning: " + std::to_string(dropped.size()) + " of " +
+                 std::to_string(config_.copyRepositories.size()) + " backup copies dropped");
+    }
+}
+
+bool BackupJob::writeBackupMetadata(const std::string& backupPath) const {
     try {
-        std::string metadataFile = config_.backupPath + "/metadata.json";
+        std::string metadataFile = backupPath + "/metadata.json";
         json metadata;
         metadata["vmId"] = config_.vmId;
+        metadata["type"] = context_.manifest && context_.manifest->isIncremental() ? "incremental" : "full";
         metadata["timestamp"] = std::chrono::system_clock::now().time_since_epoch().count();
         metadata["config"] = {
-            {"backupPath", config_.backupPath},
+            {"backupPath", backupPath},
             {"enableCBT", config_.enableCBT},
             {"incremental", config_.incremental},
             {"retentionDays", config_.retentionDays},
@@ -356,6 +566,41 @@ bool BackupJob::writeBackupMetadata() const {
             {"compressionLevel", config_.compressionLevel},
             {"maxConcurrentDisks", config_.maxConcurrentDisks}
         };
+        auto timings = getSnapshotTimings();
+        metadata["snapshot"] = {
+            {"createTimeMs", timings.createTime.count()},
+            {"openDurationMs", timings.openDuration.count()},
+            {"removeTimeMs", timings.removeTime.count()}
+        };
+        auto throttled = getThrottleTimes();
+        metadata["throttle"] = {
+            {"bandwidthMs", throttled.bandwidth.count()},
+            {"latencyMs", throttled.latency.count()}
+        };
+
+        // Extent maps go to the binary manifest; the JSON only summarizes them
+        if (context_.manifest) {
+            std::string error;
+            if (!context_.manifest->write(backupPath + "/manifest.bin", error)) {
+                Logger::error("Failed to write backup manifest: " + error);
+                return false;
+            }
+            metadata["manifest"] = {
+                {"file", "manifest.bin"},
+                {"disks", context_.manifest->getDiskCount()},
+                {"extents", context_.manifest->getExtentCount()},
+                {"bytes", context_.manifest->getBytes()}
+            };
+        }
+
+        // Every copy lists all of them, the primary first
+        if (context_.copies) {
+            json copies = json::array({catalogPath(config_.backupPath).string()});
+            for (const auto& copyPath : context_.copies->getActive()) {
+                copies.push_back(catalogPath(copyPath).string());
+            }
+            metadata["copies"] = copies;
+        }
 
         std::ofstream file(metadataFile);
         if (!file.is_open()) {
@@ -370,6 +615,24 @@ bool BackupJob::writeBackupMetadata() const {
     }
 }
 
+bool BackupJob::recordInCatalog(const std::string& backupDirectory) {
+    path backupPath = catalogPath(backupDirectory);
+    auto catalog = BackupCatalog::forRepository(backupPath.parent_path().string());
+    if (!catalog) {
+        return false;
+    }
+
+    CatalogEntry entry;
+    entry.vmId = config_.vmId;
+    entry.backupId = backupPath.string();
+    entry.timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    // What the provider ran, which is a full backup whenever a disk had no usable change ID
+    entry.type = context_.manifest && context_.manifest->isIncremental() ? BackupType::INCREMENTAL : BackupType::FULL;
+    entry.size = getBytesTransferred();
+    return catalog->add(entry);
+}
+
 bool BackupJob::readBackupMetadata() const {
     try {
         std::string metadataFile = config_.backupPath + "/metadata.json";
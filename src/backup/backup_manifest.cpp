@@ -0,0 +1,456 @@
+#include "backup/backup_manifest.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+
+constexpr char MANIFEST_MAGIC[8] = {'G', 'V', 'M', 'A', 'N', 'I', 'F', 'S'};
+constexpr uint32_t MANIFEST_VERSION = 2;  // Version 1 had no parent in the disk records
+constexpr uint32_t FLAG_DIGESTS = 1;
+
+constexpr uint32_t EXTENTS_PER_BLOCK = 4096;
+constexpr size_t DIGEST_SIZE = 32;
+
+// Disk table, block table and strings follow the header in this order;
+// block data comes last
+struct ManifestHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t diskCount;
+    uint64_t blockCount;
+    uint64_t stringsSize;
+    uint32_t tablesCrc;  // Over the disk table, block table and strings
+    uint32_t reserved;
+    uint64_t reserved2[2];
+};
+static_assert(sizeof(ManifestHeader) == 64, "manifest header layout");
+
+struct DiskRecord {
+    uint64_t pathOffset;
+    uint64_t fileOffset;
+    uint32_t pathLength;
+    uint32_t fileLength;
+    uint64_t capacity;
+    uint64_t extentCount;
+    uint64_t bytes;
+    uint64_t firstBlock;
+    uint64_t blockCount;
+    // Version 2 and later
+    uint64_t parentOffset;
+    uint32_t parentLength;
+    uint32_t reserved;
+};
+static_assert(sizeof(DiskRecord) == 80, "manifest disk record layout");
+constexpr size_t DISK_RECORD_V1_SIZE = 64;
+
+// Disk records of older versions are a prefix of the current one
+DiskRecord loadDiskRecord(const uint8_t* disks, size_t recordSize, uint64_t disk) {
+    DiskRecord record{};
+    std::memcpy(&record, disks + disk * recordSize, recordSize);
+    return record;
+}
+
+struct BlockRecord {
+    uint64_t firstOffset;
+    uint64_t end;         // End of the last extent
+    uint64_t dataOffset;
+    uint32_t dataSize;    // Less than rawSize when deflated
+    uint32_t rawSize;
+    uint32_t extentCount;
+    uint32_t crc;         // Of the stored data
+};
+static_assert(sizeof(BlockRecord) == 40, "manifest block record layout");
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool getVarint(const uint8_t*& pos, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        uint8_t byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+ManifestWriter::ManifestWriter(int compressionLevel, bool digests)
+    : compressionLevel_(std::min(std::max(compressionLevel, 0), 9))
+    , digests_(digests) {
+}
+
+size_t ManifestWriter::addDisk(const std::string& path, const std::string& file, uint64_t capacity,
+                               const std::string& parent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Disk disk;
+    disk.info.path = path;
+    disk.info.file = file;
+    disk.info.capacity = capacity;
+    disk.info.parent = parent;
+    disks_.push_back(std::move(disk));
+    return disks_.size() - 1;
+}
+
+bool ManifestWriter::addExtent(size_t disk, const ManifestExtent& extent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (disk >= disks_.size() || extent.length == 0) {
+        return false;
+    }
+    Disk& target = disks_[disk];
+    if (target.info.extentCount > 0 && extent.offset < target.end) {
+        return false;
+    }
+
+    if (target.pending.extentCount == 0) {
+        target.pending.firstOffset = extent.offset;
+        target.end = extent.offset;
+    }
+    putVarint(target.varints, extent.offset - target.end);
+    putVarint(target.varints, extent.length);
+    if (digests_) {
+        target.digests.append(reinterpret_cast<const char*>(extent.digest.data()), DIGEST_SIZE);
+    }
+    target.end = extent.offset + extent.length;
+    target.pending.end = target.end;
+    target.pending.extentCount++;
+    target.info.extentCount++;
+    target.info.bytes += extent.length;
+
+    if (target.pending.extentCount == EXTENTS_PER_BLOCK) {
+        sealBlock(target);
+    }
+    return true;
+}
+
+void ManifestWriter::sealBlock(Disk& disk) {
+    if (disk.pending.extentCount == 0) {
+        return;
+    }
+    Block block = disk.pending;
+    std::string raw = std::move(disk.varints);
+    raw += disk.digests;
+    block.rawSize = static_cast<uint32_t>(raw.size());
+
+    if (compressionLevel_ > 0) {
+        uLongf compressedSize = compressBound(raw.size());
+        std::string compressed(compressedSize, '\0');
+        if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressedSize,
+                      reinterpret_cast<const Bytef*>(raw.data()), raw.size(), compressionLevel_) == Z_OK &&
+            compressedSize < raw.size()) {
+            compressed.resize(compressedSize);
+            raw = std::move(compressed);
+        }
+    }
+    block.crc = crc32(raw.data(), raw.size());
+    block.data = std::move(raw);
+    disk.blocks.push_back(std::move(block));
+
+    disk.pending = Block();
+    disk.varints.clear();
+    disk.digests.clear();
+}
+
+bool ManifestWriter::write(const std::string& path, std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t blockCount = 0;
+    std::string strings;
+    std::vector<DiskRecord> diskRecords;
+    for (auto& disk : disks_) {
+        sealBlock(disk);
+        DiskRecord record{};
+        record.pathOffset = strings.size();
+        record.pathLength = static_cast<uint32_t>(disk.info.path.size());
+        strings += disk.info.path;
+        record.fileOffset = strings.size();
+        record.fileLength = static_cast<uint32_t>(disk.info.file.size());
+        strings += disk.info.file;
+        record.parentOffset = strings.size();
+        record.parentLength = static_cast<uint32_t>(disk.info.parent.size());
+        strings += disk.info.parent;
+        record.capacity = disk.info.capacity;
+        record.extentCount = disk.info.extentCount;
+        record.bytes = disk.info.bytes;
+        record.firstBlock = blockCount;
+        record.blockCount = disk.blocks.size();
+        blockCount += disk.blocks.size();
+        diskRecords.push_back(record);
+    }
+
+    uint64_t dataOffset = sizeof(ManifestHeader) + diskRecords.size() * sizeof(DiskRecord) +
+                          blockCount * sizeof(BlockRecord) + strings.size();
+    std::vector<BlockRecord> blockRecords;
+    blockRecords.reserve(blockCount);
+    for (const auto& disk : disks_) {
+        for (const auto& block : disk.blocks) {
+            BlockRecord record{};
+            record.firstOffset = block.firstOffset;
+            record.end = block.end;
+            record.dataOffset = dataOffset;
+            record.dataSize = static_cast<uint32_t>(block.data.size());
+            record.rawSize = block.rawSize;
+            record.extentCount = block.extentCount;
+            record.crc = block.crc;
+            blockRecords.push_back(record);
+            dataOffset += block.data.size();
+        }
+    }
+
+    std::string tables(reinterpret_cast<const char*>(diskRecords.data()), diskRecords.size() * sizeof(DiskRecord));
+    tables.append(reinterpret_cast<const char*>(blockRecords.data()), blockRecords.size() * sizeof(BlockRecord));
+    tables += strings;
+
+    ManifestHeader header{};
+    std::memcpy(header.magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    header.version = MANIFEST_VERSION;
+    header.flags = digests_ ? FLAG_DIGESTS : 0;
+    header.diskCount = diskRecords.size();
+    header.blockCount = blockCount;
+    header.stringsSize = strings.size();
+    header.tablesCrc = crc32(tables.data(), tables.size());
+
+    std::string data;
+    data.reserve(dataOffset);
+    data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    data += tables;
+    for (const auto& disk : disks_) {
+        for (const auto& block : disk.blocks) {
+            data += block.data;
+        }
+    }
+    return writeFileAtomic(path, data, error);
+}
+
+size_t ManifestWriter::getDiskCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return disks_.size();
+}
+
+uint64_t ManifestWriter::getExtentCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t count = 0;
+    for (const auto& disk : disks_) {
+        count += disk.info.extentCount;
+    }
+    return count;
+}
+
+bool ManifestWriter::isIncremental() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::any_of(disks_.begin(), disks_.end(), [](const Disk& disk) { return !disk.info.parent.empty(); });
+}
+
+uint64_t ManifestWriter::getBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t bytes = 0;
+    for (const auto& disk : disks_) {
+        bytes += disk.info.bytes;
+    }
+    return bytes;
+}
+
+bool ManifestReader::open(const std::string& path) {
+    close();
+    if (!file_.open(path, lastError_)) {
+        return false;
+    }
+
+    const uint8_t* data = file_.data();
+    size_t size = file_.size();
+    ManifestHeader header{};
+    bool valid = size >= sizeof(header);
+    uint64_t tablesSize = 0;
+    if (valid) {
+        std::memcpy(&header, data, sizeof(header));
+        valid = std::memcmp(header.magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) == 0 &&
+                header.version >= 1 && header.version <= MANIFEST_VERSION;
+    }
+    if (valid) {
+        // Bound each count by the file size first so the products cannot overflow
+        uint64_t available = size - sizeof(header);
+        diskRecordSize_ = header.version == 1 ? DISK_RECORD_V1_SIZE : sizeof(DiskRecord);
+        valid = header.diskCount <= available / diskRecordSize_ &&
+                header.blockCount <= available / sizeof(BlockRecord) && header.stringsSize <= available;
+        tablesSize = header.diskCount * diskRecordSize_ + header.blockCount * sizeof(BlockRecord) +
+                     header.stringsSize;
+        valid = valid && tablesSize <= available &&
+                crc32(data + sizeof(header), tablesSize) == header.tablesCrc;
+    }
+    if (!valid) {
+        lastError_ = "Invalid or damaged manifest: " + path;
+        Logger::error(lastError_);
+        file_.close();
+        return false;
+    }
+
+    flags_ = header.flags;
+    diskCount_ = header.diskCount;
+    blockCount_ = header.blockCount;
+    disks_ = data + sizeof(header);
+    blocks_ = disks_ + diskCount_ * diskRecordSize_;
+    strings_ = reinterpret_cast<const char*>(blocks_ + blockCount_ * sizeof(BlockRecord));
+
+    for (uint64_t i = 0; i < diskCount_; i++) {
+        DiskRecord disk = loadDiskRecord(disks_, diskRecordSize_, i);
+        if (disk.pathOffset + disk.pathLength > header.stringsSize ||
+            disk.fileOffset + disk.fileLength > header.stringsSize ||
+            disk.parentOffset + disk.parentLength > header.stringsSize ||
+            disk.firstBlock > blockCount_ || disk.blockCount > blockCount_ - disk.firstBlock) {
+            valid = false;
+        }
+    }
+    for (uint64_t i = 0; i < blockCount_ && valid; i++) {
+        const auto* block = reinterpret_cast<const BlockRecord*>(blocks_) + i;
+        valid = block->dataOffset >= sizeof(header) + tablesSize && block->dataOffset <= size &&
+                block->dataSize <= size - block->dataOffset;
+    }
+    if (!valid) {
+        lastError_ = "Manifest tables point outside the file: " + path;
+        Logger::error(lastError_);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ManifestReader::close() {
+    file_.close();
+    flags_ = 0;
+    diskRecordSize_ = 0;
+    diskCount_ = 0;
+    blockCount_ = 0;
+    disks_ = nullptr;
+    blocks_ = nullptr;
+    strings_ = nullptr;
+}
+
+ManifestDisk ManifestReader::getDisk(size_t disk) const {
+    ManifestDisk info;
+    if (disk >= diskCount_) {
+        return info;
+    }
+    DiskRecord record = loadDiskRecord(disks_, diskRecordSize_, disk);
+    info.path.assign(strings_ + record.pathOffset, record.pathLength);
+    info.file.assign(strings_ + record.fileOffset, record.fileLength);
+    info.parent.assign(strings_ + record.parentOffset, record.parentLength);
+    info.capacity = record.capacity;
+    info.extentCount = record.extentCount;
+    info.bytes = record.bytes;
+    return info;
+}
+
+bool ManifestReader::hasDigests() const {
+    return (flags_ & FLAG_DIGESTS) != 0;
+}
+
+bool ManifestReader::findExtents(size_t disk, uint64_t offset, uint64_t length, std::vector<ManifestExtent>& extents) {
+    extents.clear();
+    if (disk >= diskCount_) {
+        lastError_ = "No disk " + std::to_string(disk) + " in manifest";
+        return false;
+    }
+    DiskRecord record = loadDiskRecord(disks_, diskRecordSize_, disk);
+    const auto* first = reinterpret_cast<const BlockRecord*>(blocks_) + record.firstBlock;
+    const auto* last = first + record.blockCount;
+    uint64_t end = length > UINT64_MAX - offset ? UINT64_MAX : offset + length;
+
+    // First block reaching past offset; blocks are ordered and do not overlap
+    const auto* block = std::partition_point(first, last, [offset](const BlockRecord& b) { return b.end <= offset; });
+    std::vector<ManifestExtent> decoded;
+    for (; block != last && block->firstOffset < end; ++block) {
+        if (!decodeBlock(static_cast<uint64_t>(block - reinterpret_cast<const BlockRecord*>(blocks_)), decoded)) {
+            return false;
+        }
+        for (const auto& extent : decoded) {
+            if (extent.offset < end && extent.offset + extent.length > offset) {
+                extents.push_back(extent);
+            }
+        }
+    }
+    return true;
+}
+
+bool ManifestReader::forEachExtent(size_t disk, const std::function<bool(const ManifestExtent&)>& visit) {
+    if (disk >= diskCount_) {
+        lastError_ = "No disk " + std::to_string(disk) + " in manifest";
+        return false;
+    }
+    DiskRecord record = loadDiskRecord(disks_, diskRecordSize_, disk);
+    std::vector<ManifestExtent> decoded;
+    for (uint64_t block = record.firstBlock; block < record.firstBlock + record.blockCount; block++) {
+        if (!decodeBlock(block, decoded)) {
+            return false;
+        }
+        for (const auto& extent : decoded) {
+            if (!visit(extent)) {
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+bool ManifestReader::decodeBlock(uint64_t block, std::vector<ManifestExtent>& extents) {
+    extents.clear();
+    const auto* record = reinterpret_cast<const BlockRecord*>(blocks_) + block;
+    const uint8_t* stored = file_.data() + record->dataOffset;
+    if (crc32(stored, record->dataSize) != record->crc) {
+        lastError_ = "Checksum mismatch in manifest block " + std::to_string(block);
+        Logger::error(lastError_);
+        return false;
+    }
+
+    std::string inflated;
+    const uint8_t* raw = stored;
+    if (record->dataSize < record->rawSize) {
+        inflated.resize(record->rawSize);
+        uLongf rawSize = record->rawSize;
+        if (uncompress(reinterpret_cast<Bytef*>(&inflated[0]), &rawSize, stored, record->dataSize) != Z_OK ||
+            rawSize != record->rawSize) {
+            lastError_ = "Failed to inflate manifest block " + std::to_string(block);
+            Logger::error(lastError_);
+            return false;
+        }
+        raw = reinterpret_cast<const uint8_t*>(inflated.data());
+    }
+
+    size_t digestBytes = hasDigests() ? static_cast<size_t>(record->extentCount) * DIGEST_SIZE : 0;
+    if (digestBytes > record->rawSize) {
+        lastError_ = "Malformed manifest block " + std::to_string(block);
+        Logger::error(lastError_);
+        return false;
+    }
+    const uint8_t* pos = raw;
+    const uint8_t* varintEnd = raw + record->rawSize - digestBytes;
+    const uint8_t* digests = varintEnd;
+
+    extents.reserve(record->extentCount);
+    uint64_t end = record->firstOffset;
+    for (uint32_t i = 0; i < record->extentCount; i++) {
+        uint64_t gap = 0;
+        ManifestExtent extent;
+        if (!getVarint(pos, varintEnd, gap) || !getVarint(pos, varintEnd, extent.length)) {
+            lastError_ = "Malformed manifest block " + std::to_string(block);
+            Logger::error(lastError_);
+            return false;
+        }
+        extent.offset = end + gap;
+        if (digestBytes > 0) {
+            std::memcpy(extent.digest.data(), digests + i * DIGEST_SIZE, DIGEST_SIZE);
+        }
+        end = extent.offset + extent.length;
+        extents.push_back(extent);
+    }
+    return true;
+}
@@ -0,0 +1,210 @@
+#include "backup/backup_reaper.hpp"
+#include "backup/chunk_gc.hpp"
+#include "common/logger.hpp"
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+BackupReaper::BackupReaper(const ReaperConfig& config)
+    : config_(config) {
+}
+
+BackupReaper::~BackupReaper() {
+    stop();
+}
+
+std::shared_ptr<BackupReaper> BackupReaper::getDefault() {
+    static auto reaper = std::make_shared<BackupReaper>();
+    return reaper;
+}
+
+void BackupReaper::setConfig(const ReaperConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+    if (config_.batchSize == 0) {
+        config_.batchSize = 1;
+    }
+}
+
+ReaperConfig BackupReaper::getConfig() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+}
+
+bool BackupReaper::retire(BackupCatalog& catalog, const CatalogEntry& entry) {
+    recover(catalog.getRepository());
+
+    fs::path trash = fs::path(catalog.getRepository()) / ".trash";
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        name = fs::path(entry.backupId).filename().string() + "." + std::to_string(++sequence_) + "." +
+               std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    std::error_code ec;
+    fs::create_directories(trash, ec);
+    std::string target = (trash / name).string();
+    fs::rename(entry.backupId, target, ec);
+    if (ec == std::errc::cross_device_link) {
+        // Not in the repository's file system: unlink it where it is
+        target = entry.backupId;
+    } else if (ec && fs::exists(entry.backupId)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to move " + entry.backupId + " to the trash: " + ec.message();
+        Logger::error(lastError_);
+        return false;
+    } else if (ec) {
+        // Already gone; only the catalog still lists it
+        target.clear();
+    }
+
+    if (!catalog.remove(entry.vmId, entry.backupId)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to remove " + entry.backupId + " from the catalog: " + catalog.getLastError();
+        Logger::error(lastError_);
+        // The catalog still lists the backup, so it must stay restorable
+        if (!target.empty() && target != entry.backupId) {
+            fs::rename(target, entry.backupId, ec);
+            if (ec) {
+                Logger::error("Failed to move " + target + " back from the trash: " + ec.message());
+            }
+        }
+        return false;
+    }
+    Logger::info("Retired backup " + entry.backupId + " of VM " + entry.vmId);
+
+    // Chunks shared with other backups stay; the collector reclaims the rest
+    if (auto chunks = ChunkRepository::forRepository(catalog.getRepository())) {
+        std::string root = fs::path(entry.backupId).filename().string();
+        if (chunks->dropRoot(root)) {
+            GarbageCollector::getDefault()->request(chunks);
+        } else {
+            Logger::warning("Chunks of " + entry.backupId + " stay referenced: " + chunks->getLastError());
+        }
+    }
+
+    if (!target.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(target);
+        startLocked();
+    }
+    wakeup_.notify_one();
+    return true;
+}
+
+void BackupReaper::recover(const std::string& repository) {
+    fs::path trash = fs::path(repository) / ".trash";
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!recovered_.insert(trash.string()).second) {
+            return;
+        }
+    }
+
+    std::vector<std::string> leftovers;
+    std::error_code ec;
+    for (fs::directory_iterator it(trash, ec), end; !ec && it != end; it.increment(ec)) {
+        leftovers.push_back(it->path().string());
+    }
+    if (leftovers.empty()) {
+        return;
+    }
+
+    Logger::info("Resuming deletion of " + std::to_string(leftovers.size()) + " retired backup(s) in " +
+                 trash.string());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.insert(queue_.end(), leftovers.begin(), leftovers.end());
+        startLocked();
+    }
+    wakeup_.notify_one();
+}
+
+void BackupReaper::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopRequested_ = true;
+    }
+    wakeup_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopRequested_ = false;
+}
+
+size_t BackupReaper::getPending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+std::string BackupReaper::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+void BackupReaper::startLocked() {
+    if (!worker_.joinable() && !stopRequested_) {
+        worker_ = std::thread(&BackupReaper::run, this);
+    }
+}
+
+void BackupReaper::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopRequested_) {
+        if (queue_.empty()) {
+            wakeup_.wait(lock, [this] { return stopRequested_ || !queue_.empty(); });
+            continue;
+        }
+
+        std::string path = queue_.front();
+        ReaperConfig config = config_;
+        lock.unlock();
+        bool done = reapBatch(path, config.batchSize);
+        lock.lock();
+
+        if (done) {
+            queue_.pop_front();
+        }
+        wakeup_.wait_for(lock, config.batchInterval, [this] { return stopRequested_; });
+    }
+}
+
+bool BackupReaper::reapBatch(const std::string& path, size_t batchSize) {
+    std::error_code ec;
+    std::vector<fs::path> files;
+    for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end && files.size() < batchSize;
+         it.increment(ec)) {
+        if (it->symlink_status(ec).type() != fs::file_type::directory) {
+            files.push_back(it->path());
+        }
+    }
+
+    size_t removed = 0;
+    for (const auto& file : files) {
+        if (fs::remove(file, ec)) {
+            removed++;
+        }
+    }
+    if (!files.empty() && removed > 0) {
+        return false;
+    }
+    if (!files.empty()) {
+        // Nothing could be unlinked; leave the rest instead of retrying forever
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to delete " + files.front().string() + ": " + ec.message();
+        Logger::warning(lastError_ + ", giving up on " + path);
+        return true;
+    }
+
+    // Only empty directories are left
+    fs::remove_all(path, ec);
+    if (ec) {
+        Logger::warning("Failed to remove " + path + ": " + ec.message());
+    } else {
+        Logger::debug("Reclaimed " + path);
+    }
+    return true;
+}
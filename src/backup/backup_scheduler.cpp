@@ -1,4 +1,7 @@
 #include "backup/backup_scheduler.hpp"
+#include "backup/backup_catalog.hpp"
+#include "backup/backup_reaper.hpp"
+#include "backup/retention_policy.hpp"
 #include "common/job_manager.hpp"
 #include "common/job.hpp"
 #include "common/logger.hpp"
@@ -10,8 +13,70 @@
 #include <iomanip>
 #include <sstream>
 
+namespace {
+
+bool isValidStaggerPolicy(const std::string& policy) {
+    return policy.empty() || policy == "none" || policy == "hash" || policy == "jitter" || policy == "spread";
+}
+
+// FNV-1a, so a VM keeps its offset across restarts and builds
+uint64_t hashVmId(const std::string& vmId) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : vmId) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// VMs with the "spread" policy share a slot when they would all start at the
+// same time: same schedule time, day and stagger window
+std::string staggerSlotKey(const BackupConfig& config) {
+    bool usesDay = config.scheduleType == "weekly" || config.scheduleType == "monthly";
+    return config.scheduleType + "/" + std::to_string(config.staggerWindowMinutes) + "/" +
+           std::to_string(config.schedule.hour) + ":" + std::to_string(config.schedule.minute) + "/" +
+           std::to_string(usesDay ? config.schedule.day : 0);
+}
+
+// A run competing for a backup window slot
+struct WindowCandidate {
+    std::chrono::seconds predicted;
+    std::chrono::system_clock::time_point due;
+    std::chrono::system_clock::time_point deadline;
+};
+
+// Longest predicted run that still finishes by its deadline; if none does,
+// the longest one overall. Returns candidates.size() if nothing is due yet.
+size_t pickWindowCandidate(const std::vector<WindowCandidate>& candidates,
+                           const std::vector<bool>& taken,
+                           std::chrono::system_clock::time_point now) {
+    size_t best = candidates.size();
+    bool bestFits = false;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const auto& candidate = candidates[i];
+        if (taken[i] || candidate.due > now) {
+            continue;
+        }
+        bool fits = now + candidate.predicted <= candidate.deadline;
+        if (best == candidates.size() || (fits && !bestFits) ||
+            (fits == bestFits && candidate.predicted > candidates[best].predicted)) {
+            best = i;
+            bestFits = fits;
+        }
+    }
+    return best;
+}
+
+std::string formatMinutes(std::chrono::system_clock::duration duration) {
+    return std::to_string(std::chrono::duration_cast<std::chrono::minutes>(duration).count()) + " minute(s)";
+}
+
+} // namespace
+
 BackupScheduler::BackupScheduler(JobManager* jobManager)
     : jobManager_(jobManager)
+    , history_(std::make_shared<BackupHistory>())
+    , reaper_(BackupReaper::getDefault())
     , running_(false)
     , stopRequested_(false) {
 }
@@ -28,34 +93,65 @@ bool BackupScheduler::initialize() {
     running_ = true;
     stopRequested_ = false;
     schedulerThread_ = std::thread(&BackupScheduler::checkSchedules, this);
+    submitThread_ = std::thread(&BackupScheduler::submitBackups, this);
     return true;
 }
 
 bool BackupScheduler::scheduleBackup(const std::string& vmId, const BackupConfig& config) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    schedules_[vmId] = config;
+    if (!isValidStaggerPolicy(config.staggerPolicy)) {
+        Logger::error("Unknown stagger policy for VM " + vmId + ": " + config.staggerPolicy);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::system_clock::now();
+        auto previous = schedules_.find(vmId);
+        if (previous != schedules_.end() && previous->second.staggerPolicy == "spread") {
+            leaveStaggerSlot(vmId, previous->second);
+        }
+
+        // Pending runs of the other slot members pick up the new count when their slot arrives
+        schedules_[vmId] = config;
+        if (config.staggerPolicy == "spread") {
+            joinStaggerSlot(vmId, config);
+        }
+        upsertRun(getStaggeredRun(vmId, config, now, {}));
+    }
+    wakeup_.notify_one();
     return true;
 }
 
 bool BackupScheduler::cancelBackup(const std::string& backupId) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = schedules_.find(backupId);
-    if (it != schedules_.end()) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = schedules_.find(backupId);
+        if (it == schedules_.end()) {
+            return false;
+        }
+        BackupConfig config = it->second;
         schedules_.erase(it);
-        return true;
+        removeRun(backupId);
+        windowQueue_.erase(std::remove_if(windowQueue_.begin(), windowQueue_.end(),
+                                          [&](const QueuedRun& run) { return run.vmId == backupId; }),
+                           windowQueue_.end());
+        if (config.staggerPolicy == "spread") {
+            leaveStaggerSlot(backupId, config);
+        }
     }
-    return false;
+    wakeup_.notify_one();
+    return true;
 }
 
 bool BackupScheduler::pauseBackup(const std::string& backupId) {
     // TODO: Implement pause functionality in JobManager
-    Logger::warning("Pause functionality not implemented");
+    Logger::warning("Pause functionality not implemented, cannot pause backup " + backupId);
     return false;
 }
 
 bool BackupScheduler::resumeBackup(const std::string& backupId) {
     // TODO: Implement resume functionality in JobManager
-    Logger::warning("Resume functionality not implemented");
+    Logger::warning("Resume functionality not implemented, cannot resume backup " + backupId);
     return false;
 }
 
@@ -78,66 +174,161 @@ BackupConfig BackupScheduler::getBackupConfig(const std::string& backupId) const
 }
 
 std::chrono::system_clock::time_point BackupScheduler::getNextRunTime(const BackupConfig& config) const {
-    auto now = std::chrono::system_clock::now();
-    auto now_time_t = std::chrono::system_clock::to_time_t(now);
-    std::tm* now_tm = std::localtime(&now_time_t);
+    return getNextRunTime(config, std::chrono::system_clock::now());
+}
 
-    std::tm next_tm = *now_tm;
-    next_tm.tm_hour = config.schedule.hour;
-    next_tm.tm_min = config.schedule.minute;
-    next_tm.tm_sec = 0;
+std::chrono::system_clock::time_point BackupScheduler::getNextRunTime(const BackupConfig& config,
+                                                                      std::chrono::system_clock::time_point after) const {
+    if (config.scheduleType == "interval") {
+        auto interval = std::chrono::hours(config.schedule.hour) + std::chrono::minutes(config.schedule.minute);
+        if (interval <= std::chrono::minutes(0)) {
+            interval = std::chrono::minutes(1);
+        }
+        return after + interval;
+    }
 
-    auto next_time = std::mktime(&next_tm);
-    auto next_time_point = std::chrono::system_clock::from_time_t(next_time);
+    time_t afterTime = std::chrono::system_clock::to_time_t(after);
+    std::tm base;
+    localtime_r(&afterTime, &base);
+    base.tm_hour = config.schedule.hour;
+    base.tm_min = config.schedule.minute;
+    base.tm_sec = 0;
+    base.tm_isdst = -1;
+
+    // mktime normalizes day overflow and picks the right DST offset
+    auto candidateAt = [](std::tm tm, int dayOffset) {
+        tm.tm_mday += dayOffset;
+        tm.tm_isdst = -1;
+        return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+    };
+
+    if (config.scheduleType == "weekly") {
+        int offset = ((config.schedule.day - base.tm_wday) % 7 + 7) % 7;
+        auto next = candidateAt(base, offset);
+        return next > after ? next : candidateAt(base, offset + 7);
+    }
 
-    if (next_time_point <= now) {
-        if (config.scheduleType == "daily") {
-            next_time_point += std::chrono::hours(24);
-        } else if (config.scheduleType == "weekly") {
-            next_time_point += std::chrono::hours(24 * 7);
-        } else if (config.scheduleType == "monthly") {
-            next_tm.tm_mon++;
-            next_time = std::mktime(&next_tm);
-            next_time_point = std::chrono::system_clock::from_time_t(next_time);
+    if (config.scheduleType == "monthly") {
+        // Day 31 in a 30 day month runs on the last day of that month
+        for (int month = 0; month < 13; month++) {
+            std::tm tm = base;
+            tm.tm_mon += month;
+            tm.tm_mday = 1;
+            tm.tm_isdst = -1;
+            std::mktime(&tm);
+            std::tm probe = tm;
+            probe.tm_mon++;
+            probe.tm_mday = 0;
+            probe.tm_isdst = -1;
+            std::mktime(&probe);
+            tm.tm_mday = std::min(std::max(config.schedule.day, 1), probe.tm_mday);
+            tm.tm_hour = config.schedule.hour;
+            tm.tm_min = config.schedule.minute;
+            tm.tm_sec = 0;
+            auto next = candidateAt(tm, 0);
+            if (next > after) {
+                return next;
+            }
         }
     }
 
-    return next_time_point;
+    // daily and once
+    auto next = candidateAt(base, 0);
+    return next > after ? next : candidateAt(base, 1);
 }
 
-void BackupScheduler::addSchedule(const std::string& vmId, const BackupConfig& config) {
+std::optional<std::chrono::system_clock::time_point> BackupScheduler::getScheduledRunTime(const std::string& vmId) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = runIndex_.find(vmId);
+    if (it == runIndex_.end()) {
+        return std::nullopt;
+    }
+    return getDueTime(runQueue_[it->second]);
+}
+
+void BackupScheduler::setMissedRunGrace(std::chrono::seconds grace) {
     std::lock_guard<std::mutex> lock(mutex_);
-    schedules_[vmId] = config;
+    missedRunGrace_ = grace;
 }
 
-void BackupScheduler::removeSchedule(const std::string& vmId) {
+void BackupScheduler::setBackupWindow(const BackupWindow& window) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        window_ = window;
+        window_.durationMinutes = std::min(std::max(window_.durationMinutes, 0), 24 * 60);
+        window_.maxConcurrentJobs = std::max<size_t>(window_.maxConcurrentJobs, 1);
+        if (window_.durationMinutes > 0) {
+            auto now = std::chrono::system_clock::now();
+            nextPlanCheck_ = getNextWindowStart(now) - std::chrono::minutes(window_.warningLeadMinutes);
+        }
+    }
+    wakeup_.notify_one();
+}
+
+BackupWindow BackupScheduler::getBackupWindow() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    schedules_.erase(vmId);
+    return window_;
 }
 
-void BackupScheduler::updateSchedule(const std::string& vmId, const BackupConfig& config) {
+bool BackupScheduler::setHistoryFile(const std::string& path) {
+    auto history = std::make_shared<BackupHistory>(path);
+    if (!history->load()) {
+        Logger::error(history->getLastError());
+        return false;
+    }
     std::lock_guard<std::mutex> lock(mutex_);
-    schedules_[vmId] = config;
+    history_ = history;
+    return true;
+}
+
+std::chrono::seconds BackupScheduler::predictDuration(const std::string& vmId) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return history_->predictDuration(vmId, std::chrono::minutes(window_.defaultDurationMinutes));
+}
+
+WindowPlan BackupScheduler::getWindowPlan() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (window_.durationMinutes <= 0) {
+        return WindowPlan();
+    }
+    auto now = std::chrono::system_clock::now();
+    auto open = getWindowStart(now);
+    return planWindow(open ? *open : getNextWindowStart(now), now);
+}
+
+void BackupScheduler::addSchedule(const std::string& vmId, const BackupConfig& config) {
+    scheduleBackup(vmId, config);
+}
+
+void BackupScheduler::removeSchedule(const std::string& vmId) {
+    cancelBackup(vmId);
+}
+
+void BackupScheduler::updateSchedule(const std::string& vmId, const BackupConfig& config) {
+    scheduleBackup(vmId, config);
 }
 
 void BackupScheduler::applyRetentionPolicy(const std::string& vmId) {
     auto config = getBackupConfig(vmId);
-    if (config.retentionDays > 0) {
+    if (RetentionPolicy::fromConfig(config).isEnabled()) {
         cleanupOldBackups(vmId);
     }
 }
 
 void BackupScheduler::cleanupOldBackups(const std::string& vmId) {
     auto config = getBackupConfig(vmId);
-    auto backupPaths = getBackupPaths(vmId);
-    
-    // Sort backups by date (newest first)
-    std::sort(backupPaths.begin(), backupPaths.end(), std::greater<>());
-    
-    // Keep only the most recent backups up to maxBackups
-    if (config.maxBackups > 0 && backupPaths.size() > config.maxBackups) {
-        for (size_t i = config.maxBackups; i < backupPaths.size(); ++i) {
-            std::filesystem::remove(backupPaths[i]);
+    auto catalog = BackupCatalog::forRepository(config.backupDir);
+    if (!catalog) {
+        return;
+    }
+
+    // Expired backups only move to the trash here; the reaper deletes them later
+    auto expired = selectExpired(RetentionPolicy::fromConfig(config), catalog->list(vmId),
+                                 std::chrono::system_clock::now());
+    for (const auto& backup : expired) {
+        if (!reaper_->retire(*catalog, backup)) {
+            Logger::warning("Failed to retire backup " + backup.backupId + " of VM " + vmId + ": " +
+                            reaper_->getLastError());
         }
     }
 }
@@ -146,9 +337,10 @@ std::vector<std::string> BackupScheduler::getBackupPaths(const std::string& vmId
     auto config = getBackupConfig(vmId);
     std::vector<std::string> paths;
     
-    for (const auto& entry : std::filesystem::directory_iterator(config.backupDir)) {
-        if (entry.path().string().find(vmId) != std::string::npos) {
-            paths.push_back(entry.path().string());
+    auto catalog = BackupCatalog::forRepository(config.backupDir);
+    if (catalog) {
+        for (const auto& entry : catalog->list(vmId)) {
+            paths.push_back(entry.backupId);
         }
     }
     
@@ -156,21 +348,24 @@ std::vector<std::string> BackupScheduler::getBackupPaths(const std::string& vmId
 }
 
 bool BackupScheduler::isBackupExpired(const std::string& vmId, int retentionDays) const {
-    auto backupPaths = getBackupPaths(vmId);
-    if (backupPaths.empty()) {
+    auto config = getBackupConfig(vmId);
+    auto catalog = BackupCatalog::forRepository(config.backupDir);
+    auto backups = catalog ? catalog->list(vmId) : std::vector<CatalogEntry>();
+    if (backups.empty()) {
         return false;
     }
 
-    auto now = std::chrono::system_clock::now();
-    auto oldestBackup = std::filesystem::last_write_time(backupPaths.back());
-    
-    // Convert file_time_type to system_clock::time_point
-    auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-        oldestBackup - std::filesystem::file_time_type::clock::now()
-        + std::chrono::system_clock::now());
-    
-    auto age = std::chrono::duration_cast<std::chrono::hours>(now - sctp);
-    return age.count() > (retentionDays * 24);
+    auto oldest = std::min_element(backups.begin(), backups.end(), [](const CatalogEntry& a, const CatalogEntry& b) {
+        return a.timestamp != b.timestamp ? a.timestamp < b.timestamp : a.backupId < b.backupId;
+    });
+    std::string oldestId = oldest->backupId;
+
+    // Expired when the same GFS evaluation cleanupOldBackups runs would retire it
+    RetentionPolicy policy = RetentionPolicy::fromConfig(config);
+    policy.keepWithinDays = retentionDays;
+    auto expired = selectExpired(policy, std::move(backups), std::chrono::system_clock::now());
+    return std::any_of(expired.begin(), expired.end(),
+                       [&oldestId](const CatalogEntry& entry) { return entry.backupId == oldestId; });
 }
 
 bool BackupScheduler::isBackupNeeded(const std::string& vmId, const BackupConfig& config) const {
@@ -214,15 +409,24 @@ void BackupScheduler::start() {
         running_ = true;
         stopRequested_ = false;
         schedulerThread_ = std::thread(&BackupScheduler::checkSchedules, this);
+        submitThread_ = std::thread(&BackupScheduler::submitBackups, this);
     }
 }
 
 void BackupScheduler::stop() {
     if (running_) {
-        stopRequested_ = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopRequested_ = true;
+        }
+        wakeup_.notify_all();
+        submitReady_.notify_all();
         if (schedulerThread_.joinable()) {
             schedulerThread_.join();
         }
+        if (submitThread_.joinable()) {
+            submitThread_.join();
+        }
         running_ = false;
     }
 }
@@ -230,72 +434,508 @@ void BackupScheduler::stop() {
 void BackupScheduler::checkSchedules() {
     while (!stopRequested_) {
         std::vector<std::pair<std::string, BackupConfig>> jobsToRun;
-        
+        std::vector<std::pair<std::string, BackupConfig>> windowJobsToRun;
+
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            for (const auto& pair : schedules_) {
-                if (shouldRunBackup(pair.second)) {
-                    jobsToRun.push_back(pair);
+            // Sleep until the earliest run is due, the window plan needs checking,
+            // a window slot frees up or the schedule set changes
+            std::unique_lock<std::mutex> lock(mutex_);
+            bool windowActive = window_.durationMinutes > 0;
+            if (runQueue_.empty() && !windowActive) {
+                wakeup_.wait(lock, [this]() {
+                    return stopRequested_ || !runQueue_.empty() || window_.durationMinutes > 0;
+                });
+            } else {
+                auto wakeAt = windowActive ? nextPlanCheck_ : runQueue_.front().due;
+                if (windowActive && !runQueue_.empty()) {
+                    wakeAt = std::min(wakeAt, runQueue_.front().due);
                 }
+                wakeup_.wait_until(lock, wakeAt);
+            }
+            if (stopRequested_) {
+                break;
+            }
+
+            auto now = std::chrono::system_clock::now();
+            collectDueRuns(now, jobsToRun);
+            if (window_.durationMinutes > 0) {
+                if (now >= nextPlanCheck_) {
+                    checkWindowPlan(now);
+                }
+                takeWindowRuns(now, windowJobsToRun);
+            }
+
+            // Creating and admitting a job talks to the endpoint, which must not
+            // hold up the runs due after these
+            for (const auto& job : jobsToRun) {
+                submissions_.push_back({job.first, job.second, false});
             }
+            for (const auto& job : windowJobsToRun) {
+                submissions_.push_back({job.first, job.second, true});
+            }
+        }
+        if (!jobsToRun.empty() || !windowJobsToRun.empty()) {
+            submitReady_.notify_one();
         }
-        
-        for (const auto& job : jobsToRun) {
-            executeBackup(job.first, job.second);
+    }
+}
+
+void BackupScheduler::submitBackups() {
+    while (true) {
+        Submission submission;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            submitReady_.wait(lock, [this]() { return stopRequested_ || !submissions_.empty(); });
+            if (stopRequested_) {
+                if (!submissions_.empty()) {
+                    Logger::warning("Dropping " + std::to_string(submissions_.size()) +
+                                    " backup(s) not yet submitted at scheduler stop");
+                    for (const auto& dropped : submissions_) {
+                        if (dropped.windowed && windowRunning_ > 0) {
+                            windowRunning_--;
+                        }
+                    }
+                    submissions_.clear();
+                }
+                return;
+            }
+            submission = std::move(submissions_.front());
+            submissions_.pop_front();
         }
-        
-        std::this_thread::sleep_for(std::chrono::minutes(1));
+        executeBackup(submission.vmId, submission.config, submission.windowed);
     }
 }
 
-void BackupScheduler::executeBackup(const std::string& vmId, const BackupConfig& config) {
+void BackupScheduler::collectDueRuns(std::chrono::system_clock::time_point now,
+                                     std::vector<std::pair<std::string, BackupConfig>>& runs) {
+    while (!runQueue_.empty() && runQueue_.front().due <= now) {
+        ScheduledRun run = runQueue_.front();
+        removeRun(run.vmId);
+
+        auto it = schedules_.find(run.vmId);
+        if (it == schedules_.end()) {
+            continue;
+        }
+        const BackupConfig& config = it->second;
+
+        // The slot has arrived, so its membership is settled; the run waits out its offset
+        if (run.offsetPending) {
+            run.due = run.slot + getStaggerOffset(run.vmId, config);
+            run.offsetPending = false;
+            if (run.due > now) {
+                upsertRun(run);
+                continue;
+            }
+        }
+
+        // A run that starts later than the grace period was missed (stall, suspend, clock jump)
+        auto lateness = now - run.due;
+        bool missed = lateness > missedRunGrace_;
+        bool runNow = true;
+        if (missed) {
+            auto lateMinutes = std::chrono::duration_cast<std::chrono::minutes>(lateness).count();
+            if (config.catchUpPolicy == "skip") {
+                runNow = false;
+            } else if (config.catchUpWindowMinutes > 0 && lateMinutes > config.catchUpWindowMinutes) {
+                runNow = false;
+            }
+            Logger::warning("Backup of VM " + run.vmId + " is " + std::to_string(lateMinutes) +
+                            " minute(s) late, " + (runNow ? "running catch-up" : "skipping run"));
+        }
+        if (runNow) {
+            auto windowStart = getWindowStart(run.due);
+            if (windowStart) {
+                windowQueue_.push_back({run.vmId, config, run.due,
+                                        *windowStart + std::chrono::minutes(window_.durationMinutes)});
+            } else {
+                runs.emplace_back(run.vmId, config);
+            }
+        }
+
+        if (config.scheduleType == "once") {
+            if (config.staggerPolicy == "spread") {
+                leaveStaggerSlot(run.vmId, config);
+            }
+            schedules_.erase(it);
+            continue;
+        }
+        // Missed occurrences collapse into at most one catch-up run
+        upsertRun(getStaggeredRun(run.vmId, config, now, run.slot + std::chrono::seconds(1)));
+    }
+}
+
+BackupScheduler::ScheduledRun BackupScheduler::getStaggeredRun(const std::string& vmId, const BackupConfig& config,
+                                                              std::chrono::system_clock::time_point after,
+                                                              std::chrono::system_clock::time_point minSlot) {
+    ScheduledRun run;
+    run.vmId = vmId;
+
+    auto window = std::chrono::minutes(std::max(config.staggerWindowMinutes, 0));
+    if (config.staggerPolicy.empty() || config.staggerPolicy == "none" || window.count() == 0) {
+        run.slot = getNextRunTime(config, std::max(after, minSlot - std::chrono::seconds(1)));
+        run.due = run.slot;
+        return run;
+    }
+
+    if (config.scheduleType == "interval") {
+        // Later runs are timed from the previous one, so only the first run needs an offset
+        run.slot = getNextRunTime(config, after);
+        run.due = minSlot == std::chrono::system_clock::time_point{}
+            ? run.slot + getStaggerOffset(vmId, config)
+            : run.slot;
+        return run;
+    }
+
+    // The slot may already have passed while its staggered run is still ahead.
+    // A "spread" offset depends on how many VMs share the slot, so a run whose
+    // slot is still ahead is queued at the slot and offset once it arrives.
+    run.slot = getNextRunTime(config, std::max(after - window, minSlot - std::chrono::seconds(1)));
+    while (true) {
+        if (config.staggerPolicy == "spread" && run.slot > after) {
+            run.due = run.slot;
+            run.offsetPending = true;
+            return run;
+        }
+        run.due = run.slot + getStaggerOffset(vmId, config);
+        if (run.due > after) {
+            return run;
+        }
+        run.slot = getNextRunTime(config, run.slot);
+    }
+}
+
+std::chrono::seconds BackupScheduler::getStaggerOffset(const std::string& vmId, const BackupConfig& config) {
+    int64_t windowSeconds = static_cast<int64_t>(std::max(config.staggerWindowMinutes, 0)) * 60;
+    if (windowSeconds == 0) {
+        return std::chrono::seconds(0);
+    }
+
+    if (config.staggerPolicy == "hash") {
+        return std::chrono::seconds(hashVmId(vmId) % static_cast<uint64_t>(windowSeconds));
+    }
+    if (config.staggerPolicy == "jitter") {
+        std::uniform_int_distribution<int64_t> dist(0, windowSeconds - 1);
+        return std::chrono::seconds(dist(staggerRng_));
+    }
+    if (config.staggerPolicy == "spread") {
+        return getSpreadOffset(vmId, config);
+    }
+    return std::chrono::seconds(0);
+}
+
+std::chrono::seconds BackupScheduler::getSpreadOffset(const std::string& vmId, const BackupConfig& config) const {
+    // Even spacing by rank among the VMs sharing the slot
+    int64_t windowSeconds = static_cast<int64_t>(std::max(config.staggerWindowMinutes, 0)) * 60;
+    auto slot = staggerSlots_.find(staggerSlotKey(config));
+    if (slot == staggerSlots_.end()) {
+        return std::chrono::seconds(0);
+    }
+    auto rank = slot->second.ranks.find(vmId);
+    int64_t count = static_cast<int64_t>(slot->second.members.size());
+    if (rank == slot->second.ranks.end()) {
+        return std::chrono::seconds(0);
+    }
+    return std::chrono::seconds(windowSeconds * static_cast<int64_t>(rank->second) / count);
+}
+
+std::chrono::system_clock::time_point BackupScheduler::getDueTime(const ScheduledRun& run) const {
+    if (!run.offsetPending) {
+        return run.due;
+    }
+    auto schedule = schedules_.find(run.vmId);
+    return schedule == schedules_.end() ? run.due : run.slot + getSpreadOffset(run.vmId, schedule->second);
+}
+
+void BackupScheduler::joinStaggerSlot(const std::string& vmId, const BackupConfig& config) {
+    auto& slot = staggerSlots_[staggerSlotKey(config)];
+    auto position = std::lower_bound(slot.members.begin(), slot.members.end(), vmId);
+    if (position != slot.members.end() && *position == vmId) {
+        return;
+    }
+    // Only the members after the new one move up a rank
+    size_t rank = static_cast<size_t>(position - slot.members.begin());
+    slot.members.insert(position, vmId);
+    for (size_t i = rank; i < slot.members.size(); i++) {
+        slot.ranks[slot.members[i]] = i;
+    }
+}
+
+void BackupScheduler::leaveStaggerSlot(const std::string& vmId, const BackupConfig& config) {
+    auto it = staggerSlots_.find(staggerSlotKey(config));
+    if (it == staggerSlots_.end()) {
+        return;
+    }
+    auto& slot = it->second;
+    auto position = std::lower_bound(slot.members.begin(), slot.members.end(), vmId);
+    if (position == slot.members.end() || *position != vmId) {
+        return;
+    }
+    size_t rank = static_cast<size_t>(position - slot.members.begin());
+    slot.members.erase(position);
+    slot.ranks.erase(vmId);
+    if (slot.members.empty()) {
+        staggerSlots_.erase(it);
+        return;
+    }
+    for (size_t i = rank; i < slot.members.size(); i++) {
+        slot.ranks[slot.members[i]] = i;
+    }
+}
+
+std::optional<std::chrono::system_clock::time_point> BackupScheduler::getWindowStart(
+    std::chrono::system_clock::time_point at) const {
+    if (window_.durationMinutes <= 0) {
+        return std::nullopt;
+    }
+    // The window is open at `at` if it started within the last durationMinutes
+    auto start = getNextWindowStart(at - std::chrono::minutes(window_.durationMinutes));
+    if (start <= at) {
+        return start;
+    }
+    return std::nullopt;
+}
+
+std::chrono::system_clock::time_point BackupScheduler::getNextWindowStart(
+    std::chrono::system_clock::time_point after) const {
+    BackupConfig daily;
+    daily.scheduleType = "daily";
+    daily.schedule.hour = window_.startHour;
+    daily.schedule.minute = window_.startMinute;
+    return getNextRunTime(daily, after);
+}
+
+WindowPlan BackupScheduler::planWindow(std::chrono::system_clock::time_point windowStart,
+                                       std::chrono::system_clock::time_point now) const {
+    WindowPlan plan;
+    plan.windowStart = windowStart;
+    plan.windowEnd = windowStart + std::chrono::minutes(window_.durationMinutes);
+    auto fallback = std::chrono::seconds(std::chrono::minutes(window_.defaultDurationMinutes));
+
+    // Queued runs of the open window plus pending runs due inside it
+    std::vector<std::string> vmIds;
+    std::vector<WindowCandidate> candidates;
+    for (const auto& run : windowQueue_) {
+        if (run.deadline == plan.windowEnd) {
+            vmIds.push_back(run.vmId);
+            candidates.push_back({history_->predictDuration(run.vmId, fallback), run.due, run.deadline});
+        }
+    }
+    for (const auto& run : runQueue_) {
+        auto due = getDueTime(run);
+        if (due >= windowStart && due < plan.windowEnd) {
+            vmIds.push_back(run.vmId);
+            candidates.push_back({history_->predictDuration(run.vmId, fallback), due, plan.windowEnd});
+        }
+    }
+
+    // Replay the dispatch rule over simulated slots; running jobs are not
+    // accounted for, so the plan is optimistic while the window is open
+    std::vector<std::chrono::system_clock::time_point> slots(window_.maxConcurrentJobs,
+                                                             std::max(windowStart, now));
+    std::vector<bool> taken(candidates.size(), false);
+    for (size_t placed = 0; placed < candidates.size(); placed++) {
+        auto slot = std::min_element(slots.begin(), slots.end());
+        size_t next = pickWindowCandidate(candidates, taken, *slot);
+        if (next == candidates.size()) {
+            // Nothing due yet: the slot idles until the earliest remaining run
+            auto earliest = std::chrono::system_clock::time_point::max();
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (!taken[i]) {
+                    earliest = std::min(earliest, candidates[i].due);
+                }
+            }
+            *slot = earliest;
+            next = pickWindowCandidate(candidates, taken, *slot);
+        }
+
+        taken[next] = true;
+        WindowPlanEntry entry;
+        entry.vmId = vmIds[next];
+        entry.start = *slot;
+        entry.finish = *slot + candidates[next].predicted;
+        entry.fits = entry.finish <= plan.windowEnd;
+        plan.fits = plan.fits && entry.fits;
+        plan.entries.push_back(entry);
+        *slot = entry.finish;
+    }
+    return plan;
+}
+
+void BackupScheduler::checkWindowPlan(std::chrono::system_clock::time_point now) {
+    auto windowStart = getNextWindowStart(now);
+    nextPlanCheck_ = getNextWindowStart(windowStart) - std::chrono::minutes(window_.warningLeadMinutes);
+
+    WindowPlan plan = planWindow(windowStart, now);
+    if (plan.fits) {
+        Logger::info("Backup window plan: " + std::to_string(plan.entries.size()) +
+                     " run(s) fit in the next window");
+        return;
+    }
+
+    std::string late;
+    auto overrun = std::chrono::system_clock::duration::zero();
+    size_t lateCount = 0;
+    for (const auto& entry : plan.entries) {
+        if (!entry.fits) {
+            late += (late.empty() ? "" : ", ") + entry.vmId;
+            overrun = std::max(overrun, entry.finish - plan.windowEnd);
+            lateCount++;
+        }
+    }
+    Logger::warning("Next backup window cannot fit all runs: " + std::to_string(lateCount) +
+                    " run(s) expected to finish up to " + formatMinutes(overrun) +
+                    " after it closes (" + late + ")");
+}
+
+void BackupScheduler::takeWindowRuns(std::chrono::system_clock::time_point now,
+                                     std::vector<std::pair<std::string, BackupConfig>>& runs) {
+    auto fallback = std::chrono::seconds(std::chrono::minutes(window_.defaultDurationMinutes));
+    while (windowRunning_ < window_.maxConcurrentJobs && !windowQueue_.empty()) {
+        std::vector<WindowCandidate> candidates;
+        for (const auto& run : windowQueue_) {
+            candidates.push_back({history_->predictDuration(run.vmId, fallback), run.due, run.deadline});
+        }
+        std::vector<bool> taken(candidates.size(), false);
+        size_t next = pickWindowCandidate(candidates, taken, now);
+        if (next == candidates.size()) {
+            break;
+        }
+
+        QueuedRun run = windowQueue_[next];
+        windowQueue_.erase(windowQueue_.begin() + next);
+        auto finish = now + candidates[next].predicted;
+        if (finish > run.deadline) {
+            Logger::warning("Backup of VM " + run.vmId + " is expected to finish " +
+                            formatMinutes(finish - run.deadline) + " after the backup window closes");
+        }
+        windowRunning_++;
+        runs.emplace_back(run.vmId, run.config);
+    }
+}
+
+void BackupScheduler::executeBackup(const std::string& vmId, const BackupConfig& config, bool windowed) {
     try {
         auto job = jobManager_->createBackupJob(config);
         if (job) {
-            job->start();
+            job->addCompletionCallback([this, vmId, windowed](const Job& finished) {
+                onBackupFinished(vmId, windowed, finished);
+            });
+            // JobManager starts the job once its datastores, host and repository have room
+            if (jobManager_->submitJob(job->getId()) || job->getState() != Job::State::PENDING) {
+                return;
+            }
+            // Rejected without finishing, so the callback will never fire
+            Logger::error("Failed to submit backup for VM " + vmId + ": " + jobManager_->getLastError());
+            jobManager_->removeJob(job->getId());
         }
     } catch (const std::exception& e) {
         Logger::error("Failed to execute backup for VM " + vmId + ": " + e.what());
     }
+
+    if (windowed) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            windowRunning_--;
+        }
+        wakeup_.notify_one();
+    }
 }
 
-bool BackupScheduler::shouldRunBackup(const BackupConfig& config) const {
-    auto now = std::chrono::system_clock::now();
-    auto now_time_t = std::chrono::system_clock::to_time_t(now);
-    std::tm* now_tm = std::localtime(&now_time_t);
-    
-    if (config.scheduleType == "once") {
-        return now_tm->tm_hour == config.schedule.hour && 
-               now_tm->tm_min == config.schedule.minute;
-    } else if (config.scheduleType == "daily") {
-        return now_tm->tm_hour == config.schedule.hour && 
-               now_tm->tm_min == config.schedule.minute;
-    } else if (config.scheduleType == "weekly") {
-        return now_tm->tm_wday == config.schedule.day &&
-               now_tm->tm_hour == config.schedule.hour && 
-               now_tm->tm_min == config.schedule.minute;
-    } else if (config.scheduleType == "monthly") {
-        return now_tm->tm_mday == config.schedule.day &&
-               now_tm->tm_hour == config.schedule.hour && 
-               now_tm->tm_min == config.schedule.minute;
+void BackupScheduler::onBackupFinished(const std::string& vmId, bool windowed, const Job& job) {
+    std::shared_ptr<BackupHistory> history;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        history = history_;
+        if (windowed && windowRunning_ > 0) {
+            windowRunning_--;
+        }
+    }
+    if (windowed) {
+        wakeup_.notify_one();
+    }
+
+    // Only complete runs say how long a backup of this VM takes
+    if (job.getState() == Job::State::COMPLETED) {
+        history->record(vmId, job.getRunTime(), job.getBytesTransferred());
+        applyRetentionPolicy(vmId);
+    }
+}
+
+void BackupScheduler::upsertRun(const ScheduledRun& run) {
+    auto it = runIndex_.find(run.vmId);
+    if (it != runIndex_.end()) {
+        size_t index = it->second;
+        runQueue_[index] = run;
+        siftUp(index);
+        siftDown(runIndex_[run.vmId]);
+        return;
+    }
+
+    runQueue_.push_back(run);
+    runIndex_[run.vmId] = runQueue_.size() - 1;
+    siftUp(runQueue_.size() - 1);
+}
+
+void BackupScheduler::removeRun(const std::string& vmId) {
+    auto it = runIndex_.find(vmId);
+    if (it == runIndex_.end()) {
+        return;
+    }
+
+    size_t index = it->second;
+    size_t last = runQueue_.size() - 1;
+    if (index != last) {
+        swapRuns(index, last);
+    }
+    runQueue_.pop_back();
+    runIndex_.erase(vmId);
+    if (index < runQueue_.size()) {
+        siftUp(index);
+        siftDown(index);
+    }
+}
+
+void BackupScheduler::swapRuns(size_t a, size_t b) {
+    std::swap(runQueue_[a], runQueue_[b]);
+    runIndex_[runQueue_[a].vmId] = a;
+    runIndex_[runQueue_[b].vmId] = b;
+}
+
+void BackupScheduler::siftUp(size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (runQueue_[parent].due <= runQueue_[index].due) {
+            break;
+        }
+        swapRuns(parent, index);
+        index = parent;
+    }
+}
+
+void BackupScheduler::siftDown(size_t index) {
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < runQueue_.size() && runQueue_[left].due < runQueue_[smallest].due) {
+            smallest = left;
+        }
+        if (right < runQueue_.size() && runQueue_[right].due < runQueue_[smallest].due) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        swapRuns(index, smallest);
+        index = smallest;
     }
-    
-    return false;
 }
 
 std::optional<std::chrono::system_clock::time_point> BackupScheduler::getLastBackupTime(const std::string& vmId) const {
-    auto backupPaths = getBackupPaths(vmId);
-    if (backupPaths.empty()) {
+    auto catalog = BackupCatalog::forRepository(getBackupConfig(vmId).backupDir);
+    auto latest = catalog ? catalog->latest(vmId) : std::nullopt;
+    if (!latest) {
         return std::nullopt;
     }
-
-    // Get the most recent backup
-    auto lastBackup = std::filesystem::last_write_time(backupPaths.front());
-    
-    // Convert file_time_type to system_clock::time_point
-    auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-        lastBackup - std::filesystem::file_time_type::clock::now()
-        + std::chrono::system_clock::now());
-    
-    return sctp;
-} 
\ No newline at end of file
+    return std::chrono::system_clock::time_point(std::chrono::seconds(latest->timestamp));
+}
\ No newline at end of file
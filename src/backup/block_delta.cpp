@@ -0,0 +1,371 @@
+#include "backup/block_delta.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <zlib.h>
+
+namespace {
+
+const char kSignatureMagic[4] = {'G', 'S', 'I', 'G'};
+const char kDeltaMagic[4] = {'G', 'D', 'L', 'T'};
+const uint8_t kOpCopy = 1;
+const uint8_t kOpLiteral = 2;
+const size_t kFilterBits = 1 << 20;
+
+template <typename T>
+void putValue(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool getValue(const std::string& in, size_t& position, T& value) {
+    if (in.size() - position < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, in.data() + position, sizeof(value));
+    position += sizeof(value);
+    return true;
+}
+
+size_t filterSlot(uint32_t weak) {
+    return (weak * 2654435761u) >> 12;
+}
+
+bool readFull(int fd, uint64_t offset, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t done = pread(fd, data, size, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        data += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+}
+
+bool writeFull(int fd, uint64_t offset, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t done = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        data += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+}
+
+} // namespace
+
+void RollingChecksum::reset(const uint8_t* data, size_t size) {
+    a_ = 0;
+    b_ = 0;
+    size_ = size;
+    for (size_t i = 0; i < size; i++) {
+        a_ += data[i];
+        b_ += static_cast<uint32_t>(size - i) * data[i];
+    }
+}
+
+void RollingChecksum::roll(uint8_t out, uint8_t in) {
+    // Sums wrap modulo 2^32, so their low 16 bits stay exact
+    a_ += in - static_cast<uint32_t>(out);
+    b_ += a_ - static_cast<uint32_t>(size_) * out;
+}
+
+BlockHash computeBlockHash(const void* data, size_t size) {
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data, size, digest, &length, EVP_sha256(), nullptr);
+    BlockHash hash{};
+    memcpy(hash.data(), digest, hash.size());
+    return hash;
+}
+
+std::string BlockSignature::serialize() const {
+    std::string out(kSignatureMagic, sizeof(kSignatureMagic));
+    putValue(out, blockSize);
+    putValue(out, basisSize);
+    putValue(out, static_cast<uint64_t>(weak.size()));
+    for (size_t i = 0; i < weak.size(); i++) {
+        putValue(out, weak[i]);
+        out.append(reinterpret_cast<const char*>(strong[i].data()), strong[i].size());
+    }
+    return out;
+}
+
+bool BlockSignature::parse(const std::string& data, std::string& error) {
+    size_t position = sizeof(kSignatureMagic);
+    uint64_t count = 0;
+    if (data.size() < position || memcmp(data.data(), kSignatureMagic, position) != 0 ||
+        !getValue(data, position, blockSize) || !getValue(data, position, basisSize) ||
+        !getValue(data, position, count) || blockSize == 0 ||
+        (data.size() - position) / (sizeof(uint32_t) + sizeof(BlockHash)) != count ||
+        (data.size() - position) % (sizeof(uint32_t) + sizeof(BlockHash)) != 0) {
+        error = "Malformed block signature";
+        return false;
+    }
+    weak.resize(count);
+    strong.resize(count);
+    for (uint64_t i = 0; i < count; i++) {
+        getValue(data, position, weak[i]);
+        memcpy(strong[i].data(), data.data() + position, sizeof(BlockHash));
+        position += sizeof(BlockHash);
+    }
+    return true;
+}
+
+bool computeSignature(const std::string& path, uint32_t blockSize, BlockSignature& signature, std::string& error) {
+    signature = BlockSignature();
+    signature.blockSize = blockSize;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        error = "Failed to open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    // Many blocks per read; a partial block at the end is left out
+    std::vector<uint8_t> buffer(static_cast<size_t>(blockSize) * 64);
+    size_t filled = 0;
+    RollingChecksum checksum;
+    while (true) {
+        ssize_t done = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done < 0) {
+            error = "Failed to read " + path + ": " + strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        filled += done;
+        signature.basisSize += done;
+        if (done > 0 && filled < buffer.size()) {
+            continue;
+        }
+
+        size_t blocks = filled / blockSize;
+        for (size_t i = 0; i < blocks; i++) {
+            const uint8_t* block = buffer.data() + i * blockSize;
+            checksum.reset(block, blockSize);
+            signature.weak.push_back(checksum.value());
+            signature.strong.push_back(computeBlockHash(block, blockSize));
+        }
+        if (done == 0) {
+            break;
+        }
+        filled -= blocks * blockSize;
+        memmove(buffer.data(), buffer.data() + blocks * blockSize, filled);
+    }
+    ::close(fd);
+    return true;
+}
+
+BlockMatcher::BlockMatcher(const BlockSignature& signature)
+    : signature_(signature)
+    , filter_(kFilterBits / 64) {
+    byWeak_.reserve(signature.weak.size());
+    for (size_t i = 0; i < signature.weak.size(); i++) {
+        byWeak_.emplace_back(signature.weak[i], static_cast<uint32_t>(i));
+        size_t slot = filterSlot(signature.weak[i]);
+        filter_[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+    std::sort(byWeak_.begin(), byWeak_.end());
+}
+
+int64_t BlockMatcher::find(uint32_t weak, const uint8_t* data) const {
+    size_t slot = filterSlot(weak);
+    if (!(filter_[slot / 64] & (uint64_t(1) << (slot % 64)))) {
+        return -1;
+    }
+    auto range = std::equal_range(byWeak_.begin(), byWeak_.end(), std::make_pair(weak, uint32_t(0)),
+                                  [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+                                      return a.first < b.first;
+                                  });
+    if (range.first == range.second) {
+        return -1;
+    }
+    BlockHash hash = computeBlockHash(data, signature_.blockSize);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (signature_.strong[it->second] == hash) {
+            return it->second;
+        }
+    }
+    return -1;
+}
+
+bool computeDelta(int fd, uint64_t fileSize, uint64_t offset, uint64_t length, const BlockMatcher& matcher,
+                  uint32_t blockSize, int compressionLevel, std::string& delta, DeltaStats& stats,
+                  std::string& error) {
+    uint64_t end = std::min(fileSize, offset + length);
+    if (offset > end) {
+        error = "Delta range past the end of the file";
+        return false;
+    }
+    // A window starting in the range may reach blockSize - 1 bytes past it
+    uint64_t readEnd = std::min(fileSize, end + blockSize - 1);
+    std::vector<uint8_t> buffer(readEnd - offset);
+    if (!readFull(fd, offset, buffer.data(), buffer.size())) {
+        error = std::string("Failed to read delta source: ") + strerror(errno);
+        return false;
+    }
+    const size_t size = buffer.size();
+    const size_t rangeSize = end - offset;
+
+    std::string ops;
+    uint32_t copyStart = 0;
+    uint32_t copyCount = 0;
+    auto flushCopy = [&]() {
+        if (copyCount > 0) {
+            ops.push_back(static_cast<char>(kOpCopy));
+            putValue(ops, copyStart);
+            putValue(ops, copyCount);
+            copyCount = 0;
+        }
+    };
+    auto emitLiteral = [&](size_t from, size_t to) {
+        if (from >= to) {
+            return;
+        }
+        flushCopy();
+        ops.push_back(static_cast<char>(kOpLiteral));
+        putValue(ops, static_cast<uint32_t>(to - from));
+        ops.append(reinterpret_cast<const char*>(buffer.data() + from), to - from);
+        stats.literalBytes += to - from;
+    };
+
+    size_t literalStart = 0;
+    size_t position = 0;
+    if (!matcher.empty()) {
+        RollingChecksum checksum;
+        bool valid = false;
+        while (position < rangeSize && position + blockSize <= size) {
+            if (!valid) {
+                checksum.reset(buffer.data() + position, blockSize);
+                valid = true;
+            }
+            int64_t block = matcher.find(checksum.value(), buffer.data() + position);
+            if (block >= 0) {
+                emitLiteral(literalStart, position);
+                if (copyCount > 0 && copyStart + copyCount == static_cast<uint64_t>(block)) {
+                    copyCount++;
+                } else {
+                    flushCopy();
+                    copyStart = static_cast<uint32_t>(block);
+                    copyCount = 1;
+                }
+                stats.matchedBytes += blockSize;
+                position += blockSize;
+                literalStart = position;
+                valid = false;
+                continue;
+            }
+            if (position + blockSize < size) {
+                checksum.roll(buffer[position], buffer[position + blockSize]);
+            }
+            position++;
+        }
+    }
+    emitLiteral(literalStart, rangeSize);
+    flushCopy();
+
+    delta.assign(kDeltaMagic, sizeof(kDeltaMagic));
+    putValue(delta, offset);
+    putValue(delta, static_cast<uint64_t>(ops.size()));
+    if (compressionLevel > 0 && !ops.empty()) {
+        uLongf compressedSize = compressBound(ops.size());
+        std::string compressed(compressedSize, '\0');
+        if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressedSize,
+                      reinterpret_cast<const Bytef*>(ops.data()), ops.size(), compressionLevel) == Z_OK &&
+            compressedSize < ops.size()) {
+            delta.push_back(1);
+            delta.append(compressed.data(), compressedSize);
+            return true;
+        }
+    }
+    delta.push_back(0);
+    delta.append(ops);
+    return true;
+}
+
+bool applyDelta(const std::string& delta, int basisFd, uint32_t blockSize, int outputFd, std::string& error) {
+    size_t position = sizeof(kDeltaMagic);
+    uint64_t offset = 0;
+    uint64_t rawSize = 0;
+    uint8_t compressed = 0;
+    if (delta.size() < position || memcmp(delta.data(), kDeltaMagic, position) != 0 ||
+        !getValue(delta, position, offset) || !getValue(delta, position, rawSize) ||
+        !getValue(delta, position, compressed)) {
+        error = "Malformed delta";
+        return false;
+    }
+
+    std::string ops;
+    if (compressed) {
+        ops.resize(rawSize);
+        uLongf size = rawSize;
+        if (uncompress(reinterpret_cast<Bytef*>(&ops[0]), &size,
+                       reinterpret_cast<const Bytef*>(delta.data() + position), delta.size() - position) != Z_OK ||
+            size != rawSize) {
+            error = "Failed to inflate delta";
+            return false;
+        }
+    } else {
+        ops = delta.substr(position);
+    }
+
+    std::vector<uint8_t> block(blockSize);
+    position = 0;
+    while (position < ops.size()) {
+        uint8_t op = static_cast<uint8_t>(ops[position++]);
+        if (op == kOpCopy) {
+            uint32_t start = 0;
+            uint32_t count = 0;
+            if (!getValue(ops, position, start) || !getValue(ops, position, count) || basisFd < 0) {
+                error = "Malformed delta block reference";
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (!readFull(basisFd, static_cast<uint64_t>(start + i) * blockSize, block.data(), blockSize)) {
+                    error = std::string("Failed to read basis: ") + strerror(errno);
+                    return false;
+                }
+                if (!writeFull(outputFd, offset, block.data(), blockSize)) {
+                    error = std::string("Failed to write delta output: ") + strerror(errno);
+                    return false;
+                }
+                offset += blockSize;
+            }
+        } else if (op == kOpLiteral) {
+            uint32_t length = 0;
+            if (!getValue(ops, position, length) || ops.size() - position < length) {
+                error = "Malformed delta literal";
+                return false;
+            }
+            if (!writeFull(outputFd, offset, reinterpret_cast<const uint8_t*>(ops.data() + position), length)) {
+                error = std::string("Failed to write delta output: ") + strerror(errno);
+                return false;
+            }
+            position += length;
+            offset += length;
+        } else {
+            error = "Unknown delta operation";
+            return false;
+        }
+    }
+    return true;
+}
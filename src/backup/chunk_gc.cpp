@@ -0,0 +1,358 @@
+#include "backup/chunk_gc.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <tuple>
+
+GcCycle::GcCycle(std::shared_ptr<ChunkRepository> repository, const GcConfig& config)
+    : repository_(std::move(repository))
+    , config_(config)
+    , budget_(config.compactBytesPerSecond) {
+    config_.markBatch = std::max<size_t>(config_.markBatch, 1);
+    config_.sweepBatch = std::max<size_t>(config_.sweepBatch, 1);
+    config_.compactStepBytes = std::max<uint64_t>(config_.compactStepBytes, 1);
+    stats_.repository = repository_->getDirectory();
+}
+
+bool GcCycle::step() {
+    switch (phase_) {
+    case Phase::START:
+        start();
+        break;
+    case Phase::MARK:
+        mark();
+        break;
+    case Phase::SWEEP:
+        sweep();
+        break;
+    case Phase::COMPACT:
+        compact();
+        break;
+    case Phase::RECLAIM:
+        reclaim();
+        break;
+    case Phase::DONE:
+        break;
+    }
+    return phase_ != Phase::DONE;
+}
+
+void GcCycle::start() {
+    started_ = std::chrono::steady_clock::now();
+    uint64_t epoch = repository_->advanceEpoch();
+    sweepEpoch_ = repository_->getSweepEpoch(epoch);
+    stats_.epoch = epoch;
+
+    roots_ = repository_->listRoots();
+    // Marking order is the compaction layout; the latest backups come first
+    std::reverse(roots_.begin(), roots_.end());
+    stats_.roots = roots_.size();
+    for (const auto& pack : repository_->listPacks()) {
+        if (pack.sealed) {
+            packs_.push_back(pack);
+        }
+    }
+    phase_ = Phase::MARK;
+}
+
+void GcCycle::mark() {
+    size_t budget = config_.markBatch;
+    while (budget > 0) {
+        if (nextChunk_ == rootChunks_.size()) {
+            if (nextRoot_ == roots_.size()) {
+                stats_.liveChunks = live_.size();
+                phase_ = Phase::SWEEP;
+                return;
+            }
+            const std::string& name = roots_[nextRoot_++];
+            nextChunk_ = 0;
+            if (!repository_->readRoot(name, rootChunks_)) {
+                auto roots = repository_->listRoots();
+                if (std::binary_search(roots.begin(), roots.end(), name)) {
+                    // Sweeping without this root could delete chunks it needs
+                    lastError_ = repository_->getLastError();
+                    finish(false);
+                    return;
+                }
+                // Dropped since the collection started
+                rootChunks_.clear();
+            }
+            continue;
+        }
+        size_t count = std::min(budget, rootChunks_.size() - nextChunk_);
+        for (size_t i = nextChunk_; i < nextChunk_ + count; i++) {
+            live_.emplace(rootChunks_[i], live_.size());
+        }
+        nextChunk_ += count;
+        budget -= count;
+    }
+}
+
+void GcCycle::sweep() {
+    auto dead = [this](const ChunkLocation& chunk) { return isDead(chunk); };
+    for (size_t budget = config_.sweepBatch; budget > 0 && nextPack_ < packs_.size(); budget--) {
+        const PackInfo& pack = packs_[nextPack_++];
+        stats_.packsScanned++;
+
+        bool deleted = false;
+        if (!repository_->deletePackIf(pack.id, dead, deleted)) {
+            lastError_ = repository_->getLastError();
+            continue;
+        }
+        if (deleted) {
+            stats_.packsDeleted++;
+            stats_.chunksReclaimed += pack.chunkCount;
+            stats_.bytesReclaimed += pack.size;
+            continue;
+        }
+
+        PackUsage usage;
+        for (const auto& chunk : repository_->getPackChunks(pack.id)) {
+            if (isDead(chunk)) {
+                usage.deadChunks++;
+                usage.deadBytes += chunk.length;
+            } else {
+                usage.liveChunks++;
+                usage.liveBytes += chunk.length;
+            }
+        }
+        if (usage.deadChunks > 0) {
+            stats_.deadBytesRemaining += usage.deadBytes;
+            usage_[pack.id] = usage;
+        }
+    }
+    if (nextPack_ == packs_.size()) {
+        planCompaction();
+    }
+}
+
+void GcCycle::planCompaction() {
+    struct Move {
+        uint64_t order;
+        ChunkLocation chunk;
+    };
+    std::vector<Move> moves;
+    for (const auto& pack : packs_) {
+        auto usage = usage_.find(pack.id);
+        if (usage == usage_.end() ||
+            usage->second.liveBytes >= config_.compactBelow * (usage->second.liveBytes + usage->second.deadBytes)) {
+            continue;
+        }
+        compacted_.push_back(pack);
+        for (const auto& chunk : repository_->getPackChunks(pack.id)) {
+            if (!isDead(chunk)) {
+                // Chunks only kept by their epoch go last
+                auto live = live_.find(chunk.id);
+                moves.push_back({live != live_.end() ? live->second : UINT64_MAX, chunk});
+            }
+        }
+    }
+    if (compacted_.empty()) {
+        finish(true);
+        return;
+    }
+
+    std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) {
+        return a.order != b.order ? a.order < b.order
+                                  : std::tie(a.chunk.pack, a.chunk.offset) < std::tie(b.chunk.pack, b.chunk.offset);
+    });
+    moves_.reserve(moves.size());
+    for (const auto& move : moves) {
+        moves_.push_back(move.chunk);
+    }
+    phase_ = Phase::COMPACT;
+}
+
+void GcCycle::compact() {
+    uint64_t copied = 0;
+    while (nextMove_ < moves_.size() && copied < config_.compactStepBytes) {
+        const ChunkLocation& chunk = moves_[nextMove_++];
+        // Each byte is read once and written once
+        auto wait = budget_.reserve(2ULL * chunk.length);
+        if (wait.count() > 0) {
+            std::this_thread::sleep_for(wait);
+        }
+        if (!repository_->copyChunk(chunk)) {
+            lastError_ = repository_->getLastError();
+            repository_->finishCompaction();
+            finish(false);
+            return;
+        }
+        copied += chunk.length;
+    }
+    stats_.bytesRewritten += copied;
+
+    if (nextMove_ == moves_.size()) {
+        if (!repository_->finishCompaction()) {
+            lastError_ = repository_->getLastError();
+            finish(false);
+            return;
+        }
+        nextPack_ = 0;
+        phase_ = Phase::RECLAIM;
+    }
+}
+
+void GcCycle::reclaim() {
+    auto dead = [this](const ChunkLocation& chunk) { return isDead(chunk); };
+    for (size_t budget = config_.sweepBatch; budget > 0 && nextPack_ < compacted_.size(); budget--) {
+        const PackInfo& pack = compacted_[nextPack_++];
+        bool deleted = false;
+        if (!repository_->deletePackIf(pack.id, dead, deleted)) {
+            lastError_ = repository_->getLastError();
+            continue;
+        }
+        if (deleted) {
+            stats_.packsCompacted++;
+            stats_.bytesReclaimed += pack.size;
+            stats_.deadBytesRemaining -= std::min(stats_.deadBytesRemaining, usage_[pack.id].deadBytes);
+            usage_.erase(pack.id);
+        }
+    }
+    if (nextPack_ == compacted_.size()) {
+        finish(true);
+    }
+}
+
+void GcCycle::finish(bool completed) {
+    stats_.completed = completed;
+    stats_.duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_);
+    phase_ = Phase::DONE;
+    live_.clear();
+    rootChunks_.clear();
+    moves_.clear();
+}
+
+bool GcCycle::isDead(const ChunkLocation& chunk) const {
+    return chunk.epoch < sweepEpoch_ && live_.count(chunk.id) == 0;
+}
+
+GarbageCollector::GarbageCollector(const GcConfig& config)
+    : config_(config) {
+}
+
+GarbageCollector::~GarbageCollector() {
+    stop();
+}
+
+std::shared_ptr<GarbageCollector> GarbageCollector::getDefault() {
+    static auto collector = std::make_shared<GarbageCollector>();
+    return collector;
+}
+
+void GarbageCollector::setConfig(const GcConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+}
+
+GcConfig GarbageCollector::getConfig() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+}
+
+void GarbageCollector::request(const std::shared_ptr<ChunkRepository>& repository) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A collection already under way may have marked what was just dropped
+        auto waiting = queue_.begin() + (collecting_ && !queue_.empty() ? 1 : 0);
+        if (std::find(waiting, queue_.end(), repository) == queue_.end()) {
+            queue_.push_back(repository);
+        }
+        startLocked();
+    }
+    wakeup_.notify_one();
+}
+
+GcStats GarbageCollector::collect(const std::shared_ptr<ChunkRepository>& repository) {
+    GcConfig config = getConfig();
+    GcCycle cycle(repository, config);
+    while (cycle.step()) {
+        std::this_thread::sleep_for(config.stepPause);
+    }
+    report(cycle);
+    return cycle.getStats();
+}
+
+std::optional<GcStats> GarbageCollector::getLastStats(const std::string& directory) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = lastStats_.find(directory);
+    if (it == lastStats_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+size_t GarbageCollector::getPending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void GarbageCollector::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopRequested_ = true;
+    }
+    wakeup_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopRequested_ = false;
+}
+
+void GarbageCollector::startLocked() {
+    if (!worker_.joinable() && !stopRequested_) {
+        worker_ = std::thread(&GarbageCollector::run, this);
+    }
+}
+
+void GarbageCollector::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopRequested_) {
+        if (queue_.empty()) {
+            wakeup_.wait(lock, [this] { return stopRequested_ || !queue_.empty(); });
+            continue;
+        }
+
+        auto repository = queue_.front();
+        GcCycle cycle(repository, config_);
+        collecting_ = true;
+        while (!stopRequested_) {
+            GcConfig config = config_;
+            lock.unlock();
+            bool more = cycle.step();
+            lock.lock();
+            if (!more) {
+                break;
+            }
+            wakeup_.wait_for(lock, config.stepPause, [this] { return stopRequested_; });
+        }
+        collecting_ = false;
+        // A stopped collection is simply abandoned; the next one starts over
+        if (cycle.isDone()) {
+            queue_.pop_front();
+            lock.unlock();
+            report(cycle);
+            lock.lock();
+        }
+    }
+}
+
+void GarbageCollector::report(const GcCycle& cycle) {
+    const GcStats& stats = cycle.getStats();
+    if (stats.completed) {
+        Logger::info("Garbage collection of " + stats.repository + " reclaimed " +
+                     std::to_string(stats.bytesReclaimed) + " bytes in " + std::to_string(stats.packsDeleted) +
+                     " deleted and " + std::to_string(stats.packsCompacted) + " compacted pack(s), rewriting " +
+                     std::to_string(stats.bytesRewritten) + " bytes, in " + std::to_string(stats.duration.count()) +
+                     " ms; " +
+                     std::to_string(stats.liveChunks) + " live chunk(s) in " + std::to_string(stats.roots) +
+                     " root(s), " + std::to_string(stats.deadBytesRemaining) +
+                     " dead bytes left in partly live packs");
+    } else {
+        Logger::error("Garbage collection of " + stats.repository + " aborted after " +
+                      std::to_string(stats.duration.count()) + " ms: " + cycle.getLastError());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastStats_[stats.repository] = stats;
+}
@@ -0,0 +1,1111 @@
+#include "backup/chunk_repository.hpp"
+#include "backup/local_backend.hpp"
+#include "common/file_utils.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <openssl/evp.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char PACK_MAGIC[8] = {'G', 'V', 'C', 'H', 'P', 'A', 'C', 'K'};
+constexpr char PACK_INDEX_MAGIC[8] = {'G', 'V', 'C', 'H', 'P', 'I', 'D', 'X'};
+constexpr char ROOT_MAGIC[8] = {'G', 'V', 'C', 'H', 'R', 'O', 'O', 'T'};
+constexpr uint32_t FORMAT_VERSION = 1;
+constexpr uint32_t MAX_CHUNK_SIZE = 64u << 20;
+
+struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+static_assert(sizeof(PackHeader) == 16, "pack header layout");
+
+// Precedes each chunk's data in a pack
+struct RecordHeader {
+    uint32_t length;
+    uint32_t crc;  // Of the data
+    uint8_t id[32];
+};
+static_assert(sizeof(RecordHeader) == 40, "pack record layout");
+
+struct PackIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t packSize;  // Of the pack when it was sealed
+    uint32_t crc;       // Of the records
+    uint32_t reserved;
+};
+static_assert(sizeof(PackIndexHeader) == 32, "pack index header layout");
+
+struct PackIndexRecord {
+    uint8_t id[32];
+    uint64_t offset;
+    uint32_t length;
+    uint32_t crc;
+};
+static_assert(sizeof(PackIndexRecord) == 48, "pack index record layout");
+
+struct RootHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t crc;  // Of the ids
+    uint64_t count;
+};
+static_assert(sizeof(RootHeader) == 24, "root header layout");
+
+std::string packName(uint64_t id) {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(id));
+    return name;
+}
+
+bool validRootName(const std::string& name) {
+    return !name.empty() && name[0] != '.' && name.find('/') == std::string::npos;
+}
+
+// Ids of the pack and pack index objects stored in a backend
+bool listPackObjects(StorageBackend& backend, std::set<uint64_t>& packs, std::set<uint64_t>& indexes) {
+    std::vector<std::string> keys;
+    if (!backend.list("packs/", keys)) {
+        return false;
+    }
+    for (const auto& key : keys) {
+        fs::path name = fs::path(key).filename();
+        std::string stem = name.stem().string();
+        if (stem.size() != 16 || stem.find_first_not_of("0123456789abcdef") != std::string::npos) {
+            continue;
+        }
+        uint64_t id = std::stoull(stem, nullptr, 16);
+        if (name.extension() == ".pack") {
+            packs.insert(id);
+        } else if (name.extension() == ".idx") {
+            indexes.insert(id);
+        }
+    }
+    return true;
+}
+
+// Chunks listed by a pack index, or false if the index is damaged
+bool parseIndex(const std::vector<uint8_t>& content, uint64_t id, uint64_t& packSize,
+                std::vector<ChunkLocation>& chunks) {
+    PackIndexHeader header{};
+    if (content.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, content.data(), sizeof(header));
+    const uint8_t* records = content.data() + sizeof(header);
+    size_t recordsSize = content.size() - sizeof(header);
+    if (std::memcmp(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FORMAT_VERSION ||
+        recordsSize != static_cast<size_t>(header.count) * sizeof(PackIndexRecord) ||
+        header.crc != crc32(records, recordsSize)) {
+        return false;
+    }
+
+    packSize = header.packSize;
+    chunks.reserve(header.count);
+    for (uint32_t i = 0; i < header.count; i++) {
+        PackIndexRecord record{};
+        std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+        ChunkLocation chunk;
+        std::memcpy(chunk.id.data(), record.id, sizeof(record.id));
+        chunk.pack = id;
+        chunk.offset = record.offset;
+        chunk.length = record.length;
+        chunk.crc = record.crc;
+        chunks.push_back(chunk);
+    }
+    return true;
+}
+
+// Chunk stores opened for backup repositories, keyed by repository path
+std::mutex registryMutex;
+std::map<std::string, std::shared_ptr<ChunkRepository>> registry;
+ChunkRepositoryConfig registryConfig;
+
+// Empty for a path that is not a directory
+std::string registryKey(const std::string& repository) {
+    std::error_code ec;
+    if (repository.empty() || !fs::is_directory(repository, ec)) {
+        return "";
+    }
+    std::string key = fs::absolute(repository, ec).lexically_normal().string();
+    while (key.size() > 1 && key.back() == '/') {
+        key.pop_back();
+    }
+    return key;
+}
+
+} // namespace
+
+size_t ChunkIdHash::operator()(const ChunkId& id) const {
+    size_t hash;
+    std::memcpy(&hash, id.data(), sizeof(hash));
+    return hash;
+}
+
+ChunkId computeChunkId(const void* data, size_t size) {
+    ChunkId id{};
+    unsigned int length = 0;
+    EVP_Digest(data, size, id.data(), &length, EVP_sha256(), nullptr);
+    return id;
+}
+
+std::string chunkIdToHex(const ChunkId& id) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(id.size() * 2);
+    for (uint8_t byte : id) {
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 0x0F]);
+    }
+    return hex;
+}
+
+ChunkSession::ChunkSession(ChunkRepository* repository, uint64_t epoch)
+    : repository_(repository)
+    , epoch_(epoch) {
+}
+
+ChunkSession::~ChunkSession() {
+    repository_->endSession(epoch_);
+}
+
+ChunkRepository::ChunkRepository(const std::string& directory, const ChunkRepositoryConfig& config)
+    : backend_(std::make_shared<LocalBackend>(directory))
+    , directory_(directory)
+    , lockPath_(directory + "/lock")
+    , config_(config) {
+}
+
+ChunkRepository::ChunkRepository(std::shared_ptr<StorageBackend> backend, const ChunkRepositoryConfig& config)
+    : backend_(std::move(backend))
+    , directory_(backend_->describe())
+    , config_(config) {
+}
+
+ChunkRepository::~ChunkRepository() {
+    close();
+}
+
+std::shared_ptr<ChunkRepository> ChunkRepository::forRepository(const std::string& repository, bool create) {
+    std::string key = registryKey(repository);
+    if (key.empty()) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto it = registry.find(key);
+    if (it != registry.end()) {
+        return it->second;
+    }
+    std::error_code ec;
+    if (!create && !fs::is_directory(key + "/.chunks", ec)) {
+        return nullptr;
+    }
+
+    auto chunks = std::make_shared<ChunkRepository>(key + "/.chunks", registryConfig);
+    if (!chunks->open()) {
+        return nullptr;
+    }
+    registry[key] = chunks;
+    return chunks;
+}
+
+std::shared_ptr<ChunkRepository> ChunkRepository::forRepository(const std::string& repository,
+                                                                std::shared_ptr<StorageBackend> backend,
+                                                                std::string& error) {
+    std::string key = registryKey(repository);
+    if (key.empty()) {
+        error = "Not a directory: " + repository;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto it = registry.find(key);
+    if (it != registry.end()) {
+        if (it->second->getBackend()->describe() != backend->describe()) {
+            error = "Chunk store of " + repository + " is already open on " + it->second->getDirectory();
+            return nullptr;
+        }
+        return it->second;
+    }
+
+    auto chunks = std::make_shared<ChunkRepository>(std::move(backend), registryConfig);
+    if (!chunks->open()) {
+        error = chunks->getLastError();
+        return nullptr;
+    }
+    registry[key] = chunks;
+    return chunks;
+}
+
+void ChunkRepository::setRepositoryConfig(const ChunkRepositoryConfig& config) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registryConfig = config;
+}
+
+ChunkRepositoryConfig ChunkRepository::getRepositoryConfig() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return registryConfig;
+}
+
+bool ChunkRepository::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (open_) {
+        return true;
+    }
+
+    if (!lockPath_.empty()) {
+        std::error_code ec;
+        fs::create_directories(directory_, ec);
+        int fd = ::open(lockPath_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            lastError_ = "Failed to lock chunk repository " + directory_ + ": " + std::strerror(errno);
+            Logger::error(lastError_);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        lockFd_ = fd;
+    }
+
+    auto fail = [this]() {
+        Logger::error(lastError_);
+        packs_.clear();
+        index_.clear();
+        if (lockFd_ >= 0) {
+            ::close(lockFd_);
+            lockFd_ = -1;
+        }
+        return false;
+    };
+
+    std::set<uint64_t> ids;
+    std::set<uint64_t> indexes;
+    if (!listPackObjects(*backend_, ids, indexes)) {
+        lastError_ = "Failed to list packs of chunk repository " + directory_ + ": " + backend_->getLastError();
+        return fail();
+    }
+    for (uint64_t id : indexes) {
+        if (!ids.count(id)) {
+            // The pack was deleted but its index was not
+            backend_->remove(indexKey(id));
+        }
+    }
+
+    for (uint64_t id : ids) {
+        if (!loadPack(id, indexes.count(id) > 0, false)) {
+            return fail();
+        }
+        nextPack_ = id + 1;
+    }
+
+    stopping_ = false;
+    for (size_t i = 0; i < std::max<size_t>(1, config_.uploadThreads); i++) {
+        uploaders_.emplace_back(&ChunkRepository::runUploads, this);
+    }
+    open_ = true;
+
+    Logger::debug("Opened chunk repository " + directory_ + " with " + std::to_string(index_.size()) +
+                  " chunks in " + std::to_string(packs_.size()) + " packs");
+    return true;
+}
+
+void ChunkRepository::close() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!open_) {
+        return;
+    }
+    sealLocked(writePack_);
+    sealLocked(compactPack_);
+    if (!waitForUploads(lock)) {
+        Logger::warning("Closing chunk repository " + directory_ + " with packs that were not uploaded");
+    }
+
+    stopping_ = true;
+    lock.unlock();
+    uploadReady_.notify_all();
+    for (auto& uploader : uploaders_) {
+        uploader.join();
+    }
+    lock.lock();
+
+    uploaders_.clear();
+    packs_.clear();
+    index_.clear();
+    uploadQueue_.clear();
+    uploadError_.clear();
+    capacity_.reset();
+    if (lockFd_ >= 0) {
+        ::close(lockFd_);
+        lockFd_ = -1;
+    }
+    open_ = false;
+}
+
+std::unique_ptr<ChunkSession> ChunkRepository::beginSession() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.insert(epoch_);
+    return std::unique_ptr<ChunkSession>(new ChunkSession(this, epoch_));
+}
+
+void ChunkRepository::endSession(uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(epoch);
+    if (it != sessions_.end()) {
+        sessions_.erase(it);
+    }
+}
+
+bool ChunkRepository::put(const ChunkSession& session, const void* data, size_t size, ChunkId& id, bool* stored) {
+    if (stored) {
+        *stored = false;
+    }
+    if (size > MAX_CHUNK_SIZE) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Chunk of " + std::to_string(size) + " bytes is too large";
+        return false;
+    }
+    id = computeChunkId(data, size);
+
+    ChunkLocation chunk;
+    chunk.id = id;
+    chunk.length = static_cast<uint32_t>(size);
+    chunk.crc = crc32(data, size);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!open_) {
+        lastError_ = "Chunk repository is not open";
+        return false;
+    }
+    // The session is what keeps the chunk from being swept until it is committed
+    if (session.repository_ != this) {
+        lastError_ = "Session belongs to another chunk repository";
+        return false;
+    }
+
+    auto it = index_.find(id);
+    if (it != index_.end()) {
+        packs_[it->second.pack].chunks[it->second.position].epoch = epoch_;
+        return true;
+    }
+    if (!uploadError_.empty()) {
+        lastError_ = uploadError_;
+        return false;
+    }
+
+    chunk.epoch = epoch_;
+    ChunkLocation added;
+    appendLocked(writePack_, chunk, data, added);
+    Pack& pack = packs_[added.pack];
+    indexChunk(added.pack, static_cast<uint32_t>(pack.chunks.size() - 1), added);
+    if (stored) {
+        *stored = true;
+    }
+
+    if (pack.size >= config_.packSize) {
+        sealLocked(writePack_);
+        // Hold the writer while too many sealed packs wait for upload
+        uploadDone_.wait(lock, [this] {
+            return pendingUploads_ <= config_.maxPendingPacks || !uploadError_.empty();
+        });
+    }
+    return true;
+}
+
+bool ChunkRepository::get(const ChunkId& id, std::vector<uint8_t>& data) {
+    ChunkLocation chunk;
+    std::shared_ptr<StorageBackend> backend;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(id);
+        if (it == index_.end()) {
+            lastError_ = "Chunk " + chunkIdToHex(id) + " is not stored";
+            return false;
+        }
+        const Pack& pack = packs_[it->second.pack];
+        chunk = pack.chunks[it->second.position];
+        if (pack.data) {
+            // Not uploaded yet; copied here since put() may still append
+            const uint8_t* begin = reinterpret_cast<const uint8_t*>(pack.data->data()) + chunk.offset;
+            data.assign(begin, begin + chunk.length);
+        } else {
+            backend = tierOf(pack);
+        }
+    }
+
+    if ((backend && !readStored(chunk, backend, data)) ||
+        data.size() != chunk.length || crc32(data.data(), data.size()) != chunk.crc) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Chunk " + chunkIdToHex(id) + " in pack " + packKey(chunk.pack) + " of " + directory_ +
+                     " is unreadable or corrupt";
+        Logger::error(lastError_);
+        return false;
+    }
+    return true;
+}
+
+bool ChunkRepository::contains(const ChunkId& id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.count(id) > 0;
+}
+
+bool ChunkRepository::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    sealLocked(writePack_);
+    return waitForUploads(lock);
+}
+
+bool ChunkRepository::commitRoot(const ChunkSession& session, const std::string& name,
+                                 const std::vector<ChunkId>& chunks) {
+    std::string ids;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!validRootName(name)) {
+            lastError_ = "Invalid root name: " + name;
+            return false;
+        }
+        if (session.repository_ != this) {
+            lastError_ = "Session belongs to another chunk repository";
+            return false;
+        }
+        // A root may only reference chunks that are stored
+        sealLocked(writePack_);
+        if (!waitForUploads(lock)) {
+            return false;
+        }
+
+        ids.reserve(chunks.size() * sizeof(ChunkId));
+        for (const auto& id : chunks) {
+            auto it = index_.find(id);
+            if (it == index_.end()) {
+                lastError_ = "Root " + name + " references missing chunk " + chunkIdToHex(id);
+                Logger::error(lastError_);
+                return false;
+            }
+            // A collection that already listed the roots must not sweep these
+            packs_[it->second.pack].chunks[it->second.position].epoch = epoch_;
+            ids.append(reinterpret_cast<const char*>(id.data()), id.size());
+        }
+    }
+
+    RootHeader header{};
+    std::memcpy(header.magic, ROOT_MAGIC, sizeof(header.magic));
+    header.version = FORMAT_VERSION;
+    header.crc = crc32(ids.data(), ids.size());
+    header.count = chunks.size();
+    std::string content(reinterpret_cast<const char*>(&header), sizeof(header));
+    content += ids;
+
+    // Outside the lock; the open session keeps the chunks from being swept
+    if (!backend_->put(rootKey(name), content.data(), content.size())) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to write root " + name + ": " + backend_->getLastError();
+        Logger::error(lastError_);
+        return false;
+    }
+    return true;
+}
+
+bool ChunkRepository::dropRoot(const std::string& name) {
+    if (!validRootName(name) || !backend_->remove(rootKey(name))) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to drop root " + name + ": " + backend_->getLastError();
+        Logger::error(lastError_);
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> ChunkRepository::listRoots() const {
+    std::vector<std::string> keys;
+    std::vector<std::string> names;
+    if (!backend_->list("roots/", keys)) {
+        Logger::error("Failed to list roots of chunk repository " + directory_ + ": " + backend_->getLastError());
+        return names;
+    }
+    for (const auto& key : keys) {
+        fs::path path(key);
+        if (path.extension() == ".root" && path.parent_path() == "roots") {
+            names.push_back(path.stem().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+bool ChunkRepository::readRoot(const std::string& name, std::vector<ChunkId>& chunks) {
+    chunks.clear();
+    std::vector<uint8_t> content;
+    if (!validRootName(name) || !backend_->read(rootKey(name), 0, 0, content)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to read root " + name;
+        return false;
+    }
+
+    RootHeader header{};
+    if (content.size() >= sizeof(header)) {
+        std::memcpy(&header, content.data(), sizeof(header));
+    }
+    const uint8_t* ids = content.data() + sizeof(header);
+    size_t idsSize = content.size() - std::min(content.size(), sizeof(header));
+    if (content.size() < sizeof(header) || std::memcmp(header.magic, ROOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FORMAT_VERSION || header.count != idsSize / sizeof(ChunkId) ||
+        idsSize % sizeof(ChunkId) != 0 || header.crc != crc32(ids, idsSize)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Root " + name + " is corrupt";
+        Logger::error(lastError_);
+        return false;
+    }
+
+    chunks.resize(header.count);
+    if (idsSize > 0) {
+        std::memcpy(chunks.data(), ids, idsSize);
+    }
+    return true;
+}
+
+uint64_t ChunkRepository::advanceEpoch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ++epoch_;
+}
+
+uint64_t ChunkRepository::getSweepEpoch(uint64_t epoch) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.empty() ? epoch : std::min(epoch, *sessions_.begin());
+}
+
+std::vector<PackInfo> ChunkRepository::listPacks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<PackInfo> packs;
+    packs.reserve(packs_.size());
+    for (const auto& [id, pack] : packs_) {
+        packs.push_back({id, pack.size, pack.chunks.size(), pack.sealed, pack.offloaded, pack.sealedAt});
+    }
+    return packs;
+}
+
+std::vector<ChunkLocation> ChunkRepository::getPackChunks(uint64_t pack) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<ChunkLocation> chunks;
+    auto it = packs_.find(pack);
+    if (it == packs_.end()) {
+        return chunks;
+    }
+    for (const auto& chunk : it->second.chunks) {
+        auto slot = index_.find(chunk.id);
+        if (slot != index_.end() && slot->second.pack == pack) {
+            chunks.push_back(chunk);
+        }
+    }
+    return chunks;
+}
+
+bool ChunkRepository::deletePackIf(uint64_t pack, const std::function<bool(const ChunkLocation&)>& dead,
+                                   bool& deleted) {
+    deleted = false;
+    std::shared_ptr<StorageBackend> backend;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = packs_.find(pack);
+        if (it == packs_.end() || !it->second.sealed || it->second.moving) {
+            return true;
+        }
+
+        auto indexedHere = [&](const ChunkLocation& chunk) {
+            auto slot = index_.find(chunk.id);
+            return slot != index_.end() && slot->second.pack == pack;
+        };
+        for (const auto& chunk : it->second.chunks) {
+            // A duplicate of a chunk indexed in another pack is never read
+            if (indexedHere(chunk) && !dead(chunk)) {
+                return true;
+            }
+        }
+        for (const auto& chunk : it->second.chunks) {
+            if (indexedHere(chunk)) {
+                index_.erase(chunk.id);
+            }
+        }
+        backend = tierOf(it->second);
+        packs_.erase(it);
+        deleted = true;
+    }
+
+    // Outside the lock so readers and writers do not wait for the backend.
+    // The index goes last: a pack left without one is rescanned at open.
+    if (!backend->remove(packKey(pack))) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Failed to delete pack " + packKey(pack) + " from " + backend->describe() + ": " +
+                     backend->getLastError();
+        Logger::error(lastError_);
+        return false;
+    }
+    backend->remove(indexKey(pack));
+    return true;
+}
+
+bool ChunkRepository::copyChunk(const ChunkLocation& chunk) {
+    ChunkLocation source;
+    std::vector<uint8_t> data;
+    std::shared_ptr<StorageBackend> backend;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(chunk.id);
+        if (it == index_.end() || it->second.pack != chunk.pack) {
+            // Deleted or already moved
+            return true;
+        }
+        const Pack& pack = packs_[it->second.pack];
+        source = pack.chunks[it->second.position];
+        if (pack.data) {
+            const uint8_t* begin = reinterpret_cast<const uint8_t*>(pack.data->data()) + source.offset;
+            data.assign(begin, begin + source.length);
+        } else {
+            backend = tierOf(pack);
+        }
+    }
+
+    if ((backend && !readStored(source, backend, data)) ||
+        data.size() != source.length || crc32(data.data(), data.size()) != source.crc) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = "Chunk " + chunkIdToHex(source.id) + " in pack " + packKey(source.pack) + " of " +
+                     directory_ + " is unreadable or corrupt";
+        Logger::error(lastError_);
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!uploadError_.empty()) {
+        lastError_ = uploadError_;
+        return false;
+    }
+    ChunkLocation copy;
+    appendLocked(compactPack_, source, data.data(), copy);
+    Pack& pack = packs_[copy.pack];
+    pack.sources.push_back(source);
+
+    if (pack.size >= config_.packSize) {
+        sealLocked(compactPack_);
+        uploadDone_.wait(lock, [this] {
+            return pendingUploads_ <= config_.maxPendingPacks || !uploadError_.empty();
+        });
+    }
+    return true;
+}
+
+bool ChunkRepository::finishCompaction() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    sealLocked(compactPack_);
+    return waitForUploads(lock);
+}
+
+bool ChunkRepository::attachCapacityTier(std::shared_ptr<StorageBackend> capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_ || capacity_ || writePack_ != 0 || compactPack_ != 0 || pendingUploads_ > 0) {
+        lastError_ = "A capacity tier can only be attached to an open chunk repository before it is used";
+        return false;
+    }
+
+    std::set<uint64_t> ids;
+    std::set<uint64_t> indexes;
+    if (!listPackObjects(*capacity, ids, indexes)) {
+        lastError_ = "Failed to list packs of capacity tier " + capacity->describe() + ": " + capacity->getLastError();
+        Logger::error(lastError_);
+        return false;
+    }
+    capacity_ = capacity;
+
+    for (uint64_t id : indexes) {
+        if (!ids.count(id)) {
+            capacity_->remove(indexKey(id));
+        }
+    }
+    size_t loaded = 0;
+    for (uint64_t id : ids) {
+        bool landed = packs_.count(id) > 0;
+        if (landed && !indexes.count(id)) {
+            // A move that stopped before the index was stored; the landing
+            // copy is still complete
+            capacity_->remove(packKey(id));
+            continue;
+        }
+        if (landed) {
+            // A move that stopped before the landing copy was deleted
+            unloadPack(id);
+            backend_->remove(packKey(id));
+            backend_->remove(indexKey(id));
+        }
+        if (!loadPack(id, indexes.count(id) > 0, true)) {
+            Logger::error(lastError_);
+            capacity_.reset();
+            return false;
+        }
+        nextPack_ = std::max(nextPack_, id + 1);
+        loaded++;
+    }
+
+    Logger::info("Attached capacity tier " + capacity_->describe() + " with " + std::to_string(loaded) +
+                 " packs to chunk repository " + directory_);
+    return true;
+}
+
+bool ChunkRepository::hasCapacityTier() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_ != nullptr;
+}
+
+bool ChunkRepository::offloadPack(uint64_t pack, bool& moved) {
+    moved = false;
+    std::shared_ptr<StorageBackend> capacity;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = packs_.find(pack);
+        if (!capacity_ || it == packs_.end() || !it->second.sealed || it->second.offloaded || it->second.moving) {
+            return true;
+        }
+        it->second.moving = true;
+        capacity = capacity_;
+    }
+
+    // The landing copy stays readable until the capacity copy is complete;
+    // collections leave the pack alone meanwhile
+    std::string error;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> index;
+    if (!backend_->read(packKey(pack), 0, 0, data) || !backend_->read(indexKey(pack), 0, 0, index)) {
+        error = "Failed to read pack " + packKey(pack) + " from " + directory_ + ": " + backend_->getLastError();
+    } else {
+        auto writer = capacity->createWriter(packKey(pack));
+        if (!writer || !writer->write(data.data(), data.size()) || !writer->commit() ||
+            !capacity->put(indexKey(pack), index.data(), index.size())) {
+            error = "Failed to copy pack " + packKey(pack) + " to " + capacity->describe() + ": " +
+                    (writer && !writer->getLastError().empty() ? writer->getLastError() : capacity->getLastError());
+            capacity->remove(packKey(pack));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = packs_.find(pack);
+        if (it != packs_.end()) {
+            it->second.moving = false;
+        }
+        if (!error.empty()) {
+            lastError_ = error;
+            Logger::error(lastError_);
+            return false;
+        }
+        if (it == packs_.end()) {
+            // Closed meanwhile
+            return true;
+        }
+        it->second.offloaded = true;
+    }
+    moved = true;
+
+    // Should this fail, the landing copy is deleted when the capacity tier
+    // is attached next time
+    if (!backend_->remove(packKey(pack)) || !backend_->remove(indexKey(pack))) {
+        Logger::warning("Failed to delete moved pack " + packKey(pack) + " from " + directory_ + ": " +
+                        backend_->getLastError());
+    }
+    return true;
+}
+
+std::string ChunkRepository::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool ChunkRepository::loadPack(uint64_t id, bool indexed, bool offloaded) {
+    Pack pack;
+    pack.sealed = true;
+    pack.offloaded = offloaded;
+    pack.sealedAt = static_cast<int64_t>(time(nullptr));
+    std::shared_ptr<StorageBackend> backend = tierOf(pack);
+
+    bool loaded = false;
+    if (indexed) {
+        std::vector<uint8_t> content;
+        loaded = backend->read(indexKey(id), 0, 0, content) && parseIndex(content, id, pack.size, pack.chunks);
+        if (!loaded) {
+            Logger::warning("Index of pack " + packKey(id) + " in " + backend->describe() + " is unreadable, rescanning");
+            pack.chunks.clear();
+        }
+    }
+
+    if (!loaded) {
+        if (!scanPack(id, pack)) {
+            return false;
+        }
+        if (pack.chunks.empty()) {
+            // Nothing survived; the pack was created just before a crash
+            backend->remove(packKey(id));
+            backend->remove(indexKey(id));
+            return true;
+        }
+        // So the next open does not scan it again
+        std::string index = buildIndex(pack);
+        if (!backend->put(indexKey(id), index.data(), index.size())) {
+            lastError_ = "Failed to write index of pack " + packKey(id) + " in " + backend->describe() + ": " +
+                         backend->getLastError();
+            return false;
+        }
+    }
+
+    auto& stored = packs_[id] = std::move(pack);
+    for (uint32_t i = 0; i < stored.chunks.size(); i++) {
+        indexChunk(id, i, stored.chunks[i]);
+    }
+    return true;
+}
+
+bool ChunkRepository::scanPack(uint64_t id, Pack& pack) {
+    std::shared_ptr<StorageBackend> backend = tierOf(pack);
+    std::vector<uint8_t> content;
+    if (!backend->read(packKey(id), 0, 0, content)) {
+        lastError_ = "Failed to read pack " + packKey(id) + " in " + backend->describe() + ": " +
+                     backend->getLastError();
+        return false;
+    }
+
+    PackHeader header{};
+    uint64_t offset = sizeof(header);
+    if (content.size() < sizeof(header)) {
+        offset = 0;
+    } else {
+        std::memcpy(&header, content.data(), sizeof(header));
+        if (std::memcmp(header.magic, PACK_MAGIC, sizeof(header.magic)) != 0 || header.version != FORMAT_VERSION) {
+            offset = 0;
+        }
+    }
+
+    while (offset > 0 && content.size() - offset >= sizeof(RecordHeader)) {
+        RecordHeader record{};
+        std::memcpy(&record, content.data() + offset, sizeof(record));
+        if (record.length > MAX_CHUNK_SIZE || content.size() - offset - sizeof(record) < record.length ||
+            crc32(content.data() + offset + sizeof(record), record.length) != record.crc) {
+            break;
+        }
+        ChunkLocation chunk;
+        std::memcpy(chunk.id.data(), record.id, sizeof(record.id));
+        chunk.pack = id;
+        chunk.offset = offset + sizeof(record);
+        chunk.length = record.length;
+        chunk.crc = record.crc;
+        pack.chunks.push_back(chunk);
+        offset += sizeof(record) + record.length;
+    }
+
+    if (content.size() > offset) {
+        // Records past the damage are not indexed and never read
+        Logger::warning("Ignoring " + std::to_string(content.size() - offset) + " damaged bytes of pack " +
+                        packKey(id) + " in " + backend->describe());
+    }
+    pack.size = offset;
+    return true;
+}
+
+void ChunkRepository::appendLocked(uint64_t& id, const ChunkLocation& chunk, const void* data,
+                                   ChunkLocation& stored) {
+    if (id == 0) {
+        id = nextPack_++;
+        Pack& created = packs_[id];
+        created.data = std::make_shared<std::string>();
+        created.data->reserve(config_.packSize + sizeof(RecordHeader) + chunk.length);
+        PackHeader header{};
+        std::memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+        header.version = FORMAT_VERSION;
+        created.data->append(reinterpret_cast<const char*>(&header), sizeof(header));
+        created.size = sizeof(header);
+        // Compaction rewrites cold data, which belongs on the capacity tier
+        created.offloaded = capacity_ && &id == &compactPack_;
+    }
+    Pack& pack = packs_[id];
+
+    RecordHeader header{};
+    header.length = chunk.length;
+    header.crc = chunk.crc;
+    std::memcpy(header.id, chunk.id.data(), chunk.id.size());
+    pack.data->append(reinterpret_cast<const char*>(&header), sizeof(header));
+    pack.data->append(static_cast<const char*>(data), chunk.length);
+
+    stored = chunk;
+    stored.pack = id;
+    stored.offset = pack.size + sizeof(header);
+    pack.size += sizeof(header) + chunk.length;
+    pack.chunks.push_back(stored);
+}
+
+void ChunkRepository::sealLocked(uint64_t& id) {
+    if (id == 0) {
+        return;
+    }
+    uploadQueue_.push_back(id);
+    pendingUploads_++;
+    id = 0;
+    uploadReady_.notify_one();
+}
+
+bool ChunkRepository::waitForUploads(std::unique_lock<std::mutex>& lock) {
+    uploadDone_.wait(lock, [this] { return pendingUploads_ == 0; });
+    if (!uploadError_.empty()) {
+        lastError_ = uploadError_;
+        return false;
+    }
+    return true;
+}
+
+void ChunkRepository::runUploads() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        uploadReady_.wait(lock, [this] { return stopping_ || !uploadQueue_.empty(); });
+        if (uploadQueue_.empty()) {
+            return;
+        }
+        uint64_t id = uploadQueue_.front();
+        uploadQueue_.pop_front();
+        std::shared_ptr<std::string> data = packs_[id].data;
+        std::string index = buildIndex(packs_[id]);
+        std::shared_ptr<StorageBackend> backend = tierOf(packs_[id]);
+        lock.unlock();
+
+        // The index goes last, so a pack is never listed by an index before
+        // it is stored
+        std::string error;
+        auto writer = backend->createWriter(packKey(id));
+        bool uploaded = writer && writer->write(data->data(), data->size()) && writer->commit();
+        if (!uploaded) {
+            error = writer ? writer->getLastError() : backend->getLastError();
+        } else if (!backend->put(indexKey(id), index.data(), index.size())) {
+            uploaded = false;
+            error = backend->getLastError();
+        }
+
+        lock.lock();
+        Pack& pack = packs_[id];
+        if (uploaded) {
+            pack.sealed = true;
+            pack.sealedAt = static_cast<int64_t>(time(nullptr));
+            pack.data.reset();
+            if (!pack.sources.empty()) {
+                switchToCopies(id);
+            }
+        } else {
+            // The pack stays in memory, so its chunks can still be read
+            uploadError_ = "Failed to upload pack " + packKey(id) + " to " + backend->describe() + ": " + error;
+            lastError_ = uploadError_;
+            Logger::error(uploadError_);
+        }
+        pendingUploads_--;
+        uploadDone_.notify_all();
+    }
+}
+
+void ChunkRepository::switchToCopies(uint64_t id) {
+    Pack& pack = packs_[id];
+    size_t moved = 0;
+    for (uint32_t i = 0; i < pack.chunks.size(); i++) {
+        // Switch every chunk that has not moved since it was copied
+        const ChunkLocation& source = pack.sources[i];
+        auto slot = index_.find(source.id);
+        if (slot == index_.end() || slot->second.pack != source.pack) {
+            continue;
+        }
+        ChunkLocation& old = packs_[source.pack].chunks[slot->second.position];
+        if (old.offset != source.offset) {
+            continue;
+        }
+        pack.chunks[i].epoch = old.epoch;
+        slot->second = Slot{id, i};
+        moved++;
+    }
+    pack.sources.clear();
+    pack.sources.shrink_to_fit();
+    Logger::debug("Moved " + std::to_string(moved) + " chunks into compacted pack " + packKey(id) + " of " +
+                  directory_);
+}
+
+void ChunkRepository::unloadPack(uint64_t id) {
+    auto it = packs_.find(id);
+    if (it == packs_.end()) {
+        return;
+    }
+    for (const auto& chunk : it->second.chunks) {
+        auto slot = index_.find(chunk.id);
+        if (slot != index_.end() && slot->second.pack == id) {
+            index_.erase(slot);
+        }
+    }
+    packs_.erase(it);
+}
+
+std::shared_ptr<StorageBackend> ChunkRepository::tierOf(const Pack& pack) const {
+    return pack.offloaded ? capacity_ : backend_;
+}
+
+bool ChunkRepository::readStored(const ChunkLocation& chunk, std::shared_ptr<StorageBackend> backend,
+                                 std::vector<uint8_t>& data) {
+    if (backend->read(packKey(chunk.pack), chunk.offset, chunk.length, data)) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = packs_.find(chunk.pack);
+        if (it == packs_.end() || tierOf(it->second) == backend) {
+            return false;
+        }
+        backend = tierOf(it->second);
+    }
+    return backend->read(packKey(chunk.pack), chunk.offset, chunk.length, data);
+}
+
+void ChunkRepository::indexChunk(uint64_t id, uint32_t position, const ChunkLocation& chunk) {
+    index_.emplace(chunk.id, Slot{id, position});
+}
+
+std::string ChunkRepository::buildIndex(const Pack& pack) const {
+    std::string records;
+    records.reserve(pack.chunks.size() * sizeof(PackIndexRecord));
+    for (const auto& chunk : pack.chunks) {
+        PackIndexRecord record{};
+        std::memcpy(record.id, chunk.id.data(), sizeof(record.id));
+        record.offset = chunk.offset;
+        record.length = chunk.length;
+        record.crc = chunk.crc;
+        records.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    PackIndexHeader header{};
+    std::memcpy(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic));
+    header.version = FORMAT_VERSION;
+    header.count = static_cast<uint32_t>(pack.chunks.size());
+    header.packSize = pack.size;
+    header.crc = crc32(records.data(), records.size());
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + records;
+}
+
+std::string ChunkRepository::packKey(uint64_t id) {
+    return "packs/" + packName(id) + ".pack";
+}
+
+std::string ChunkRepository::indexKey(uint64_t id) {
+    return "packs/" + packName(id) + ".idx";
+}
+
+std::string ChunkRepository::rootKey(const std::string& name) {
+    return "roots/" + name + ".root";
+}
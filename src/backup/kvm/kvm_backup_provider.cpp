@@ -23,7 +23,7 @@ KVMBackupProvider::~KVMBackupProvider() {
     disconnect();
 }
 
-bool KVMBackupProvider::connect(const std::string& host, const std::string& username, const std::string& password) {
+bool KVMBackupProvider::connect(const std::string& host, const std::string& username, const std::string& /*password*/) {
     if (isConnected()) {
         disconnect();
     }
@@ -62,7 +62,21 @@ bool KVMBackupProvider::getVMDiskPaths(const std::string& vmId, std::vector<std:
     return true;
 }
 
-bool KVMBackupProvider::createSnapshot(const std::string& vmId, std::string& snapshotId) {
+bool KVMBackupProvider::getDiskCapacities(const std::string& vmId, std::map<std::string, uint64_t>& capacities) {
+    std::vector<std::string> diskPaths;
+    if (!getVMDiskPaths(vmId, diskPaths)) {
+        return false;
+    }
+    // Allocated size of the image; qcow2 headers are not parsed here
+    for (const auto& diskPath : diskPaths) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(diskPath, ec);
+        capacities[diskPath] = ec ? 0 : static_cast<uint64_t>(size);
+    }
+    return true;
+}
+
+bool KVMBackupProvider::createSnapshot(const std::string& /*vmId*/, std::string& snapshotId) {
     if (!isConnected()) {
         lastError_ = "Not connected to KVM host";
         return false;
@@ -71,7 +85,7 @@ bool KVMBackupProvider::createSnapshot(const std::string& vmId, std::string& sna
     return true;
 }
 
-bool KVMBackupProvider::removeSnapshot(const std::string& vmId, const std::string& snapshotId) {
+bool KVMBackupProvider::removeSnapshot(const std::string& /*vmId*/, const std::string& /*snapshotId*/) {
     if (!isConnected()) {
         lastError_ = "Not connected to KVM host";
         return false;
@@ -79,7 +93,7 @@ bool KVMBackupProvider::removeSnapshot(const std::string& vmId, const std::strin
     return true;
 }
 
-bool KVMBackupProvider::getChangedBlocks(const std::string& vmId, const std::string& diskPath,
+bool KVMBackupProvider::getChangedBlocks(const std::string& /*vmId*/, const std::string& /*diskPath*/,
                                        std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks) {
     changedBlocks.push_back(std::make_pair(0, 1024 * 1024 * 1024)); // Dummy 1GB block
     return true;
@@ -89,7 +103,8 @@ std::string KVMBackupProvider::getLastError() const {
     return lastError_;
 }
 
-bool KVMBackupProvider::backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config) {
+bool KVMBackupProvider::backupDisk(const std::string& /*vmId*/, const std::string& /*diskPath*/, const BackupConfig& /*config*/,
+                                   const BackupContext& /*context*/) {
     progress_ = 0.0;
     while (progress_ < 100.0) {
         progress_ += 10.0;
@@ -98,23 +113,30 @@ bool KVMBackupProvider::backupDisk(const std::string& vmId, const std::string& d
     return true;
 }
 
-bool KVMBackupProvider::verifyDisk(const std::string& diskPath) {
+bool KVMBackupProvider::finishBackup(const std::string& /*vmId*/, const BackupConfig& /*config*/,
+                                     const BackupContext& /*context*/, bool /*succeeded*/) {
+    // Disk backups keep no state the next backup builds on
+    return true;
+}
+
+bool KVMBackupProvider::verifyDisk(const std::string& /*diskPath*/) {
     return true;
 }
 
-bool KVMBackupProvider::listBackups(std::vector<std::string>& backupDirs) {
+bool KVMBackupProvider::listBackups(std::vector<std::string>& /*backupDirs*/) {
     return true;
 }
 
-bool KVMBackupProvider::deleteBackup(const std::string& backupDir) {
+bool KVMBackupProvider::deleteBackup(const std::string& /*backupDir*/) {
     return true;
 }
 
-bool KVMBackupProvider::verifyBackup(const std::string& backupId) {
+bool KVMBackupProvider::verifyBackup(const std::string& /*backupId*/) {
     return true;
 }
 
-bool KVMBackupProvider::restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config) {
+bool KVMBackupProvider::restoreDisk(const std::string& /*vmId*/, const std::string& /*diskPath*/, const RestoreConfig& /*config*/,
+                                    const RestoreContext& /*context*/) {
     progress_ = 0.0;
     while (progress_ < 100.0) {
         progress_ += 10.0;
@@ -1,4 +1,4 @@
-#include "storage_detector.hpp"
+#include "backup/kvm/storage_detector.hpp"
 #include "common/logger.hpp"
 #include <filesystem>
 #include <fstream>
@@ -10,6 +10,94 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <linux/fs.h>
+#include <sys/sysmacros.h>
+#include <algorithm>
+#include <set>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Spinning disks get few, large sequential requests; flash gets more in flight
+constexpr uint64_t HDD_BLOCK_SIZE = 4 * 1024 * 1024;
+constexpr uint64_t FLASH_BLOCK_SIZE = 1024 * 1024;
+constexpr uint64_t MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+constexpr size_t HDD_QUEUE_DEPTH = 1;
+constexpr size_t SSD_QUEUE_DEPTH = 4;
+constexpr size_t NVME_QUEUE_DEPTH = 8;
+constexpr size_t MAX_QUEUE_DEPTH = 32;
+
+// Device mapper stacks are shallow; this only guards against loops
+constexpr int MAX_STACK_DEPTH = 8;
+
+bool readSysfsValue(const fs::path& file, uint64_t& value) {
+    std::ifstream in(file);
+    return static_cast<bool>(in >> value);
+}
+
+// stackIoSize carries the optimal I/O size of the layers above (e.g. an md
+// stripe width), which the leaves do not report themselves
+void collectLeafDevices(const fs::path& blockDir, const std::string& sysfsRoot, int depth, uint64_t stackIoSize,
+                        std::vector<StorageDetector::DeviceTopology>& devices) {
+    std::error_code ec;
+    fs::path dir = fs::canonical(blockDir, ec);
+    if (ec || depth > MAX_STACK_DEPTH) {
+        return;
+    }
+    // A partition shares the queue of the disk it belongs to
+    if (fs::exists(dir / "partition")) {
+        dir = dir.parent_path();
+    }
+
+    uint64_t optimalIoSize = 0;
+    readSysfsValue(dir / "queue" / "optimal_io_size", optimalIoSize);
+    stackIoSize = std::max(stackIoSize, optimalIoSize);
+
+    std::vector<std::string> slaves;
+    if (fs::is_directory(dir / "slaves", ec)) {
+        for (const auto& entry : fs::directory_iterator(dir / "slaves", ec)) {
+            slaves.push_back(entry.path().filename().string());
+        }
+    }
+    if (!slaves.empty()) {
+        for (const auto& slave : slaves) {
+            collectLeafDevices(fs::path(sysfsRoot) / "class" / "block" / slave, sysfsRoot, depth + 1, stackIoSize,
+                               devices);
+        }
+        return;
+    }
+
+    StorageDetector::DeviceTopology device;
+    device.name = dir.filename().string();
+    for (const auto& known : devices) {
+        if (known.name == device.name) {
+            return;
+        }
+    }
+    uint64_t value = 0;
+    fs::path queue = dir / "queue";
+    if (readSysfsValue(queue / "rotational", value)) {
+        device.rotational = value != 0;
+    }
+    device.optimalIoSize = stackIoSize;
+    readSysfsValue(queue / "max_sectors_kb", device.maxSectorsKb);
+    readSysfsValue(queue / "logical_block_size", device.logicalBlockSize);
+    readSysfsValue(queue / "nr_requests", device.requestQueueSize);
+    device.nvme = device.name.compare(0, 4, "nvme") == 0;
+
+    // NVMe namespaces report the node on their controller's PCI device
+    for (const char* file : {"device/numa_node", "device/device/numa_node"}) {
+        std::ifstream in(dir / file);
+        int node = -1;
+        if (in >> node) {
+            device.numaNode = node;
+            break;
+        }
+    }
+    devices.push_back(device);
+}
+
+} // namespace
 
 std::vector<StorageDetector::StorageInfo> StorageDetector::detectStorageDevices() {
     std::vector<StorageInfo> devices;
@@ -197,13 +285,124 @@ bool StorageDetector::isQCOW2(const std::string& path) {
 }
 
 bool StorageDetector::isLVM(const std::string& path) {
-    // Check if path starts with /dev/mapper/ or /dev/vg_name/
-    return path.find("/dev/mapper/") == 0 || 
-           path.find("/dev/") == 0 && path.find("/") != std::string::npos;
+    // /dev/mapper/<name> or /dev/<vg>/<lv>; a plain /dev/<device> and the
+    // udev links under /dev/disk/ are not logical volumes
+    if (path.compare(0, 12, "/dev/mapper/") == 0) {
+        return true;
+    }
+    return path.compare(0, 5, "/dev/") == 0 && path.compare(0, 10, "/dev/disk/") != 0 &&
+           path.find('/', 5) != std::string::npos;
 }
 
 bool StorageDetector::isRaw(const std::string& path) {
     // Check if it's a regular file or block device
     std::ifstream file(path, std::ios::binary);
     return file.good();
-} 
\ No newline at end of file
+} 
+
+std::vector<StorageDetector::DeviceTopology> StorageDetector::resolveDevices(const std::string& path,
+                                                                             const std::string& sysfsRoot) {
+    std::vector<DeviceTopology> devices;
+
+    // A target that does not exist yet lives on the device of its nearest existing parent
+    fs::path existing = path;
+    std::error_code ec;
+    while (!existing.empty() && !fs::exists(existing, ec)) {
+        existing = existing.parent_path();
+    }
+    struct stat st;
+    if (existing.empty() || stat(existing.c_str(), &st) != 0) {
+        return devices;
+    }
+
+    dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    fs::path blockDir = fs::path(sysfsRoot) / "dev" / "block" /
+                        (std::to_string(major(dev)) + ":" + std::to_string(minor(dev)));
+    if (!fs::exists(blockDir, ec)) {
+        // Network and virtual filesystems have no block device behind them
+        return devices;
+    }
+    collectLeafDevices(blockDir, sysfsRoot, 0, 0, devices);
+    return devices;
+}
+
+StorageDetector::IoProfile StorageDetector::recommendIoProfile(const std::vector<DeviceTopology>& devices) {
+    IoProfile profile;
+    if (devices.empty()) {
+        profile.description = "unknown";
+        return profile;
+    }
+
+    // The slowest kind of device in the set decides
+    bool rotational = std::any_of(devices.begin(), devices.end(),
+                                  [](const DeviceTopology& device) { return device.rotational; });
+    bool nvme = std::all_of(devices.begin(), devices.end(),
+                            [](const DeviceTopology& device) { return device.nvme; });
+    size_t perDevice = rotational ? HDD_QUEUE_DEPTH : (nvme ? NVME_QUEUE_DEPTH : SSD_QUEUE_DEPTH);
+    profile.queueDepth = std::min(MAX_QUEUE_DEPTH, perDevice * devices.size());
+    profile.blockSize = rotational ? HDD_BLOCK_SIZE : FLASH_BLOCK_SIZE;
+
+    std::set<int> nodes;
+    for (const auto& device : devices) {
+        // Whole stripes: round up to the optimal I/O size, e.g. a RAID stripe width
+        if (device.optimalIoSize > 0 && device.optimalIoSize <= MAX_BLOCK_SIZE) {
+            profile.blockSize = (profile.blockSize + device.optimalIoSize - 1) / device.optimalIoSize *
+                                device.optimalIoSize;
+        }
+        nodes.insert(device.numaNode);
+    }
+    profile.blockSize = std::min(profile.blockSize, MAX_BLOCK_SIZE);
+    if (nodes.size() == 1) {
+        profile.numaNode = *nodes.begin();
+    }
+
+    profile.description = std::string(rotational ? "hdd" : (nvme ? "nvme" : "ssd"));
+    if (devices.size() > 1) {
+        profile.description += " x" + std::to_string(devices.size());
+    }
+    return profile;
+}
+
+StorageDetector::IoProfile StorageDetector::probeIoProfile(const std::vector<std::string>& paths,
+                                                           const std::string& sysfsRoot) {
+    std::vector<DeviceTopology> devices;
+    for (const auto& path : paths) {
+        for (const auto& device : resolveDevices(path, sysfsRoot)) {
+            bool known = std::any_of(devices.begin(), devices.end(),
+                                     [&device](const DeviceTopology& other) { return other.name == device.name; });
+            if (!known) {
+                devices.push_back(device);
+            }
+        }
+    }
+    return recommendIoProfile(devices);
+}
+
+std::vector<int> StorageDetector::getNodeCpus(int node, const std::string& sysfsRoot) {
+    std::vector<int> cpus;
+    if (node < 0) {
+        return cpus;
+    }
+    std::ifstream in(sysfsRoot + "/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(in, list)) {
+        return cpus;
+    }
+
+    // "0-3,8-11"
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        try {
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            return {};
+        }
+    }
+    return cpus;
+}
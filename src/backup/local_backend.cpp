@@ -0,0 +1,274 @@
+#include "backup/local_backend.hpp"
+#include "common/file_utils.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char* TEMP_MARKER = ".tmp.";
+
+bool validKey(const std::string& key) {
+    if (key.empty() || key[0] == '/' || key.find(TEMP_MARKER) != std::string::npos) {
+        return false;
+    }
+    for (const auto& part : fs::path(key)) {
+        if (part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& path) {
+    int fd = ::open(fs::path(path).parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+} // namespace
+
+class LocalObjectWriter : public ObjectWriter {
+public:
+    LocalObjectWriter(LocalBackend* backend, const std::string& path)
+        : backend_(backend)
+        , path_(path) {
+        static std::atomic<uint64_t> sequence{0};
+        tmpPath_ = path + TEMP_MARKER + std::to_string(getpid()) + "." + std::to_string(++sequence);
+    }
+
+    ~LocalObjectWriter() override {
+        abort();
+    }
+
+    bool write(const void* data, size_t size) override {
+        if (fd_ < 0 && !openTemp()) {
+            return false;
+        }
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd_, bytes, size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return fail("Failed to write " + tmpPath_ + ": " + std::strerror(errno));
+            }
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool commit() override {
+        if (fd_ < 0 && !openTemp()) {
+            return false;
+        }
+        bool synced = ::fsync(fd_) == 0;
+        ::close(fd_);
+        fd_ = -1;
+        if (!synced || std::rename(tmpPath_.c_str(), path_.c_str()) != 0) {
+            return fail("Failed to commit " + path_ + ": " + std::strerror(errno));
+        }
+        syncDirectory(path_);
+        tmpPath_.clear();
+        return true;
+    }
+
+    void abort() override {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        if (!tmpPath_.empty()) {
+            ::unlink(tmpPath_.c_str());
+        }
+    }
+
+    std::string getLastError() const override { return lastError_; }
+
+private:
+    bool openTemp() {
+        if (tmpPath_.empty()) {
+            return fail("Object " + path_ + " was already committed");
+        }
+        std::error_code ec;
+        fs::create_directories(fs::path(path_).parent_path(), ec);
+        fd_ = ::open(tmpPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            return fail("Failed to create " + tmpPath_ + ": " + std::strerror(errno));
+        }
+        return true;
+    }
+
+    bool fail(const std::string& error) {
+        lastError_ = error;
+        backend_->setError(error);
+        Logger::error(error);
+        abort();
+        tmpPath_.clear();
+        return false;
+    }
+
+    LocalBackend* backend_;
+    std::string path_;
+    std::string tmpPath_;
+    int fd_{-1};
+    std::string lastError_;
+};
+
+LocalBackend::LocalBackend(const std::string& root)
+    : root_(root) {
+    while (root_.size() > 1 && root_.back() == '/') {
+        root_.pop_back();
+    }
+}
+
+bool LocalBackend::put(const std::string& key, const void* data, size_t size) {
+    if (!validKey(key)) {
+        setError("Invalid object key: " + key);
+        return false;
+    }
+    std::string error;
+    if (!writeFileAtomic(pathOf(key), std::string(static_cast<const char*>(data), size), error)) {
+        setError("Failed to store " + key + " in " + root_ + ": " + error);
+        Logger::error(getLastError());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<ObjectWriter> LocalBackend::createWriter(const std::string& key) {
+    if (!validKey(key)) {
+        setError("Invalid object key: " + key);
+        return nullptr;
+    }
+    return std::make_unique<LocalObjectWriter>(this, pathOf(key));
+}
+
+bool LocalBackend::read(const std::string& key, uint64_t offset, uint64_t length, std::vector<uint8_t>& data) {
+    data.clear();
+    if (!validKey(key)) {
+        setError("Invalid object key: " + key);
+        return false;
+    }
+    std::string path = pathOf(key);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        setError("Failed to open " + path + ": " + std::strerror(errno));
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    if (offset > size || (length > 0 && offset + length > size)) {
+        ::close(fd);
+        setError("Range past the end of " + path);
+        return false;
+    }
+    data.resize(length > 0 ? length : size - offset);
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::pread(fd, data.data() + done, data.size() - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ::close(fd);
+            setError("Failed to read " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    return true;
+}
+
+bool LocalBackend::stat(const std::string& key, bool& exists, uint64_t& size) {
+    exists = false;
+    size = 0;
+    if (!validKey(key)) {
+        setError("Invalid object key: " + key);
+        return false;
+    }
+    struct stat st{};
+    if (::stat(pathOf(key).c_str(), &st) != 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        setError("Failed to stat " + pathOf(key) + ": " + std::strerror(errno));
+        return false;
+    }
+    exists = true;
+    size = static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+bool LocalBackend::remove(const std::string& key) {
+    if (!validKey(key)) {
+        setError("Invalid object key: " + key);
+        return false;
+    }
+    if (::unlink(pathOf(key).c_str()) != 0 && errno != ENOENT) {
+        setError("Failed to remove " + pathOf(key) + ": " + std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool LocalBackend::list(const std::string& prefix, std::vector<std::string>& keys) {
+    keys.clear();
+    // Only walk the directory the prefix ends in
+    std::string directory = root_;
+    size_t slash = prefix.rfind('/');
+    if (slash != std::string::npos) {
+        directory += "/" + prefix.substr(0, slash);
+    }
+
+    std::error_code ec;
+    if (!fs::exists(directory, ec)) {
+        return true;
+    }
+    for (fs::recursive_directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file()) {
+            continue;
+        }
+        std::string key = it->path().string().substr(root_.size() + 1);
+        if (key.compare(0, prefix.size(), prefix) == 0 && key.find(TEMP_MARKER) == std::string::npos) {
+            keys.push_back(key);
+        }
+    }
+    if (ec) {
+        setError("Failed to list " + directory + ": " + ec.message());
+        return false;
+    }
+    std::sort(keys.begin(), keys.end());
+    return true;
+}
+
+std::string LocalBackend::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+std::string LocalBackend::pathOf(const std::string& key) const {
+    return root_ + "/" + key;
+}
+
+void LocalBackend::setError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastError_ = error;
+}
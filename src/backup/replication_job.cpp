@@ -0,0 +1,620 @@
+#include "backup/replication_job.hpp"
+#include "backup/block_delta.hpp"
+#include "common/logger.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <set>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const size_t kChunkBatch = 64;  // Chunks sent at once
+
+// Chunks as sent: (length, data) records, deflated as a whole
+std::string packChunks(const std::vector<std::vector<uint8_t>>& chunks, int level) {
+    std::string records;
+    for (const auto& chunk : chunks) {
+        uint32_t length = static_cast<uint32_t>(chunk.size());
+        records.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        records.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    }
+
+    uint64_t rawSize = records.size();
+    std::string batch(reinterpret_cast<const char*>(&rawSize), sizeof(rawSize));
+    if (level > 0) {
+        uLongf compressedSize = compressBound(records.size());
+        std::string compressed(compressedSize, '\0');
+        if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressedSize,
+                      reinterpret_cast<const Bytef*>(records.data()), records.size(), level) == Z_OK &&
+            compressedSize < records.size()) {
+            batch.push_back(1);
+            batch.append(compressed.data(), compressedSize);
+            return batch;
+        }
+    }
+    batch.push_back(0);
+    batch.append(records);
+    return batch;
+}
+
+bool unpackChunks(const std::string& batch, std::vector<std::vector<uint8_t>>& chunks) {
+    uint64_t rawSize = 0;
+    if (batch.size() < sizeof(rawSize) + 1) {
+        return false;
+    }
+    memcpy(&rawSize, batch.data(), sizeof(rawSize));
+    size_t header = sizeof(rawSize) + 1;
+    std::string records;
+    if (batch[sizeof(rawSize)]) {
+        records.resize(rawSize);
+        uLongf size = rawSize;
+        if (uncompress(reinterpret_cast<Bytef*>(&records[0]), &size,
+                       reinterpret_cast<const Bytef*>(batch.data() + header), batch.size() - header) != Z_OK ||
+            size != rawSize) {
+            return false;
+        }
+    } else {
+        records = batch.substr(header);
+    }
+
+    size_t position = 0;
+    while (position < records.size()) {
+        uint32_t length = 0;
+        if (records.size() - position < sizeof(length)) {
+            return false;
+        }
+        memcpy(&length, records.data() + position, sizeof(length));
+        position += sizeof(length);
+        if (records.size() - position < length) {
+            return false;
+        }
+        const auto* data = reinterpret_cast<const uint8_t*>(records.data() + position);
+        chunks.emplace_back(data, data + length);
+        position += length;
+    }
+    return true;
+}
+
+std::string normalize(const fs::path& directory) {
+    std::error_code ec;
+    fs::path normalized = fs::absolute(directory, ec).lexically_normal();
+    if (normalized.filename().empty()) {
+        normalized = normalized.parent_path();
+    }
+    return normalized.string();
+}
+
+} // namespace
+
+ReplicationJob::ReplicationJob(const ReplicationConfig& config)
+    : config_(config)
+    , budget_(config.bandwidthLimit) {
+    setId(generateId());
+    jobClass_ = JobClass::SCRUB;  // Background work, behind every VM-facing job
+    config_.streams = std::max(config_.streams, 1);
+    config_.blockSize = std::max<uint32_t>(config_.blockSize, 4096);
+    config_.segmentSize = std::max<uint64_t>(config_.segmentSize, config_.blockSize);
+    setStatus("pending");
+}
+
+ReplicationJob::~ReplicationJob() {
+    if (isRunning()) {
+        cancel();
+    }
+}
+
+bool ReplicationJob::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (isRunning() || isCompleted() || isFailed() || isCancelled()) {
+        setError("Cannot start job in current state");
+        return false;
+    }
+    if (config_.source.empty() || config_.destination.empty() ||
+        normalize(config_.source) == normalize(config_.destination)) {
+        setError("Invalid replication configuration");
+        setState(State::FAILED);
+        return false;
+    }
+
+    setState(State::RUNNING);
+    setStatus("Starting replication");
+    updateProgress(0);
+
+    startWorker([this]() {
+        try {
+            executeReplication();
+        } catch (const std::exception& e) {
+            Logger::error("Replication failed: " + std::string(e.what()));
+            setError(std::string("Replication failed: ") + e.what());
+            setState(State::FAILED);
+        }
+    });
+    return true;
+}
+
+bool ReplicationJob::pause() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isRunning()) {
+        return false;
+    }
+    setState(State::PAUSED);
+    setStatus("paused");
+    return true;
+}
+
+bool ReplicationJob::resume() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isPaused()) {
+        return false;
+    }
+    setState(State::RUNNING);
+    setStatus("running");
+    return true;
+}
+
+bool ReplicationJob::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isRunning() && !isPaused()) {
+        return false;
+    }
+    setState(State::CANCELLED);
+    setStatus("cancelled");
+    return true;
+}
+
+bool ReplicationJob::isRunning() const {
+    return getState() == State::RUNNING;
+}
+
+bool ReplicationJob::isPaused() const {
+    return getState() == State::PAUSED;
+}
+
+bool ReplicationJob::isCompleted() const {
+    return getState() == State::COMPLETED;
+}
+
+bool ReplicationJob::isFailed() const {
+    return getState() == State::FAILED;
+}
+
+bool ReplicationJob::isCancelled() const {
+    return getState() == State::CANCELLED;
+}
+
+int ReplicationJob::getProgress() const {
+    return Job::getProgress();
+}
+
+std::string ReplicationJob::getStatus() const {
+    return Job::getStatus();
+}
+
+std::string ReplicationJob::getError() const {
+    return Job::getError();
+}
+
+std::string ReplicationJob::getId() const {
+    return Job::getId();
+}
+
+ReplicationStats ReplicationJob::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ReplicationJob::executeReplication() {
+    std::error_code ec;
+    fs::create_directories(config_.destination, ec);
+    sourceCatalog_ = BackupCatalog::forRepository(config_.source);
+    destinationCatalog_ = BackupCatalog::forRepository(config_.destination);
+    if (!sourceCatalog_ || !destinationCatalog_) {
+        setError("Failed to open the catalogs of " + config_.source + " and " + config_.destination);
+        setState(State::FAILED);
+        return;
+    }
+    // Backups moved into place by an interrupted run but not cataloged yet
+    destinationCatalog_->importDirectory();
+
+    sourceChunks_ = ChunkRepository::forRepository(config_.source);
+    if (!sourceChunks_ && fs::is_directory(fs::path(config_.source) / ".chunks", ec)) {
+        setError("Failed to open the chunk store of " + config_.source);
+        setState(State::FAILED);
+        return;
+    }
+    if (sourceChunks_) {
+        destinationChunks_ = ChunkRepository::forRepository(config_.destination, true);
+        if (!destinationChunks_) {
+            setError("Failed to open the chunk store of " + config_.destination);
+            setState(State::FAILED);
+            return;
+        }
+    }
+
+    // Oldest first per VM, so every backup finds its predecessor at the destination
+    std::vector<CatalogEntry> backups;
+    for (const auto& entry : sourceCatalog_->listAll()) {
+        if (config_.vmIds.empty() ||
+            std::find(config_.vmIds.begin(), config_.vmIds.end(), entry.vmId) != config_.vmIds.end()) {
+            backups.push_back(entry);
+        }
+    }
+    std::sort(backups.begin(), backups.end(), [](const CatalogEntry& a, const CatalogEntry& b) {
+        return a.vmId != b.vmId ? a.vmId < b.vmId : a.timestamp < b.timestamp;
+    });
+
+    Logger::info("Replicating " + std::to_string(backups.size()) + " backup(s) from " + config_.source + " to " +
+                 config_.destination);
+    for (size_t i = 0; i < backups.size(); i++) {
+        if (!checkpoint()) {
+            Logger::info("Replication cancelled");
+            return;
+        }
+
+        const auto& entry = backups[i];
+        std::string name = fs::path(normalize(entry.backupId)).filename().string();
+        bool present = false;
+        for (const auto& existing : destinationCatalog_->list(entry.vmId)) {
+            if (fs::path(existing.backupId).filename() == name) {
+                present = true;
+                break;
+            }
+        }
+
+        if (present) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.backupsSkipped++;
+        } else if (!fs::is_directory(entry.backupId, ec)) {
+            Logger::warning("Skipping backup " + entry.backupId + " of VM " + entry.vmId + ": directory is gone");
+        } else {
+            setStatus("Replicating " + name);
+            if (!replicateBackup(entry)) {
+                if (isCancelled()) {
+                    return;
+                }
+                Logger::error("Failed to replicate backup " + entry.backupId + ": " + failure_);
+                setError("Failed to replicate backup " + name + ": " + failure_);
+                setState(State::FAILED);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.backupsReplicated++;
+        }
+        updateProgress(static_cast<int>((i + 1) * 100 / backups.size()));
+    }
+
+    auto stats = getStats();
+    addBytesTransferred(stats.sentBytes);
+    std::string summary = "Replicated " + std::to_string(stats.backupsReplicated) + " backup(s), " +
+                          std::to_string(stats.backupsSkipped) + " already present; sent " +
+                          std::to_string(stats.sentBytes) + " bytes for " + std::to_string(stats.sourceBytes) +
+                          " bytes of files and " + std::to_string(stats.chunksSent) + " chunk(s)";
+    Logger::info(summary);
+    setState(State::COMPLETED);
+    setStatus(summary);
+    updateProgress(100);
+}
+
+bool ReplicationJob::replicateBackup(const CatalogEntry& entry) {
+    failure_.clear();
+    std::string name = fs::path(normalize(entry.backupId)).filename().string();
+    fs::path target = fs::path(normalize(config_.destination)) / name;
+    fs::path staging = fs::path(normalize(config_.destination)) / ".replicating" / name;
+
+    std::error_code ec;
+    if (fs::exists(target, ec)) {
+        failure_ = target.string() + " exists but is not a cataloged backup";
+        return false;
+    }
+    // Left over from an interrupted run
+    fs::remove_all(staging, ec);
+    fs::create_directories(staging, ec);
+    if (ec) {
+        failure_ = "Failed to create " + staging.string() + ": " + ec.message();
+        return false;
+    }
+
+    // Files are rebuilt from the newest backup of the VM already replicated
+    std::string basisDir;
+    if (auto latest = destinationCatalog_->latest(entry.vmId)) {
+        basisDir = latest->backupId;
+    }
+
+    if (!replicateFiles(entry.backupId, basisDir, staging.string())) {
+        return false;
+    }
+
+    // The root is committed once the files are in, and before the backup
+    // shows up in the catalog; a later failure drops it again so the chunks
+    // of a backup that never arrived can be collected
+    bool rootCommitted = false;
+    if (sourceChunks_) {
+        auto roots = sourceChunks_->listRoots();
+        if (std::find(roots.begin(), roots.end(), name) != roots.end()) {
+            if (!replicateRoot(name)) {
+                return false;
+            }
+            rootCommitted = true;
+        }
+    }
+    auto dropRoot = [&]() {
+        if (rootCommitted && !destinationChunks_->dropRoot(name)) {
+            Logger::warning("Failed to drop chunk root " + name + ": " + destinationChunks_->getLastError());
+        }
+    };
+
+    fs::rename(staging, target, ec);
+    if (ec) {
+        failure_ = "Failed to move " + staging.string() + " into place: " + ec.message();
+        dropRoot();
+        return false;
+    }
+    CatalogEntry replicated = entry;
+    replicated.backupId = target.string();
+    if (!destinationCatalog_->add(replicated)) {
+        failure_ = "Failed to add it to the catalog: " + destinationCatalog_->getLastError();
+        // Back into staging, or the next run takes it for a foreign directory
+        fs::rename(target, staging, ec);
+        dropRoot();
+        return false;
+    }
+    return true;
+}
+
+bool ReplicationJob::replicateRoot(const std::string& name) {
+    std::vector<ChunkId> chunks;
+    if (!sourceChunks_->readRoot(name, chunks)) {
+        failure_ = "Failed to read chunk root " + name + ": " + sourceChunks_->getLastError();
+        return false;
+    }
+
+    // Compare by id; a chunk referenced twice is sent once
+    auto session = destinationChunks_->beginSession();
+    std::vector<ChunkId> missing;
+    std::set<ChunkId> seen;
+    size_t present = 0;
+    for (const auto& id : chunks) {
+        if (!seen.insert(id).second) {
+            continue;
+        }
+        if (destinationChunks_->contains(id)) {
+            present++;
+        } else {
+            missing.push_back(id);
+        }
+    }
+
+    size_t batches = (missing.size() + kChunkBatch - 1) / kChunkBatch;
+    bool sent = runStreams(batches, [&](size_t batch) {
+        size_t first = batch * kChunkBatch;
+        size_t last = std::min(missing.size(), first + kChunkBatch);
+        std::vector<std::vector<uint8_t>> data(last - first);
+        for (size_t i = first; i < last; i++) {
+            if (!sourceChunks_->get(missing[i], data[i - first])) {
+                fail("Failed to read chunk " + chunkIdToHex(missing[i]) + ": " + sourceChunks_->getLastError());
+                return false;
+            }
+        }
+        std::string wire = packChunks(data, config_.compressionLevel);
+        send(wire.size());
+
+        std::vector<std::vector<uint8_t>> received;
+        if (!unpackChunks(wire, received) || received.size() != last - first) {
+            fail("Malformed chunk batch");
+            return false;
+        }
+        for (size_t i = 0; i < received.size(); i++) {
+            ChunkId id;
+            if (!destinationChunks_->put(*session, received[i].data(), received[i].size(), id)) {
+                fail("Failed to store chunk: " + destinationChunks_->getLastError());
+                return false;
+            }
+            if (id != missing[first + i]) {
+                fail("Chunk " + chunkIdToHex(missing[first + i]) + " arrived corrupted");
+                return false;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.chunksSent += received.size();
+        return true;
+    });
+    if (!sent) {
+        return false;
+    }
+
+    if (!destinationChunks_->flush() || !destinationChunks_->commitRoot(*session, name, chunks)) {
+        failure_ = "Failed to commit chunk root " + name + ": " + destinationChunks_->getLastError();
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.chunksPresent += present;
+    return true;
+}
+
+bool ReplicationJob::replicateFiles(const std::string& sourceDir, const std::string& basisDir,
+                                    const std::string& stagingDir) {
+    struct File {
+        std::string name;
+        uint64_t size{0};
+        int sourceFd{-1};
+        int basisFd{-1};
+        int outputFd{-1};
+        BlockSignature signature;
+        std::unique_ptr<BlockMatcher> matcher;
+    };
+
+    std::vector<File> files;
+    std::error_code ec;
+    for (const auto& item : fs::directory_iterator(sourceDir, ec)) {
+        if (item.is_regular_file(ec)) {
+            File file;
+            file.name = item.path().filename().string();
+            file.size = item.file_size(ec);
+            files.push_back(std::move(file));
+        }
+    }
+    if (ec) {
+        failure_ = "Failed to list " + sourceDir + ": " + ec.message();
+        return false;
+    }
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.name < b.name; });
+
+    auto closeFiles = [&]() {
+        for (auto& file : files) {
+            for (int* fd : {&file.sourceFd, &file.basisFd, &file.outputFd}) {
+                if (*fd >= 0) {
+                    ::close(*fd);
+                    *fd = -1;
+                }
+            }
+        }
+    };
+
+    // The destination signs its basis of each file; the source builds a matcher from what it received
+    bool opened = runStreams(files.size(), [&](size_t index) {
+        File& file = files[index];
+        std::string sourcePath = sourceDir + "/" + file.name;
+        std::string outputPath = stagingDir + "/" + file.name;
+        file.sourceFd = ::open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+        file.outputFd = ::open(outputPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file.sourceFd < 0 || file.outputFd < 0 ||
+            ftruncate(file.outputFd, static_cast<off_t>(file.size)) != 0) {
+            fail("Failed to open " + sourcePath + " or " + outputPath + ": " + strerror(errno));
+            return false;
+        }
+
+        BlockSignature signature;
+        std::string error;
+        if (!basisDir.empty()) {
+            std::string basisPath = basisDir + "/" + file.name;
+            if (!computeSignature(basisPath, config_.blockSize, signature, error)) {
+                fail(error);
+                return false;
+            }
+            if (!signature.weak.empty()) {
+                file.basisFd = ::open(basisPath.c_str(), O_RDONLY | O_CLOEXEC);
+                if (file.basisFd < 0) {
+                    fail("Failed to open " + basisPath + ": " + strerror(errno));
+                    return false;
+                }
+            }
+        }
+        if (signature.blockSize == 0) {
+            signature.blockSize = config_.blockSize;
+        }
+        std::string wire = signature.serialize();
+        send(wire.size());
+        if (!file.signature.parse(wire, error)) {
+            fail(error);
+            return false;
+        }
+        file.matcher = std::make_unique<BlockMatcher>(file.signature);
+        return true;
+    });
+    if (!opened) {
+        closeFiles();
+        return false;
+    }
+
+    std::vector<std::pair<size_t, uint64_t>> segments;  // File, offset
+    for (size_t i = 0; i < files.size(); i++) {
+        for (uint64_t offset = 0; offset < files[i].size; offset += config_.segmentSize) {
+            segments.emplace_back(i, offset);
+        }
+    }
+
+    bool copied = runStreams(segments.size(), [&](size_t index) {
+        File& file = files[segments[index].first];
+        uint64_t offset = segments[index].second;
+        std::string delta;
+        std::string error;
+        DeltaStats deltaStats;
+        if (!computeDelta(file.sourceFd, file.size, offset, config_.segmentSize, *file.matcher, config_.blockSize,
+                          config_.compressionLevel, delta, deltaStats, error)) {
+            fail(file.name + ": " + error);
+            return false;
+        }
+        send(delta.size());
+        if (!applyDelta(delta, file.basisFd, config_.blockSize, file.outputFd, error)) {
+            fail(file.name + ": " + error);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.sourceBytes += std::min(config_.segmentSize, file.size - offset);
+        stats_.matchedBytes += deltaStats.matchedBytes;
+        return true;
+    });
+
+    bool synced = copied;
+    for (const auto& file : files) {
+        if (copied && fsync(file.outputFd) != 0) {
+            failure_ = "Failed to sync " + file.name + ": " + strerror(errno);
+            synced = false;
+        }
+    }
+    closeFiles();
+    return synced;
+}
+
+bool ReplicationJob::runStreams(size_t count, const std::function<bool(size_t)>& task) {
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    auto stream = [&]() {
+        while (!failed) {
+            size_t index = next++;
+            if (index >= count) {
+                break;
+            }
+            if (!checkpoint()) {
+                fail("Replication cancelled");
+                failed = true;
+                break;
+            }
+            if (!task(index)) {
+                failed = true;
+            }
+        }
+    };
+
+    size_t streams = std::min(count, static_cast<size_t>(config_.streams));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < streams; i++) {
+        threads.emplace_back(stream);
+    }
+    stream();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return !failed;
+}
+
+void ReplicationJob::send(uint64_t bytes) {
+    auto delay = budget_.reserve(bytes);
+    if (delay.count() > 0) {
+        std::this_thread::sleep_for(delay);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.sentBytes += bytes;
+}
+
+bool ReplicationJob::checkpoint() {
+    while (isPaused()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return !isCancelled();
+}
+
+void ReplicationJob::fail(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failure_.empty()) {
+        failure_ = error;
+    }
+}
@@ -0,0 +1,118 @@
+#include "backup/retention_policy.hpp"
+#include <algorithm>
+#include <ctime>
+
+namespace {
+
+constexpr int64_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+struct Calendar {
+    int64_t day;    // Local days since the epoch
+    int64_t week;   // Local weeks since the epoch, starting on Monday
+    int64_t month;  // year * 12 + month
+    int64_t year;
+};
+
+Calendar calendarOf(int64_t timestamp) {
+    time_t time = static_cast<time_t>(timestamp);
+    std::tm local{};
+    localtime_r(&time, &local);
+
+    int64_t localSeconds = timestamp + local.tm_gmtoff;
+    int64_t day = localSeconds >= 0 ? localSeconds / SECONDS_PER_DAY : (localSeconds - SECONDS_PER_DAY + 1) / SECONDS_PER_DAY;
+    // 1970-01-01 was a Thursday, so Monday-based weeks start 3 days later
+    int64_t shifted = day + 3;
+    int64_t week = shifted >= 0 ? shifted / 7 : (shifted - 6) / 7;
+    return {day, week, (local.tm_year + 1900) * 12LL + local.tm_mon, local.tm_year + 1900LL};
+}
+
+} // namespace
+
+RetentionPolicy RetentionPolicy::fromConfig(const BackupConfig& config) {
+    RetentionPolicy policy;
+    policy.keepLast = config.maxBackups;
+    policy.keepDaily = config.keepDaily;
+    policy.keepWeekly = config.keepWeekly;
+    policy.keepMonthly = config.keepMonthly;
+    policy.keepYearly = config.keepYearly;
+    policy.keepWithinDays = config.retentionDays;
+    return policy;
+}
+
+bool RetentionPolicy::isEnabled() const {
+    return keepLast > 0 || keepDaily > 0 || keepWeekly > 0 || keepMonthly > 0 || keepYearly > 0;
+}
+
+std::vector<CatalogEntry> selectExpired(const RetentionPolicy& policy, std::vector<CatalogEntry> backups,
+                                        std::chrono::system_clock::time_point now) {
+    if (!policy.isEnabled() || backups.empty()) {
+        return {};
+    }
+
+    // Newest first
+    std::sort(backups.begin(), backups.end(), [](const CatalogEntry& a, const CatalogEntry& b) {
+        return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.backupId > b.backupId;
+    });
+    std::vector<Calendar> calendar;
+    calendar.reserve(backups.size());
+    for (const auto& backup : backups) {
+        calendar.push_back(calendarOf(backup.timestamp));
+    }
+
+    std::vector<bool> keep(backups.size(), false);
+    keep[0] = true;
+    for (size_t i = 0; i < backups.size() && i < static_cast<size_t>(std::max(policy.keepLast, 0)); i++) {
+        keep[i] = true;
+    }
+
+    if (policy.keepWithinDays > 0) {
+        int64_t cutoff = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count() -
+                         policy.keepWithinDays * SECONDS_PER_DAY;
+        for (size_t i = 0; i < backups.size(); i++) {
+            if (backups[i].timestamp >= cutoff) {
+                keep[i] = true;
+            }
+        }
+    }
+
+    // The newest backup of each period, for the most recent `count` periods that have one
+    auto keepPeriods = [&](int count, int64_t Calendar::*period) {
+        int kept = 0;
+        for (size_t i = 0; i < backups.size() && kept < count; i++) {
+            if (i == 0 || calendar[i].*period != calendar[i - 1].*period) {
+                keep[i] = true;
+                kept++;
+            }
+        }
+    };
+    keepPeriods(policy.keepDaily, &Calendar::day);
+    keepPeriods(policy.keepWeekly, &Calendar::week);
+    keepPeriods(policy.keepMonthly, &Calendar::month);
+    keepPeriods(policy.keepYearly, &Calendar::year);
+
+    // An incremental needs every older backup back to its full; a
+    // differential only needs the full
+    for (size_t i = 0; i < backups.size(); i++) {
+        if (!keep[i] || backups[i].type == BackupType::FULL) {
+            continue;
+        }
+        bool differential = backups[i].type == BackupType::DIFFERENTIAL;
+        for (size_t j = i + 1; j < backups.size(); j++) {
+            if (backups[j].type == BackupType::FULL) {
+                keep[j] = true;
+                break;
+            }
+            if (!differential) {
+                keep[j] = true;
+            }
+        }
+    }
+
+    std::vector<CatalogEntry> expired;
+    for (size_t i = backups.size(); i > 0; i--) {
+        if (!keep[i - 1]) {
+            expired.push_back(backups[i - 1]);
+        }
+    }
+    return expired;
+}
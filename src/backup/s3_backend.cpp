@@ -0,0 +1,751 @@
+#include "backup/s3_backend.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+namespace {
+
+constexpr const char* EMPTY_PAYLOAD_HASH = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+std::string toHex(const unsigned char* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; i++) {
+        hex.push_back(digits[data[i] >> 4]);
+        hex.push_back(digits[data[i] & 0x0F]);
+    }
+    return hex;
+}
+
+std::string sha256Hex(const void* data, size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data, size, digest, &length, EVP_sha256(), nullptr);
+    return toHex(digest, length);
+}
+
+std::string hmacSha256(const std::string& key, const std::string& data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()), reinterpret_cast<const unsigned char*>(data.data()),
+         data.size(), digest, &length);
+    return std::string(reinterpret_cast<const char*>(digest), length);
+}
+
+// RFC 3986 encoding as SigV4 wants it; '/' is kept in paths
+std::string uriEncode(const std::string& value, bool keepSlash) {
+    static const char digits[] = "0123456789ABCDEF";
+    std::string encoded;
+    encoded.reserve(value.size());
+    for (unsigned char c : value) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || (keepSlash && c == '/')) {
+            encoded.push_back(static_cast<char>(c));
+        } else {
+            encoded.push_back('%');
+            encoded.push_back(digits[c >> 4]);
+            encoded.push_back(digits[c & 0x0F]);
+        }
+    }
+    return encoded;
+}
+
+std::string canonicalQueryOf(const std::map<std::string, std::string>& query) {
+    std::map<std::string, std::string> encoded;
+    for (const auto& [name, value] : query) {
+        encoded[uriEncode(name, false)] = uriEncode(value, false);
+    }
+    std::string canonical;
+    for (const auto& [name, value] : encoded) {
+        if (!canonical.empty()) {
+            canonical += '&';
+        }
+        canonical += name + "=" + value;
+    }
+    return canonical;
+}
+
+std::string xmlUnescape(std::string value) {
+    static const std::pair<const char*, const char*> entities[] = {
+        {"&lt;", "<"}, {"&gt;", ">"}, {"&quot;", "\""}, {"&apos;", "'"}, {"&amp;", "&"}};
+    for (const auto& [entity, text] : entities) {
+        std::string from(entity);
+        for (size_t pos = value.find(from); pos != std::string::npos; pos = value.find(from, pos + 1)) {
+            value.replace(pos, from.size(), text);
+        }
+    }
+    return value;
+}
+
+// Text of the next <tag> element at or after pos; pos moves past it
+bool xmlElement(const std::string& xml, const std::string& tag, size_t& pos, std::string& text) {
+    std::string open = "<" + tag + ">";
+    std::string close = "</" + tag + ">";
+    size_t start = xml.find(open, pos);
+    if (start == std::string::npos) {
+        return false;
+    }
+    start += open.size();
+    size_t end = xml.find(close, start);
+    if (end == std::string::npos) {
+        return false;
+    }
+    text = xmlUnescape(xml.substr(start, end - start));
+    pos = end + close.size();
+    return true;
+}
+
+std::string xmlValue(const std::string& xml, const std::string& tag) {
+    size_t pos = 0;
+    std::string text;
+    return xmlElement(xml, tag, pos, text) ? text : std::string();
+}
+
+std::string amzDateNow() {
+    std::time_t now = std::time(nullptr);
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char buffer[17];
+    std::strftime(buffer, sizeof(buffer), "%Y%m%dT%H%M%SZ", &utc);
+    return buffer;
+}
+
+size_t appendToString(char* data, size_t size, size_t count, void* userdata) {
+    static_cast<std::string*>(userdata)->append(data, size * count);
+    return size * count;
+}
+
+size_t appendToVector(char* data, size_t size, size_t count, void* userdata) {
+    auto* sink = static_cast<std::vector<uint8_t>*>(userdata);
+    sink->insert(sink->end(), data, data + size * count);
+    return size * count;
+}
+
+size_t collectHeader(char* data, size_t size, size_t count, void* userdata) {
+    std::string line(data, size * count);
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        size_t begin = line.find_first_not_of(" \t", colon + 1);
+        size_t end = line.find_last_not_of(" \t\r\n");
+        (*static_cast<std::map<std::string, std::string>*>(userdata))[name] =
+            begin != std::string::npos && end >= begin ? line.substr(begin, end - begin + 1) : std::string();
+    }
+    return size * count;
+}
+
+bool retryable(long status) {
+    return status == 429 || status >= 500;
+}
+
+} // namespace
+
+// Uploads an object in parts once it outgrows one part
+class S3ObjectWriter : public ObjectWriter {
+public:
+    S3ObjectWriter(S3Backend* backend, const std::string& key)
+        : backend_(backend)
+        , key_(key)
+        , partSize_(backend->config_.partSize) {
+    }
+
+    ~S3ObjectWriter() override {
+        abort();
+    }
+
+    bool write(const void* data, size_t size) override {
+        if (done_) {
+            return fail("Object " + key_ + " was already committed or aborted");
+        }
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            if (!reserved_) {
+                backend_->reserveBuffer(partSize_);
+                reserved_ = true;
+                buffer_.reserve(partSize_);
+            }
+            size_t count = std::min<size_t>(size, partSize_ - buffer_.size());
+            buffer_.insert(buffer_.end(), bytes, bytes + count);
+            bytes += count;
+            size -= count;
+            if (buffer_.size() == partSize_ && !uploadPart()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool commit() override {
+        if (done_) {
+            return fail("Object " + key_ + " was already committed or aborted");
+        }
+        if (uploadId_.empty()) {
+            bool stored = backend_->put(key_, buffer_.data(), buffer_.size());
+            releaseReservation();
+            done_ = true;
+            return stored || fail(backend_->getLastError());
+        }
+        if (!buffer_.empty() && !uploadPart()) {
+            return false;
+        }
+        releaseReservation();
+        if (!waitForParts()) {
+            abort();
+            return false;
+        }
+
+        std::string xml = "<CompleteMultipartUpload>";
+        for (const auto& [number, etag] : etags_) {
+            xml += "<Part><PartNumber>" + std::to_string(number) + "</PartNumber><ETag>" + etag + "</ETag></Part>";
+        }
+        xml += "</CompleteMultipartUpload>";
+
+        S3Backend::Response response;
+        // S3 may report a failed completion in the body of a 200
+        if (!backend_->request("POST", key_, {{"uploadId", uploadId_}}, xml.data(), xml.size(),
+                               {{"Content-Type", "application/xml"}}, response) ||
+            response.status != 200 || response.body.find("<Error>") != std::string::npos) {
+            fail(backend_->describeFailure("complete the upload of " + key_, response));
+            abort();
+            return false;
+        }
+        done_ = true;
+        return true;
+    }
+
+    void abort() override {
+        if (done_) {
+            return;
+        }
+        done_ = true;
+        waitForParts();
+        releaseReservation();
+        if (!uploadId_.empty()) {
+            S3Backend::Response response;
+            if (!backend_->request("DELETE", key_, {{"uploadId", uploadId_}}, nullptr, 0, {}, response) ||
+                (response.status != 204 && response.status != 404)) {
+                Logger::warning("Failed to abort the upload of " + key_ + "; its parts stay until the bucket's "
+                                "lifecycle rules remove them");
+            }
+        }
+    }
+
+    std::string getLastError() const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lastError_;
+    }
+
+private:
+    bool uploadPart() {
+        if (uploadId_.empty()) {
+            S3Backend::Response response;
+            if (!backend_->request("POST", key_, {{"uploads", ""}}, nullptr, 0, {}, response) ||
+                response.status != 200 || (uploadId_ = xmlValue(response.body, "UploadId")).empty()) {
+                fail(backend_->describeFailure("start the upload of " + key_, response));
+                abort();
+                return false;
+            }
+        }
+        bool failed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            failed = failed_;
+            if (failed) {
+                lastError_ = "Upload of " + key_ + " failed: " + partError_;
+            }
+        }
+        if (failed) {
+            abort();
+            return false;
+        }
+
+        int number = nextPart_++;
+        auto part = std::make_shared<std::vector<uint8_t>>();
+        part->swap(buffer_);
+        reserved_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_++;
+        }
+        backend_->submit([this, number, part] {
+            S3Backend::Response response;
+            bool ok = backend_->request("PUT", key_, {{"partNumber", std::to_string(number)}, {"uploadId", uploadId_}},
+                                        part->data(), part->size(), {}, response) &&
+                      response.status == 200 && response.headers.count("etag") > 0;
+            std::string error = ok ? std::string() : backend_->describeFailure("upload part " +
+                                                                               std::to_string(number) + " of " + key_,
+                                                                               response);
+            part->clear();
+            part->shrink_to_fit();
+            backend_->releaseBuffer(partSize_);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (ok) {
+                etags_[number] = response.headers["etag"];
+            } else if (!failed_) {
+                failed_ = true;
+                partError_ = error;
+            }
+            pending_--;
+            partDone_.notify_all();
+        });
+        return true;
+    }
+
+    bool waitForParts() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        partDone_.wait(lock, [this] { return pending_ == 0; });
+        if (failed_) {
+            lastError_ = "Upload of " + key_ + " failed: " + partError_;
+            Logger::error(lastError_);
+            return false;
+        }
+        return true;
+    }
+
+    void releaseReservation() {
+        if (reserved_) {
+            backend_->releaseBuffer(partSize_);
+            reserved_ = false;
+        }
+        buffer_.clear();
+        buffer_.shrink_to_fit();
+    }
+
+    bool fail(const std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = error;
+        Logger::error(error);
+        return false;
+    }
+
+    S3Backend* backend_;
+    std::string key_;
+    uint64_t partSize_;
+    std::vector<uint8_t> buffer_;
+    bool reserved_{false};  // buffer_ holds a reservation of partSize_
+    bool done_{false};
+    std::string uploadId_;
+    int nextPart_{1};
+
+    // Shared with the upload threads
+    std::map<int, std::string> etags_;
+    size_t pending_{0};
+    bool failed_{false};
+    std::string partError_;
+    std::string lastError_;
+    mutable std::mutex mutex_;
+    std::condition_variable partDone_;
+};
+
+S3Backend::S3Backend(const StorageConfig& config)
+    : config_(config) {
+    static std::once_flag curlInit;
+    std::call_once(curlInit, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+    config_.partSize = std::max<uint64_t>(config_.partSize, 5ULL << 20);  // S3's minimum part size
+    config_.maxInFlightBytes = std::max(config_.maxInFlightBytes, config_.partSize);
+    config_.uploadThreads = std::max<size_t>(config_.uploadThreads, 1);
+}
+
+S3Backend::~S3Backend() {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        stopping_ = true;
+    }
+    tasksReady_.notify_all();
+    for (auto& uploader : uploaders_) {
+        uploader.join();
+    }
+    for (CURL* curl : idleHandles_) {
+        curl_easy_cleanup(curl);
+    }
+}
+
+bool S3Backend::init(std::string& error) {
+    const std::string scheme = "s3://";
+    if (config_.url.compare(0, scheme.size(), scheme) != 0) {
+        error = "Not an S3 URL: " + config_.url;
+        return false;
+    }
+    std::string path = config_.url.substr(scheme.size());
+    size_t slash = path.find('/');
+    bucket_ = path.substr(0, slash);
+    prefix_ = slash != std::string::npos ? path.substr(slash + 1) : std::string();
+    while (!prefix_.empty() && prefix_.back() == '/') {
+        prefix_.pop_back();
+    }
+    if (!prefix_.empty()) {
+        prefix_ += '/';
+    }
+    if (bucket_.empty()) {
+        error = "No bucket in " + config_.url;
+        return false;
+    }
+
+    std::string endpoint = config_.endpoint.empty() ? "https://s3." + config_.region + ".amazonaws.com"
+                                                    : config_.endpoint;
+    size_t separator = endpoint.find("://");
+    if (separator == std::string::npos) {
+        error = "Endpoint needs a scheme: " + endpoint;
+        return false;
+    }
+    scheme_ = endpoint.substr(0, separator);
+    host_ = endpoint.substr(separator + 3);
+    while (!host_.empty() && host_.back() == '/') {
+        host_.pop_back();
+    }
+    if (!config_.pathStyle) {
+        host_ = bucket_ + "." + host_;
+    }
+
+    auto fromEnvironment = [](std::string& value, const char* name) {
+        const char* env = std::getenv(name);
+        if (value.empty() && env) {
+            value = env;
+        }
+    };
+    fromEnvironment(config_.accessKey, "AWS_ACCESS_KEY_ID");
+    fromEnvironment(config_.secretKey, "AWS_SECRET_ACCESS_KEY");
+    fromEnvironment(config_.sessionToken, "AWS_SESSION_TOKEN");
+    if (config_.accessKey.empty() || config_.secretKey.empty()) {
+        error = "No credentials for " + config_.url;
+        return false;
+    }
+
+    for (size_t i = 0; i < config_.uploadThreads; i++) {
+        uploaders_.emplace_back(&S3Backend::runUploads, this);
+    }
+    return true;
+}
+
+std::string S3Backend::describe() const {
+    return config_.url + " at " + scheme_ + "://" + host_;
+}
+
+bool S3Backend::put(const std::string& key, const void* data, size_t size) {
+    Response response;
+    if (!request("PUT", key, {}, data, size, {{"Content-Type", "application/octet-stream"}}, response) ||
+        response.status != 200) {
+        setError(describeFailure("store " + key, response));
+        Logger::error(getLastError());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<ObjectWriter> S3Backend::createWriter(const std::string& key) {
+    return std::make_unique<S3ObjectWriter>(this, key);
+}
+
+bool S3Backend::read(const std::string& key, uint64_t offset, uint64_t length, std::vector<uint8_t>& data) {
+    data.clear();
+    std::map<std::string, std::string> headers;
+    bool ranged = offset > 0 || length > 0;
+    if (ranged) {
+        headers["Range"] = "bytes=" + std::to_string(offset) + "-" +
+                           (length > 0 ? std::to_string(offset + length - 1) : std::string());
+        data.reserve(length);
+    }
+
+    Response response;
+    // A server that ignores the Range answers 200 with the whole object,
+    // which must not pass for the requested bytes
+    if (!request("GET", key, {}, nullptr, 0, headers, response, &data) ||
+        response.status != (ranged ? 206 : 200) || (length > 0 && data.size() != length)) {
+        setError(describeFailure("read " + key, response));
+        Logger::error(getLastError());
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
+bool S3Backend::stat(const std::string& key, bool& exists, uint64_t& size) {
+    exists = false;
+    size = 0;
+    Response response;
+    if (!request("HEAD", key, {}, nullptr, 0, {}, response) ||
+        (response.status != 200 && response.status != 404)) {
+        setError(describeFailure("stat " + key, response));
+        return false;
+    }
+    if (response.status == 200) {
+        exists = true;
+        size = std::strtoull(response.headers["content-length"].c_str(), nullptr, 10);
+    }
+    return true;
+}
+
+bool S3Backend::remove(const std::string& key) {
+    Response response;
+    if (!request("DELETE", key, {}, nullptr, 0, {}, response) ||
+        (response.status != 204 && response.status != 200 && response.status != 404)) {
+        setError(describeFailure("remove " + key, response));
+        Logger::error(getLastError());
+        return false;
+    }
+    return true;
+}
+
+bool S3Backend::list(const std::string& prefix, std::vector<std::string>& keys) {
+    keys.clear();
+    std::string token;
+    while (true) {
+        std::map<std::string, std::string> query{{"list-type", "2"}, {"prefix", prefix_ + prefix}};
+        if (!token.empty()) {
+            query["continuation-token"] = token;
+        }
+        Response response;
+        // An empty key addresses the bucket itself
+        if (!request("GET", std::string(), query, nullptr, 0, {}, response) || response.status != 200) {
+            setError(describeFailure("list " + prefix, response));
+            Logger::error(getLastError());
+            return false;
+        }
+
+        size_t pos = 0;
+        std::string contents;
+        while (xmlElement(response.body, "Contents", pos, contents)) {
+            std::string key = xmlValue(contents, "Key");
+            if (key.compare(0, prefix_.size(), prefix_) == 0) {
+                keys.push_back(key.substr(prefix_.size()));
+            }
+        }
+        if (xmlValue(response.body, "IsTruncated") != "true") {
+            break;
+        }
+        token = xmlValue(response.body, "NextContinuationToken");
+        if (token.empty()) {
+            break;
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    return true;
+}
+
+std::string S3Backend::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+std::string S3Backend::signRequest(const std::string& method, const std::string& canonicalUri,
+                                   const std::string& canonicalQuery,
+                                   const std::map<std::string, std::string>& headers,
+                                   const std::string& payloadHash, const std::string& amzDate,
+                                   const std::string& region, const std::string& accessKey,
+                                   const std::string& secretKey) {
+    std::string canonicalHeaders;
+    std::string signedHeaders;
+    for (const auto& [name, value] : headers) {
+        canonicalHeaders += name + ":" + value + "\n";
+        signedHeaders += (signedHeaders.empty() ? "" : ";") + name;
+    }
+    std::string canonicalRequest = method + "\n" + canonicalUri + "\n" + canonicalQuery + "\n" + canonicalHeaders +
+                                   "\n" + signedHeaders + "\n" + payloadHash;
+
+    std::string date = amzDate.substr(0, 8);
+    std::string scope = date + "/" + region + "/s3/aws4_request";
+    std::string stringToSign = "AWS4-HMAC-SHA256\n" + amzDate + "\n" + scope + "\n" +
+                               sha256Hex(canonicalRequest.data(), canonicalRequest.size());
+
+    std::string key = hmacSha256("AWS4" + secretKey, date);
+    key = hmacSha256(key, region);
+    key = hmacSha256(key, "s3");
+    key = hmacSha256(key, "aws4_request");
+    std::string signature = hmacSha256(key, stringToSign);
+
+    return "AWS4-HMAC-SHA256 Credential=" + accessKey + "/" + scope + ",SignedHeaders=" + signedHeaders +
+           ",Signature=" + toHex(reinterpret_cast<const unsigned char*>(signature.data()), signature.size());
+}
+
+bool S3Backend::request(const std::string& method, const std::string& key,
+                        const std::map<std::string, std::string>& query, const void* body, size_t bodySize,
+                        const std::map<std::string, std::string>& extraHeaders, Response& response,
+                        std::vector<uint8_t>* sink) {
+    std::string payloadHash = bodySize > 0 ? sha256Hex(body, bodySize) : EMPTY_PAYLOAD_HASH;
+    std::string error;
+    for (int attempt = 0;; attempt++) {
+        response = Response();
+        if (sink) {
+            sink->clear();
+        }
+        CURL* curl = acquireHandle();
+        bool sent = perform(curl, method, key, query, body, bodySize, payloadHash, extraHeaders, response, sink,
+                            error);
+        releaseHandle(curl);
+        if (sent && !retryable(response.status)) {
+            return true;
+        }
+        if (attempt >= config_.retries) {
+            if (!sent) {
+                setError(method + " " + objectPath(key) + " failed: " + error);
+            }
+            return sent;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200) * (1 << std::min(attempt, 5)));
+    }
+}
+
+bool S3Backend::perform(CURL* curl, const std::string& method, const std::string& key,
+                        const std::map<std::string, std::string>& query, const void* body, size_t bodySize,
+                        const std::string& payloadHash, const std::map<std::string, std::string>& extraHeaders,
+                        Response& response, std::vector<uint8_t>* sink, std::string& error) {
+    if (!curl) {
+        error = "Failed to create a curl handle";
+        return false;
+    }
+
+    std::string canonicalUri = objectPath(key);
+    std::string canonicalQuery = canonicalQueryOf(query);
+    std::string amzDate = amzDateNow();
+    std::map<std::string, std::string> signedHeaders{
+        {"host", host_}, {"x-amz-content-sha256", payloadHash}, {"x-amz-date", amzDate}};
+    if (!config_.sessionToken.empty()) {
+        signedHeaders["x-amz-security-token"] = config_.sessionToken;
+    }
+    std::string authorization = signRequest(method, canonicalUri, canonicalQuery, signedHeaders, payloadHash,
+                                            amzDate, config_.region, config_.accessKey, config_.secretKey);
+
+    struct curl_slist* headerList = nullptr;
+    for (const auto& [name, value] : signedHeaders) {
+        if (name != "host") {
+            headerList = curl_slist_append(headerList, (name + ": " + value).c_str());
+        }
+    }
+    for (const auto& [name, value] : extraHeaders) {
+        headerList = curl_slist_append(headerList, (name + ": " + value).c_str());
+    }
+    headerList = curl_slist_append(headerList, ("Authorization: " + authorization).c_str());
+    headerList = curl_slist_append(headerList, "Expect:");
+
+    std::string url = scheme_ + "://" + host_ + canonicalUri + (canonicalQuery.empty() ? "" : "?" + canonicalQuery);
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);   // Give up on a stalled transfer
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, config_.verifyTls ? 1L : 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, config_.verifyTls ? 2L : 0L);
+    if (method == "HEAD") {
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+    }
+    if (method == "PUT" || method == "POST") {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body ? static_cast<const char*>(body) : "");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(bodySize));
+    }
+    if (sink) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, appendToVector);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, sink);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, appendToString);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.body);
+    }
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, collectHeader);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response.headers);
+
+    CURLcode result = curl_easy_perform(curl);
+    curl_slist_free_all(headerList);
+    if (result != CURLE_OK) {
+        error = curl_easy_strerror(result);
+        return false;
+    }
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+    if (sink && response.status >= 300) {
+        // Keep the error document for the message
+        response.body.assign(sink->begin(), sink->end());
+        sink->clear();
+    }
+    return true;
+}
+
+std::string S3Backend::objectPath(const std::string& key) const {
+    std::string path = config_.pathStyle ? "/" + bucket_ : std::string();
+    if (key.empty()) {
+        return path.empty() ? "/" : path;
+    }
+    return path + "/" + uriEncode(prefix_ + key, true);
+}
+
+std::string S3Backend::describeFailure(const std::string& what, const Response& response) const {
+    if (response.status == 0) {
+        return "Failed to " + what + ": " + getLastError();
+    }
+    std::string message = xmlValue(response.body, "Message");
+    std::string code = xmlValue(response.body, "Code");
+    return "Failed to " + what + ": HTTP " + std::to_string(response.status) +
+           (code.empty() ? "" : " " + code) + (message.empty() ? "" : ": " + message);
+}
+
+CURL* S3Backend::acquireHandle() {
+    std::lock_guard<std::mutex> lock(handlesMutex_);
+    if (idleHandles_.empty()) {
+        return curl_easy_init();
+    }
+    CURL* curl = idleHandles_.back();
+    idleHandles_.pop_back();
+    return curl;
+}
+
+void S3Backend::releaseHandle(CURL* curl) {
+    if (!curl) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(handlesMutex_);
+    idleHandles_.push_back(curl);
+}
+
+void S3Backend::reserveBuffer(uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(bufferMutex_);
+    bufferReleased_.wait(lock, [&] {
+        return inFlightBytes_ == 0 || inFlightBytes_ + bytes <= config_.maxInFlightBytes;
+    });
+    inFlightBytes_ += bytes;
+}
+
+void S3Backend::releaseBuffer(uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex_);
+        inFlightBytes_ -= std::min(inFlightBytes_, bytes);
+    }
+    bufferReleased_.notify_all();
+}
+
+void S3Backend::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks_.push_back(std::move(task));
+    }
+    tasksReady_.notify_one();
+}
+
+void S3Backend::runUploads() {
+    std::unique_lock<std::mutex> lock(tasksMutex_);
+    while (true) {
+        tasksReady_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            return;
+        }
+        auto task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+void S3Backend::setError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastError_ = error;
+}
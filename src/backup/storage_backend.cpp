@@ -0,0 +1,22 @@
+#include "backup/storage_backend.hpp"
+#include "backup/local_backend.hpp"
+#include "backup/s3_backend.hpp"
+#include <filesystem>
+
+std::unique_ptr<StorageBackend> StorageBackend::create(const StorageConfig& config, std::string& error) {
+    if (config.url.compare(0, 5, "s3://") == 0) {
+        auto backend = std::make_unique<S3Backend>(config);
+        if (!backend->init(error)) {
+            return nullptr;
+        }
+        return backend;
+    }
+
+    std::string root = config.url.compare(0, 7, "file://") == 0 ? config.url.substr(7) : config.url;
+    std::error_code ec;
+    if (root.empty() || (!std::filesystem::create_directories(root, ec) && ec)) {
+        error = "Cannot use " + config.url + " as a repository" + (ec ? ": " + ec.message() : std::string());
+        return nullptr;
+    }
+    return std::make_unique<LocalBackend>(root);
+}
@@ -0,0 +1,216 @@
+#include "backup/tee_writer.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+
+TeeWriter::TeeWriter(const TeeConfig& config)
+    : config_(config) {
+}
+
+TeeWriter::~TeeWriter() {
+    finish();
+}
+
+void TeeWriter::addTarget(std::unique_ptr<TeeTarget> target, bool required) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (started_) {
+        Logger::error("Copy target " + target->describe() + " added after the copy started");
+        return;
+    }
+    auto entry = std::make_unique<Target>();
+    entry->sink = std::move(target);
+    entry->required = required;
+    targets_.push_back(std::move(entry));
+}
+
+bool TeeWriter::write(uint64_t offset, const void* data, size_t size) {
+    // One copy of the data, however many targets
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    auto block = std::make_shared<const std::vector<uint8_t>>(bytes, bytes + size);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!started_) {
+        startLocked();
+    }
+    for (auto& entry : targets_) {
+        Target& target = *entry;
+        if (failed_) {
+            return false;
+        }
+        if (target.dropped) {
+            continue;
+        }
+
+        // An empty queue takes any block, so one larger than queueBytes
+        // cannot wait forever
+        auto waitStart = std::chrono::steady_clock::now();
+        bool room = target.drained.wait_for(lock, config_.stallTimeout, [&] {
+            return failed_ || target.dropped || target.queued == 0 || target.queued + size <= config_.queueBytes;
+        });
+        target.blocked += std::chrono::steady_clock::now() - waitStart;
+        if (failed_) {
+            return false;
+        }
+        if (target.dropped) {
+            continue;
+        }
+        if (!room) {
+            dropLocked(target, target.sink->describe() + " fell behind with " + std::to_string(target.queued) +
+                                   " bytes queued for " + std::to_string(config_.stallTimeout.count()) + " ms");
+            continue;
+        }
+
+        target.queue.push_back({offset, block});
+        target.queued += size;
+        target.ready.notify_one();
+    }
+    return !failed_;
+}
+
+bool TeeWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        for (auto& target : targets_) {
+            target->ready.notify_all();
+        }
+    }
+    for (auto& target : targets_) {
+        if (target->thread.joinable()) {
+            target->thread.join();
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !failed_;
+}
+
+std::vector<TeeTargetStatus> TeeWriter::getStatus() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<TeeTargetStatus> status;
+    for (const auto& target : targets_) {
+        TeeTargetStatus entry;
+        entry.target = target->sink->describe();
+        entry.required = target->required;
+        entry.bytesWritten = target->written;
+        entry.queuedBytes = target->queued;
+        entry.blockedTime = std::chrono::duration_cast<std::chrono::milliseconds>(target->blocked);
+        entry.dropped = target->dropped;
+        entry.error = target->error;
+        status.push_back(entry);
+    }
+    return status;
+}
+
+bool TeeWriter::hasFailed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+std::string TeeWriter::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+void TeeWriter::startLocked() {
+    started_ = true;
+    if (targets_.empty()) {
+        failLocked("No copy targets");
+        return;
+    }
+    for (auto& target : targets_) {
+        target->thread = std::thread(&TeeWriter::run, this, std::ref(*target));
+    }
+}
+
+void TeeWriter::dropLocked(Target& target, const std::string& reason) {
+    target.error = reason;
+    if (config_.policy == TeePolicy::FAIL || target.required || activeLocked() <= config_.minTargets) {
+        failLocked(reason);
+        return;
+    }
+
+    Logger::warning("Dropping copy target: " + reason + "; " + std::to_string(activeLocked() - 1) +
+                    " target(s) left");
+    target.dropped = true;
+    target.queue.clear();
+    target.queued = 0;
+    target.ready.notify_all();
+    target.drained.notify_all();
+}
+
+size_t TeeWriter::activeLocked() const {
+    size_t active = 0;
+    for (const auto& target : targets_) {
+        if (!target->dropped) {
+            active++;
+        }
+    }
+    return active;
+}
+
+void TeeWriter::failLocked(const std::string& reason) {
+    if (failed_) {
+        return;
+    }
+    failed_ = true;
+    lastError_ = reason;
+    Logger::error("Copy failed: " + reason);
+    for (auto& target : targets_) {
+        target->ready.notify_all();
+        target->drained.notify_all();
+    }
+}
+
+void TeeWriter::run(Target& target) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        target.ready.wait(lock, [&] {
+            return stopping_ || failed_ || target.dropped || !target.queue.empty();
+        });
+        if (failed_ || target.dropped || target.queue.empty()) {
+            return;
+        }
+
+        Block block = std::move(target.queue.front());
+        target.queue.pop_front();
+        lock.unlock();
+        std::string error;
+        bool ok = target.sink->write(block.offset, block.data->data(), block.data->size(), error);
+        lock.lock();
+
+        if (failed_ || target.dropped) {
+            return;
+        }
+        if (!ok) {
+            dropLocked(target, target.sink->describe() + ": " + error);
+            continue;
+        }
+        target.queued -= block.data->size();
+        target.written += block.data->size();
+        target.drained.notify_all();
+    }
+}
+
+BackupCopies::BackupCopies(std::vector<std::string> paths, const TeeConfig& config)
+    : paths_(std::move(paths))
+    , config_(config) {
+}
+
+std::vector<std::string> BackupCopies::getActive() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return paths_;
+}
+
+void BackupCopies::drop(const std::string& path, const std::string& reason) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find(paths_.begin(), paths_.end(), path);
+    if (it == paths_.end()) {
+        return;
+    }
+    paths_.erase(it);
+    dropped_.emplace_back(path, reason);
+}
+
+std::vector<std::pair<std::string, std::string>> BackupCopies::getDropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
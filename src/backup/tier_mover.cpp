@@ -0,0 +1,170 @@
+#include "backup/tier_mover.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <ctime>
+
+TierMover::TierMover(const TierPolicy& policy)
+    : policy_(policy)
+    , budget_(policy.bytesPerSecond) {
+}
+
+TierMover::~TierMover() {
+    stop();
+}
+
+std::shared_ptr<TierMover> TierMover::getDefault() {
+    static auto mover = std::make_shared<TierMover>();
+    return mover;
+}
+
+void TierMover::setPolicy(const TierPolicy& policy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    policy_ = policy;
+    budget_.setRate(policy.bytesPerSecond);
+}
+
+TierPolicy TierMover::getPolicy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return policy_;
+}
+
+bool TierMover::add(const std::shared_ptr<ChunkRepository>& repository) {
+    if (!repository || !repository->hasCapacityTier()) {
+        Logger::error("Chunk repository " + (repository ? repository->getDirectory() : std::string("(none)")) +
+                      " has no capacity tier to move packs to");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::find(repositories_.begin(), repositories_.end(), repository) == repositories_.end()) {
+        repositories_.push_back(repository);
+    }
+    if (!worker_.joinable() && !stopRequested_) {
+        worker_ = std::thread(&TierMover::run, this);
+    }
+    return true;
+}
+
+void TierMover::remove(const std::shared_ptr<ChunkRepository>& repository) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    repositories_.erase(std::remove(repositories_.begin(), repositories_.end(), repository), repositories_.end());
+}
+
+TierStats TierMover::moveDue(const std::shared_ptr<ChunkRepository>& repository) {
+    TierStats stats = pass(repository, getPolicy());
+    report(stats);
+    return stats;
+}
+
+std::optional<TierStats> TierMover::getLastStats(const std::string& directory) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = lastStats_.find(directory);
+    if (it == lastStats_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void TierMover::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopRequested_ = true;
+    }
+    wakeup_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopRequested_ = false;
+}
+
+void TierMover::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopRequested_) {
+        auto repositories = repositories_;
+        TierPolicy policy = policy_;
+        lock.unlock();
+        for (const auto& repository : repositories) {
+            report(pass(repository, policy));
+        }
+        lock.lock();
+        wakeup_.wait_for(lock, policy.scanInterval, [this] { return stopRequested_; });
+    }
+}
+
+TierStats TierMover::pass(const std::shared_ptr<ChunkRepository>& repository, const TierPolicy& policy) {
+    auto started = std::chrono::steady_clock::now();
+    TierStats stats;
+    stats.repository = repository->getDirectory();
+
+    // Listed by id, so oldest first
+    std::vector<PackInfo> landing;
+    for (const auto& pack : repository->listPacks()) {
+        if (pack.offloaded) {
+            stats.capacityPacks++;
+            stats.capacityBytes += pack.size;
+        } else {
+            stats.landingPacks++;
+            stats.landingBytes += pack.size;
+            if (pack.sealed) {
+                landing.push_back(pack);
+            }
+        }
+    }
+
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    stats.completed = true;
+    for (const auto& pack : landing) {
+        bool old = now - pack.sealedAt >= static_cast<int64_t>(policy.moveAfter.count());
+        bool crowded = policy.landingLimit > 0 && stats.landingBytes > policy.landingLimit;
+        if (!old && !crowded) {
+            continue;
+        }
+        if (!pause(budget_.reserve(pack.size))) {
+            stats.completed = false;
+            break;
+        }
+
+        bool moved = false;
+        if (!repository->offloadPack(pack.id, moved)) {
+            stats.completed = false;
+            break;
+        }
+        if (moved) {
+            stats.packsMoved++;
+            stats.bytesMoved += pack.size;
+            stats.landingPacks--;
+            stats.landingBytes -= pack.size;
+            stats.capacityPacks++;
+            stats.capacityBytes += pack.size;
+        }
+    }
+
+    stats.duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    return stats;
+}
+
+bool TierMover::pause(std::chrono::nanoseconds delay) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (delay.count() > 0) {
+        wakeup_.wait_for(lock, delay, [this] { return stopRequested_; });
+    }
+    return !stopRequested_;
+}
+
+void TierMover::report(const TierStats& stats) {
+    if (stats.packsMoved > 0 || !stats.completed) {
+        std::string summary = "Moved " + std::to_string(stats.packsMoved) + " pack(s), " +
+                              std::to_string(stats.bytesMoved) + " bytes, of " + stats.repository +
+                              " to its capacity tier in " + std::to_string(stats.duration.count()) + " ms; " +
+                              std::to_string(stats.landingBytes) + " bytes in " +
+                              std::to_string(stats.landingPacks) + " pack(s) left on the landing tier";
+        if (stats.completed) {
+            Logger::info(summary);
+        } else {
+            Logger::warning(summary + ", the rest waits for the next pass");
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastStats_[stats.repository] = stats;
+}
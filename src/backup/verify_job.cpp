@@ -17,6 +17,7 @@ VerifyJob::VerifyJob(BackupProvider* provider,
     , taskManager_(taskManager)
     , config_(config) {
     setId(generateId());
+    jobClass_ = JobClass::VERIFY;
     setStatus("pending");
 }
 
@@ -43,7 +44,7 @@ bool VerifyJob::start() {
     updateProgress(0);
 
     // Start verification in a separate thread
-    std::thread([this]() {
+    startWorker([this]() {
         try {
             bool success = verifyBackup();
             handleVerificationCompletion(success, success ? "" : provider_->getLastError());
@@ -52,14 +53,14 @@ bool VerifyJob::start() {
             setError(std::string("Verification failed: ") + e.what());
             setState(State::FAILED);
         }
-    }).detach();
+    });
 
     return true;
 }
 
 bool VerifyJob::cancel() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning()) {
+    if (!isRunning() && !isPaused()) {
         return false;
     }
 
@@ -70,7 +71,8 @@ bool VerifyJob::cancel() {
 
 bool VerifyJob::pause() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning() || isPaused()) {
+    // The provider checks a backup in one call that cannot stop midway
+    if (!isRunning() || isPaused() || verifying_) {
         return false;
     }
 
@@ -81,7 +83,7 @@ bool VerifyJob::pause() {
 
 bool VerifyJob::resume() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning() || !isPaused()) {
+    if (!isPaused()) {
         return false;
     }
 
@@ -135,18 +137,26 @@ bool VerifyJob::validateVerifyConfig() const {
 
 bool VerifyJob::verifyBackup() {
     try {
-        // Check if job is paused
-        while (isPaused()) {
+        // Wait while paused; from here on the job can no longer pause
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!isPaused()) {
+                    if (!isRunning()) {
+                        return false;
+                    }
+                    verifying_ = true;
+                    break;
+                }
+            }
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
 
-        // Check if job is cancelled
-        if (!isRunning()) {
-            return false;
-        }
-
-        // Perform verification
-        if (!provider_->verifyBackup(config_.backupId)) {
+        // Perform verification on the shared pool with this job's class share
+        bool verified = taskManager_->addSharedTask(static_cast<size_t>(getJobClass()), [&]() {
+            return provider_->verifyBackup(config_.backupId);
+        }).get();
+        if (!verified) {
             return false;
         }
 
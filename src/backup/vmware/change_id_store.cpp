@@ -0,0 +1,199 @@
+#include "backup/vmware/change_id_store.hpp"
+#include "common/file_utils.hpp"
+#include "common/logger.hpp"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+
+using json = nlohmann::json;
+
+ChangeIdStore::ChangeIdStore(const std::string& path)
+    : path_(path) {
+}
+
+bool ChangeIdStore::load() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.clear();
+
+    if (!std::filesystem::exists(path_)) {
+        return true;
+    }
+
+    try {
+        std::ifstream file(path_);
+        if (!file.is_open()) {
+            lastError_ = "Failed to open change ID store: " + path_;
+            return false;
+        }
+
+        json j;
+        file >> j;
+        for (const auto& entry : j["disks"]) {
+            ChangeIdRecord record;
+            record.vmId = entry["vmId"].get<std::string>();
+            record.diskPath = entry["diskPath"].get<std::string>();
+            record.changeId = entry["changeId"].get<std::string>();
+            record.backupId = entry.value("backupId", "");
+            record.capacity = entry.value("capacity", static_cast<uint64_t>(0));
+            record.timestamp = entry.value("timestamp", static_cast<int64_t>(0));
+            records_[makeKey(record.vmId, record.diskPath)] = record;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        lastError_ = std::string("Failed to load change ID store: ") + e.what();
+        Logger::error(lastError_);
+        return false;
+    }
+}
+
+std::optional<ChangeIdRecord> ChangeIdStore::get(const std::string& vmId, const std::string& diskPath) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = records_.find(makeKey(vmId, diskPath));
+    if (it == records_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+bool ChangeIdStore::update(const ChangeIdRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = makeKey(record.vmId, record.diskPath);
+    auto previous = records_.find(key);
+    std::optional<ChangeIdRecord> saved;
+    if (previous != records_.end()) {
+        saved = previous->second;
+    }
+
+    records_[key] = record;
+    if (!persist()) {
+        // Keep memory consistent with what is on disk
+        if (saved) {
+            records_[key] = *saved;
+        } else {
+            records_.erase(key);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool ChangeIdStore::update(const std::vector<ChangeIdRecord>& records) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto saved = records_;
+    for (const auto& record : records) {
+        records_[makeKey(record.vmId, record.diskPath)] = record;
+    }
+    if (!persist()) {
+        records_ = std::move(saved);
+        return false;
+    }
+    return true;
+}
+
+bool ChangeIdStore::remove(const std::string& vmId, const std::string& diskPath) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (records_.erase(makeKey(vmId, diskPath)) == 0) {
+        return true;
+    }
+    return persist();
+}
+
+bool ChangeIdStore::removeVM(const std::string& vmId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool changed = false;
+    for (auto it = records_.begin(); it != records_.end();) {
+        if (it->second.vmId == vmId) {
+            it = records_.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+    return changed ? persist() : true;
+}
+
+bool ChangeIdStore::requiresFullBackup(const std::optional<ChangeIdRecord>& record,
+                                       const std::string& currentChangeId,
+                                       uint64_t currentCapacity,
+                                       std::string& reason) {
+    if (!record || record->changeId.empty()) {
+        reason = "no previous change ID";
+        return true;
+    }
+    if (currentChangeId.empty()) {
+        reason = "change tracking is disabled";
+        return true;
+    }
+    if (record->capacity != currentCapacity) {
+        reason = "disk capacity changed from " + std::to_string(record->capacity) +
+                 " to " + std::to_string(currentCapacity);
+        return true;
+    }
+
+    std::string previousInstance, currentInstance;
+    uint64_t previousSequence = 0, currentSequence = 0;
+    if (!parseChangeId(record->changeId, previousInstance, previousSequence) ||
+        !parseChangeId(currentChangeId, currentInstance, currentSequence)) {
+        reason = "unrecognized change ID format";
+        return true;
+    }
+    if (previousInstance != currentInstance) {
+        reason = "change tracking was reset";
+        return true;
+    }
+    if (currentSequence < previousSequence) {
+        reason = "change ID sequence went backwards";
+        return true;
+    }
+
+    reason.clear();
+    return false;
+}
+
+std::string ChangeIdStore::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool ChangeIdStore::persist() {
+    json j;
+    j["version"] = 1;
+    j["disks"] = json::array();
+    for (const auto& pair : records_) {
+        const auto& record = pair.second;
+        j["disks"].push_back({
+            {"vmId", record.vmId},
+            {"diskPath", record.diskPath},
+            {"changeId", record.changeId},
+            {"backupId", record.backupId},
+            {"capacity", record.capacity},
+            {"timestamp", record.timestamp}
+        });
+    }
+    std::string error;
+    if (!writeFileAtomic(path_, j.dump(4), error)) {
+        lastError_ = "Failed to persist change ID store: " + error;
+        Logger::error(lastError_);
+        return false;
+    }
+    return true;
+}
+
+std::string ChangeIdStore::makeKey(const std::string& vmId, const std::string& diskPath) {
+    return vmId + "|" + diskPath;
+}
+
+bool ChangeIdStore::parseChangeId(const std::string& changeId, std::string& instance, uint64_t& sequence) {
+    // VMware change IDs look like "52 de c0 ... 5e/4711"
+    auto slash = changeId.rfind('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 >= changeId.size()) {
+        return false;
+    }
+    try {
+        instance = changeId.substr(0, slash);
+        sequence = std::stoull(changeId.substr(slash + 1));
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
@@ -1,9 +1,15 @@
 #include "backup/vmware/vmware_backup_provider.hpp"
 #include "backup/backup_job.hpp"
+#include "backup/backup_catalog.hpp"
+#include "backup/backup_manifest.hpp"
+#include "backup/tee_writer.hpp"
 #include "common/parallel_task_manager.hpp"
 #include "common/vmware_connection.hpp"
 #include "common/backup_status.hpp"
 #include "common/vsphere_rest_client.hpp"
+#include "common/rate_limiter.hpp"
+#include "common/stream_controller.hpp"
+#include "common/latency_monitor.hpp"
 #include <sstream>
 #include <chrono>
 #include <thread>
@@ -22,6 +28,7 @@
 #include "common/logger.hpp"
 #include <memory>
 #include <algorithm>
+#include <pthread.h>
 
 namespace fs = std::filesystem;
 
@@ -37,6 +44,144 @@ std::string vixErrorToString(int32_t error) {
     return result;
 }
 
+// VixDiskLib_Open and VixDiskLib_Close must not run concurrently, while reads
+// and writes on different handles may
+std::mutex vddkOpenMutex;
+
+VixError openDisk(const VDDKConnection connection, const char* path, uint32_t flags, VDDKHandle* handle) {
+    std::lock_guard<std::mutex> lock(vddkOpenMutex);
+    return VixDiskLib_OpenWrapper(connection, path, flags, handle);
+}
+
+VixError closeDisk(VDDKHandle* handle) {
+    std::lock_guard<std::mutex> lock(vddkOpenMutex);
+    return VixDiskLib_CloseWrapper(handle);
+}
+
+// Disk offsets chunk-stored backups are cut at. The grid is fixed, so a range
+// that did not change between backups becomes the same chunk and is stored once
+constexpr uint64_t BACKUP_CHUNK_SIZE = 1ULL << 20;
+
+// One backup of a disk in a restore chain: its backup file and the areas it
+// holds (none = the whole disk)
+struct RestoreLayer {
+    std::string file;        // Empty for a disk in the chunk store
+    std::string repository;  // Whose chunk store holds the disk
+    std::vector<std::pair<uint64_t, uint64_t>> areas;
+    std::vector<ChunkId> chunks;  // Of each area, for a disk in the chunk store
+};
+
+// Layers that rebuild diskPath from the backup at backupId, oldest first. An
+// incremental brings the backups its manifest names as parents, which live
+// next to it in the same repository; one whose parent is gone is refused,
+// since its changed areas alone are not the disk. A backupId naming a backup
+// file, or a backup without a manifest, is a whole-disk copy. A disk the
+// manifest names no file for is in the repository's chunk store, one chunk
+// per extent.
+bool resolveRestoreChain(const std::string& backupId, const std::string& diskPath,
+                         std::vector<RestoreLayer>& layers, std::string& error) {
+    layers.clear();
+    std::error_code ec;
+    if (fs::is_regular_file(backupId, ec)) {
+        RestoreLayer layer;
+        layer.file = backupId;
+        layers.push_back(layer);
+        return true;
+    }
+
+    std::string diskFile = fs::path(diskPath).filename().string();
+    std::set<std::string> visited;
+    fs::path dir = fs::path(backupId).lexically_normal();
+    if (dir.filename().empty()) {
+        dir = dir.parent_path();
+    }
+    while (true) {
+        if (!visited.insert(dir.string()).second) {
+            error = "Backup chain of " + backupId + " loops at " + dir.string();
+            return false;
+        }
+
+        fs::path manifestPath = dir / "manifest.bin";
+        if (!fs::exists(manifestPath, ec)) {
+            if (!layers.empty()) {
+                error = "Backup " + dir.string() + " that " + backupId + " builds on has no manifest";
+                return false;
+            }
+            RestoreLayer layer;
+            layer.file = (dir / diskFile).string();
+            layers.push_back(layer);
+            return true;
+        }
+
+        ManifestReader manifest;
+        if (!manifest.open(manifestPath.string())) {
+            error = "Failed to read " + manifestPath.string() + ": " + manifest.getLastError();
+            return false;
+        }
+
+        // The disk may be restored under another path than the one it was backed up from
+        size_t disk = manifest.getDiskCount();
+        for (size_t i = 0; i < manifest.getDiskCount() && disk == manifest.getDiskCount(); i++) {
+            if (manifest.getDisk(i).path == diskPath) {
+                disk = i;
+            }
+        }
+        for (size_t i = 0; i < manifest.getDiskCount() && disk == manifest.getDiskCount(); i++) {
+            if (fs::path(manifest.getDisk(i).path).filename() == diskFile) {
+                disk = i;
+            }
+        }
+        if (disk == manifest.getDiskCount() && manifest.getDiskCount() == 1) {
+            disk = 0;
+        }
+        if (disk == manifest.getDiskCount()) {
+            error = "Backup " + dir.string() + " holds no disk " + diskPath;
+            return false;
+        }
+
+        ManifestDisk info = manifest.getDisk(disk);
+        RestoreLayer layer;
+        bool chunked = info.file.empty();
+        if (chunked) {
+            if (!manifest.hasDigests()) {
+                error = "Backup " + dir.string() + " names neither a file nor chunks for disk " + diskPath;
+                return false;
+            }
+            layer.repository = dir.parent_path().string();
+        } else {
+            layer.file = (dir / info.file).string();
+        }
+        if (chunked || !info.parent.empty()) {
+            if (!manifest.forEachExtent(disk, [&layer, chunked](const ManifestExtent& extent) {
+                    layer.areas.emplace_back(extent.offset, extent.length);
+                    if (chunked) {
+                        layer.chunks.push_back(extent.digest);
+                    }
+                    return true;
+                })) {
+                error = "Failed to read the extents of disk " + diskPath + " in " + dir.string() + ": " +
+                        manifest.getLastError();
+                return false;
+            }
+        }
+        layers.push_back(std::move(layer));
+        if (info.parent.empty()) {
+            break;
+        }
+
+        fs::path parentDir = dir.parent_path() / info.parent;
+        if (!fs::is_directory(parentDir, ec)) {
+            error = "Incremental backup " + dir.string() + " builds on " + parentDir.string() +
+                    ", which is gone; it cannot be restored on its own";
+            return false;
+        }
+        dir = parentDir;
+    }
+
+    std::reverse(layers.begin(), layers.end());
+    return true;
+}
+
 // RAII wrapper for VixDiskLibHandle
 class VDDKDiskHandle {
 public:
@@ -91,6 +236,64 @@ private:
     VDDKInfo* info_{nullptr};
 };
 
+// A backup disk written through a TeeWriter; the handle stays owned by the caller
+class BackupDiskTarget : public TeeTarget {
+public:
+    BackupDiskTarget(VDDKHandle handle, const std::string& path)
+        : handle_(handle)
+        , path_(path) {
+    }
+
+    std::string describe() const override { return path_; }
+
+    bool write(uint64_t offset, const uint8_t* data, size_t size, std::string& error) override {
+        int32_t result = VixDiskLib_WriteWrapper(handle_, offset / VIXDISKLIB_SECTOR_SIZE,
+                                                 size / VIXDISKLIB_SECTOR_SIZE, data);
+        if (result != VIX_OK) {
+            error = vixErrorToString(result);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    VDDKHandle handle_;
+    std::string path_;
+};
+
+// A backup disk stored in a chunk store, one chunk per write
+class ChunkTarget : public TeeTarget {
+public:
+    ChunkTarget(std::shared_ptr<ChunkRepository> chunks, const ChunkSession& session, const std::string& path)
+        : chunks_(std::move(chunks))
+        , session_(session)
+        , path_(path) {
+    }
+
+    std::string describe() const override { return path_; }
+
+    bool write(uint64_t offset, const uint8_t* data, size_t size, std::string& error) override {
+        ManifestExtent extent;
+        extent.offset = offset;
+        extent.length = size;
+        if (!chunks_->put(session_, data, size, extent.digest)) {
+            error = chunks_->getLastError();
+            return false;
+        }
+        extents_.push_back(extent);
+        return true;
+    }
+
+    // In the order written; read once the TeeWriter finished
+    const std::vector<ManifestExtent>& getExtents() const { return extents_; }
+
+private:
+    std::shared_ptr<ChunkRepository> chunks_;
+    const ChunkSession& session_;
+    std::string path_;
+    std::vector<ManifestExtent> extents_;
+};
+
 // RAII wrapper for VDDK connection
 /*class VDDKConnectionManager {
 public:
@@ -238,6 +441,20 @@ bool VMwareBackupProvider::getVMDiskPaths(const std::string& vmId, std::vector<s
     return connection_->getVMDiskPaths(vmId, diskPaths);
 }
 
+bool VMwareBackupProvider::getDiskCapacities(const std::string& vmId, std::map<std::string, uint64_t>& capacities) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* restClient = connection_ ? connection_->getRestClient() : nullptr;
+    if (!restClient) {
+        lastError_ = "Not connected";
+        return false;
+    }
+    if (!restClient->getVMDiskCapacities(vmId, capacities)) {
+        lastError_ = "Failed to get disk capacities of VM " + vmId;
+        return false;
+    }
+    return true;
+}
+
 bool VMwareBackupProvider::getVMInfo(const std::string& vmId, std::string& name, std::string& status) const {
     if (!connection_ || !connection_->isConnected()) {
         const_cast<VMwareBackupProvider*>(this)->lastError_ = "Not connected";
@@ -304,7 +521,8 @@ void VMwareBackupProvider::cleanupSnapshot() {
     }
 }
 
-bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConfig& config) {
+bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConfig& config,
+                                       const BackupContext& context) {
     if (!connection_ || !connection_->isConnected()) {
         lastError_ = "Not connected to vCenter";
         Logger::error("Backup failed: Not connected to vCenter");
@@ -355,6 +573,7 @@ bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConf
         Logger::info("Found " + std::to_string(diskPaths.size()) + " disk(s) to backup");
 
         // Backup each disk
+        ManifestWriter manifest(config.compressionLevel);
         for (size_t i = 0; i < diskPaths.size(); ++i) {
             const auto& diskPath = diskPaths[i];
             Logger::info("Starting backup of disk " + std::to_string(i + 1) + "/" + 
@@ -420,6 +639,10 @@ bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConf
                     uint64_t bytesToRead = std::min(bufferSize, capacity - bytesRead);
                     uint64_t bytesReadThisTime = 0;
 
+                    if (context.rateLimiter) {
+                        context.rateLimiter->acquire(bytesToRead);
+                    }
+
                     vixError = VixDiskLib_ReadWrapper(srcDisk, bytesRead / VIXDISKLIB_SECTOR_SIZE,
                         bytesToRead / VIXDISKLIB_SECTOR_SIZE, buffer.data());
                     if (vixError != VIX_OK) {
@@ -442,6 +665,11 @@ bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConf
                 }
 
                 Logger::info("Disk " + std::to_string(i + 1) + " backup completed successfully");
+
+                ManifestExtent extent;
+                extent.length = capacity;
+                manifest.addExtent(manifest.addDisk(diskPath, std::filesystem::path(backupPath).filename().string(),
+                                                    capacity), extent);
             }
             catch (const std::exception& e) {
                 lastError_ = std::string("Disk backup failed: ") + e.what();
@@ -464,7 +692,7 @@ bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConf
 
         // Save backup metadata
         Logger::info("Saving backup metadata...");
-        if (!saveBackupMetadata(config.backupPath, vmId, diskPaths)) {
+        if (!saveBackupMetadata(config.backupPath, vmId, diskPaths, &manifest)) {
             lastError_ = "Warning: Failed to save backup metadata";
             Logger::warning(lastError_);
             // Continue anyway as the backup was successful
@@ -486,19 +714,19 @@ bool VMwareBackupProvider::startBackup(const std::string& vmId, const BackupConf
     }
 }
 
-bool VMwareBackupProvider::cancelBackup(const std::string& vmId) {
+bool VMwareBackupProvider::cancelBackup(const std::string& /*vmId*/) {
     // TODO: Implement cancel functionality
     lastError_ = "Cancel not implemented yet";
     return false;
 }
 
-bool VMwareBackupProvider::pauseBackup(const std::string& vmId) {
+bool VMwareBackupProvider::pauseBackup(const std::string& /*vmId*/) {
     // TODO: Implement pause functionality
     lastError_ = "Pause not implemented yet";
     return false;
 }
 
-bool VMwareBackupProvider::resumeBackup(const std::string& vmId) {
+bool VMwareBackupProvider::resumeBackup(const std::string& /*vmId*/) {
     // TODO: Implement resume functionality
     lastError_ = "Resume not implemented yet";
     return false;
@@ -551,7 +779,7 @@ bool VMwareBackupProvider::startRestore(const std::string& vmId, const std::stri
         for (const auto& diskPath : diskPaths) {
             updateProgress(0.0, "Restoring disk: " + diskPath);
 
-            if (!restoreDisk(vmId, diskPath, config)) {
+            if (!restoreDisk(vmId, diskPath, config, RestoreContext())) {
                 lastError_ = "Failed to restore disk: " + diskPath;
                 return false;
             }
@@ -565,7 +793,7 @@ bool VMwareBackupProvider::startRestore(const std::string& vmId, const std::stri
     }
 }
 
-bool VMwareBackupProvider::cancelRestore(const std::string& restoreId) {
+bool VMwareBackupProvider::cancelRestore(const std::string& /*restoreId*/) {
     if (!connection_ || !connection_->isConnected()) {
         lastError_ = "Not connected";
         return false;
@@ -581,12 +809,12 @@ bool VMwareBackupProvider::cancelRestore(const std::string& restoreId) {
     }
 }
 
-bool VMwareBackupProvider::pauseRestore(const std::string& restoreId) {
+bool VMwareBackupProvider::pauseRestore(const std::string& /*restoreId*/) {
     lastError_ = "Pause operation not supported";
     return false;
 }
 
-bool VMwareBackupProvider::resumeRestore(const std::string& restoreId) {
+bool VMwareBackupProvider::resumeRestore(const std::string& /*restoreId*/) {
     lastError_ = "Resume operation not supported";
     return false;
 }
@@ -688,8 +916,16 @@ bool VMwareBackupProvider::verifyBackupIntegrity(const std::string& backupId) {
 }
 
 bool VMwareBackupProvider::saveBackupMetadata(const std::string& backupId, const std::string& vmId,
-                                            const std::vector<std::string>& diskPaths) {
+                                            const std::vector<std::string>& diskPaths, ManifestWriter* manifest) {
     try {
+        if (manifest) {
+            std::string error;
+            if (!manifest->write(backupId + "/manifest.bin", error)) {
+                lastError_ = "Failed to write manifest: " + error;
+                return false;
+            }
+        }
+
         std::string metadataPath = backupId + "/metadata.json";
         std::ofstream file(metadataPath);
         if (!file.is_open()) {
@@ -702,8 +938,15 @@ bool VMwareBackupProvider::saveBackupMetadata(const std::string& backupId, const
         j["vmId"] = vmId;
         j["timestamp"] = std::chrono::system_clock::now().time_since_epoch().count();
         j["type"] = static_cast<int>(BackupType::FULL);
-        j["size"] = 0;
+        j["size"] = manifest ? manifest->getBytes() : 0;
         j["disks"] = diskPaths;
+        if (manifest) {
+            j["manifest"] = {
+                {"file", "manifest.bin"},
+                {"disks", manifest->getDiskCount()},
+                {"extents", manifest->getExtentCount()}
+            };
+        }
         j["checksum"] = calculateChecksum(backupId);
 
         file << j.dump(4);
@@ -718,8 +961,14 @@ std::optional<BackupMetadata> VMwareBackupProvider::getLatestBackupInfo(const st
     try {
         std::string backupPath = vmId;
         if (!std::filesystem::exists(backupPath)) {
-            lastError_ = std::string("Backup not found for VM: ") + vmId;
-            return std::nullopt;
+            // Not a backup directory: look up the newest backup of the VM
+            auto catalog = BackupCatalog::forRepository((std::filesystem::current_path() / "backups").string());
+            auto latest = catalog ? catalog->latest(vmId) : std::nullopt;
+            if (!latest) {
+                lastError_ = std::string("Backup not found for VM: ") + vmId;
+                return std::nullopt;
+            }
+            backupPath = latest->backupId;
         }
 
         std::string metadataPath = backupPath + "/metadata.json";
@@ -738,7 +987,17 @@ std::optional<BackupMetadata> VMwareBackupProvider::getLatestBackupInfo(const st
         info.timestamp = j["timestamp"];
         info.type = static_cast<BackupType>(j["type"].get<int>());
         info.size = j["size"];
-        info.disks = j["disks"].get<std::vector<std::string>>();
+        if (j.contains("disks")) {
+            info.disks = j["disks"].get<std::vector<std::string>>();
+        } else {
+            // Backups written by BackupJob list their disks in the manifest only
+            ManifestReader manifest;
+            if (manifest.open(backupPath + "/manifest.bin")) {
+                for (size_t disk = 0; disk < manifest.getDiskCount(); disk++) {
+                    info.disks.push_back(manifest.getDisk(disk).path);
+                }
+            }
+        }
         info.checksum = j["checksum"];
 
         return info;
@@ -796,10 +1055,11 @@ std::string VMwareBackupProvider::calculateChecksum(const std::string& filePath)
     return oss.str();
 }
 
-bool VMwareBackupProvider::backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config) {
-    std::lock_guard<std::mutex> lock(mutex_);
+bool VMwareBackupProvider::backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig& config,
+                                      const BackupContext& context) {
+    // Disks of other jobs are copied at the same time; only the shared state is locked
     if (!connection_) {
-        lastError_ = "Not connected";
+        setError("Not connected");
         return false;
     }
 
@@ -810,15 +1070,15 @@ bool VMwareBackupProvider::backupDisk(const std::string& vmId, const std::string
         // Get VDDK connection
         VDDKConnection vddkConn = connection_->getVDDKConnection();
         if (!vddkConn) {
-            lastError_ = "Failed to get VDDK connection";
-            Logger::error(lastError_);
+            setError("Failed to get VDDK connection");
+            Logger::error(getLastError());
             return false;
         }
 
         // Validate disk path format
         if (diskPath.empty() || diskPath[0] != '[' || diskPath.find(']') == std::string::npos) {
-            lastError_ = "Invalid disk path format. Expected format: [datastore] path/to/vmdk";
-            Logger::error(lastError_);
+            setError("Invalid disk path format. Expected format: [datastore] path/to/vmdk");
+            Logger::error(getLastError());
             return false;
         }
 
@@ -826,49 +1086,13 @@ bool VMwareBackupProvider::backupDisk(const std::string& vmId, const std::string
 
         // Open source disk
         VDDKHandle sourceHandle;
-        int32_t result = VixDiskLib_OpenWrapper(vddkConn,
-                                              diskPath.c_str(),
-                                              VIXDISKLIB_FLAG_OPEN_READ_ONLY,
-                                              &sourceHandle);
-        if (result != VIX_OK) {
-            lastError_ = "Failed to open source disk: " + vixErrorToString(result);
-            Logger::error(lastError_);
-            return false;
-        }
-
-        // Create backup file path
-        std::string backupDiskPath = config.backupPath + "/" + std::filesystem::path(diskPath).filename().string();
-        Logger::debug("Creating backup disk at: " + backupDiskPath);
-
-        // Create target disk
-        VixDiskLibCreateParams createParams;
-        memset(&createParams, 0, sizeof(createParams));
-        createParams.diskType = static_cast<VixDiskLibDiskType>(VIXDISKLIB_DISK_MONOLITHIC_SPARSE);
-        createParams.adapterType = static_cast<VixDiskLibAdapterType>(VIXDISKLIB_ADAPTER_SCSI_LSILOGIC);
-        createParams.hwVersion = VIXDISKLIB_HWVERSION_WORKSTATION_5;
-
-        result = VixDiskLib_CreateWrapper(vddkConn,
-                                        backupDiskPath.c_str(),
-                                        &createParams,
-                                        nullptr,
-                                        nullptr);
-        if (result != VIX_OK) {
-            VixDiskLib_CloseWrapper(&sourceHandle);
-            lastError_ = "Failed to create backup disk: " + vixErrorToString(result);
-            Logger::error(lastError_);
-            return false;
-        }
-
-        // Open backup disk
-        VDDKHandle backupHandle;
-        result = VixDiskLib_OpenWrapper(vddkConn,
-                                      backupDiskPath.c_str(),
-                                      VIXDISKLIB_FLAG_OPEN_UNBUFFERED,
-                                      &backupHandle);
+        int32_t result = openDisk(vddkConn,
+                                  diskPath.c_str(),
+                                  VIXDISKLIB_FLAG_OPEN_READ_ONLY,
+                                  &sourceHandle);
         if (result != VIX_OK) {
-            VixDiskLib_CloseWrapper(&sourceHandle);
-            lastError_ = "Failed to open backup disk: " + vixErrorToString(result);
-            Logger::error(lastError_);
+            setError("Failed to open source disk: " + vixErrorToString(result));
+            Logger::error(getLastError());
             return false;
         }
 
@@ -876,126 +1100,423 @@ bool VMwareBackupProvider::backupDisk(const std::string& vmId, const std::string
         VDDKInfo* diskInfo = nullptr;
         result = VixDiskLib_GetInfoWrapper(sourceHandle, &diskInfo);
         if (result != VIX_OK) {
-            VixDiskLib_CloseWrapper(&sourceHandle);
-            VixDiskLib_CloseWrapper(&backupHandle);
-            lastError_ = "Failed to get disk info: " + vixErrorToString(result);
-            Logger::error(lastError_);
+            closeDisk(&sourceHandle);
+            setError("Failed to get disk info: " + vixErrorToString(result));
+            Logger::error(getLastError());
             return false;
         }
+        uint64_t capacity = diskInfo->capacity * VIXDISKLIB_SECTOR_SIZE;
+
+        // Resolve the CBT checkpoint this backup can build on. The REST
+        // client and the change ID stores are shared, the copy below is not
+        ChangeIdStore* changeIds = nullptr;
+        std::string currentChangeId;
+        bool incremental = false;
+        std::string parent;  // Backup directory the changed areas apply on top of
+        std::vector<std::pair<uint64_t, uint64_t>> changedAreas;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            changeIds = config.enableCBT ? getChangeIdStore(config) : nullptr;
+            if (changeIds) {
+                // The change ID must describe the disk as read, so it comes from the snapshot's
+                // disk backing; the live disk has moved on since the snapshot was taken
+                auto* restClient = connection_->getRestClient();
+                std::string vmMoRef, diskId;
+                if (!connection_->isCBTEnabled(vmId)) {
+                    Logger::warning("Change tracking is not active for VM: " + vmId);
+                } else if (context.snapshotId.empty()) {
+                    Logger::warning("No snapshot to take the change ID of disk " + diskPath + " from");
+                } else if (!restClient || !restClient->getVMDiskId(vmId, diskPath, vmMoRef, diskId) ||
+                           !restClient->getSnapshotDiskChangeId(vmMoRef, context.snapshotId, diskId,
+                                                                currentChangeId)) {
+                    Logger::warning("Failed to get the change ID of disk " + diskPath + " in snapshot " +
+                                    context.snapshotId);
+                    currentChangeId.clear();
+                }
+            }
 
-        // Copy disk contents
-        Logger::info("Starting disk copy operation...");
-        result = VixDiskLib_CloneWrapper(vddkConn, backupDiskPath.c_str(), vddkConn, diskPath.c_str(), &createParams, nullptr, nullptr, FALSE);
-        if (result != VIX_OK) {
+            if (changeIds && config.incremental) {
+                auto previous = changeIds->get(vmId, diskPath);
+                std::string reason;
+                if (ChangeIdStore::requiresFullBackup(previous, currentChangeId, capacity, reason)) {
+                    Logger::info("Full backup required for disk " + diskPath + ": " + reason);
+                } else if (queryChangedAreas(vmId, diskPath, previous->changeId, capacity, changedAreas)) {
+                    incremental = true;
+                    fs::path parentDir = fs::path(previous->backupId).lexically_normal();
+                    if (parentDir.filename().empty()) {
+                        parentDir = parentDir.parent_path();
+                    }
+                    parent = parentDir.filename().string();
+                    Logger::info("Incremental backup of disk " + diskPath + " since change ID " +
+                                 previous->changeId + " (" + std::to_string(changedAreas.size()) + " changed areas)");
+                } else {
+                    Logger::warning("Failed to query changed areas for disk " + diskPath +
+                                    ", falling back to full backup");
+                }
+            }
+        }
+
+        if (context.chunkStore) {
+            // No backup file: the disk goes to the chunk stores and only the manifest maps it
+            std::vector<ManifestExtent> extents;
+            bool stored = context.manifest &&
+                          storeDiskChunks(vddkConn, diskPath, sourceHandle,
+                                          incremental ? changedAreas
+                                                      : std::vector<std::pair<uint64_t, uint64_t>>{{0, capacity}},
+                                          config, context, extents);
             VixDiskLib_FreeInfoWrapper(diskInfo);
-            VixDiskLib_CloseWrapper(&sourceHandle);
-            VixDiskLib_CloseWrapper(&backupHandle);
-            lastError_ = "Failed to copy disk contents: " + vixErrorToString(result);
-            Logger::error(lastError_);
-            return false;
+            closeDisk(&sourceHandle);
+            if (!context.manifest) {
+                setError("Disks in a chunk store need a manifest");
+            }
+            if (!stored) {
+                Logger::error(getLastError());
+                return false;
+            }
+            size_t disk = context.manifest->addDisk(diskPath, "", capacity, parent);
+            for (const auto& extent : extents) {
+                if (!context.manifest->addExtent(disk, extent)) {
+                    setError("Overlapping chunks at offset " + std::to_string(extent.offset) + " of disk " + diskPath);
+                    Logger::error(getLastError());
+                    return false;
+                }
+            }
+        } else {
+            // Create backup file path
+            std::string backupDiskPath = config.backupPath + "/" + std::filesystem::path(diskPath).filename().string();
+            Logger::debug("Creating backup disk at: " + backupDiskPath);
+
+            // Create target disk
+            VixDiskLibCreateParams createParams;
+            memset(&createParams, 0, sizeof(createParams));
+            createParams.diskType = static_cast<VixDiskLibDiskType>(VIXDISKLIB_DISK_MONOLITHIC_SPARSE);
+            createParams.adapterType = static_cast<VixDiskLibAdapterType>(VIXDISKLIB_ADAPTER_SCSI_LSILOGIC);
+            createParams.hwVersion = VIXDISKLIB_HWVERSION_WORKSTATION_5;
+            createParams.capacity = diskInfo->capacity;
+
+            result = VixDiskLib_CreateWrapper(vddkConn,
+                                            backupDiskPath.c_str(),
+                                            &createParams,
+                                            nullptr,
+                                            nullptr);
+            if (result != VIX_OK) {
+                VixDiskLib_FreeInfoWrapper(diskInfo);
+                closeDisk(&sourceHandle);
+                setError("Failed to create backup disk: " + vixErrorToString(result));
+                Logger::error(getLastError());
+                return false;
+            }
+
+            // Open backup disk
+            VDDKHandle backupHandle;
+            result = openDisk(vddkConn,
+                              backupDiskPath.c_str(),
+                              VIXDISKLIB_FLAG_OPEN_UNBUFFERED,
+                              &backupHandle);
+            if (result != VIX_OK) {
+                VixDiskLib_FreeInfoWrapper(diskInfo);
+                closeDisk(&sourceHandle);
+                setError("Failed to open backup disk: " + vixErrorToString(result));
+                Logger::error(getLastError());
+                return false;
+            }
+
+            // Copies in other repositories get backup disks of their own, written from the same reads
+            std::unique_ptr<TeeWriter> tee;
+            std::vector<std::pair<std::string, VDDKHandle>> copyHandles;  // Copy's backup directory, disk
+            auto closeCopies = [&]() {
+                for (auto& copy : copyHandles) {
+                    closeDisk(&copy.second);
+                }
+                copyHandles.clear();
+            };
+            if (context.copies) {
+                bool degrade = context.copies->getConfig().policy == TeePolicy::DEGRADE;
+                for (const auto& copyPath : context.copies->getActive()) {
+                    std::string copyDiskPath = copyPath + "/" + fs::path(diskPath).filename().string();
+                    VDDKHandle copyHandle = nullptr;
+                    result = VixDiskLib_CreateWrapper(vddkConn, copyDiskPath.c_str(), &createParams, nullptr, nullptr);
+                    if (result == VIX_OK) {
+                        result = openDisk(vddkConn, copyDiskPath.c_str(), VIXDISKLIB_FLAG_OPEN_UNBUFFERED,
+                                          &copyHandle);
+                    }
+                    if (result != VIX_OK) {
+                        std::string reason = "Failed to create backup disk " + copyDiskPath + ": " + vixErrorToString(result);
+                        if (degrade) {
+                            Logger::warning(reason + ", dropping the copy");
+                            context.copies->drop(copyPath, reason);
+                            continue;
+                        }
+                        closeCopies();
+                        VixDiskLib_FreeInfoWrapper(diskInfo);
+                        closeDisk(&sourceHandle);
+                        closeDisk(&backupHandle);
+                        setError(reason);
+                        Logger::error(getLastError());
+                        return false;
+                    }
+                    copyHandles.emplace_back(copyPath, copyHandle);
+                }
+                if (!copyHandles.empty()) {
+                    tee = std::make_unique<TeeWriter>(context.copies->getConfig());
+                    tee->addTarget(std::make_unique<BackupDiskTarget>(backupHandle, backupDiskPath), true);
+                    for (const auto& copy : copyHandles) {
+                        tee->addTarget(std::make_unique<BackupDiskTarget>(
+                            copy.second, copy.first + "/" + fs::path(diskPath).filename().string()));
+                    }
+                    Logger::info("Writing disk " + diskPath + " to " + std::to_string(copyHandles.size() + 1) +
+                                 " repositories");
+                }
+            }
+
+            auto io = probeLocalStorage(config.backupPath, context.streamController.get());
+            if (incremental) {
+                // Only the areas changed since the stored change ID go into the sparse target
+                Logger::info("Starting changed area copy operation...");
+                if (!copyAreas(vddkConn, diskPath, VIXDISKLIB_FLAG_OPEN_READ_ONLY, sourceHandle, backupHandle, true,
+                               changedAreas, context.rateLimiter.get(), context.streamController.get(),
+                               context.latencyThrottle.get(), io, nullptr, tee.get())) {
+                    closeCopies();
+                    VixDiskLib_FreeInfoWrapper(diskInfo);
+                    closeDisk(&sourceHandle);
+                    closeDisk(&backupHandle);
+                    Logger::error(getLastError());
+                    return false;
+                }
+            } else if ((context.rateLimiter && !context.rateLimiter->isUnlimited()) ||
+                       (context.latencyThrottle && context.latencyThrottle->isEnabled()) ||
+                       (context.streamController && context.streamController->getMaxStreams() > 1) || tee) {
+                // Clone can be neither throttled, split into streams nor written to copies, so the
+                // whole disk is copied read by read
+                Logger::info("Starting streamed disk copy operation...");
+                if (!copyAreas(vddkConn, diskPath, VIXDISKLIB_FLAG_OPEN_READ_ONLY, sourceHandle, backupHandle, true,
+                               {{0, capacity}}, context.rateLimiter.get(), context.streamController.get(),
+                               context.latencyThrottle.get(), io, nullptr, tee.get())) {
+                    closeCopies();
+                    VixDiskLib_FreeInfoWrapper(diskInfo);
+                    closeDisk(&sourceHandle);
+                    closeDisk(&backupHandle);
+                    Logger::error(getLastError());
+                    return false;
+                }
+            } else {
+                // Copy disk contents
+                Logger::info("Starting disk copy operation...");
+                result = VixDiskLib_CloneWrapper(vddkConn, backupDiskPath.c_str(), vddkConn, diskPath.c_str(), &createParams, nullptr, nullptr, FALSE);
+                if (result != VIX_OK) {
+                    VixDiskLib_FreeInfoWrapper(diskInfo);
+                    closeDisk(&sourceHandle);
+                    closeDisk(&backupHandle);
+                    setError("Failed to copy disk contents: " + vixErrorToString(result));
+                    Logger::error(getLastError());
+                    return false;
+                }
+            }
+
+            // Copies dropped under the degrade policy are left out of the remaining disks
+            if (tee) {
+                auto status = tee->getStatus();
+                for (size_t i = 1; i < status.size(); i++) {
+                    if (status[i].dropped) {
+                        context.copies->drop(copyHandles[i - 1].first, status[i].error);
+                    }
+                }
+            }
+
+            // Cleanup
+            closeCopies();
+            VixDiskLib_FreeInfoWrapper(diskInfo);
+            closeDisk(&sourceHandle);
+            closeDisk(&backupHandle);
+
+            if (context.manifest) {
+                size_t disk = context.manifest->addDisk(diskPath, std::filesystem::path(backupDiskPath).filename().string(),
+                                                       capacity, parent);
+                for (const auto& area : incremental ? changedAreas : std::vector<std::pair<uint64_t, uint64_t>>{{0, capacity}}) {
+                    ManifestExtent extent;
+                    extent.offset = area.first;
+                    extent.length = area.second;
+                    if (!context.manifest->addExtent(disk, extent)) {
+                        Logger::warning("Skipping out-of-order changed area at offset " + std::to_string(area.first) +
+                                        " of disk " + diskPath + " in the manifest");
+                    }
+                }
+            }
         }
 
-        // Cleanup
-        VixDiskLib_FreeInfoWrapper(diskInfo);
-        VixDiskLib_CloseWrapper(&sourceHandle);
-        VixDiskLib_CloseWrapper(&backupHandle);
+        // Remember where this backup left off so the next run can be incremental; saved
+        // by finishBackup once every disk of the backup is in
+        if (changeIds && !currentChangeId.empty()) {
+            ChangeIdRecord record;
+            record.vmId = vmId;
+            record.diskPath = diskPath;
+            record.changeId = currentChangeId;
+            record.backupId = config.backupPath;
+            record.capacity = capacity;
+            record.timestamp = std::time(nullptr);
+            std::lock_guard<std::mutex> lock(mutex_);
+            pendingBackups_[config.backupPath].changeIds.emplace_back(changeIds, record);
+        }
 
         Logger::info("Successfully backed up disk: " + diskPath);
         return true;
     } catch (const std::exception& e) {
-        lastError_ = std::string("Backup failed: ") + e.what();
-        Logger::error(lastError_);
+        setError(std::string("Backup failed: ") + e.what());
+        Logger::error(getLastError());
         return false;
     }
 }
 
-bool VMwareBackupProvider::restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig& config) {
+bool VMwareBackupProvider::finishBackup(const std::string& vmId, const BackupConfig& config,
+                                        const BackupContext& context, bool succeeded) {
     std::lock_guard<std::mutex> lock(mutex_);
+    auto found = pendingBackups_.find(config.backupPath);
+    if (found == pendingBackups_.end()) {
+        return true;
+    }
+    PendingBackup pending = std::move(found->second);
+    pendingBackups_.erase(found);
+    if (!succeeded) {
+        Logger::info("Discarding change IDs of the unfinished backup of VM " + vmId);
+        if (!pending.roots.empty()) {
+            // Closing the sessions leaves the chunks to the garbage collector
+            lastError_ = "Chunks of the unfinished backup " + config.backupPath + " are not referenced";
+            return false;
+        }
+        return true;
+    }
+
+    // Chunks stay stored only once a root references them; a copy dropped
+    // meanwhile gets none
+    std::vector<std::string> active;
+    if (context.copies) {
+        active = context.copies->getActive();
+    }
+    for (size_t i = 0; i < pending.roots.size(); i++) {
+        auto& root = pending.roots[i];
+        if (i > 0 && std::find(active.begin(), active.end(), root.backupDir) == active.end()) {
+            continue;
+        }
+        std::string name = fs::path(root.backupDir).lexically_normal().filename().string();
+        if (name.empty()) {
+            name = fs::path(root.backupDir).lexically_normal().parent_path().filename().string();
+        }
+        if (!root.chunks->commitRoot(*root.session, name, root.ids)) {
+            std::string reason = "Failed to commit chunks of " + root.backupDir + ": " + root.chunks->getLastError();
+            if (i > 0 && context.copies->getConfig().policy == TeePolicy::DEGRADE) {
+                Logger::warning(reason + ", dropping the copy");
+                context.copies->drop(root.backupDir, reason);
+                continue;
+            }
+            lastError_ = reason;
+            Logger::error(lastError_);
+            return false;
+        }
+    }
+
+    // The disks of one store are saved together, so a chain never mixes two
+    // backups. A store that cannot be written only costs the next backup its
+    // increment
+    std::map<ChangeIdStore*, std::vector<ChangeIdRecord>> byStore;
+    for (auto& entry : pending.changeIds) {
+        byStore[entry.first].push_back(std::move(entry.second));
+    }
+    for (const auto& store : byStore) {
+        if (!store.first->update(store.second)) {
+            Logger::warning("Failed to persist change IDs, the next backup will be full: " +
+                            store.first->getLastError());
+        }
+    }
+    return true;
+}
+
+bool VMwareBackupProvider::restoreDisk(const std::string& /*vmId*/, const std::string& diskPath,
+                                       const RestoreConfig& config, const RestoreContext& context) {
     if (!connection_) {
-        lastError_ = "Not connected";
+        setError("Not connected");
         return false;
     }
 
     try {
-        // Open backup disk
-        VDDKHandle backupHandle;
-        int32_t result = VixDiskLib_OpenWrapper(connection_->getVDDKConnection(),
-                                              config.backupId.c_str(),
-                                              VIXDISKLIB_FLAG_OPEN_READ_ONLY,
-                                              &backupHandle);
-        if (result != VIX_OK) {
-            lastError_ = "Failed to open backup disk";
+        // An incremental is rebuilt by writing the backups it builds on first
+        std::vector<RestoreLayer> layers;
+        std::string error;
+        if (!resolveRestoreChain(config.backupId, diskPath, layers, error)) {
+            setError(error);
+            Logger::error(getLastError());
             return false;
         }
+        if (layers.size() > 1) {
+            Logger::info("Restoring disk " + diskPath + " from a chain of " + std::to_string(layers.size()) +
+                         " backups");
+        }
 
         // Open target disk
         VDDKHandle targetHandle;
-        result = VixDiskLib_OpenWrapper(connection_->getVDDKConnection(),
-                                      diskPath.c_str(),
-                                      VIXDISKLIB_FLAG_OPEN_UNBUFFERED,
-                                      &targetHandle);
-        if (result != VIX_OK) {
-            VixDiskLib_CloseWrapper(&backupHandle);
-            lastError_ = "Failed to open target disk";
-            return false;
-        }
-
-        // Get disk info
-        VDDKInfo* diskInfo = nullptr;
-        result = VixDiskLib_GetInfoWrapper(backupHandle, &diskInfo);
+        int32_t result = openDisk(connection_->getVDDKConnection(),
+                                  diskPath.c_str(),
+                                  VIXDISKLIB_FLAG_OPEN_UNBUFFERED,
+                                  &targetHandle);
         if (result != VIX_OK) {
-            VixDiskLib_CloseWrapper(&backupHandle);
-            VixDiskLib_CloseWrapper(&targetHandle);
-            lastError_ = "Failed to get disk info";
+            setError("Failed to open target disk");
             return false;
         }
 
-        // Copy disk data
-        const size_t bufferSize = 1024 * 1024;  // 1MB buffer
-        std::vector<uint8_t> buffer(bufferSize);
-        uint64_t totalSectors = diskInfo->capacity;
-        uint64_t sectorsProcessed = 0;
-
-        while (sectorsProcessed < totalSectors) {
-            uint64_t sectorsToRead = std::min(static_cast<uint64_t>(bufferSize / VIXDISKLIB_SECTOR_SIZE),
-                                            totalSectors - sectorsProcessed);
+        auto io = probeLocalStorage(config.backupId, context.streamController.get());
+        for (const auto& layer : layers) {
+            if (layer.file.empty()) {
+                if (!restoreChunks(targetHandle, layer, context)) {
+                    closeDisk(&targetHandle);
+                    Logger::error(getLastError());
+                    return false;
+                }
+                continue;
+            }
 
-            result = VixDiskLib_ReadWrapper(backupHandle,
-                                          sectorsProcessed,
-                                          sectorsToRead,
-                                          buffer.data());
+            // Open backup disk
+            VDDKHandle backupHandle;
+            result = openDisk(connection_->getVDDKConnection(),
+                              layer.file.c_str(),
+                              VIXDISKLIB_FLAG_OPEN_READ_ONLY,
+                              &backupHandle);
             if (result != VIX_OK) {
-                VixDiskLib_FreeInfoWrapper(diskInfo);
-                VixDiskLib_CloseWrapper(&backupHandle);
-                VixDiskLib_CloseWrapper(&targetHandle);
-                lastError_ = "Failed to read backup disk";
+                closeDisk(&targetHandle);
+                setError("Failed to open backup disk " + layer.file);
                 return false;
             }
 
-            result = VixDiskLib_WriteWrapper(targetHandle,
-                                           sectorsProcessed,
-                                           sectorsToRead,
-                                           buffer.data());
+            // Get disk info
+            VDDKInfo* diskInfo = nullptr;
+            result = VixDiskLib_GetInfoWrapper(backupHandle, &diskInfo);
             if (result != VIX_OK) {
-                VixDiskLib_FreeInfoWrapper(diskInfo);
-                VixDiskLib_CloseWrapper(&backupHandle);
-                VixDiskLib_CloseWrapper(&targetHandle);
-                lastError_ = "Failed to write target disk";
+                closeDisk(&backupHandle);
+                closeDisk(&targetHandle);
+                setError("Failed to get disk info");
                 return false;
             }
 
-            sectorsProcessed += sectorsToRead;
-            progress_ = static_cast<double>(sectorsProcessed) / totalSectors * 100.0;
+            // Copy disk data
+            uint64_t capacity = diskInfo->capacity * VIXDISKLIB_SECTOR_SIZE;
+            VixDiskLib_FreeInfoWrapper(diskInfo);
+            auto areas = layer.areas.empty() ? std::vector<std::pair<uint64_t, uint64_t>>{{0, capacity}}
+                                             : layer.areas;
+            bool copied = copyAreas(connection_->getVDDKConnection(), diskPath, VIXDISKLIB_FLAG_OPEN_UNBUFFERED,
+                                    targetHandle, backupHandle, false, areas, context.rateLimiter.get(),
+                                    context.streamController.get(), context.latencyThrottle.get(), io, &progress_);
+            closeDisk(&backupHandle);
+            if (!copied) {
+                closeDisk(&targetHandle);
+                Logger::error(getLastError());
+                return false;
+            }
         }
 
         // Cleanup
-        VixDiskLib_FreeInfoWrapper(diskInfo);
-        VixDiskLib_CloseWrapper(&backupHandle);
-        VixDiskLib_CloseWrapper(&targetHandle);
+        closeDisk(&targetHandle);
 
         return true;
     } catch (const std::exception& e) {
-        lastError_ = std::string("Restore failed: ") + e.what();
+        setError(std::string("Restore failed: ") + e.what());
         return false;
     }
 }
@@ -1047,7 +1568,7 @@ bool VMwareBackupProvider::verifyDisk(const std::string& diskPath) {
     }
 }
 
-bool VMwareBackupProvider::getChangedBlocks(const std::string& vmId, const std::string& diskPath,
+bool VMwareBackupProvider::getChangedBlocks(const std::string& /*vmId*/, const std::string& diskPath,
                                           std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks) {
     std::lock_guard<std::mutex> lock(mutex_);
     if (!connection_) {
@@ -1123,15 +1644,13 @@ bool VMwareBackupProvider::listBackups(std::vector<std::string>& backupIds) {
             return false;
         }
 
-        // Iterate through the backup directory
-        for (const auto& entry : std::filesystem::directory_iterator(backupDir)) {
-            if (entry.is_directory()) {
-                // Check if it's a valid backup directory by looking for metadata
-                auto metadataPath = entry.path() / "metadata.json";
-                if (std::filesystem::exists(metadataPath)) {
-                    backupIds.push_back(entry.path().filename().string());
-                }
-            }
+        auto catalog = BackupCatalog::forRepository(backupDir.string());
+        if (!catalog) {
+            lastError_ = "Failed to open backup catalog in " + backupDir.string();
+            return false;
+        }
+        for (const auto& entry : catalog->listAll()) {
+            backupIds.push_back(std::filesystem::path(entry.backupId).filename().string());
         }
 
         return true;
@@ -1237,6 +1756,427 @@ bool VMwareBackupProvider::cleanupCBT(const std::string& diskPath) {
     }
 }
 
+ChangeIdStore* VMwareBackupProvider::getChangeIdStore(const BackupConfig& config) {
+    std::string root = config.backupDir.empty() ? config.backupPath : config.backupDir;
+    if (root.empty()) {
+        return nullptr;
+    }
+
+    std::string storePath = (fs::path(root) / "changeid_store.json").string();
+    auto it = changeIdStores_.find(storePath);
+    if (it != changeIdStores_.end()) {
+        return it->second.get();
+    }
+
+    auto store = std::make_unique<ChangeIdStore>(storePath);
+    if (!store->load()) {
+        // An unreadable store only costs a full backup, never a broken chain
+        Logger::warning("Ignoring unreadable change ID store: " + store->getLastError());
+    }
+    auto* result = store.get();
+    changeIdStores_[storePath] = std::move(store);
+    return result;
+}
+
+bool VMwareBackupProvider::queryChangedAreas(const std::string& vmId, const std::string& diskPath,
+                                             const std::string& changeId, uint64_t capacity,
+                                             std::vector<std::pair<uint64_t, uint64_t>>& changedAreas) {
+    auto* restClient = connection_->getRestClient();
+    if (!restClient) {
+        lastError_ = "Failed to get REST client";
+        return false;
+    }
+
+    std::string vmMoRef, diskId;
+    if (!restClient->getVMDiskId(vmId, diskPath, vmMoRef, diskId)) {
+        lastError_ = "Failed to resolve disk ID for " + diskPath;
+        return false;
+    }
+
+    // QueryChangedDiskAreas may answer for a prefix of the range only, so walk the disk
+    changedAreas.clear();
+    uint64_t offset = 0;
+    while (offset < capacity) {
+        nlohmann::json response;
+        if (!restClient->getChangedDiskAreas(vmMoRef, diskId, changeId, offset, capacity - offset, response)) {
+            lastError_ = "Failed to query changed disk areas for " + diskPath;
+            return false;
+        }
+
+        try {
+            const auto& info = response.contains("value") ? response["value"] : response;
+            if (info.contains("changedArea")) {
+                for (const auto& area : info["changedArea"]) {
+                    changedAreas.emplace_back(area["start"].get<uint64_t>(), area["length"].get<uint64_t>());
+                }
+            }
+            // An answer that does not move past offset would loop forever or
+            // leave the rest of the disk out of the incremental
+            uint64_t end = info.value("startOffset", offset) + info.value("length", static_cast<uint64_t>(0));
+            if (end <= offset) {
+                lastError_ = "Changed disk areas of " + diskPath + " stop at offset " + std::to_string(offset);
+                return false;
+            }
+            offset = end;
+        } catch (const std::exception& e) {
+            lastError_ = std::string("Failed to parse changed disk areas: ") + e.what();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VMwareBackupProvider::copyAreas(VDDKConnection connection, const std::string& productionPath,
+                                     uint32_t productionFlags, VDDKHandle productionHandle, VDDKHandle backupHandle,
+                                     bool fromProduction, const std::vector<std::pair<uint64_t, uint64_t>>& areas,
+                                     RateLimiter* limiter, AdaptiveStreamController* controller,
+                                     LatencyThrottle* throttle, const StorageDetector::IoProfile& io,
+                                     std::atomic<double>* progress, TeeWriter* tee) {
+    const uint64_t bufferSectors = std::max<uint64_t>(1, io.blockSize / VIXDISKLIB_SECTOR_SIZE);
+
+    uint64_t totalSectors = 0;
+    for (const auto& area : areas) {
+        totalSectors += (area.second + VIXDISKLIB_SECTOR_SIZE - 1) / VIXDISKLIB_SECTOR_SIZE;
+    }
+
+    // Streams take chunks from a shared cursor over the areas
+    std::mutex cursorMutex;
+    size_t areaIndex = 0;
+    uint64_t areaOffset = 0;  // Sectors already handed out of the current area
+    auto nextChunk = [&](uint64_t& sector, uint64_t& count) {
+        std::lock_guard<std::mutex> lock(cursorMutex);
+        while (areaIndex < areas.size()) {
+            // Areas are sector aligned byte ranges
+            uint64_t start = areas[areaIndex].first / VIXDISKLIB_SECTOR_SIZE;
+            uint64_t length = (areas[areaIndex].second + VIXDISKLIB_SECTOR_SIZE - 1) / VIXDISKLIB_SECTOR_SIZE;
+            if (areaOffset < length) {
+                sector = start + areaOffset;
+                count = std::min(bufferSectors, length - areaOffset);
+                areaOffset += count;
+                return true;
+            }
+            areaIndex++;
+            areaOffset = 0;
+        }
+        return false;
+    };
+
+    auto source = throttle ? throttle->getSource(productionPath) : nullptr;
+
+    std::mutex backupMutex;  // The backup side is one handle shared by all streams
+    std::mutex errorMutex;
+    std::string error;
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> copiedSectors{0};
+
+    auto fail = [&](const std::string& message) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!failed.exchange(true)) {
+            error = message;
+        }
+    };
+
+    auto runStream = [&](size_t index) {
+        std::vector<uint8_t> buffer(bufferSectors * VIXDISKLIB_SECTOR_SIZE);
+        VDDKHandle handle = index == 0 ? productionHandle : nullptr;
+
+        while (!failed) {
+            // Streams above the controller's current count stay parked
+            if (controller && index >= controller->getStreamCount()) {
+                {
+                    std::lock_guard<std::mutex> lock(cursorMutex);
+                    if (areaIndex >= areas.size()) {
+                        break;
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                continue;
+            }
+
+            if (!handle) {
+                int32_t result = openDisk(connection, productionPath.c_str(), productionFlags, &handle);
+                if (result != VIX_OK) {
+                    // The remaining streams carry on without this one
+                    Logger::warning("Failed to open stream " + std::to_string(index + 1) + " on disk " +
+                                    productionPath + ": " + vixErrorToString(result));
+                    handle = nullptr;
+                    break;
+                }
+            }
+
+            uint64_t sector = 0;
+            uint64_t count = 0;
+            if (!nextChunk(sector, count)) {
+                break;
+            }
+
+            if (limiter) {
+                limiter->acquire(count * VIXDISKLIB_SECTOR_SIZE);
+            }
+            int32_t result;
+            std::chrono::steady_clock::duration latency;
+            if (source) {
+                throttle->pace(*source);
+            }
+            if (fromProduction) {
+                auto started = std::chrono::steady_clock::now();
+                result = VixDiskLib_ReadWrapper(handle, sector, count, buffer.data());
+                latency = std::chrono::steady_clock::now() - started;
+                if (result != VIX_OK) {
+                    fail("Failed to read source disk: " + vixErrorToString(result));
+                    break;
+                }
+                if (tee) {
+                    // Queued for every copy; waits only while a copy's queue is full
+                    if (!tee->write(sector * VIXDISKLIB_SECTOR_SIZE, buffer.data(), count * VIXDISKLIB_SECTOR_SIZE)) {
+                        fail("Failed to write backup disks: " + tee->getLastError());
+                        break;
+                    }
+                } else {
+                    std::lock_guard<std::mutex> lock(backupMutex);
+                    result = VixDiskLib_WriteWrapper(backupHandle, sector, count, buffer.data());
+                    if (result != VIX_OK) {
+                        fail("Failed to write backup disk: " + vixErrorToString(result));
+                        break;
+                    }
+                }
+            } else {
+                {
+                    std::lock_guard<std::mutex> lock(backupMutex);
+                    result = VixDiskLib_ReadWrapper(backupHandle, sector, count, buffer.data());
+                }
+                if (result != VIX_OK) {
+                    fail("Failed to read backup disk: " + vixErrorToString(result));
+                    break;
+                }
+                auto started = std::chrono::steady_clock::now();
+                result = VixDiskLib_WriteWrapper(handle, sector, count, buffer.data());
+                latency = std::chrono::steady_clock::now() - started;
+                if (result != VIX_OK) {
+                    fail("Failed to write target disk: " + vixErrorToString(result));
+                    break;
+                }
+            }
+            auto latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(latency);
+            if (controller) {
+                controller->recordRead(count * VIXDISKLIB_SECTOR_SIZE, latencyUs);
+            }
+            if (source) {
+                throttle->record(*source, latencyUs);
+            }
+
+            uint64_t copied = copiedSectors += count;
+            if (progress && index == 0 && totalSectors > 0) {
+                *progress = static_cast<double>(copied) / totalSectors * 100.0;
+            }
+        }
+
+        if (handle && index > 0) {
+            closeDisk(&handle);
+        }
+    };
+
+    size_t streams = controller ? controller->getMaxStreams() : 1;
+    std::vector<std::thread> extraStreams;
+    auto cpus = StorageDetector::getNodeCpus(io.numaNode);
+    for (size_t i = 1; i < streams; i++) {
+        extraStreams.emplace_back(runStream, i);
+        // Keep the buffers of extra streams on the node the local storage hangs off
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus) {
+                CPU_SET(cpu, &set);
+            }
+            pthread_setaffinity_np(extraStreams.back().native_handle(), sizeof(set), &set);
+        }
+    }
+    runStream(0);
+    for (auto& thread : extraStreams) {
+        thread.join();
+    }
+    if (tee && !tee->finish()) {
+        fail("Failed to write backup disks: " + tee->getLastError());
+    }
+
+    if (failed) {
+        setError(error);
+        return false;
+    }
+    if (progress) {
+        *progress = 100.0;
+    }
+    return true;
+}
+
+bool VMwareBackupProvider::storeDiskChunks(VDDKConnection connection, const std::string& diskPath,
+                                           VDDKHandle sourceHandle,
+                                           const std::vector<std::pair<uint64_t, uint64_t>>& areas,
+                                           const BackupConfig& config, const BackupContext& context,
+                                           std::vector<ManifestExtent>& extents) {
+    // Every read is one chunk of the grid
+    std::vector<std::pair<uint64_t, uint64_t>> pieces;
+    for (const auto& area : areas) {
+        uint64_t offset = area.first;
+        uint64_t end = area.first + area.second;
+        while (offset < end) {
+            uint64_t next = std::min(end, (offset / BACKUP_CHUNK_SIZE + 1) * BACKUP_CHUNK_SIZE);
+            pieces.emplace_back(offset, next - offset);
+            offset = next;
+        }
+    }
+
+    // The backup's repository first, then the copies'; each backup keeps one
+    // session per repository open until finishBackup commits its root
+    std::vector<std::string> backupDirs{config.backupPath};
+    if (context.copies) {
+        auto active = context.copies->getActive();
+        backupDirs.insert(backupDirs.end(), active.begin(), active.end());
+    }
+    bool degrade = context.copies && context.copies->getConfig().policy == TeePolicy::DEGRADE;
+    std::vector<std::pair<std::shared_ptr<ChunkRepository>, const ChunkSession*>> stores;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& pending = pendingBackups_[config.backupPath];
+        for (size_t i = 0; i < backupDirs.size(); i++) {
+            auto root = std::find_if(pending.roots.begin(), pending.roots.end(),
+                                     [&](const PendingRoot& root) { return root.backupDir == backupDirs[i]; });
+            if (root == pending.roots.end()) {
+                fs::path dir = fs::absolute(backupDirs[i]).lexically_normal();
+                if (dir.filename().empty()) {
+                    dir = dir.parent_path();
+                }
+                PendingRoot added;
+                added.backupDir = backupDirs[i];
+                added.chunks = ChunkRepository::forRepository(dir.parent_path().string(), true);
+                if (!added.chunks) {
+                    std::string reason = "Failed to open the chunk store of repository " + dir.parent_path().string();
+                    if (i > 0 && degrade) {
+                        Logger::warning(reason + ", dropping the copy");
+                        context.copies->drop(backupDirs[i], reason);
+                        stores.emplace_back(nullptr, nullptr);
+                        continue;
+                    }
+                    lastError_ = reason;
+                    return false;
+                }
+                added.session = added.chunks->beginSession();
+                pending.roots.push_back(std::move(added));
+                root = pending.roots.end() - 1;
+            }
+            stores.emplace_back(root->chunks, root->session.get());
+        }
+    }
+
+    TeeWriter tee(context.copies ? context.copies->getConfig() : TeeConfig());
+    std::vector<ChunkTarget*> targets;
+    for (size_t i = 0; i < backupDirs.size(); i++) {
+        if (!stores[i].first) {
+            targets.push_back(nullptr);
+            continue;
+        }
+        auto target = std::make_unique<ChunkTarget>(stores[i].first, *stores[i].second,
+                                                    backupDirs[i] + "/" + fs::path(diskPath).filename().string());
+        targets.push_back(target.get());
+        tee.addTarget(std::move(target), i == 0);
+    }
+
+    auto io = probeLocalStorage(config.backupPath, context.streamController.get());
+    io.blockSize = BACKUP_CHUNK_SIZE;
+    Logger::info("Storing disk " + diskPath + " as chunks in " + std::to_string(targets.size()) + " repositories");
+    if (!copyAreas(connection, diskPath, VIXDISKLIB_FLAG_OPEN_READ_ONLY, sourceHandle, nullptr, true, pieces,
+                   context.rateLimiter.get(), context.streamController.get(), context.latencyThrottle.get(), io,
+                   nullptr, &tee)) {
+        return false;
+    }
+
+    // Copies dropped under the degrade policy are left out of the remaining disks
+    auto status = tee.getStatus();
+    for (size_t i = 1, target = 1; i < backupDirs.size(); i++) {
+        if (!targets[i]) {
+            continue;
+        }
+        if (status[target].dropped) {
+            context.copies->drop(backupDirs[i], status[target].error);
+        }
+        target++;
+    }
+
+    // Streams store chunks in any order; the manifest wants them by offset
+    extents = targets[0]->getExtents();
+    std::sort(extents.begin(), extents.end(), [](const ManifestExtent& a, const ManifestExtent& b) {
+        return a.offset < b.offset;
+    });
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& pending = pendingBackups_[config.backupPath];
+    for (size_t i = 0; i < backupDirs.size(); i++) {
+        if (!targets[i]) {
+            continue;
+        }
+        for (auto& root : pending.roots) {
+            if (root.backupDir == backupDirs[i]) {
+                for (const auto& extent : targets[i]->getExtents()) {
+                    root.ids.push_back(extent.digest);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool VMwareBackupProvider::restoreChunks(VDDKHandle targetHandle, const RestoreLayer& layer,
+                                         const RestoreContext& context) {
+    auto chunks = ChunkRepository::forRepository(layer.repository);
+    if (!chunks) {
+        setError("Repository " + layer.repository + " has no chunk store");
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (const auto& area : layer.areas) {
+        total += area.second;
+    }
+    // Chunks are fetched one by one, from whichever tier holds them
+    uint64_t written = 0;
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < layer.areas.size(); i++) {
+        uint64_t offset = layer.areas[i].first;
+        uint64_t length = layer.areas[i].second;
+        if (context.rateLimiter) {
+            context.rateLimiter->acquire(length);
+        }
+        if (!chunks->get(layer.chunks[i], data)) {
+            setError("Failed to read chunk at offset " + std::to_string(offset) + ": " + chunks->getLastError());
+            return false;
+        }
+        if (data.size() != length || offset % VIXDISKLIB_SECTOR_SIZE != 0 || length % VIXDISKLIB_SECTOR_SIZE != 0) {
+            setError("Chunk at offset " + std::to_string(offset) + " does not match its extent");
+            return false;
+        }
+        int32_t result = VixDiskLib_WriteWrapper(targetHandle, offset / VIXDISKLIB_SECTOR_SIZE,
+                                                 length / VIXDISKLIB_SECTOR_SIZE, data.data());
+        if (result != VIX_OK) {
+            setError("Failed to write target disk: " + vixErrorToString(result));
+            return false;
+        }
+        written += length;
+        progress_ = total > 0 ? static_cast<double>(written) / total * 100.0 : 100.0;
+    }
+    return true;
+}
+
+StorageDetector::IoProfile VMwareBackupProvider::probeLocalStorage(const std::string& path,
+                                                                   AdaptiveStreamController* controller) {
+    auto io = StorageDetector::probeIoProfile({path});
+    if (controller && io.queueDepth > 0) {
+        controller->limitMaxStreams(io.queueDepth);
+    }
+    Logger::debug("Local storage for " + path + ": " + io.description + ", " +
+                  std::to_string(io.blockSize / 1024) + " KiB blocks, queue depth " + std::to_string(io.queueDepth));
+    return io;
+}
+
 void VMwareBackupProvider::updateProgress(double progress, const std::string& status) {
     progress_ = progress;
     if (progressCallback_) {
@@ -1249,7 +2189,6 @@ void VMwareBackupProvider::updateProgress(double progress, const std::string& st
 
 
 double VMwareBackupProvider::getProgress() const {
-    std::lock_guard<std::mutex> lock(mutex_);
     return progress_;
 }
 
@@ -1258,6 +2197,11 @@ std::string VMwareBackupProvider::getLastError() const {
     return lastError_;
 }
 
+void VMwareBackupProvider::setError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastError_ = error;
+}
+
 void VMwareBackupProvider::clearLastError() {
     std::lock_guard<std::mutex> lock(mutex_);
     lastError_.clear();
@@ -1271,17 +2215,17 @@ void VMwareBackupProvider::setStatusCallback(StatusCallback callback) {
     statusCallback_ = std::move(callback);
 }
 
-bool VMwareBackupProvider::enableCBT(const std::string& vmId) {
+bool VMwareBackupProvider::enableCBT(const std::string& /*vmId*/) {
     lastError_ = "CBT operations not supported";
     return false;
 }
 
-bool VMwareBackupProvider::disableCBT(const std::string& vmId) {
+bool VMwareBackupProvider::disableCBT(const std::string& /*vmId*/) {
     lastError_ = "CBT operations not supported";
     return false;
 }
 
-bool VMwareBackupProvider::isCBTEnabled(const std::string& vmId) const {
+bool VMwareBackupProvider::isCBTEnabled(const std::string& /*vmId*/) const {
     const_cast<VMwareBackupProvider*>(this)->lastError_ = "CBT operations not supported";
     return false;
 }
@@ -7,6 +7,10 @@
 #include "main/backup_main.hpp"
 #include "common/backup_status.hpp"
 #include "backup/backup_provider_factory.hpp"
+#include "common/backup_daemon.hpp"
+#include "common/control_client.hpp"
+#include "common/rate_limiter.hpp"
+#include "backup/replication_job.hpp"
 #include <iostream>
 #include <iomanip>
 #include <ctime>
@@ -64,7 +68,31 @@ void BackupCLI::run(int argc, char* argv[]) {
     }
     argc--;
 
-    if (command == "backup") {
+    // Options that make the CLI a client of a running daemon
+    int kept = 0;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath_ = argv[++i];
+        } else if (arg == "--detach") {
+            detach_ = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    if (command == "daemon") {
+        handleDaemonCommand(argc, argv);
+    } else if (command == "status") {
+        handleStatusCommand(argc, argv);
+    } else if (command == "cancel") {
+        handleCancelCommand(argc, argv);
+    } else if (command == "watch") {
+        handleWatchCommand(argc, argv);
+    } else if (command == "bandwidth") {
+        handleBandwidthCommand(argc, argv);
+    } else if (command == "backup") {
         handleBackupCommand(argc, argv);
     } else if (command == "schedule") {
         handleScheduleCommand(argc, argv);
@@ -74,6 +102,8 @@ void BackupCLI::run(int argc, char* argv[]) {
         handleVerifyCommand(argc, argv);
     } else if (command == "restore") {
         handleRestoreCommand(argc, argv);
+    } else if (command == "replicate") {
+        handleReplicateCommand(argc, argv);
     } else {
         printUsage();
     }
@@ -142,22 +172,54 @@ void BackupCLI::handleBackupCommand(int argc, char* argv[]) {
                 config.schedule.minute = minutes % 60;
             }
         } else if (arg == "--parallel") {
-            if (i + 1 < argc) config.maxConcurrentDisks = std::stoi(argv[++i]);
+            if (i + 1 < argc) {
+                std::string streams = argv[++i];
+                config.maxConcurrentDisks = streams == "auto" ? 0 : std::stoi(streams);
+            }
         } else if (arg == "--compression") {
             if (i + 1 < argc) config.compressionLevel = std::stoi(argv[++i]);
         } else if (arg == "--retention") {
             if (i + 1 < argc) config.retentionDays = std::stoi(argv[++i]);
         } else if (arg == "--max-backups") {
             if (i + 1 < argc) config.maxBackups = std::stoi(argv[++i]);
+        } else if (arg == "--keep-daily") {
+            if (i + 1 < argc) config.keepDaily = std::stoi(argv[++i]);
+        } else if (arg == "--keep-weekly") {
+            if (i + 1 < argc) config.keepWeekly = std::stoi(argv[++i]);
+        } else if (arg == "--keep-monthly") {
+            if (i + 1 < argc) config.keepMonthly = std::stoi(argv[++i]);
+        } else if (arg == "--keep-yearly") {
+            if (i + 1 < argc) config.keepYearly = std::stoi(argv[++i]);
         } else if (arg == "--disable-cbt") {
             config.enableCBT = false;
         } else if (arg == "--exclude-disk") {
             if (i + 1 < argc) config.excludedDisks.push_back(argv[++i]);
+        } else if (arg == "--bandwidth") {
+            if (i + 1 < argc && !parseByteRate(argv[++i], config.bandwidthLimit)) {
+                Logger::error(std::string("Invalid bandwidth limit: ") + argv[i]);
+                return;
+            }
+        } else if (arg == "--copy-to") {
+            if (i + 1 < argc) config.copyRepositories.push_back(argv[++i]);
+        } else if (arg == "--copy-policy") {
+            if (i + 1 < argc) {
+                config.copyPolicy = argv[++i];
+                if (config.copyPolicy != "fail" && config.copyPolicy != "degrade") {
+                    Logger::error("Invalid copy policy: " + config.copyPolicy);
+                    return;
+                }
+            }
+        } else if (arg == "--copy-stall") {
+            if (i + 1 < argc) config.copyStallSeconds = std::stoi(argv[++i]);
+        } else if (arg == "--chunk-store") {
+            config.chunkStore = true;
         }
     }
 
-    // Validate required parameters
-    if (config.vmId.empty() || config.backupDir.empty() || host.empty() || username.empty() || password.empty()) {
+    // Validate required parameters; a daemon may already hold the credentials
+    bool viaDaemon = !socketPath_.empty();
+    if (config.vmId.empty() || config.backupDir.empty() || host.empty() ||
+        (!viaDaemon && (username.empty() || password.empty()))) {
         Logger::error("Missing required parameters");
         Logger::error(std::string("VM name: ") + (config.vmId.empty() ? "missing" : "set"));
         Logger::error(std::string("Backup dir: ") + (config.backupDir.empty() ? "missing" : "set"));
@@ -168,6 +230,12 @@ void BackupCLI::handleBackupCommand(int argc, char* argv[]) {
         return;
     }
 
+    if (viaDaemon) {
+        EndpointCredentials credentials{vmType, host, "443", username, password};
+        submitToDaemon("backup", backupConfigToJson(config), credentials);
+        return;
+    }
+
     Logger::info("Starting backup process for VM: " + config.vmId);
     
     initialize("vmware", host, "443", username, password);
@@ -253,11 +321,19 @@ void BackupCLI::handleScheduleCommand(int argc, char** argv) {
             if (i + 1 < argc) {
                 config.schedule.day = std::stoi(argv[++i]);
             }
+        } else if (arg == "--stagger") {
+            if (i + 1 < argc) {
+                config.staggerPolicy = argv[++i];
+            }
+        } else if (arg == "--stagger-window") {
+            if (i + 1 < argc) {
+                config.staggerWindowMinutes = std::stoi(argv[++i]);
+            }
         }
     }
 
     if (scheduler_->scheduleBackup(config.vmId, config)) {
-        auto nextRunTime = scheduler_->getNextRunTime(config);
+        auto nextRunTime = scheduler_->getScheduledRunTime(config.vmId).value_or(scheduler_->getNextRunTime(config));
         std::cout << "Backup scheduled successfully\n";
         std::cout << "Next run: " << formatTime(std::chrono::system_clock::to_time_t(nextRunTime)) << "\n";
     } else {
@@ -265,7 +341,7 @@ void BackupCLI::handleScheduleCommand(int argc, char** argv) {
     }
 }
 
-void BackupCLI::handleListCommand(int argc, char** argv) {
+void BackupCLI::handleListCommand(int /*argc*/, char** /*argv*/) {
     auto schedules = scheduler_->getScheduledBackups();
     
     if (schedules.empty()) {
@@ -280,7 +356,11 @@ void BackupCLI::handleListCommand(int argc, char** argv) {
         if (config.scheduleType == "weekly" || config.scheduleType == "monthly") {
             std::cout << "Day: " << config.schedule.day << "\n";
         }
-        std::cout << "Next run: " << formatTime(std::chrono::system_clock::to_time_t(scheduler_->getNextRunTime(config))) << "\n\n";
+        if (config.staggerPolicy != "none" && config.staggerWindowMinutes > 0) {
+            std::cout << "Stagger: " << config.staggerPolicy << " over " << config.staggerWindowMinutes << " minutes\n";
+        }
+        auto nextRunTime = scheduler_->getScheduledRunTime(config.vmId).value_or(scheduler_->getNextRunTime(config));
+        std::cout << "Next run: " << formatTime(std::chrono::system_clock::to_time_t(nextRunTime)) << "\n\n";
     }
 }
 
@@ -321,13 +401,20 @@ bool BackupCLI::handleVerifyCommand(int argc, char* argv[]) {
         }
     }
 
-    // Validate required parameters
-    if (config.backupId.empty() || host.empty() || username.empty() || password.empty()) {
+    // Validate required parameters; a daemon may already hold the credentials
+    bool viaDaemon = !socketPath_.empty();
+    if (config.backupId.empty() || host.empty() ||
+        (!viaDaemon && (username.empty() || password.empty()))) {
         Logger::error("Missing required parameters");
         printUsage();
         return false;
     }
 
+    if (viaDaemon) {
+        EndpointCredentials credentials{"vmware", host, "443", username, password};
+        return submitToDaemon("verify", verifyConfigToJson(config), credentials);
+    }
+
     Logger::info("Starting verify process for backup: " + config.backupId);
     
     // Connect to server
@@ -421,19 +508,34 @@ bool BackupCLI::handleRestoreCommand(int argc, char* argv[]) {
                 Logger::debug("Parsed password: [REDACTED]");
             }
         } else if (arg == "--parallel") {
-            if (i + 1 < argc) config.maxConcurrentDisks = std::stoi(argv[++i]);
+            if (i + 1 < argc) {
+                std::string streams = argv[++i];
+                config.maxConcurrentDisks = streams == "auto" ? 0 : std::stoi(streams);
+            }
         } else if (arg == "--power-on") {
             config.powerOnAfterRestore = true;
+        } else if (arg == "--bandwidth") {
+            if (i + 1 < argc && !parseByteRate(argv[++i], config.bandwidthLimit)) {
+                Logger::error(std::string("Invalid bandwidth limit: ") + argv[i]);
+                return false;
+            }
         }
     }
 
-    // Validate required parameters
-    if (config.vmId.empty() || config.backupId.empty() || host.empty() || username.empty() || password.empty()) {
+    // Validate required parameters; a daemon may already hold the credentials
+    bool viaDaemon = !socketPath_.empty();
+    if (config.vmId.empty() || config.backupId.empty() || host.empty() ||
+        (!viaDaemon && (username.empty() || password.empty()))) {
         Logger::error("Missing required parameters");
         printUsage();
         return false;
     }
 
+    if (viaDaemon) {
+        EndpointCredentials credentials{"vmware", host, "443", username, password};
+        return submitToDaemon("restore", restoreConfigToJson(config), credentials);
+    }
+
     Logger::info("Starting restore process for VM: " + config.vmId);
     
     // Connect to server
@@ -489,6 +591,292 @@ bool BackupCLI::handleRestoreCommand(int argc, char* argv[]) {
     }
 }
 
+bool BackupCLI::handleReplicateCommand(int argc, char* argv[]) {
+    ReplicationConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return true;
+        } else if (arg == "--from") {
+            if (i + 1 < argc) config.source = argv[++i];
+        } else if (arg == "--to") {
+            if (i + 1 < argc) config.destination = argv[++i];
+        } else if (arg == "-v" || arg == "--vm-name") {
+            if (i + 1 < argc) config.vmIds.push_back(argv[++i]);
+        } else if (arg == "--parallel") {
+            if (i + 1 < argc) config.streams = std::stoi(argv[++i]);
+        } else if (arg == "--compression") {
+            if (i + 1 < argc) config.compressionLevel = std::stoi(argv[++i]);
+        } else if (arg == "--bandwidth") {
+            if (i + 1 < argc && !parseByteRate(argv[++i], config.bandwidthLimit)) {
+                Logger::error(std::string("Invalid bandwidth limit: ") + argv[i]);
+                return false;
+            }
+        }
+    }
+    if (config.source.empty() || config.destination.empty()) {
+        Logger::error("Missing required parameters: --from and --to");
+        printUsage();
+        return false;
+    }
+
+    auto job = std::make_shared<ReplicationJob>(config);
+    job->setProgressCallback([](int progress) {
+        std::cout << "\rProgress: " << progress << "%" << std::flush;
+    });
+    job->setStatusCallback([](const std::string& status) {
+        std::cout << "\nStatus: " << status << std::endl;
+    });
+    if (!job->start()) {
+        Logger::error("Failed to start replication job: " + job->getError());
+        return false;
+    }
+    while (job->isRunning()) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    std::cout << "\nReplication job " << (job->isCompleted() ? "completed successfully" : "failed") << std::endl;
+    if (!job->isCompleted()) {
+        Logger::error("Error: " + job->getError());
+        return false;
+    }
+    return true;
+}
+
+bool BackupCLI::handleDaemonCommand(int argc, char* argv[]) {
+    DaemonConfig config;
+    if (!socketPath_.empty()) {
+        config.socketPath = socketPath_;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return false;
+        } else if (arg == "--endpoints") {
+            if (i + 1 < argc) config.endpointsFile = argv[++i];
+        } else if (arg == "--workers") {
+            if (i + 1 < argc) config.defaultLimits.workerThreads = std::stoul(argv[++i]);
+        } else if (arg == "--max-jobs") {
+            if (i + 1 < argc) config.defaultLimits.maxConcurrentJobs = std::stoul(argv[++i]);
+        }
+    }
+
+    BackupDaemon daemon(config);
+    if (!daemon.start()) {
+        std::cerr << "Failed to start daemon: " << daemon.getLastError() << std::endl;
+        return false;
+    }
+    std::cout << "Daemon listening on " << config.socketPath << std::endl;
+    daemon.run();
+    return true;
+}
+
+bool BackupCLI::handleStatusCommand(int argc, char* argv[]) {
+    ControlClient client;
+    if (!client.connect(socketPath_.empty() ? DEFAULT_CONTROL_SOCKET : socketPath_)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+
+    json request = {{"command", "status"}};
+    if (argc > 1) {
+        request["jobId"] = argv[1];
+    }
+
+    json response;
+    if (!client.request(request, response)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+    if (!response.value("ok", false)) {
+        std::cerr << "Error: " << response.value("error", "unknown error") << std::endl;
+        return false;
+    }
+
+    auto printJob = [](const json& job) {
+        std::cout << job.value("jobId", "") << "  " << std::setw(8) << std::left << job.value("type", "")
+                  << " " << std::setw(10) << job.value("state", "") << std::right
+                  << std::setw(4) << job.value("progress", 0) << "%  " << job.value("status", "") << "\n";
+    };
+    if (response.contains("job")) {
+        printJob(response["job"]);
+    } else {
+        for (const auto& job : response["jobs"]) {
+            printJob(job);
+        }
+    }
+    return true;
+}
+
+bool BackupCLI::handleCancelCommand(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return false;
+    }
+
+    ControlClient client;
+    if (!client.connect(socketPath_.empty() ? DEFAULT_CONTROL_SOCKET : socketPath_)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+
+    json response;
+    if (!client.request({{"command", "cancel"}, {"jobId", argv[1]}}, response)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+    if (!response.value("ok", false)) {
+        std::cerr << "Error: " << response.value("error", "unknown error") << std::endl;
+        return false;
+    }
+    std::cout << "Job " << argv[1] << " cancelled\n";
+    return true;
+}
+
+bool BackupCLI::handleBandwidthCommand(int argc, char* argv[]) {
+    // Without options this only shows the current limits
+    json request = {{"command", "bandwidth"}};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            printUsage();
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--global") {
+            request["global"] = value;
+        } else if (arg == "--per-source") {
+            request["perSource"] = value;
+        } else if (arg == "--source") {
+            request["source"] = value;
+        } else if (arg == "--job") {
+            request["jobId"] = value;
+        } else if (arg == "--limit") {
+            request["limit"] = value;
+        } else {
+            printUsage();
+            return false;
+        }
+    }
+
+    ControlClient client;
+    if (!client.connect(socketPath_.empty() ? DEFAULT_CONTROL_SOCKET : socketPath_)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+
+    json response;
+    if (!client.request(request, response)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+    if (!response.value("ok", false)) {
+        std::cerr << "Error: " << response.value("error", "unknown error") << std::endl;
+        return false;
+    }
+
+    const auto& bandwidth = response["bandwidth"];
+    std::string profile = bandwidth.value("activeProfile", "");
+    std::cout << "Active profile: " << (profile.empty() ? "none" : profile) << "\n"
+              << "Global:         " << formatByteRate(bandwidth["active"].value("global", uint64_t(0))) << "\n"
+              << "Per source:     " << formatByteRate(bandwidth["active"].value("perSource", uint64_t(0))) << "\n";
+    for (const auto& source : bandwidth["sources"].items()) {
+        std::cout << "  " << source.key() << ": " << formatByteRate(source.value().get<uint64_t>()) << "\n";
+    }
+    if (response.contains("jobId")) {
+        std::cout << "Job " << response["jobId"].get<std::string>() << ": "
+                  << formatByteRate(response["limit"].get<uint64_t>()) << "\n";
+    }
+    return true;
+}
+
+bool BackupCLI::handleWatchCommand(int argc, char* argv[]) {
+    ControlClient client;
+    if (!client.connect(socketPath_.empty() ? DEFAULT_CONTROL_SOCKET : socketPath_)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+
+    json request = {{"command", "subscribe"}};
+    if (argc > 1) {
+        request["jobId"] = argv[1];
+    }
+    if (!client.send(request)) {
+        std::cerr << client.getLastError() << std::endl;
+        return false;
+    }
+
+    // One JSON object per line, suitable for piping into other tools
+    json message;
+    while (client.receive(message)) {
+        if (message.contains("ok") && !message.value("ok", false)) {
+            std::cerr << "Error: " << message.value("error", "unknown error") << std::endl;
+            return false;
+        }
+        std::cout << message.dump() << std::endl;
+        if (message.value("end", false)) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool BackupCLI::submitToDaemon(const std::string& command, const json& config,
+                               const EndpointCredentials& credentials) {
+    ControlClient client;
+    if (!client.connect(socketPath_)) {
+        Logger::error(client.getLastError());
+        return false;
+    }
+
+    json response;
+    json request = {{"command", command}, {"config", config}, {"connection", credentialsToJson(credentials)}};
+    if (!client.request(request, response)) {
+        Logger::error(client.getLastError());
+        return false;
+    }
+    if (!response.value("ok", false)) {
+        Logger::error("Daemon rejected " + command + " job: " + response.value("error", "unknown error"));
+        return false;
+    }
+
+    std::string jobId = response.value("jobId", "");
+    std::cout << "Submitted " << command << " job " << jobId << std::endl;
+    if (detach_) {
+        return true;
+    }
+
+    // Follow the job through the daemon's event stream
+    if (!client.request({{"command", "subscribe"}, {"jobId", jobId}}, response) ||
+        !response.value("ok", false)) {
+        Logger::error("Failed to follow job " + jobId + ": " + client.getLastError());
+        return false;
+    }
+    json job = response["job"];
+    std::string lastStatus = job.value("status", "");
+    while (client.receive(response) && !response.value("end", false)) {
+        if (!response.contains("event")) {
+            continue;
+        }
+        job = response["event"];
+        if (job.value("status", "") != lastStatus) {
+            lastStatus = job.value("status", "");
+            std::cout << "\nStatus: " << lastStatus << std::endl;
+        }
+        std::cout << "\rProgress: " << job.value("progress", 0) << "%" << std::flush;
+    }
+
+    bool completed = job.value("state", "") == "completed";
+    std::cout << "\n" << command << " job " << (completed ? "completed successfully" : "failed") << std::endl;
+    if (!completed) {
+        Logger::error("Error: " + job.value("error", ""));
+    }
+    return completed;
+}
+
 void BackupCLI::parseBackupOptions(int argc, char* argv[], BackupConfig& config) {
     for (int i = 5; i < argc; ++i) {
         std::string arg = argv[i];
@@ -502,6 +890,14 @@ void BackupCLI::parseBackupOptions(int argc, char* argv[], BackupConfig& config)
             config.retentionDays = std::stoi(argv[++i]);
         } else if (arg == "--max-backups" && i + 1 < argc) {
             config.maxBackups = std::stoi(argv[++i]);
+        } else if (arg == "--keep-daily" && i + 1 < argc) {
+            config.keepDaily = std::stoi(argv[++i]);
+        } else if (arg == "--keep-weekly" && i + 1 < argc) {
+            config.keepWeekly = std::stoi(argv[++i]);
+        } else if (arg == "--keep-monthly" && i + 1 < argc) {
+            config.keepMonthly = std::stoi(argv[++i]);
+        } else if (arg == "--keep-yearly" && i + 1 < argc) {
+            config.keepYearly = std::stoi(argv[++i]);
         } else if (arg == "--disable-cbt") {
             config.enableCBT = false;
         } else if (arg == "--exclude-disk" && i + 1 < argc) {
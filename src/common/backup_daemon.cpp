@@ -0,0 +1,824 @@
+#include "common/backup_daemon.hpp"
+#include "backup/backup_provider_factory.hpp"
+#include "common/logger.hpp"
+#include "common/io_cgroup.hpp"
+#include "backup/backup_reaper.hpp"
+#include "backup/chunk_gc.hpp"
+#include "backup/tier_mover.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+std::atomic<bool> signalReceived{false};
+
+void handleTerminationSignal(int) {
+    signalReceived = true;
+}
+
+json errorResponse(const std::string& error) {
+    return {{"ok", false}, {"error", error}};
+}
+
+// Rates are bytes per second, or strings such as "100M"
+bool rateFromJson(const json& value, uint64_t& rate) {
+    if (value.is_number_unsigned()) {
+        rate = value.get<uint64_t>();
+        return true;
+    }
+    return value.is_string() && parseByteRate(value.get<std::string>(), rate);
+}
+
+StorageConfig storageFromJson(const json& j) {
+    StorageConfig config;
+    config.url = j.value("url", "");
+    config.endpoint = j.value("endpoint", config.endpoint);
+    config.region = j.value("region", config.region);
+    config.accessKey = j.value("accessKey", config.accessKey);
+    config.secretKey = j.value("secretKey", config.secretKey);
+    config.sessionToken = j.value("sessionToken", config.sessionToken);
+    config.pathStyle = j.value("pathStyle", config.pathStyle);
+    config.verifyTls = j.value("verifyTls", config.verifyTls);
+    config.partSize = j.value("partSize", config.partSize);
+    config.uploadThreads = j.value("uploadThreads", config.uploadThreads);
+    config.maxInFlightBytes = j.value("maxInFlightBytes", config.maxInFlightBytes);
+    config.retries = j.value("retries", config.retries);
+    return config;
+}
+
+// "HH:MM" -> hour and minute
+bool parseClockTime(const std::string& text, int& hour, int& minute) {
+    auto colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    try {
+        hour = std::stoi(text.substr(0, colon));
+        minute = std::stoi(text.substr(colon + 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool profileFromJson(const json& j, BandwidthProfile& profile, std::string& error) {
+    profile.name = j.value("name", "");
+    if (!parseClockTime(j.value("start", ""), profile.startHour, profile.startMinute) ||
+        !parseClockTime(j.value("end", ""), profile.endHour, profile.endMinute)) {
+        error = "Bandwidth profile needs \"start\" and \"end\" as HH:MM";
+        return false;
+    }
+    if ((j.contains("global") && !rateFromJson(j["global"], profile.limits.globalBytesPerSecond)) ||
+        (j.contains("perSource") && !rateFromJson(j["perSource"], profile.limits.perSourceBytesPerSecond))) {
+        error = "Invalid rate in bandwidth profile " + profile.name;
+        return false;
+    }
+    return true;
+}
+
+std::string formatClockTime(int hour, int minute) {
+    char buffer[8];
+    std::snprintf(buffer, sizeof(buffer), "%02d:%02d", hour, minute);
+    return buffer;
+}
+
+json bandwidthToJson(const BandwidthManager& bandwidth) {
+    auto limits = bandwidth.getLimits();
+    auto active = bandwidth.getActiveLimits();
+    json profiles = json::array();
+    for (const auto& profile : bandwidth.getProfiles()) {
+        profiles.push_back({
+            {"name", profile.name},
+            {"start", formatClockTime(profile.startHour, profile.startMinute)},
+            {"end", formatClockTime(profile.endHour, profile.endMinute)},
+            {"global", profile.limits.globalBytesPerSecond},
+            {"perSource", profile.limits.perSourceBytesPerSecond}
+        });
+    }
+    return {
+        {"global", limits.globalBytesPerSecond},
+        {"perSource", limits.perSourceBytesPerSecond},
+        {"sources", bandwidth.getSourceLimits()},
+        {"profiles", profiles},
+        {"activeProfile", bandwidth.getActiveProfile()},
+        {"active", {
+            {"global", active.globalBytesPerSecond},
+            {"perSource", active.perSourceBytesPerSecond}
+        }}
+    };
+}
+
+json sourceLatencyToJson(const LatencyMonitor& monitor) {
+    json sources = json::array();
+    for (const auto& status : monitor.getStatus()) {
+        sources.push_back({
+            {"source", status.source},
+            {"latencyUs", status.latency.count()},
+            {"delayUs", status.delay.count()}
+        });
+    }
+    return sources;
+}
+
+} // namespace
+
+BackupDaemon::BackupDaemon(const DaemonConfig& config)
+    : config_(config) {
+}
+
+BackupDaemon::~BackupDaemon() {
+    stop();
+}
+
+bool BackupDaemon::start() {
+    if (!config_.endpointsFile.empty() && !loadEndpoints(config_.endpointsFile)) {
+        return false;
+    }
+
+    server_ = std::make_unique<ControlServer>(config_.socketPath,
+        [this](const json& request, const ControlReply& reply) {
+            return handleRequest(request, reply);
+        });
+    if (!server_->start()) {
+        lastError_ = server_->getLastError();
+        server_.reset();
+        return false;
+    }
+
+    stopRequested_ = false;
+    Logger::info("Daemon started on " + config_.socketPath);
+    return true;
+}
+
+void BackupDaemon::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex_);
+        stopRequested_ = true;
+    }
+    stopCv_.notify_all();
+
+    if (server_) {
+        server_->stop();
+        server_.reset();
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobManager_.stopAllJobs();
+        jobManager_.disconnect();
+        Logger::info("Daemon stopped");
+    }
+}
+
+void BackupDaemon::run() {
+    std::signal(SIGINT, handleTerminationSignal);
+    std::signal(SIGTERM, handleTerminationSignal);
+
+    std::unique_lock<std::mutex> lock(stopMutex_);
+    while (!stopRequested_ && !signalReceived) {
+        stopCv_.wait_for(lock, std::chrono::milliseconds(500));
+        // Switch time-of-day bandwidth profiles even while no job is reading
+        jobManager_.getBandwidthManager()->refreshIfDue();
+        // Finished jobs age out even while no other job finishes
+        jobManager_.pruneFinishedJobs();
+    }
+    lock.unlock();
+
+    if (signalReceived) {
+        Logger::info("Termination signal received, shutting down daemon");
+    }
+    stop();
+}
+
+bool BackupDaemon::handleRequest(const json& request, const ControlReply& reply) {
+    std::string command = request.value("command", "");
+    if (command == "subscribe") {
+        return handleSubscribe(request, reply);
+    }
+
+    json response;
+
+    if (command == "ping") {
+        response = {{"ok", true}};
+    } else if (command == "backup") {
+        response = handleBackup(request);
+    } else if (command == "verify") {
+        response = handleVerify(request);
+    } else if (command == "restore") {
+        response = handleRestore(request);
+    } else if (command == "status") {
+        response = handleStatus(request);
+    } else if (command == "cancel") {
+        response = handleCancel(request);
+    } else if (command == "bandwidth") {
+        response = handleBandwidth(request);
+    } else {
+        response = errorResponse("Unknown command: " + command);
+    }
+
+    if (request.contains("requestId")) {
+        response["requestId"] = request["requestId"];
+    }
+    return reply(response);
+}
+
+json BackupDaemon::handleBackup(const json& request) {
+    BackupConfig config;
+    if (!backupConfigFromJson(request.value("config", json::object()), config)) {
+        return errorResponse("Invalid backup config");
+    }
+    if (config.vmId.empty() || config.backupDir.empty()) {
+        return errorResponse("Backup requires vmId and backupDir");
+    }
+    if (config.backupPath.empty()) {
+        config.backupPath = config.backupDir;
+    }
+
+    std::string error;
+    if (!resolveEndpoint(request, config.endpoint, error)) {
+        return errorResponse(error);
+    }
+
+    std::shared_ptr<Job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job = jobManager_.createBackupJob(config);
+        if (!job) {
+            return errorResponse("Failed to create backup job: " + jobManager_.getLastError());
+        }
+    }
+    return submitJob(job, "backup");
+}
+
+json BackupDaemon::handleVerify(const json& request) {
+    VerifyConfig config;
+    if (!verifyConfigFromJson(request.value("config", json::object()), config)) {
+        return errorResponse("Invalid verify config");
+    }
+    if (config.backupId.empty()) {
+        return errorResponse("Verify requires backupId");
+    }
+
+    std::string error;
+    if (!resolveEndpoint(request, config.endpoint, error)) {
+        return errorResponse(error);
+    }
+
+    std::shared_ptr<Job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job = jobManager_.createVerifyJob(config);
+        if (!job) {
+            return errorResponse("Failed to create verify job: " + jobManager_.getLastError());
+        }
+    }
+    return submitJob(job, "verify");
+}
+
+json BackupDaemon::handleRestore(const json& request) {
+    RestoreConfig config;
+    if (!restoreConfigFromJson(request.value("config", json::object()), config)) {
+        return errorResponse("Invalid restore config");
+    }
+    if (config.vmId.empty() || config.backupId.empty()) {
+        return errorResponse("Restore requires vmId and backupId");
+    }
+
+    std::string error;
+    if (!resolveEndpoint(request, config.endpoint, error)) {
+        return errorResponse(error);
+    }
+
+    // Restore jobs connect on their own, so hand them the credentials the
+    // endpoint was registered with; a request for a connected endpoint
+    // need not carry any
+    std::shared_ptr<Job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const EndpointCredentials& credentials = credentials_[config.endpoint];
+        config.vsphereHost = config.endpoint;
+        config.vsphereUsername = credentials.username;
+        config.vspherePassword = credentials.password;
+
+        job = jobManager_.createRestoreJob(config);
+        if (!job) {
+            return errorResponse("Failed to create restore job: " + jobManager_.getLastError());
+        }
+    }
+    return submitJob(job, "restore");
+}
+
+json BackupDaemon::handleStatus(const json& request) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string jobId = request.value("jobId", "");
+    if (!jobId.empty()) {
+        std::string type;
+        auto job = findJob(jobId, type);
+        if (!job) {
+            return errorResponse("Job not found: " + jobId);
+        }
+        return {{"ok", true}, {"job", jobToJson(*job, type)}};
+    }
+
+    json jobs = json::array();
+    for (const auto& job : jobManager_.getBackupJobs()) {
+        jobs.push_back(jobToJson(*job, "backup"));
+    }
+    for (const auto& job : jobManager_.getVerifyJobs()) {
+        jobs.push_back(jobToJson(*job, "verify"));
+    }
+    for (const auto& job : jobManager_.getRestoreJobs()) {
+        jobs.push_back(jobToJson(*job, "restore"));
+    }
+    return {{"ok", true}, {"jobs", jobs}, {"endpoints", jobManager_.getEndpoints()},
+            {"queuedJobs", jobManager_.getQueuedJobCount()}, {"resourceUsage", jobManager_.getResourceUsage()},
+            {"preemptedJobs", jobManager_.getPreemptedJobCount()}, {"sourceLatency", sourceLatencyToJson(*jobManager_.getLatencyMonitor())}};
+}
+
+json BackupDaemon::handleCancel(const json& request) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string jobId = request.value("jobId", "");
+    std::string type;
+    auto job = findJob(jobId, type);
+    if (!job) {
+        return errorResponse("Job not found: " + jobId);
+    }
+    if (!jobManager_.cancelJob(jobId)) {
+        return errorResponse("Failed to cancel job: " + jobManager_.getLastError());
+    }
+    return {{"ok", true}, {"job", jobToJson(*job, type)}};
+}
+
+json BackupDaemon::handleBandwidth(const json& request) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string error;
+    if (!applyBandwidthSettings(request, error)) {
+        return errorResponse(error);
+    }
+
+    json response = {{"ok", true}, {"bandwidth", bandwidthToJson(*jobManager_.getBandwidthManager())}};
+    std::string jobId = request.value("jobId", "");
+    if (!jobId.empty()) {
+        uint64_t limit = 0;
+        if (!request.contains("limit") || !rateFromJson(request["limit"], limit)) {
+            return errorResponse("A job bandwidth change needs a \"limit\"");
+        }
+        if (!jobManager_.setJobBandwidth(jobId, limit)) {
+            return errorResponse(jobManager_.getLastError());
+        }
+        response["jobId"] = jobId;
+        response["limit"] = limit;
+    }
+    return response;
+}
+
+bool BackupDaemon::applyBandwidthSettings(const json& settings, std::string& error) {
+    auto bandwidth = jobManager_.getBandwidthManager();
+
+    if (settings.contains("global") || settings.contains("perSource")) {
+        BandwidthLimits limits = bandwidth->getLimits();
+        if ((settings.contains("global") && !rateFromJson(settings["global"], limits.globalBytesPerSecond)) ||
+            (settings.contains("perSource") && !rateFromJson(settings["perSource"], limits.perSourceBytesPerSecond))) {
+            error = "Invalid bandwidth rate";
+            return false;
+        }
+        bandwidth->setLimits(limits);
+    }
+
+    // One source: {"source": NAME, "limit": RATE}; several: {"sources": {NAME: RATE}}
+    json sources = settings.value("sources", json::object());
+    if (settings.contains("source") && settings.value("jobId", "").empty()) {
+        sources[settings.value("source", "")] = settings.value("limit", json(0));
+    }
+    for (auto it = sources.begin(); it != sources.end(); ++it) {
+        uint64_t limit = 0;
+        if (!rateFromJson(it.value(), limit)) {
+            error = "Invalid bandwidth rate for source " + it.key();
+            return false;
+        }
+        bandwidth->setSourceLimit(it.key(), limit);
+    }
+
+    if (settings.contains("profiles")) {
+        std::vector<BandwidthProfile> profiles;
+        for (const auto& entry : settings["profiles"]) {
+            BandwidthProfile profile;
+            if (!profileFromJson(entry, profile, error)) {
+                return false;
+            }
+            profiles.push_back(profile);
+        }
+        if (!bandwidth->setProfiles(profiles)) {
+            error = bandwidth->getLastError();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BackupDaemon::handleSubscribe(const json& request, const ControlReply& reply) {
+    auto ring = jobManager_.getEventRing();
+    std::string jobId = request.value("jobId", "");
+
+    // Remember the ring position before the snapshot so no change is lost in between
+    uint64_t nextSequence = ring->getNextSequence();
+    json snapshot;
+    bool finished = false;
+    if (!jobId.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string type;
+        auto job = findJob(jobId, type);
+        if (!job) {
+            return reply(errorResponse("Job not found: " + jobId));
+        }
+        snapshot = {{"ok", true}, {"job", jobToJson(*job, type)}};
+        finished = isTerminalJobState(job->getState());
+    } else {
+        snapshot = handleStatus(json::object());
+    }
+    if (request.contains("requestId")) {
+        snapshot["requestId"] = request["requestId"];
+    }
+    if (!reply(snapshot)) {
+        return false;
+    }
+    if (finished) {
+        return reply({{"end", true}});
+    }
+
+    // Stream from the shared ring; slow subscribers skip ahead, workers never wait
+    std::vector<JobEvent> events;
+    while (!stopRequested_) {
+        if (!ring->wait(nextSequence, std::chrono::milliseconds(500))) {
+            continue;
+        }
+
+        events.clear();
+        uint64_t dropped = 0;
+        ring->read(nextSequence, events, 256, dropped);
+        if (dropped > 0 && !reply({{"dropped", dropped}})) {
+            return false;
+        }
+
+        for (const auto& event : events) {
+            if (!jobId.empty() && event.jobId != jobId) {
+                continue;
+            }
+            if (!reply({{"event", jobEventToJson(event)}})) {
+                return false;
+            }
+            if (!jobId.empty() && event.kind == JobEventKind::STATE && isTerminalJobState(event.state)) {
+                return reply({{"end", true}});
+            }
+        }
+    }
+    return false;
+}
+
+bool BackupDaemon::loadEndpoints(const std::string& path) {
+    json j;
+    try {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            lastError_ = "Failed to open endpoints file: " + path;
+            Logger::error(lastError_);
+            return false;
+        }
+        file >> j;
+    } catch (const std::exception& e) {
+        lastError_ = "Failed to parse endpoints file: " + std::string(e.what());
+        Logger::error(lastError_);
+        return false;
+    }
+    if (!j.is_object()) {
+        lastError_ = "Endpoints file " + path + " does not hold a JSON object";
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // A section with values of the wrong type is skipped; the rest of the file still applies
+    auto section = [&j, &path](const char* name, const std::function<void(const json&)>& apply) {
+        if (!j.contains(name)) {
+            return;
+        }
+        try {
+            apply(j[name]);
+        } catch (const json::exception& e) {
+            Logger::warning("Skipping invalid " + std::string(name) + " settings in " + path + ": " + e.what());
+        }
+    };
+
+    section("admission", [&](const json& admission) {
+        AdmissionLimits limits = jobManager_.getAdmissionLimits();
+        limits.streamsPerDatastore = admission.value("streamsPerDatastore", limits.streamsPerDatastore);
+        limits.streamsPerHost = admission.value("streamsPerHost", limits.streamsPerHost);
+        limits.streamsPerRepository = admission.value("streamsPerRepository", limits.streamsPerRepository);
+        jobManager_.setAdmissionLimits(limits);
+    });
+
+    section("jobs", [&](const json& jobs) {
+        JobRetention retention = jobManager_.getJobRetention();
+        retention.maxAge = std::chrono::seconds(
+            jobs.value("retentionSeconds", static_cast<int64_t>(retention.maxAge.count())));
+        retention.maxFinishedJobs = jobs.value("maxFinishedJobs", retention.maxFinishedJobs);
+        jobManager_.setJobRetention(retention);
+    });
+
+    section("bandwidth", [&](const json& bandwidth) {
+        std::string error;
+        if (!applyBandwidthSettings(bandwidth, error)) {
+            Logger::warning("Ignoring bandwidth settings in " + path + ": " + error);
+        }
+    });
+
+    section("qos", [&](const json& qos) {
+        QosPolicy policy = jobManager_.getQosPolicy();
+        policy.restoreWeight = qos.value("restoreWeight", policy.restoreWeight);
+        policy.verifyWeight = qos.value("verifyWeight", policy.verifyWeight);
+        policy.backupWeight = qos.value("backupWeight", policy.backupWeight);
+        policy.scrubWeight = qos.value("scrubWeight", policy.scrubWeight);
+        policy.lowerClassAction = qos.value("lowerClassAction", policy.lowerClassAction);
+        if (qos.contains("throttledBytesPerSecond") &&
+            !rateFromJson(qos["throttledBytesPerSecond"], policy.throttledBytesPerSecond)) {
+            Logger::warning("Ignoring invalid qos.throttledBytesPerSecond in " + path);
+        }
+        if (!jobManager_.setQosPolicy(policy)) {
+            Logger::warning("Ignoring qos settings in " + path + ": " + jobManager_.getLastError());
+        }
+    });
+
+    section("streams", [&](const json& streams) {
+        StreamControllerConfig config = jobManager_.getStreamControllerConfig();
+        config.initialStreams = streams.value("initial", config.initialStreams);
+        config.minStreams = streams.value("min", config.minStreams);
+        config.maxStreams = streams.value("max", config.maxStreams);
+        config.latencyTarget = std::chrono::milliseconds(
+            streams.value("latencyTargetMs", static_cast<int64_t>(config.latencyTarget.count())));
+        jobManager_.setStreamControllerConfig(config);
+    });
+
+    section("latency", [&](const json& latency) {
+        auto monitor = jobManager_.getLatencyMonitor();
+        LatencySlo slo = monitor->getSlo();
+        slo.target = std::chrono::milliseconds(latency.value("targetMs", static_cast<int64_t>(slo.target.count())));
+        slo.maxDelay = std::chrono::milliseconds(latency.value("maxDelayMs", static_cast<int64_t>(slo.maxDelay.count())));
+        monitor->setSlo(slo);
+        for (const auto& source : latency.value("sources", json::object()).items()) {
+            monitor->setSourceTarget(source.key(), std::chrono::milliseconds(source.value().get<int64_t>()));
+        }
+    });
+
+    // Pace of background deletion of expired backups
+    section("reaper", [&](const json& entry) {
+        auto reaper = BackupReaper::getDefault();
+        ReaperConfig config = reaper->getConfig();
+        config.batchSize = entry.value("batchSize", config.batchSize);
+        config.batchInterval = std::chrono::milliseconds(
+            entry.value("batchIntervalMs", static_cast<int64_t>(config.batchInterval.count())));
+        reaper->setConfig(config);
+    });
+
+    // Pack settings of chunk stores, and repositories whose chunk store
+    // lives on another backend, such as an S3 bucket; backups to them with
+    // chunkStore write there
+    section("storage", [&](const json& entry) {
+        ChunkRepositoryConfig packs = ChunkRepository::getRepositoryConfig();
+        if (entry.contains("packSize") && !rateFromJson(entry["packSize"], packs.packSize)) {
+            Logger::warning("Ignoring invalid storage.packSize in " + path);
+        }
+        packs.maxPendingPacks = entry.value("maxPendingPacks", packs.maxPendingPacks);
+        packs.uploadThreads = entry.value("packUploadThreads", packs.uploadThreads);
+        ChunkRepository::setRepositoryConfig(packs);
+
+        for (const auto& store : entry.value("repositories", json::array())) {
+            std::string repository = store.value("repository", "");
+            std::string error;
+            std::shared_ptr<StorageBackend> backend =
+                StorageBackend::create(storageFromJson(store.value("chunks", json::object())), error);
+            if (!backend || !ChunkRepository::forRepository(repository, backend, error)) {
+                Logger::warning("Skipping chunk store of repository " + repository + ": " + error);
+                continue;
+            }
+            Logger::info("Chunk store of repository " + repository + " is on " + backend->describe());
+        }
+    });
+
+    // Step sizes and pace of chunk garbage collection
+    section("gc", [&](const json& entry) {
+        auto collector = GarbageCollector::getDefault();
+        GcConfig config = collector->getConfig();
+        config.markBatch = entry.value("markBatch", config.markBatch);
+        config.sweepBatch = entry.value("sweepBatch", config.sweepBatch);
+        config.stepPause = std::chrono::milliseconds(
+            entry.value("stepPauseMs", static_cast<int64_t>(config.stepPause.count())));
+        config.compactBelow = entry.value("compactBelow", config.compactBelow);
+        config.compactStepBytes = entry.value("compactStepBytes", config.compactStepBytes);
+        if (entry.contains("compactBytesPerSecond") &&
+            !rateFromJson(entry["compactBytesPerSecond"], config.compactBytesPerSecond)) {
+            Logger::warning("Ignoring invalid gc.compactBytesPerSecond in " + path);
+        }
+        collector->setConfig(config);
+    });
+
+    // Repositories whose chunk packs land locally and move to capacity
+    // storage later; sizes are written like rates
+    section("tiering", [&](const json& entry) {
+        auto mover = TierMover::getDefault();
+        TierPolicy policy = mover->getPolicy();
+        policy.moveAfter = std::chrono::hours(
+            entry.value("moveAfterHours", static_cast<int64_t>(
+                std::chrono::duration_cast<std::chrono::hours>(policy.moveAfter).count())));
+        policy.scanInterval = std::chrono::seconds(
+            entry.value("scanIntervalSec", static_cast<int64_t>(policy.scanInterval.count())));
+        if ((entry.contains("landingLimit") && !rateFromJson(entry["landingLimit"], policy.landingLimit)) ||
+            (entry.contains("bytesPerSecond") && !rateFromJson(entry["bytesPerSecond"], policy.bytesPerSecond))) {
+            Logger::warning("Ignoring invalid tiering sizes in " + path);
+        }
+        mover->setPolicy(policy);
+
+        for (const auto& tier : entry.value("repositories", json::array())) {
+            std::string repository = tier.value("repository", "");
+            std::string error;
+            std::shared_ptr<StorageBackend> capacity =
+                StorageBackend::create(storageFromJson(tier.value("capacity", json::object())), error);
+            auto chunks = ChunkRepository::forRepository(repository, true);
+            if (!capacity || !chunks) {
+                Logger::warning("Skipping tiering of repository " + repository + ": " +
+                                (capacity ? "no chunk store" : error));
+                continue;
+            }
+            if (!chunks->hasCapacityTier() && !chunks->attachCapacityTier(capacity)) {
+                Logger::warning("Skipping tiering of repository " + repository + ": " + chunks->getLastError());
+                continue;
+            }
+            mover->add(chunks);
+        }
+    });
+
+    // cgroup v2 limits for the devices backing VMs on this host. The io
+    // controller is not threaded, so the group can only hold the whole
+    // daemon: its limits cover the I/O of every endpoint the daemon serves.
+    // The daemon therefore joins only when an endpoint opts in below
+    std::optional<IoCgroupConfig> ioCgroup;
+    section("ioCgroup", [&](const json& entry) {
+        IoCgroupConfig config;
+        config.path = entry.value("path", "genievm-backup");
+        for (const auto& device : entry.value("devices", json::array())) {
+            IoDeviceLimits limits;
+            limits.device = device.value("device", "");
+            limits.readBytesPerSecond = device.value("readBytesPerSecond", static_cast<uint64_t>(0));
+            limits.writeBytesPerSecond = device.value("writeBytesPerSecond", static_cast<uint64_t>(0));
+            limits.readIops = device.value("readIops", static_cast<uint64_t>(0));
+            limits.writeIops = device.value("writeIops", static_cast<uint64_t>(0));
+            limits.latencyTarget = std::chrono::microseconds(device.value("latencyTargetUs", static_cast<int64_t>(0)));
+            config.devices.push_back(limits);
+        }
+        ioCgroup = config;
+    });
+    std::vector<std::string> ioCgroupEndpoints;
+
+    // A vCenter that is down at startup is registered on first use instead
+    section("endpoints", [&](const json& endpoints) {
+        for (const auto& entry : endpoints) {
+            EndpointCredentials credentials;
+            EndpointLimits limits = config_.defaultLimits;
+            try {
+                if (!credentialsFromJson(entry, credentials) || credentials.host.empty()) {
+                    Logger::warning("Skipping invalid endpoint entry in " + path);
+                    continue;
+                }
+                limits.workerThreads = entry.value("workerThreads", limits.workerThreads);
+                limits.maxConcurrentJobs = entry.value("maxConcurrentJobs", limits.maxConcurrentJobs);
+                if (entry.value("ioCgroup", false)) {
+                    ioCgroupEndpoints.push_back(credentials.host);
+                }
+            } catch (const json::exception& e) {
+                Logger::warning("Skipping invalid endpoint entry in " + path + ": " + e.what());
+                continue;
+            }
+
+            std::string error;
+            if (!registerEndpoint(credentials, limits, error)) {
+                Logger::warning("Failed to connect endpoint " + credentials.host + ": " + error);
+            }
+        }
+    });
+
+    if (!ioCgroupEndpoints.empty()) {
+        std::string endpoints;
+        for (const auto& endpoint : ioCgroupEndpoints) {
+            endpoints += (endpoints.empty() ? "" : ", ") + endpoint;
+        }
+        if (!ioCgroup) {
+            Logger::warning("Endpoints " + endpoints + " ask for I/O cgroup limits, but " + path +
+                            " has no \"ioCgroup\" section");
+        } else {
+            IoCgroup cgroup(*ioCgroup);
+            if (!cgroup.apply() || !cgroup.attach(getpid())) {
+                Logger::warning("Running without I/O cgroup limits: " + cgroup.getLastError());
+            } else {
+                Logger::info("Daemon joined I/O cgroup " + cgroup.getPath() + " for " + endpoints +
+                             "; its limits apply to all daemon I/O on the listed devices, whichever endpoint it serves");
+            }
+        }
+    } else if (ioCgroup) {
+        Logger::info("No endpoint opts in to the \"ioCgroup\" limits of " + path + ", not applying them");
+    }
+    return true;
+}
+
+bool BackupDaemon::resolveEndpoint(const json& request, std::string& endpoint, std::string& error) {
+    EndpointCredentials credentials;
+    if (!credentialsFromJson(request.value("connection", json::object()), credentials)) {
+        error = "Invalid connection parameters";
+        return false;
+    }
+    if (credentials.host.empty()) {
+        credentials.host = endpoint;
+    }
+    if (credentials.host.empty()) {
+        error = "No endpoint given";
+        return false;
+    }
+    endpoint = credentials.host;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (providers_.count(endpoint) > 0) {
+            return true;
+        }
+    }
+    if (credentials.username.empty()) {
+        error = "Endpoint " + endpoint + " is not connected and no credentials were given";
+        return false;
+    }
+    return registerEndpoint(credentials, config_.defaultLimits, error);
+}
+
+bool BackupDaemon::registerEndpoint(const EndpointCredentials& credentials, const EndpointLimits& limits,
+                                    std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (providers_.count(credentials.host) > 0) {
+            return true;
+        }
+    }
+
+    // Connecting can take as long as the vCenter does to answer, so it runs
+    // without mutex_ and requests for other endpoints go on meanwhile
+    std::unique_ptr<BackupProvider> provider;
+    try {
+        provider.reset(createBackupProvider(credentials.type, credentials.host, credentials.port,
+                                            credentials.username, credentials.password));
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (providers_.count(credentials.host) > 0) {
+        // Another request connected the endpoint first
+        return true;
+    }
+    if (!jobManager_.addProvider(credentials.host, provider.get(), limits)) {
+        error = jobManager_.getLastError();
+        return false;
+    }
+    providers_[credentials.host] = std::move(provider);
+    credentials_[credentials.host] = credentials;
+    return true;
+}
+
+json BackupDaemon::submitJob(const std::shared_ptr<Job>& job, const std::string& type) {
+    // Called without mutex_: admission looks up the VM's datastores at the
+    // endpoint, and JobManager serializes itself
+    std::string jobId = job->getId();
+    if (!jobManager_.submitJob(jobId)) {
+        std::string error = jobManager_.getLastError();
+        jobManager_.removeJob(jobId);
+        return errorResponse("Failed to start " + type + " job: " + error);
+    }
+    bool queued = jobManager_.isJobQueued(jobId);
+    Logger::info((queued ? "Queued " : "Started ") + type + " job " + jobId);
+    return {{"ok", true}, {"jobId", jobId}, {"queued", queued}, {"job", jobToJson(*job, type)}};
+}
+
+std::shared_ptr<Job> BackupDaemon::findJob(const std::string& jobId, std::string& type) const {
+    if (auto job = jobManager_.getBackupJob(jobId)) {
+        type = "backup";
+        return job;
+    }
+    if (auto job = jobManager_.getVerifyJob(jobId)) {
+        type = "verify";
+        return job;
+    }
+    if (auto job = jobManager_.getRestoreJob(jobId)) {
+        type = "restore";
+        return job;
+    }
+    return nullptr;
+}
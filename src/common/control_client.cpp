@@ -0,0 +1,82 @@
+#include "common/control_client.hpp"
+#include "common/control_protocol.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+ControlClient::~ControlClient() {
+    disconnect();
+}
+
+bool ControlClient::connect(const std::string& socketPath) {
+    disconnect();
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path)) {
+        lastError_ = "Invalid control socket path: " + socketPath;
+        return false;
+    }
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        lastError_ = "Failed to create socket: " + std::string(strerror(errno));
+        return false;
+    }
+    if (::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        lastError_ = "Failed to connect to daemon at " + socketPath + ": " + std::string(strerror(errno));
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+void ControlClient::disconnect() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    buffer_.clear();
+}
+
+bool ControlClient::request(const json& request, json& response) {
+    return send(request) && receive(response);
+}
+
+bool ControlClient::send(const json& message) {
+    if (fd_ < 0) {
+        lastError_ = "Not connected to daemon";
+        return false;
+    }
+    if (!writeControlMessage(fd_, message)) {
+        lastError_ = "Failed to send request to daemon";
+        return false;
+    }
+    return true;
+}
+
+bool ControlClient::receive(json& message) {
+    if (fd_ < 0) {
+        lastError_ = "Not connected to daemon";
+        return false;
+    }
+
+    std::string line;
+    if (!readControlMessage(fd_, buffer_, line)) {
+        lastError_ = "Connection to daemon closed";
+        return false;
+    }
+    message = json::parse(line, nullptr, false);
+    if (message.is_discarded()) {
+        lastError_ = "Malformed response from daemon";
+        return false;
+    }
+    return true;
+}
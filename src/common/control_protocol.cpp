@@ -0,0 +1,304 @@
+#include "common/control_protocol.hpp"
+#include "common/logger.hpp"
+#include <cerrno>
+#include <sys/socket.h>
+
+using json = nlohmann::json;
+
+bool readControlMessage(int fd, std::string& buffer, std::string& message) {
+    while (true) {
+        auto newline = buffer.find('\n');
+        if (newline != std::string::npos) {
+            message = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            return true;
+        }
+        if (buffer.size() > MAX_CONTROL_MESSAGE_SIZE) {
+            Logger::error("Control message exceeds " + std::to_string(MAX_CONTROL_MESSAGE_SIZE) + " bytes");
+            return false;
+        }
+
+        char chunk[4096];
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+bool writeControlMessage(int fd, const json& message) {
+    std::string data = message.dump() + "\n";
+    size_t written = 0;
+    while (written < data.size()) {
+        // MSG_NOSIGNAL: a client that went away must not kill the daemon with SIGPIPE
+        ssize_t n = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+json backupConfigToJson(const BackupConfig& config) {
+    return {
+        {"vmId", config.vmId},
+        {"endpoint", config.endpoint},
+        {"host", config.host},
+        {"sourcePath", config.sourcePath},
+        {"backupPath", config.backupPath},
+        {"backupDir", config.backupDir},
+        {"scheduleType", config.scheduleType},
+        {"schedule", {
+            {"hour", config.schedule.hour},
+            {"minute", config.schedule.minute},
+            {"day", config.schedule.day}
+        }},
+        {"catchUpPolicy", config.catchUpPolicy},
+        {"catchUpWindowMinutes", config.catchUpWindowMinutes},
+        {"staggerPolicy", config.staggerPolicy},
+        {"staggerWindowMinutes", config.staggerWindowMinutes},
+        {"maxBackups", config.maxBackups},
+        {"keepDaily", config.keepDaily},
+        {"keepWeekly", config.keepWeekly},
+        {"keepMonthly", config.keepMonthly},
+        {"keepYearly", config.keepYearly},
+        {"incremental", config.incremental},
+        {"compressionLevel", config.compressionLevel},
+        {"maxConcurrentDisks", config.maxConcurrentDisks},
+        {"enableCBT", config.enableCBT},
+        {"retentionDays", config.retentionDays},
+        {"excludedDisks", config.excludedDisks},
+        {"bandwidthLimit", config.bandwidthLimit},
+        {"copyRepositories", config.copyRepositories},
+        {"copyPolicy", config.copyPolicy},
+        {"copyStallSeconds", config.copyStallSeconds},
+        {"copyQueueBytes", config.copyQueueBytes},
+        {"chunkStore", config.chunkStore}
+    };
+}
+
+bool backupConfigFromJson(const json& j, BackupConfig& config) {
+    try {
+        config.vmId = j.value("vmId", "");
+        config.endpoint = j.value("endpoint", "");
+        config.host = j.value("host", "");
+        config.sourcePath = j.value("sourcePath", "");
+        config.backupPath = j.value("backupPath", "");
+        config.backupDir = j.value("backupDir", "");
+        config.scheduleType = j.value("scheduleType", "");
+        if (j.contains("schedule")) {
+            config.schedule.hour = j["schedule"].value("hour", 0);
+            config.schedule.minute = j["schedule"].value("minute", 0);
+            config.schedule.day = j["schedule"].value("day", 1);
+        }
+        config.catchUpPolicy = j.value("catchUpPolicy", "once");
+        config.catchUpWindowMinutes = j.value("catchUpWindowMinutes", 0);
+        config.staggerPolicy = j.value("staggerPolicy", "none");
+        config.staggerWindowMinutes = j.value("staggerWindowMinutes", 0);
+        config.maxBackups = j.value("maxBackups", 0);
+        config.keepDaily = j.value("keepDaily", 0);
+        config.keepWeekly = j.value("keepWeekly", 0);
+        config.keepMonthly = j.value("keepMonthly", 0);
+        config.keepYearly = j.value("keepYearly", 0);
+        config.incremental = j.value("incremental", false);
+        config.compressionLevel = j.value("compressionLevel", 0);
+        config.maxConcurrentDisks = j.value("maxConcurrentDisks", 1);
+        config.enableCBT = j.value("enableCBT", true);
+        config.retentionDays = j.value("retentionDays", 7);
+        config.excludedDisks = j.value("excludedDisks", std::vector<std::string>());
+        config.bandwidthLimit = j.value("bandwidthLimit", static_cast<uint64_t>(0));
+        config.copyRepositories = j.value("copyRepositories", std::vector<std::string>());
+        config.copyPolicy = j.value("copyPolicy", "fail");
+        if (config.copyPolicy != "fail" && config.copyPolicy != "degrade") {
+            Logger::error("Invalid backup config: unknown copy policy " + config.copyPolicy);
+            return false;
+        }
+        config.copyStallSeconds = j.value("copyStallSeconds", 60);
+        config.copyQueueBytes = j.value("copyQueueBytes", static_cast<uint64_t>(64ULL << 20));
+        config.chunkStore = j.value("chunkStore", false);
+        return true;
+    } catch (const std::exception& e) {
+        Logger::error("Invalid backup config: " + std::string(e.what()));
+        return false;
+    }
+}
+
+json verifyConfigToJson(const VerifyConfig& config) {
+    return {
+        {"backupId", config.backupId},
+        {"endpoint", config.endpoint},
+        {"verifyChecksums", config.verifyChecksums},
+        {"verifyMetadata", config.verifyMetadata},
+        {"verifyData", config.verifyData},
+        {"maxConcurrentDisks", config.maxConcurrentDisks}
+    };
+}
+
+bool verifyConfigFromJson(const json& j, VerifyConfig& config) {
+    try {
+        config.backupId = j.value("backupId", "");
+        config.endpoint = j.value("endpoint", "");
+        config.verifyChecksums = j.value("verifyChecksums", true);
+        config.verifyMetadata = j.value("verifyMetadata", true);
+        config.verifyData = j.value("verifyData", true);
+        config.maxConcurrentDisks = j.value("maxConcurrentDisks", 1);
+        return true;
+    } catch (const std::exception& e) {
+        Logger::error("Invalid verify config: " + std::string(e.what()));
+        return false;
+    }
+}
+
+json restoreConfigToJson(const RestoreConfig& config) {
+    json disks = json::array();
+    for (const auto& disk : config.diskConfigs) {
+        disks.push_back({
+            {"path", disk.path},
+            {"sizeKB", disk.sizeKB},
+            {"format", disk.format},
+            {"type", disk.type},
+            {"thinProvisioned", disk.thinProvisioned}
+        });
+    }
+
+    // vSphere credentials travel in the connection block, never in the config
+    return {
+        {"vmId", config.vmId},
+        {"endpoint", config.endpoint},
+        {"backupId", config.backupId},
+        {"vmName", config.vmName},
+        {"datastore", config.datastore},
+        {"resourcePool", config.resourcePool},
+        {"guestOS", config.guestOS},
+        {"restorePath", config.restorePath},
+        {"numCPUs", config.numCPUs},
+        {"memoryMB", config.memoryMB},
+        {"verifyAfterRestore", config.verifyAfterRestore},
+        {"powerOnAfterRestore", config.powerOnAfterRestore},
+        {"diskConfigs", disks},
+        {"maxConcurrentDisks", config.maxConcurrentDisks},
+        {"excludedDisks", config.excludedDisks},
+        {"bandwidthLimit", config.bandwidthLimit}
+    };
+}
+
+bool restoreConfigFromJson(const json& j, RestoreConfig& config) {
+    try {
+        config.vmId = j.value("vmId", "");
+        config.endpoint = j.value("endpoint", "");
+        config.backupId = j.value("backupId", "");
+        config.vmName = j.value("vmName", "");
+        config.datastore = j.value("datastore", "");
+        config.resourcePool = j.value("resourcePool", "");
+        config.guestOS = j.value("guestOS", "");
+        config.restorePath = j.value("restorePath", "");
+        config.numCPUs = j.value("numCPUs", 2);
+        config.memoryMB = j.value("memoryMB", 4096);
+        config.verifyAfterRestore = j.value("verifyAfterRestore", true);
+        config.powerOnAfterRestore = j.value("powerOnAfterRestore", false);
+        config.maxConcurrentDisks = j.value("maxConcurrentDisks", 1);
+        config.excludedDisks = j.value("excludedDisks", std::vector<std::string>());
+        config.bandwidthLimit = j.value("bandwidthLimit", static_cast<uint64_t>(0));
+        config.diskConfigs.clear();
+        if (j.contains("diskConfigs")) {
+            for (const auto& disk : j["diskConfigs"]) {
+                DiskConfig diskConfig;
+                diskConfig.path = disk.value("path", "");
+                diskConfig.sizeKB = disk.value("sizeKB", static_cast<int64_t>(0));
+                diskConfig.format = disk.value("format", "");
+                diskConfig.type = disk.value("type", "");
+                diskConfig.thinProvisioned = disk.value("thinProvisioned", false);
+                config.diskConfigs.push_back(diskConfig);
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        Logger::error("Invalid restore config: " + std::string(e.what()));
+        return false;
+    }
+}
+
+json credentialsToJson(const EndpointCredentials& credentials) {
+    return {
+        {"type", credentials.type},
+        {"host", credentials.host},
+        {"port", credentials.port},
+        {"username", credentials.username},
+        {"password", credentials.password}
+    };
+}
+
+bool credentialsFromJson(const json& j, EndpointCredentials& credentials) {
+    try {
+        credentials.type = j.value("type", "vmware");
+        credentials.host = j.value("host", "");
+        credentials.port = j.value("port", "443");
+        credentials.username = j.value("username", "");
+        credentials.password = j.value("password", "");
+        return true;
+    } catch (const std::exception& e) {
+        Logger::error("Invalid connection parameters: " + std::string(e.what()));
+        return false;
+    }
+}
+
+std::string jobStateToString(Job::State state) {
+    switch (state) {
+        case Job::State::PENDING: return "pending";
+        case Job::State::RUNNING: return "running";
+        case Job::State::PAUSED: return "paused";
+        case Job::State::COMPLETED: return "completed";
+        case Job::State::FAILED: return "failed";
+        case Job::State::CANCELLED: return "cancelled";
+    }
+    return "unknown";
+}
+
+json jobToJson(const Job& job, const std::string& type) {
+    auto throttled = job.getThrottleTimes();
+    return {
+        {"jobId", job.getId()},
+        {"type", type},
+        {"state", jobStateToString(job.getState())},
+        {"status", job.getStatus()},
+        {"progress", job.getProgress()},
+        {"error", job.getError()},
+        {"bandwidthThrottledMs", throttled.bandwidth.count()},
+        {"latencyThrottledMs", throttled.latency.count()}
+    };
+}
+
+bool isTerminalJobState(Job::State state) {
+    return state == Job::State::COMPLETED || state == Job::State::FAILED || state == Job::State::CANCELLED;
+}
+
+json jobEventToJson(const JobEvent& event) {
+    std::string kind;
+    switch (event.kind) {
+        case JobEventKind::PROGRESS: kind = "progress"; break;
+        case JobEventKind::STATUS: kind = "status"; break;
+        case JobEventKind::STATE: kind = "state"; break;
+        case JobEventKind::THROUGHPUT: kind = "throughput"; break;
+    }
+
+    return {
+        {"seq", event.sequence},
+        {"kind", kind},
+        {"jobId", event.jobId},
+        {"type", event.jobType},
+        {"state", jobStateToString(event.state)},
+        {"progress", event.progress},
+        {"status", event.status},
+        {"bytes", event.bytesTransferred},
+        {"throughput", event.throughput},
+        {"timestamp", event.timestamp}
+    };
+}
@@ -0,0 +1,160 @@
+#include "common/control_server.hpp"
+#include "common/control_protocol.hpp"
+#include "common/logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+ControlServer::ControlServer(const std::string& socketPath, ControlHandler handler)
+    : socketPath_(socketPath)
+    , handler_(std::move(handler)) {
+}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+bool ControlServer::start() {
+    if (running_) {
+        return true;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath_.empty() || socketPath_.size() >= sizeof(addr.sun_path)) {
+        lastError_ = "Invalid control socket path: " + socketPath_;
+        Logger::error(lastError_);
+        return false;
+    }
+    strncpy(addr.sun_path, socketPath_.c_str(), sizeof(addr.sun_path) - 1);
+
+    // Refuse to steal the socket of a live daemon, but clean up a stale one
+    int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0) {
+        bool alive = ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        ::close(probe);
+        if (alive) {
+            lastError_ = "Another daemon is listening on " + socketPath_;
+            Logger::error(lastError_);
+            return false;
+        }
+    }
+    ::unlink(socketPath_.c_str());
+
+    listenFd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+        lastError_ = "Failed to create control socket: " + std::string(strerror(errno));
+        Logger::error(lastError_);
+        return false;
+    }
+
+    if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::chmod(socketPath_.c_str(), 0600) != 0 ||
+        ::listen(listenFd_, 64) != 0) {
+        lastError_ = "Failed to listen on " + socketPath_ + ": " + std::string(strerror(errno));
+        Logger::error(lastError_);
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    running_ = true;
+    acceptThread_ = std::thread(&ControlServer::acceptLoop, this);
+    Logger::info("Control server listening on " + socketPath_);
+    return true;
+}
+
+void ControlServer::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+
+    // Wake up accept() and every blocked client read
+    ::shutdown(listenFd_, SHUT_RDWR);
+    if (acceptThread_.joinable()) {
+        acceptThread_.join();
+    }
+    ::close(listenFd_);
+    listenFd_ = -1;
+
+    std::unique_lock<std::mutex> lock(connectionsMutex_);
+    for (int fd : connections_) {
+        ::shutdown(fd, SHUT_RDWR);
+    }
+    connectionsCv_.wait(lock, [this]() { return connections_.empty(); });
+    lock.unlock();
+
+    ::unlink(socketPath_.c_str());
+    Logger::info("Control server stopped");
+}
+
+void ControlServer::acceptLoop() {
+    while (running_) {
+        int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (!running_) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::warning("Failed to accept control connection: " + std::string(strerror(errno)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex_);
+            connections_.insert(fd);
+        }
+        std::thread(&ControlServer::serveConnection, this, fd).detach();
+    }
+}
+
+void ControlServer::serveConnection(int fd) {
+    std::mutex writeMutex;
+    ControlReply reply = [fd, &writeMutex](const json& message) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        return writeControlMessage(fd, message);
+    };
+
+    std::string buffer;
+    std::string message;
+    while (running_ && readControlMessage(fd, buffer, message)) {
+        if (message.empty()) {
+            continue;
+        }
+
+        json request = json::parse(message, nullptr, false);
+        if (request.is_discarded() || !request.is_object()) {
+            if (!reply({{"ok", false}, {"error", "Malformed request"}})) {
+                break;
+            }
+            continue;
+        }
+
+        bool keepOpen = false;
+        try {
+            keepOpen = handler_(request, reply);
+        } catch (const std::exception& e) {
+            Logger::error("Control request failed: " + std::string(e.what()));
+            keepOpen = reply({{"ok", false}, {"error", e.what()}});
+        }
+        if (!keepOpen) {
+            break;
+        }
+    }
+
+    // Forgotten before it is closed: once closed, the number can be handed
+    // to a new connection, and stop() must not shut that one down
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    connections_.erase(fd);
+    ::close(fd);
+    connectionsCv_.notify_all();
+}
@@ -0,0 +1,129 @@
+#include "common/file_utils.hpp"
+#include <filesystem>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool writeFileAtomic(const std::string& path, const std::string& data, std::string& error) {
+    try {
+        std::filesystem::path target(path);
+        if (target.has_parent_path()) {
+            std::filesystem::create_directories(target.parent_path());
+        }
+    } catch (const std::exception& e) {
+        error = std::string("Failed to create directory: ") + e.what();
+        return false;
+    }
+
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error = "Failed to open temporary file: " + tmpPath;
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            ::close(fd);
+            ::unlink(tmpPath.c_str());
+            error = "Failed to write temporary file: " + tmpPath;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        ::unlink(tmpPath.c_str());
+        error = "Failed to sync temporary file: " + tmpPath;
+        return false;
+    }
+    ::close(fd);
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        ::unlink(tmpPath.c_str());
+        error = "Failed to replace " + path;
+        return false;
+    }
+
+    // Make the rename itself durable
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return true;
+}
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+    static const auto table = [] {
+        struct Table {
+            uint32_t entries[256];
+        } t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t.entries[i] = c;
+        }
+        return t;
+    }();
+
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path, std::string& error) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "Failed to open " + path;
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        error = "Failed to stat " + path;
+        return false;
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            size_ = 0;
+            error = "Failed to map " + path;
+            return false;
+        }
+        data_ = static_cast<const uint8_t*>(mapped);
+    }
+    fd_ = fd;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) {
+        ::munmap(const_cast<uint8_t*>(data_), size_);
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+}
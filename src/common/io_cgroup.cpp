@@ -0,0 +1,109 @@
+#include "common/io_cgroup.hpp"
+#include "common/logger.hpp"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+IoCgroup::IoCgroup(const IoCgroupConfig& config, const std::string& root)
+    : config_(config)
+    , root_(root)
+    , path_(root + "/" + config.path) {
+}
+
+bool IoCgroup::apply() {
+    if (config_.path.empty()) {
+        lastError_ = "No cgroup path configured";
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(path_, ec);
+    if (ec) {
+        lastError_ = "Failed to create cgroup " + path_ + ": " + ec.message();
+        Logger::error(lastError_);
+        return false;
+    }
+
+    // Limits are only honoured once the parent delegates the io controller
+    std::string parent = std::filesystem::path(path_).parent_path().string();
+    if (!writeFile(parent + "/cgroup.subtree_control", "+io")) {
+        return false;
+    }
+
+    for (const auto& device : config_.devices) {
+        std::string majorMinor;
+        if (!resolveDevice(device.device, majorMinor)) {
+            return false;
+        }
+
+        std::ostringstream max;
+        max << majorMinor;
+        auto limit = [&max](const char* key, uint64_t value) {
+            max << " " << key << "=";
+            if (value == 0) {
+                max << "max";
+            } else {
+                max << value;
+            }
+        };
+        limit("rbps", device.readBytesPerSecond);
+        limit("wbps", device.writeBytesPerSecond);
+        limit("riops", device.readIops);
+        limit("wiops", device.writeIops);
+        if (!writeFile(path_ + "/io.max", max.str())) {
+            return false;
+        }
+
+        if (device.latencyTarget.count() > 0 &&
+            !writeFile(path_ + "/io.latency", majorMinor + " target=" + std::to_string(device.latencyTarget.count()))) {
+            return false;
+        }
+    }
+
+    Logger::info("I/O limits applied to cgroup " + path_ + " for " + std::to_string(config_.devices.size()) +
+                 " device(s)");
+    return true;
+}
+
+bool IoCgroup::attach(pid_t pid) {
+    return writeFile(path_ + "/cgroup.procs", std::to_string(pid));
+}
+
+bool IoCgroup::resolveDevice(const std::string& device, std::string& majorMinor) {
+    if (device.find(':') != std::string::npos) {
+        majorMinor = device;
+        return true;
+    }
+
+    struct stat st {};
+    if (stat(device.c_str(), &st) != 0) {
+        lastError_ = "Failed to stat device " + device + ": " + std::strerror(errno);
+        Logger::error(lastError_);
+        return false;
+    }
+    if (!S_ISBLK(st.st_mode)) {
+        lastError_ = "Not a block device: " + device;
+        Logger::error(lastError_);
+        return false;
+    }
+    majorMinor = std::to_string(major(st.st_rdev)) + ":" + std::to_string(minor(st.st_rdev));
+    return true;
+}
+
+bool IoCgroup::writeFile(const std::string& file, const std::string& value) {
+    std::ofstream out(file);
+    if (out.is_open()) {
+        out << value;
+        out.flush();
+    }
+    if (!out.is_open() || !out.good()) {
+        lastError_ = "Failed to write \"" + value + "\" to " + file;
+        Logger::error(lastError_);
+        return false;
+    }
+    return true;
+}
@@ -1,6 +1,8 @@
 #include "common/job.hpp"
+#include "common/job_event_ring.hpp"
 #include <chrono>
 #include <random>
+#include <thread>
 #include <sstream>
 #include <iomanip>
 
@@ -9,6 +11,7 @@ Job::Job() : state_(State::PENDING), progress_(0) {}
 void Job::updateProgress(int progress) {
     std::lock_guard<std::mutex> lock(mutex_);
     progress_ = progress;
+    publishEvent(JobEventKind::PROGRESS);
     if (progressCallback_) {
         progressCallback_(progress);
     }
@@ -20,18 +23,115 @@ void Job::setError(const std::string& error) {
 }
 
 void Job::setState(State state) {
+    auto isFinished = [](State s) {
+        return s == State::COMPLETED || s == State::FAILED || s == State::CANCELLED;
+    };
+
+    std::vector<std::function<void(const Job& job)>> completions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state == State::RUNNING && state_ == State::PENDING) {
+            runningSince_ = std::chrono::steady_clock::now();
+        }
+        if (isFinished(state) && !isFinished(state_)) {
+            finishedAt_ = std::chrono::steady_clock::now();
+            if (state_ == State::PENDING) {
+                runningSince_ = finishedAt_;
+            }
+            completions.swap(completionCallbacks_);
+        }
+        state_ = state;
+        publishEvent(JobEventKind::STATE);
+    }
+
+    for (const auto& completion : completions) {
+        completion(*this);
+    }
+}
+
+void Job::addCompletionCallback(std::function<void(const Job& job)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    completionCallbacks_.push_back(std::move(callback));
+}
+
+void Job::addExitCallback(std::function<void(const Job& job)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exitCallbacks_.push_back(std::move(callback));
+}
+
+void Job::startWorker(std::function<void()> body) {
+    std::thread([this, body = std::move(body)]() {
+        body();
+
+        std::vector<std::function<void(const Job& job)>> exits;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            exits.swap(exitCallbacks_);
+        }
+        for (const auto& exit : exits) {
+            exit(*this);
+        }
+    }).detach();
+}
+
+uint64_t Job::getBytesTransferred() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    state_ = state;
+    return bytesTransferred_;
+}
+
+std::chrono::milliseconds Job::getRunTime() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == State::PENDING) {
+        return std::chrono::milliseconds(0);
+    }
+    bool finished = state_ == State::COMPLETED || state_ == State::FAILED || state_ == State::CANCELLED;
+    auto end = finished ? finishedAt_ : std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(end - runningSince_);
 }
 
 void Job::setStatus(const std::string& status) {
     std::lock_guard<std::mutex> lock(mutex_);
     status_ = status;
+    publishEvent(JobEventKind::STATUS);
     if (statusCallback_) {
         statusCallback_(status);
     }
 }
 
+void Job::setEventRing(std::shared_ptr<JobEventRing> ring, const std::string& jobType) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    eventRing_ = std::move(ring);
+    jobType_ = jobType;
+}
+
+void Job::addBytesTransferred(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytesTransferred_ += bytes;
+    publishEvent(JobEventKind::THROUGHPUT);
+}
+
+void Job::publishEvent(JobEventKind kind) {
+    if (!eventRing_) {
+        return;
+    }
+
+    JobEvent event;
+    event.kind = kind;
+    event.jobId = id_;
+    event.jobType = jobType_;
+    event.state = state_;
+    event.progress = progress_;
+    event.status = status_;
+    event.bytesTransferred = bytesTransferred_;
+    if (state_ != State::PENDING) {
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - runningSince_).count();
+        event.throughput = elapsed > 0.0 ? bytesTransferred_ / elapsed : 0.0;
+    }
+    event.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    eventRing_->publish(std::move(event));
+}
+
 std::string Job::generateId() const {
     auto now = std::chrono::system_clock::now();
     auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
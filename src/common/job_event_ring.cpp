@@ -0,0 +1,59 @@
+#include "common/job_event_ring.hpp"
+#include <algorithm>
+
+JobEventRing::JobEventRing(size_t capacity)
+    : slots_(std::max<size_t>(1, capacity)) {
+}
+
+uint64_t JobEventRing::publish(JobEvent event) {
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence = nextSequence_++;
+        event.sequence = sequence;
+        slots_[sequence % slots_.size()] = std::move(event);
+    }
+    cv_.notify_all();
+    return sequence;
+}
+
+size_t JobEventRing::read(uint64_t& nextSequence, std::vector<JobEvent>& events,
+                          size_t maxEvents, uint64_t& dropped) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dropped = 0;
+
+    uint64_t oldest = oldestSequence();
+    if (nextSequence < oldest) {
+        dropped = oldest - nextSequence;
+        nextSequence = oldest;
+    }
+
+    size_t count = 0;
+    while (nextSequence < nextSequence_ && count < maxEvents) {
+        events.push_back(slots_[nextSequence % slots_.size()]);
+        nextSequence++;
+        count++;
+    }
+    return count;
+}
+
+bool JobEventRing::wait(uint64_t nextSequence, std::chrono::milliseconds timeout) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cv_.wait_for(lock, timeout, [this, nextSequence]() {
+        return nextSequence_ > nextSequence;
+    });
+}
+
+uint64_t JobEventRing::getNextSequence() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nextSequence_;
+}
+
+uint64_t JobEventRing::getOldestSequence() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return oldestSequence();
+}
+
+uint64_t JobEventRing::oldestSequence() const {
+    return nextSequence_ > slots_.size() ? nextSequence_ - slots_.size() : 0;
+}
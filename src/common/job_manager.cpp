@@ -1,9 +1,33 @@
 #include "common/job_manager.hpp"
 #include "common/logger.hpp"
 #include <algorithm>
+#include <filesystem>
+#include <set>
+
+namespace {
+
+// Backups live in <repository>/<backup>, so the parent directory is the repository
+std::string repositoryOf(const std::string& backupId) {
+    auto parent = std::filesystem::path(backupId).parent_path().string();
+    return parent.empty() ? backupId : parent;
+}
+
+// Lookup in a job registry; the caller holds JobManager::mutex_
+template <typename Jobs>
+typename Jobs::mapped_type findIn(const Jobs& jobs, const std::string& jobId) {
+    auto it = jobs.find(jobId);
+    return it != jobs.end() ? it->second : nullptr;
+}
+
+} // namespace
 
 JobManager::JobManager() 
-    : provider_(nullptr) {
+    : provider_(nullptr)
+    , events_(std::make_shared<JobEventRing>())
+    , bandwidth_(std::make_shared<BandwidthManager>())
+    , latency_(std::make_shared<LatencyMonitor>())
+    , defaultPool_(std::make_shared<ParallelTaskManager>()) {
+    applyShareWeights(*defaultPool_);
 }
 
 JobManager::~JobManager() {
@@ -15,6 +39,8 @@ JobManager::~JobManager() {
         cleanupCompletedJobs();
         
         // Clear all job registries
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobEndpoints_.clear();
         backupJobs_.clear();
         verifyJobs_.clear();
         restoreJobs_.clear();
@@ -28,7 +54,8 @@ void JobManager::setProvider(BackupProvider* provider) {
 }
 
 bool JobManager::initialize() {
-    if (!provider_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!provider_ && endpoints_.empty()) {
         lastError_ = "No provider available";
         return false;
     }
@@ -36,60 +63,181 @@ bool JobManager::initialize() {
 }
 
 bool JobManager::connect(const std::string& host, const std::string& username, const std::string& password) {
-    if (!provider_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* endpoint = findEndpoint(host);
+    BackupProvider* provider = endpoint ? endpoint->provider : provider_;
+    if (!provider) {
         lastError_ = "No provider available";
         return false;
     }
-    return provider_->connect(host, username, password);
+    if (!provider->connect(host, username, password)) {
+        lastError_ = provider->getLastError();
+        return false;
+    }
+    return true;
 }
 
 void JobManager::disconnect() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& pair : endpoints_) {
+        pair.second.provider->disconnect();
+    }
     if (provider_) {
         provider_->disconnect();
     }
 }
 
 bool JobManager::isConnected() const {
-    return provider_ && provider_->isConnected();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (provider_ && provider_->isConnected()) {
+        return true;
+    }
+    for (const auto& pair : endpoints_) {
+        if (pair.second.provider->isConnected()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JobManager::addProvider(const std::string& endpoint, BackupProvider* provider,
+                             const EndpointLimits& limits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (endpoint.empty() || !provider) {
+        lastError_ = "Invalid endpoint or provider";
+        return false;
+    }
+    if (endpoints_.count(endpoint) > 0) {
+        lastError_ = "Endpoint already registered: " + endpoint;
+        return false;
+    }
+
+    Endpoint entry;
+    entry.provider = provider;
+    entry.limits = limits;
+    entry.taskManager = std::make_shared<ParallelTaskManager>(std::max<size_t>(1, limits.workerThreads));
+    applyShareWeights(*entry.taskManager);
+    endpoints_[endpoint] = std::move(entry);
+    Logger::info("Registered endpoint " + endpoint + " (" + std::to_string(limits.workerThreads) +
+                 " workers, " + std::to_string(limits.maxConcurrentJobs) + " concurrent jobs)");
+    return true;
+}
+
+bool JobManager::removeProvider(const std::string& endpoint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (endpoints_.count(endpoint) == 0) {
+        lastError_ = "Unknown endpoint: " + endpoint;
+        return false;
+    }
+    if (countRunningJobs(endpoint) > 0) {
+        lastError_ = "Endpoint has running jobs: " + endpoint;
+        return false;
+    }
+    endpoints_.erase(endpoint);
+    return true;
+}
+
+BackupProvider* JobManager::getProvider(const std::string& endpoint) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (endpoint.empty()) {
+        return provider_;
+    }
+    auto it = endpoints_.find(endpoint);
+    return it != endpoints_.end() ? it->second.provider : nullptr;
+}
+
+std::vector<std::string> JobManager::getEndpoints() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> result;
+    result.reserve(endpoints_.size());
+    for (const auto& pair : endpoints_) {
+        result.push_back(pair.first);
+    }
+    return result;
+}
+
+size_t JobManager::getRunningJobCount(const std::string& endpoint) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return countRunningJobs(endpoint);
 }
 
 std::shared_ptr<BackupJob> JobManager::createBackupJob(const BackupConfig& config) {
-    if (!provider_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* endpoint = findEndpoint(config.endpoint);
+    if (!endpoint && !config.endpoint.empty()) {
+        lastError_ = "Unknown endpoint: " + config.endpoint;
+        return nullptr;
+    }
+    BackupProvider* provider = endpoint ? endpoint->provider : provider_;
+    if (!provider) {
         lastError_ = "No provider available";
         return nullptr;
     }
 
-    auto taskManager = std::make_shared<ParallelTaskManager>();
-    auto job = std::make_shared<BackupJob>(provider_, taskManager, config);
+    BackupContext context;
+    context.rateLimiter = bandwidth_->createLimiter(endpoint ? config.endpoint : "", config.bandwidthLimit);
+    context.streamController = createStreamController(config.maxConcurrentDisks);
+    context.latencyThrottle = latency_->createThrottle();
+
+    auto taskManager = endpoint ? endpoint->taskManager : defaultPool_;
+    auto job = std::make_shared<BackupJob>(provider, taskManager, config, context);
+    job->setEventRing(events_, "backup");
     backupJobs_[job->getId()] = job;
+    jobEndpoints_[job->getId()] = endpoint ? config.endpoint : "";
     return job;
 }
 
 std::shared_ptr<VerifyJob> JobManager::createVerifyJob(const VerifyConfig& config) {
-    if (!provider_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* endpoint = findEndpoint(config.endpoint);
+    if (!endpoint && !config.endpoint.empty()) {
+        lastError_ = "Unknown endpoint: " + config.endpoint;
+        return nullptr;
+    }
+    BackupProvider* provider = endpoint ? endpoint->provider : provider_;
+    if (!provider) {
         lastError_ = "No provider available";
         return nullptr;
     }
 
-    auto taskManager = std::make_shared<ParallelTaskManager>();
-    auto job = std::make_shared<VerifyJob>(provider_, taskManager, config);
+    auto taskManager = endpoint ? endpoint->taskManager : defaultPool_;
+    auto job = std::make_shared<VerifyJob>(provider, taskManager, config);
+    job->setEventRing(events_, "verify");
     verifyJobs_[job->getId()] = job;
+    jobEndpoints_[job->getId()] = endpoint ? config.endpoint : "";
     return job;
 }
 
 std::shared_ptr<RestoreJob> JobManager::createRestoreJob(const RestoreConfig& config) {
-    if (!provider_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Without an endpoint, the target vCenter picks one if it is registered
+    const std::string& name = config.endpoint.empty() ? config.vsphereHost : config.endpoint;
+    auto* endpoint = findEndpoint(name);
+    if (!endpoint && !config.endpoint.empty()) {
+        lastError_ = "Unknown endpoint: " + config.endpoint;
+        return nullptr;
+    }
+    BackupProvider* provider = endpoint ? endpoint->provider : provider_;
+    if (!provider) {
         lastError_ = "No provider available";
         return nullptr;
     }
 
-    auto taskManager = std::make_shared<ParallelTaskManager>();
-    auto job = std::make_shared<RestoreJob>(provider_, taskManager, config);
+    RestoreContext context;
+    context.rateLimiter = bandwidth_->createLimiter(endpoint ? name : "", config.bandwidthLimit);
+    context.streamController = createStreamController(config.maxConcurrentDisks);
+    context.latencyThrottle = latency_->createThrottle();
+
+    auto taskManager = endpoint ? endpoint->taskManager : defaultPool_;
+    auto job = std::make_shared<RestoreJob>(provider, taskManager, config, context);
+    job->setEventRing(events_, "restore");
     restoreJobs_[job->getId()] = job;
+    jobEndpoints_[job->getId()] = endpoint ? name : "";
     return job;
 }
 
 std::vector<std::shared_ptr<BackupJob>> JobManager::getBackupJobs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::shared_ptr<BackupJob>> result;
     result.reserve(backupJobs_.size());
     for (const auto& pair : backupJobs_) {
@@ -99,6 +247,7 @@ std::vector<std::shared_ptr<BackupJob>> JobManager::getBackupJobs() const {
 }
 
 std::vector<std::shared_ptr<VerifyJob>> JobManager::getVerifyJobs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::shared_ptr<VerifyJob>> result;
     result.reserve(verifyJobs_.size());
     for (const auto& pair : verifyJobs_) {
@@ -108,6 +257,7 @@ std::vector<std::shared_ptr<VerifyJob>> JobManager::getVerifyJobs() const {
 }
 
 std::vector<std::shared_ptr<RestoreJob>> JobManager::getRestoreJobs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::shared_ptr<RestoreJob>> result;
     result.reserve(restoreJobs_.size());
     for (const auto& pair : restoreJobs_) {
@@ -117,48 +267,42 @@ std::vector<std::shared_ptr<RestoreJob>> JobManager::getRestoreJobs() const {
 }
 
 std::shared_ptr<BackupJob> JobManager::getBackupJob(const std::string& jobId) const {
-    auto it = backupJobs_.find(jobId);
-    return it != backupJobs_.end() ? it->second : nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return findIn(backupJobs_, jobId);
 }
 
 std::shared_ptr<VerifyJob> JobManager::getVerifyJob(const std::string& jobId) const {
-    auto it = verifyJobs_.find(jobId);
-    return it != verifyJobs_.end() ? it->second : nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return findIn(verifyJobs_, jobId);
 }
 
 std::shared_ptr<RestoreJob> JobManager::getRestoreJob(const std::string& jobId) const {
-    auto it = restoreJobs_.find(jobId);
-    return it != restoreJobs_.end() ? it->second : nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return findIn(restoreJobs_, jobId);
 }
 
 bool JobManager::removeJob(const std::string& jobId) {
-    // Try to find and remove from each job registry
-    auto backupIt = backupJobs_.find(jobId);
-    if (backupIt != backupJobs_.end()) {
-        backupJobs_.erase(backupIt);
-        return true;
-    }
-
-    auto verifyIt = verifyJobs_.find(jobId);
-    if (verifyIt != verifyJobs_.end()) {
-        verifyJobs_.erase(verifyIt);
-        return true;
-    }
-
-    auto restoreIt = restoreJobs_.find(jobId);
-    if (restoreIt != restoreJobs_.end()) {
-        restoreJobs_.erase(restoreIt);
-        return true;
-    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    releaseResources(jobId);
+    admissionQueue_.erase(std::remove(admissionQueue_.begin(), admissionQueue_.end(), jobId),
+                          admissionQueue_.end());
+    preemptedJobs_.erase(jobId);
+    jobEndpoints_.erase(jobId);
+    finishedJobs_.erase(std::remove_if(finishedJobs_.begin(), finishedJobs_.end(),
+                                       [&jobId](const FinishedJob& job) { return job.jobId == jobId; }),
+                        finishedJobs_.end());
 
-    return false;
+    // Try to find and remove from each job registry
+    return backupJobs_.erase(jobId) > 0 || verifyJobs_.erase(jobId) > 0 || restoreJobs_.erase(jobId) > 0;
 }
 
 void JobManager::cleanupCompletedJobs() {
+    std::lock_guard<std::mutex> lock(mutex_);
     // Remove completed jobs from each registry
-    auto removeCompleted = [](auto& jobs) {
+    auto removeCompleted = [this](auto& jobs) {
         for (auto it = jobs.begin(); it != jobs.end();) {
             if (it->second->isCompleted() || it->second->isFailed() || it->second->isCancelled()) {
+                jobEndpoints_.erase(it->first);
                 it = jobs.erase(it);
             } else {
                 ++it;
@@ -169,40 +313,78 @@ void JobManager::cleanupCompletedJobs() {
     removeCompleted(backupJobs_);
     removeCompleted(verifyJobs_);
     removeCompleted(restoreJobs_);
+    finishedJobs_.clear();
+}
+
+size_t JobManager::pruneFinishedJobs() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pruneFinishedJobsLocked();
+}
+
+void JobManager::setJobRetention(const JobRetention& retention) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    retention_ = retention;
+    pruneFinishedJobsLocked();
+}
+
+JobRetention JobManager::getJobRetention() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return retention_;
 }
 
 void JobManager::stopAllJobs() {
-    // Stop all jobs in each registry
-    auto stopJobs = [](auto& jobs) {
-        for (auto& pair : jobs) {
-            pair.second->cancel();
+    std::vector<std::shared_ptr<Job>> jobs;
+    {
+        // Queued jobs must not be admitted while running ones are cancelled
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& jobId : admissionQueue_) {
+            admissions_.erase(jobId);
         }
-    };
+        admissionQueue_.clear();
+        preemptedJobs_.clear();
+
+        auto collect = [&jobs](const auto& registry) {
+            for (const auto& pair : registry) {
+                jobs.push_back(pair.second);
+            }
+        };
+        collect(backupJobs_);
+        collect(verifyJobs_);
+        collect(restoreJobs_);
+    }
 
-    stopJobs(backupJobs_);
-    stopJobs(verifyJobs_);
-    stopJobs(restoreJobs_);
+    // Cancelled outside mutex_: a job finishing re-enters onJobFinished
+    for (const auto& job : jobs) {
+        job->cancel();
+    }
 }
 
 bool JobManager::getChangedBlocks(const std::string& vmId, const std::string& backupId,
                                 std::vector<std::pair<uint64_t, uint64_t>>& changedBlocks) {
-    if (!provider_) {
-        lastError_ = "No provider available";
+    // The backup's job, if still registered, tells which endpoint serves the VM
+    std::string endpointName;
+    auto backupJob = getBackupJob(backupId);
+    if (backupJob) {
+        endpointName = backupJob->getConfig().endpoint;
+    }
+    BackupProvider* provider = getProvider(endpointName);
+    if (!provider) {
+        setLastError(endpointName.empty() ? "No provider available" : "Unknown endpoint: " + endpointName);
         return false;
     }
 
     // Get disk paths for the VM
     std::vector<std::string> diskPaths;
-    if (!provider_->getVMDiskPaths(vmId, diskPaths)) {
-        lastError_ = "Failed to get VM disk paths: " + provider_->getLastError();
+    if (!provider->getVMDiskPaths(vmId, diskPaths)) {
+        setLastError("Failed to get VM disk paths: " + provider->getLastError());
         return false;
     }
 
     // Get changed blocks for each disk
     for (const auto& diskPath : diskPaths) {
         std::vector<std::pair<uint64_t, uint64_t>> diskBlocks;
-        if (!provider_->getChangedBlocks(vmId, diskPath, diskBlocks)) {
-            lastError_ = "Failed to get changed blocks for disk " + diskPath + ": " + provider_->getLastError();
+        if (!provider->getChangedBlocks(vmId, diskPath, diskBlocks)) {
+            setLastError("Failed to get changed blocks for disk " + diskPath + ": " + provider->getLastError());
             return false;
         }
         changedBlocks.insert(changedBlocks.end(), diskBlocks.begin(), diskBlocks.end());
@@ -212,27 +394,678 @@ bool JobManager::getChangedBlocks(const std::string& vmId, const std::string& ba
 }
 
 bool JobManager::addJob(const std::shared_ptr<Job>& job) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!job) {
         lastError_ = "Invalid job pointer";
         return false;
     }
 
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto knownEndpoint = [this](const std::string& endpoint) {
+        if (!endpoint.empty() && !findEndpoint(endpoint)) {
+            lastError_ = "Unknown endpoint: " + endpoint;
+            return false;
+        }
+        return true;
+    };
     
     // Try to cast to specific job types and add to appropriate registry
     if (auto backupJob = std::dynamic_pointer_cast<BackupJob>(job)) {
+        if (!knownEndpoint(backupJob->getConfig().endpoint)) {
+            return false;
+        }
         backupJobs_[job->getId()] = backupJob;
+        backupJob->setEventRing(events_, "backup");
+        jobEndpoints_[job->getId()] = backupJob->getConfig().endpoint;
         return true;
     }
     if (auto verifyJob = std::dynamic_pointer_cast<VerifyJob>(job)) {
+        if (!knownEndpoint(verifyJob->getConfig().endpoint)) {
+            return false;
+        }
         verifyJobs_[job->getId()] = verifyJob;
+        verifyJob->setEventRing(events_, "verify");
+        jobEndpoints_[job->getId()] = verifyJob->getConfig().endpoint;
         return true;
     }
     if (auto restoreJob = std::dynamic_pointer_cast<RestoreJob>(job)) {
+        if (!knownEndpoint(restoreJob->getConfig().endpoint)) {
+            return false;
+        }
         restoreJobs_[job->getId()] = restoreJob;
+        restoreJob->setEventRing(events_, "restore");
+        jobEndpoints_[job->getId()] = restoreJob->getConfig().endpoint;
         return true;
     }
 
     lastError_ = "Unknown job type";
     return false;
-} 
\ No newline at end of file
+} 
+
+bool JobManager::startJob(const std::string& jobId) {
+    std::shared_ptr<Job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job = findJob(jobId);
+        if (!job) {
+            lastError_ = "Job not found: " + jobId;
+            return false;
+        }
+        if (admissions_.count(jobId) > 0) {
+            lastError_ = "Job already submitted: " + jobId;
+            return false;
+        }
+    }
+
+    // Looking up the VM's datastores talks to the endpoint, so do it unlocked
+    Admission admission = resolveAdmission(job);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string reason;
+        if (!canAdmit(jobId, admission, reason)) {
+            lastError_ = reason;
+            return false;
+        }
+        claimResources(admission);
+        admissions_[jobId] = admission;
+    }
+
+    // The claim is released when the worker returns, not when the job's
+    // state changes: a cancelled job goes on copying until it notices
+    job->addExitCallback([this, jobId](const Job&) { onJobFinished(jobId); });
+    if (!job->start()) {
+        setLastError(job->getError());
+        // No worker was started, so nothing else releases the claim
+        onJobFinished(jobId);
+        return false;
+    }
+    if (admission.jobClass == JobClass::RESTORE) {
+        preemptLowerClasses();
+    }
+    return true;
+}
+
+bool JobManager::submitJob(const std::string& jobId) {
+    std::shared_ptr<Job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job = findJob(jobId);
+        if (!job) {
+            lastError_ = "Job not found: " + jobId;
+            return false;
+        }
+        if (admissions_.count(jobId) > 0) {
+            lastError_ = "Job already submitted: " + jobId;
+            return false;
+        }
+    }
+
+    Admission admission = resolveAdmission(job);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string reason;
+        if (!canAdmit(jobId, admission, reason)) {
+            admissions_[jobId] = admission;
+            admissionQueue_.push_back(jobId);
+            Logger::info("Job " + jobId + " queued: " + reason);
+            return true;
+        }
+        claimResources(admission);
+        admissions_[jobId] = admission;
+    }
+
+    launchJobs({job});
+    return true;
+}
+
+bool JobManager::cancelJob(const std::string& jobId) {
+    std::shared_ptr<Job> job;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job = findJob(jobId);
+        if (!job) {
+            lastError_ = "Job not found: " + jobId;
+            return false;
+        }
+        queued = std::find(admissionQueue_.begin(), admissionQueue_.end(), jobId) != admissionQueue_.end();
+    }
+
+    if (queued) {
+        // Still queued, so it never started: dropping it is the cancellation
+        removeJob(jobId);
+        Logger::info("Dropped queued job " + jobId);
+        return true;
+    }
+    if (!job->cancel()) {
+        setLastError(job->getError());
+        return false;
+    }
+    // The job keeps its admission until its worker has wound down
+    return true;
+}
+
+void JobManager::setAdmissionLimits(const AdmissionLimits& limits) {
+    std::vector<std::shared_ptr<Job>> admitted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        admissionLimits_ = limits;
+        takeAdmittableJobs(admitted);
+    }
+    launchJobs(admitted);
+}
+
+AdmissionLimits JobManager::getAdmissionLimits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return admissionLimits_;
+}
+
+size_t JobManager::getQueuedJobCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return admissionQueue_.size();
+}
+
+bool JobManager::isJobQueued(const std::string& jobId) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::find(admissionQueue_.begin(), admissionQueue_.end(), jobId) != admissionQueue_.end();
+}
+
+std::map<std::string, size_t> JobManager::getResourceUsage() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resourceUsage_;
+}
+
+bool JobManager::setQosPolicy(const QosPolicy& policy) {
+    if (policy.lowerClassAction != "none" && policy.lowerClassAction != "hold" &&
+        policy.lowerClassAction != "throttle") {
+        setLastError("Unknown lower class action: " + policy.lowerClassAction);
+        return false;
+    }
+
+    std::vector<std::shared_ptr<Job>> admitted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        qos_ = policy;
+        for (auto& pair : endpoints_) {
+            applyShareWeights(*pair.second.taskManager);
+        }
+        applyShareWeights(*defaultPool_);
+        // Jobs held back under the old policy may be admittable now
+        takeAdmittableJobs(admitted);
+    }
+    launchJobs(admitted);
+
+    if (policy.lowerClassAction != "throttle") {
+        resumePreemptedJobs();
+        return true;
+    }
+    {
+        // Jobs throttled already move to the new rate
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& pair : preemptedJobs_) {
+            const auto& preemption = pair.second;
+            if (preemption.limiter) {
+                preemption.limiter->setRate(preemption.rate == 0 || preemption.rate > policy.throttledBytesPerSecond
+                                                ? policy.throttledBytesPerSecond
+                                                : preemption.rate);
+            }
+        }
+    }
+    preemptLowerClasses();
+    return true;
+}
+
+bool JobManager::setJobBandwidth(const std::string& jobId, uint64_t bytesPerSecond) {
+    std::shared_ptr<RateLimiter> limiter;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto preempted = preemptedJobs_.find(jobId);
+        if (preempted != preemptedJobs_.end() && preempted->second.limiter) {
+            // Takes effect once the restore that throttles the job ends
+            preempted->second.rate = bytesPerSecond;
+            Logger::info("Bandwidth limit of job " + jobId + " set to " + formatByteRate(bytesPerSecond) +
+                         " after the running restores");
+            return true;
+        }
+        if (auto backupJob = findIn(backupJobs_, jobId)) {
+            limiter = backupJob->getRateLimiter();
+        } else if (auto restoreJob = findIn(restoreJobs_, jobId)) {
+            limiter = restoreJob->getRateLimiter();
+        } else {
+            lastError_ = "No backup or restore job with ID " + jobId;
+            return false;
+        }
+    }
+    if (!limiter) {
+        setLastError("Job " + jobId + " has no bandwidth limiter");
+        return false;
+    }
+    limiter->setRate(bytesPerSecond);
+    Logger::info("Bandwidth limit of job " + jobId + " set to " + formatByteRate(bytesPerSecond));
+    return true;
+}
+
+void JobManager::setStreamControllerConfig(const StreamControllerConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streamDefaults_ = config;
+}
+
+StreamControllerConfig JobManager::getStreamControllerConfig() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streamDefaults_;
+}
+
+QosPolicy JobManager::getQosPolicy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return qos_;
+}
+
+size_t JobManager::getPreemptedJobCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return preemptedJobs_.size();
+}
+
+std::string JobManager::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+void JobManager::clearLastError() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastError_.clear();
+}
+
+void JobManager::setLastError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastError_ = error;
+}
+
+JobManager::Endpoint* JobManager::findEndpoint(const std::string& endpoint) {
+    if (endpoint.empty()) {
+        return nullptr;
+    }
+    auto it = endpoints_.find(endpoint);
+    return it != endpoints_.end() ? &it->second : nullptr;
+}
+
+std::shared_ptr<Job> JobManager::findJob(const std::string& jobId) const {
+    if (auto job = findIn(backupJobs_, jobId)) {
+        return job;
+    }
+    if (auto job = findIn(verifyJobs_, jobId)) {
+        return job;
+    }
+    return findIn(restoreJobs_, jobId);
+}
+
+size_t JobManager::countRunningJobs(const std::string& endpoint, const JobClass* onlyClass) const {
+    size_t count = 0;
+    for (const auto& pair : jobEndpoints_) {
+        if (pair.second != endpoint) {
+            continue;
+        }
+        // Admitted jobs count even before their thread has moved them to RUNNING
+        auto admission = admissions_.find(pair.first);
+        bool admitted = admission != admissions_.end() && admission->second.running;
+        auto job = findJob(pair.first);
+        if (job && onlyClass && job->getJobClass() != *onlyClass) {
+            continue;
+        }
+        if (job && (admitted || job->isRunning() || job->isPaused())) {
+            count++;
+        }
+    }
+    return count;
+}
+
+JobManager::Admission JobManager::resolveAdmission(const std::shared_ptr<Job>& job) {
+    Admission admission;
+    admission.jobClass = job->getJobClass();
+    std::set<std::string> resources;
+
+    if (auto backupJob = std::dynamic_pointer_cast<BackupJob>(job)) {
+        const auto& config = backupJob->getConfig();
+        auto controller = backupJob->getStreamController();
+        admission.streams = controller ? controller->getStreamCount()
+                                       : static_cast<size_t>(std::max(config.maxConcurrentDisks, 1));
+
+        std::vector<std::string> diskPaths;
+        BackupProvider* provider = getProvider(config.endpoint);
+        if (provider && provider->getVMDiskPaths(config.vmId, diskPaths)) {
+            for (const auto& diskPath : diskPaths) {
+                auto datastore = datastoreOf(diskPath);
+                if (!datastore.empty()) {
+                    resources.insert("datastore:" + datastore);
+                }
+            }
+        } else {
+            Logger::warning("Could not resolve datastores of VM " + config.vmId +
+                            ", admitting it without datastore limits");
+        }
+        if (!config.host.empty()) {
+            resources.insert("host:" + config.host);
+        }
+        const std::string& repository = config.backupDir.empty() ? config.backupPath : config.backupDir;
+        if (!repository.empty()) {
+            resources.insert("repository:" + repository);
+        }
+        // Copies load their repositories with the same streams
+        for (const auto& copyRepository : config.copyRepositories) {
+            resources.insert("repository:" + copyRepository);
+        }
+    } else if (auto verifyJob = std::dynamic_pointer_cast<VerifyJob>(job)) {
+        const auto& config = verifyJob->getConfig();
+        admission.streams = static_cast<size_t>(std::max(config.maxConcurrentDisks, 1));
+        if (!config.backupId.empty()) {
+            resources.insert("repository:" + repositoryOf(config.backupId));
+        }
+    } else if (auto restoreJob = std::dynamic_pointer_cast<RestoreJob>(job)) {
+        const auto& config = restoreJob->getConfig();
+        auto controller = restoreJob->getStreamController();
+        admission.streams = controller ? controller->getStreamCount()
+                                       : static_cast<size_t>(std::max(config.maxConcurrentDisks, 1));
+        if (!config.datastore.empty()) {
+            resources.insert("datastore:" + config.datastore);
+        }
+        if (!config.backupId.empty()) {
+            resources.insert("repository:" + repositoryOf(config.backupId));
+        }
+    }
+
+    admission.resources.assign(resources.begin(), resources.end());
+    return admission;
+}
+
+bool JobManager::canAdmit(const std::string& jobId, const Admission& admission, std::string& reason) {
+    bool isRestore = admission.jobClass == JobClass::RESTORE;
+    if (!isRestore && qos_.lowerClassAction != "none" && isRestoreRunning()) {
+        reason = "Held back while a restore is running";
+        return false;
+    }
+    // A restore that throttles the lower classes only competes with other
+    // restores; the throttled jobs keep their claims but barely use them
+    bool preempting = isRestore && qos_.lowerClassAction == "throttle";
+    const JobClass restoreClass = JobClass::RESTORE;
+
+    auto it = jobEndpoints_.find(jobId);
+    std::string endpointName = it != jobEndpoints_.end() ? it->second : "";
+    auto* endpoint = findEndpoint(endpointName);
+    if (endpoint && endpoint->limits.maxConcurrentJobs > 0 &&
+        countRunningJobs(endpointName, preempting ? &restoreClass : nullptr) >= endpoint->limits.maxConcurrentJobs) {
+        reason = "Endpoint " + endpointName + " is at its concurrent job limit";
+        return false;
+    }
+
+    for (const auto& resource : admission.resources) {
+        size_t limit = getResourceLimit(resource);
+        size_t used = 0;
+        if (preempting) {
+            used = getClassUsage(resource, JobClass::RESTORE);
+        } else {
+            auto usage = resourceUsage_.find(resource);
+            used = usage != resourceUsage_.end() ? usage->second : 0;
+        }
+        // A job wider than the limit still runs, alone on that resource
+        if (limit > 0 && used > 0 && used + admission.streams > limit) {
+            reason = resource + " is at its stream limit (" + std::to_string(used) + "/" +
+                     std::to_string(limit) + ")";
+            return false;
+        }
+    }
+    return true;
+}
+
+void JobManager::claimResources(Admission& admission) {
+    for (const auto& resource : admission.resources) {
+        resourceUsage_[resource] += admission.streams;
+    }
+    admission.running = true;
+}
+
+void JobManager::releaseResources(const std::string& jobId) {
+    auto it = admissions_.find(jobId);
+    if (it == admissions_.end()) {
+        return;
+    }
+    if (it->second.running) {
+        for (const auto& resource : it->second.resources) {
+            auto usage = resourceUsage_.find(resource);
+            if (usage == resourceUsage_.end()) {
+                continue;
+            }
+            usage->second -= std::min(usage->second, it->second.streams);
+            if (usage->second == 0) {
+                resourceUsage_.erase(usage);
+            }
+        }
+    }
+    admissions_.erase(it);
+}
+
+void JobManager::takeAdmittableJobs(std::vector<std::shared_ptr<Job>>& jobs) {
+    while (true) {
+        // Among the jobs that fit, prefer the most urgent class, then the job whose busiest
+        // datastore is least loaded, so an idle datastore is never starved behind a saturated one
+        auto best = admissionQueue_.end();
+        size_t bestLoad = 0;
+        JobClass bestClass = JobClass::SCRUB;
+        for (auto it = admissionQueue_.begin(); it != admissionQueue_.end(); ++it) {
+            const Admission& admission = admissions_[*it];
+            std::string reason;
+            if (!canAdmit(*it, admission, reason)) {
+                continue;
+            }
+            size_t load = 0;
+            for (const auto& resource : admission.resources) {
+                auto usage = resourceUsage_.find(resource);
+                if (resource.compare(0, 10, "datastore:") == 0 && usage != resourceUsage_.end()) {
+                    load = std::max(load, usage->second);
+                }
+            }
+            if (best == admissionQueue_.end() || admission.jobClass > bestClass ||
+                (admission.jobClass == bestClass && load < bestLoad)) {
+                best = it;
+                bestLoad = load;
+                bestClass = admission.jobClass;
+            }
+        }
+        if (best == admissionQueue_.end()) {
+            return;
+        }
+
+        std::string jobId = *best;
+        admissionQueue_.erase(best);
+        auto job = findJob(jobId);
+        if (!job) {
+            admissions_.erase(jobId);
+            continue;
+        }
+        claimResources(admissions_[jobId]);
+        jobs.push_back(job);
+    }
+}
+
+size_t JobManager::getResourceLimit(const std::string& resource) const {
+    if (resource.compare(0, 10, "datastore:") == 0) {
+        return admissionLimits_.streamsPerDatastore;
+    }
+    if (resource.compare(0, 5, "host:") == 0) {
+        return admissionLimits_.streamsPerHost;
+    }
+    if (resource.compare(0, 11, "repository:") == 0) {
+        return admissionLimits_.streamsPerRepository;
+    }
+    return 0;
+}
+
+void JobManager::launchJobs(const std::vector<std::shared_ptr<Job>>& jobs) {
+    // Called without mutex_: a job finishing inside start() re-enters onJobFinished
+    bool restoreStarted = false;
+    for (const auto& job : jobs) {
+        std::string jobId = job->getId();
+        job->addExitCallback([this, jobId](const Job&) { onJobFinished(jobId); });
+        if (!job->start()) {
+            Logger::error("Failed to start admitted job " + jobId + ": " + job->getError());
+            onJobFinished(jobId);
+        } else if (job->getJobClass() == JobClass::RESTORE) {
+            restoreStarted = true;
+        }
+    }
+    if (restoreStarted) {
+        preemptLowerClasses();
+    }
+}
+
+void JobManager::onJobFinished(const std::string& jobId) {
+    std::vector<std::shared_ptr<Job>> admitted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        releaseResources(jobId);
+        preemptedJobs_.erase(jobId);
+        // A job that never started stays registered until removed by hand
+        auto job = findJob(jobId);
+        if (job && (job->isCompleted() || job->isFailed() || job->isCancelled())) {
+            finishedJobs_.push_back({jobId, std::chrono::steady_clock::now(), events_->getNextSequence()});
+            pruneFinishedJobsLocked();
+        }
+        takeAdmittableJobs(admitted);
+    }
+    launchJobs(admitted);
+    resumePreemptedJobs();
+}
+
+size_t JobManager::pruneFinishedJobsLocked() {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t oldestEvent = events_->getOldestSequence();
+    size_t pruned = 0;
+    while (!finishedJobs_.empty()) {
+        const FinishedJob& oldest = finishedJobs_.front();
+        bool expired = now - oldest.finishedAt >= retention_.maxAge ||
+                       finishedJobs_.size() > retention_.maxFinishedJobs;
+        // Jobs finish in order, so a later one is neither older nor out of the ring sooner
+        if (!expired || oldest.eventsEnd > oldestEvent) {
+            break;
+        }
+        jobEndpoints_.erase(oldest.jobId);
+        backupJobs_.erase(oldest.jobId);
+        verifyJobs_.erase(oldest.jobId);
+        restoreJobs_.erase(oldest.jobId);
+        finishedJobs_.pop_front();
+        pruned++;
+    }
+    if (pruned > 0) {
+        Logger::debug("Pruned " + std::to_string(pruned) + " finished job(s)");
+    }
+    return pruned;
+}
+
+std::shared_ptr<AdaptiveStreamController> JobManager::createStreamController(int maxConcurrentDisks) const {
+    if (maxConcurrentDisks > 0) {
+        return std::make_shared<AdaptiveStreamController>(
+            AdaptiveStreamController::fixed(static_cast<size_t>(maxConcurrentDisks)));
+    }
+    return std::make_shared<AdaptiveStreamController>(streamDefaults_);
+}
+
+void JobManager::applyShareWeights(ParallelTaskManager& pool) const {
+    pool.setShareWeight(static_cast<size_t>(JobClass::SCRUB), qos_.scrubWeight);
+    pool.setShareWeight(static_cast<size_t>(JobClass::BACKUP), qos_.backupWeight);
+    pool.setShareWeight(static_cast<size_t>(JobClass::VERIFY), qos_.verifyWeight);
+    pool.setShareWeight(static_cast<size_t>(JobClass::RESTORE), qos_.restoreWeight);
+}
+
+bool JobManager::isRestoreRunning() const {
+    for (const auto& pair : admissions_) {
+        if (pair.second.running && pair.second.jobClass == JobClass::RESTORE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t JobManager::getClassUsage(const std::string& resource, JobClass jobClass) const {
+    size_t used = 0;
+    for (const auto& pair : admissions_) {
+        const auto& admission = pair.second;
+        if (admission.running && admission.jobClass == jobClass &&
+            std::find(admission.resources.begin(), admission.resources.end(), resource) !=
+                admission.resources.end()) {
+            used += admission.streams;
+        }
+    }
+    return used;
+}
+
+void JobManager::preemptLowerClasses() {
+    // Called without mutex_: pausing takes the job's own lock
+    std::vector<std::shared_ptr<Job>> paused;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (qos_.lowerClassAction != "throttle" || !isRestoreRunning()) {
+            return;
+        }
+        for (const auto& pair : admissions_) {
+            if (!pair.second.running || pair.second.jobClass == JobClass::RESTORE ||
+                preemptedJobs_.count(pair.first) > 0) {
+                continue;
+            }
+            auto job = findJob(pair.first);
+            if (!job || !job->isRunning()) {
+                continue;
+            }
+
+            Preemption preemption;
+            if (auto backupJob = findIn(backupJobs_, pair.first)) {
+                preemption.limiter = backupJob->getRateLimiter();
+            }
+            if (preemption.limiter) {
+                // A backup holds its snapshot until the last disk is copied,
+                // so it is slowed down rather than stopped
+                preemption.rate = preemption.limiter->getRate();
+                if (preemption.rate == 0 || preemption.rate > qos_.throttledBytesPerSecond) {
+                    preemption.limiter->setRate(qos_.throttledBytesPerSecond);
+                }
+                Logger::info("Throttled job " + pair.first + " to " + formatByteRate(qos_.throttledBytesPerSecond) +
+                             " while a restore is running");
+            } else {
+                paused.push_back(job);
+            }
+            preemptedJobs_[pair.first] = preemption;
+        }
+    }
+
+    for (const auto& job : paused) {
+        if (job->pause()) {
+            Logger::info("Paused job " + job->getId() + " while a restore is running");
+        } else {
+            // Finished or paused by hand in the meantime, or a verification
+            // already in progress; the class weights still apply to it
+            std::lock_guard<std::mutex> lock(mutex_);
+            preemptedJobs_.erase(job->getId());
+        }
+    }
+}
+
+void JobManager::resumePreemptedJobs() {
+    std::vector<std::shared_ptr<Job>> paused;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (preemptedJobs_.empty() || (qos_.lowerClassAction == "throttle" && isRestoreRunning())) {
+            return;
+        }
+        for (const auto& pair : preemptedJobs_) {
+            if (pair.second.limiter) {
+                pair.second.limiter->setRate(pair.second.rate);
+                Logger::info("Restored the bandwidth limit of job " + pair.first + " after restore");
+            } else if (auto job = findJob(pair.first)) {
+                paused.push_back(job);
+            }
+        }
+        preemptedJobs_.clear();
+    }
+
+    for (const auto& job : paused) {
+        if (job->isPaused() && job->resume()) {
+            Logger::info("Resumed job " + job->getId() + " after restore");
+        }
+    }
+}
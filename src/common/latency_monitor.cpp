@@ -0,0 +1,178 @@
+#include "common/latency_monitor.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+
+namespace {
+
+// Weight of the newest sample in the smoothed latency
+constexpr double LATENCY_WEIGHT = 0.2;
+
+// Pause changes at most this often, so one slow read does not double it repeatedly
+constexpr std::chrono::milliseconds ADJUST_INTERVAL(100);
+
+// Smallest pause worth sleeping for; shorter ones end the throttling
+constexpr int64_t MIN_DELAY_US = 1000;
+
+// Latency has to drop this far under target before the pause shrinks
+constexpr double RECOVER_RATIO = 0.8;
+
+} // namespace
+
+SourceLatency::SourceLatency(std::string name)
+    : name_(std::move(name)) {
+}
+
+void SourceLatency::record(std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double sample = static_cast<double>(latency.count());
+    latencyUs_ = latencyUs_ == 0.0 ? sample : latencyUs_ + LATENCY_WEIGHT * (sample - latencyUs_);
+
+    int64_t delay = delayUs_.load(std::memory_order_relaxed);
+    if (slo_.target.count() == 0) {
+        delayUs_.store(0, std::memory_order_relaxed);
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastAdjust_ < ADJUST_INTERVAL) {
+        return;
+    }
+    lastAdjust_ = now;
+
+    double targetUs = std::chrono::duration_cast<std::chrono::microseconds>(slo_.target).count();
+    int64_t next = delay;
+    if (latencyUs_ > targetUs) {
+        int64_t maxDelay = std::chrono::duration_cast<std::chrono::microseconds>(slo_.maxDelay).count();
+        next = std::min(std::max(delay * 2, MIN_DELAY_US), std::max(maxDelay, MIN_DELAY_US));
+    } else if (latencyUs_ < targetUs * RECOVER_RATIO) {
+        next = delay <= MIN_DELAY_US ? 0 : delay - delay / 4;
+    }
+
+    if (next != delay) {
+        delayUs_.store(next, std::memory_order_relaxed);
+        if (delay == 0) {
+            Logger::info("Read latency on " + name_ + " is " + std::to_string(static_cast<int64_t>(latencyUs_ / 1000)) +
+                         " ms, over its " + std::to_string(slo_.target.count()) + " ms target; throttling its streams");
+        } else if (next == 0) {
+            Logger::info("Read latency on " + name_ + " is back under target, throttling lifted");
+        }
+    }
+}
+
+void SourceLatency::setSlo(const LatencySlo& slo) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slo_ = slo;
+    if (slo_.target.count() == 0) {
+        delayUs_.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::chrono::microseconds SourceLatency::getLatency() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::microseconds(static_cast<int64_t>(latencyUs_));
+}
+
+LatencyThrottle::LatencyThrottle(std::shared_ptr<LatencyMonitor> monitor)
+    : monitor_(std::move(monitor)) {
+}
+
+std::shared_ptr<SourceLatency> LatencyThrottle::getSource(const std::string& diskPath) {
+    return monitor_->getSource(datastoreOf(diskPath));
+}
+
+bool LatencyThrottle::isEnabled() const {
+    return monitor_->isEnabled();
+}
+
+void LatencyThrottle::pace(SourceLatency& source) {
+    auto delay = source.getDelay();
+    if (delay.count() > 0) {
+        throttledNs_ += std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+        std::this_thread::sleep_for(delay);
+    }
+}
+
+std::chrono::milliseconds LatencyThrottle::getThrottledTime() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::nanoseconds(throttledNs_.load()));
+}
+
+void LatencyMonitor::setSlo(const LatencySlo& slo) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slo_ = slo;
+    for (auto& pair : sources_) {
+        pair.second->setSlo(sloFor(pair.first));
+    }
+}
+
+LatencySlo LatencyMonitor::getSlo() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slo_;
+}
+
+bool LatencyMonitor::isEnabled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slo_.target.count() > 0 || !sourceTargets_.empty();
+}
+
+void LatencyMonitor::setSourceTarget(const std::string& source, std::chrono::milliseconds target) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (target.count() == 0) {
+        sourceTargets_.erase(source);
+    } else {
+        sourceTargets_[source] = target;
+    }
+    auto it = sources_.find(source);
+    if (it != sources_.end()) {
+        it->second->setSlo(sloFor(source));
+    }
+}
+
+std::map<std::string, std::chrono::milliseconds> LatencyMonitor::getSourceTargets() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sourceTargets_;
+}
+
+std::shared_ptr<LatencyThrottle> LatencyMonitor::createThrottle() {
+    return std::make_shared<LatencyThrottle>(shared_from_this());
+}
+
+std::shared_ptr<SourceLatency> LatencyMonitor::getSource(const std::string& source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = sources_[source];
+    if (!entry) {
+        entry = std::make_shared<SourceLatency>(source);
+        entry->setSlo(sloFor(source));
+    }
+    return entry;
+}
+
+std::vector<SourceLatencyStatus> LatencyMonitor::getStatus() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<SourceLatencyStatus> status;
+    for (const auto& pair : sources_) {
+        status.push_back({pair.first, pair.second->getLatency(), pair.second->getDelay()});
+    }
+    return status;
+}
+
+LatencySlo LatencyMonitor::sloFor(const std::string& source) const {
+    LatencySlo slo = slo_;
+    auto it = sourceTargets_.find(source);
+    if (it != sourceTargets_.end()) {
+        slo.target = it->second;
+    }
+    return slo;
+}
+
+std::string datastoreOf(const std::string& diskPath) {
+    if (!diskPath.empty() && diskPath[0] == '[') {
+        auto end = diskPath.find(']');
+        if (end != std::string::npos) {
+            return diskPath.substr(1, end - 1);
+        }
+    }
+    return std::filesystem::path(diskPath).parent_path().string();
+}
@@ -28,10 +28,49 @@ ParallelTaskManager::~ParallelTaskManager() {
 void ParallelTaskManager::waitForAll() {
     std::unique_lock<std::mutex> lock(queueMutex_);
     condition_.wait(lock, [this] {
-        return tasks_.empty() && activeTasks_ == 0;
+        return queuedTasks_ == 0 && activeTasks_ == 0;
     });
 }
 
+void ParallelTaskManager::setShareWeight(size_t shareClass, unsigned weight) {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queues_[shareClass].weight = std::max(weight, 1u);
+}
+
+bool ParallelTaskManager::taskOrder(const Task& a, const Task& b) {
+    // Higher priority first, then first in first out
+    if (a.priority != b.priority) {
+        return a.priority < b.priority;
+    }
+    return a.startTime > b.startTime;
+}
+
+void ParallelTaskManager::enqueue(Task task) {
+    auto& queue = queues_[task.shareClass];
+    if (queue.tasks.empty()) {
+        // A class coming back from idle must not bank credit for the time it had no work
+        queue.pass = std::max(queue.pass, globalPass_);
+    }
+    queue.tasks.push(std::move(task));
+    queuedTasks_++;
+}
+
+std::function<void()> ParallelTaskManager::dequeue() {
+    ShareQueue* next = nullptr;
+    for (auto& pair : queues_) {
+        if (!pair.second.tasks.empty() && (!next || pair.second.pass < next->pass)) {
+            next = &pair.second;
+        }
+    }
+
+    std::function<void()> func = next->tasks.top().func;
+    next->tasks.pop();
+    globalPass_ = next->pass;
+    next->pass += 1.0 / next->weight;
+    queuedTasks_--;
+    return func;
+}
+
 void ParallelTaskManager::stop() {
     stop_ = true;
     condition_.notify_all();
@@ -43,15 +82,14 @@ void ParallelTaskManager::workerThread() {
         {
             std::unique_lock<std::mutex> lock(queueMutex_);
             condition_.wait(lock, [this] {
-                return !tasks_.empty() || stop_;
+                return queuedTasks_ > 0 || stop_;
             });
             
-            if (stop_ && tasks_.empty()) {
+            if (stop_ && queuedTasks_ == 0) {
                 return;
             }
             
-            taskFunc = std::move(tasks_.top().func);
-            tasks_.pop();
+            taskFunc = dequeue();
             ++activeTasks_;
         }
         
@@ -66,7 +104,7 @@ void ParallelTaskManager::workerThread() {
         {
             std::lock_guard<std::mutex> lock(queueMutex_);
             --activeTasks_;
-            if (tasks_.empty() && activeTasks_ == 0) {
+            if (queuedTasks_ == 0 && activeTasks_ == 0) {
                 condition_.notify_all();
             }
         }
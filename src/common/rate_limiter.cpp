@@ -0,0 +1,343 @@
+#include "common/rate_limiter.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <ctime>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <thread>
+
+namespace {
+
+// How often the copy path re-checks the time-of-day profiles
+constexpr std::chrono::seconds PROFILE_CHECK_INTERVAL(60);
+
+// Default burst, as a fraction of a second of the rate
+constexpr double DEFAULT_BURST_SECONDS = 0.25;
+
+int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool inWindow(const BandwidthProfile& profile, int minuteOfDay) {
+    int start = profile.startHour * 60 + profile.startMinute;
+    int end = profile.endHour * 60 + profile.endMinute;
+    if (start <= end) {
+        return minuteOfDay >= start && minuteOfDay < end;
+    }
+    // Wraps past midnight
+    return minuteOfDay >= start || minuteOfDay < end;
+}
+
+} // namespace
+
+TokenBucket::TokenBucket(uint64_t bytesPerSecond)
+    : lastRefill_(std::chrono::steady_clock::now()) {
+    setRate(bytesPerSecond);
+}
+
+void TokenBucket::setRate(uint64_t bytesPerSecond, uint64_t burstBytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    uint64_t previous = rate_.load(std::memory_order_relaxed);
+    if (previous > 0) {
+        // Settle what accrued under the old rate before switching
+        refill(now);
+    }
+
+    rate_.store(bytesPerSecond, std::memory_order_relaxed);
+    burst_ = burstBytes > 0 ? static_cast<double>(burstBytes) : bytesPerSecond * DEFAULT_BURST_SECONDS;
+    if (previous == 0) {
+        tokens_ = burst_;
+    }
+    tokens_ = std::min(tokens_, burst_);
+    lastRefill_ = now;
+}
+
+std::chrono::nanoseconds TokenBucket::reserve(uint64_t bytes) {
+    if (rate_.load(std::memory_order_relaxed) == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t rate = rate_.load(std::memory_order_relaxed);
+    if (rate == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    refill(std::chrono::steady_clock::now());
+    tokens_ -= static_cast<double>(bytes);
+    if (tokens_ >= 0.0) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::nanoseconds(static_cast<int64_t>(-tokens_ * 1e9 / rate));
+}
+
+void TokenBucket::refill(std::chrono::steady_clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - lastRefill_).count();
+    tokens_ = std::min(burst_, tokens_ + elapsed * rate_.load(std::memory_order_relaxed));
+    lastRefill_ = now;
+}
+
+RateLimiter::RateLimiter(std::shared_ptr<BandwidthManager> manager,
+                         std::vector<std::shared_ptr<TokenBucket>> parents,
+                         uint64_t bytesPerSecond)
+    : manager_(std::move(manager))
+    , own_(std::make_shared<TokenBucket>(bytesPerSecond)) {
+    chain_.push_back(own_);
+    chain_.insert(chain_.end(), parents.begin(), parents.end());
+}
+
+void RateLimiter::acquire(uint64_t bytes) {
+    if (manager_) {
+        manager_->refreshIfDue();
+    }
+
+    // Every level is charged; the slowest one decides the wait
+    std::chrono::nanoseconds wait(0);
+    for (const auto& bucket : chain_) {
+        wait = std::max(wait, bucket->reserve(bytes));
+    }
+    if (wait.count() > 0) {
+        throttledNs_ += wait.count();
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+bool RateLimiter::isUnlimited() const {
+    return std::all_of(chain_.begin(), chain_.end(),
+                       [](const std::shared_ptr<TokenBucket>& bucket) { return bucket->isUnlimited(); });
+}
+
+void RateLimiter::setRate(uint64_t bytesPerSecond) {
+    own_->setRate(bytesPerSecond);
+}
+
+std::chrono::milliseconds RateLimiter::getThrottledTime() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::nanoseconds(throttledNs_.load()));
+}
+
+BandwidthManager::BandwidthManager()
+    : global_(std::make_shared<TokenBucket>()) {
+}
+
+void BandwidthManager::setLimits(const BandwidthLimits& limits) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        limits_ = limits;
+    }
+    refresh();
+}
+
+BandwidthLimits BandwidthManager::getLimits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limits_;
+}
+
+BandwidthLimits BandwidthManager::getActiveLimits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return currentLimits();
+}
+
+std::string BandwidthManager::getActiveProfile() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return activeProfile_;
+}
+
+void BandwidthManager::setSourceLimit(const std::string& source, uint64_t bytesPerSecond) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = source.empty() ? "default" : source;
+    if (bytesPerSecond == 0) {
+        sourceOverrides_.erase(key);
+    } else {
+        sourceOverrides_[key] = bytesPerSecond;
+    }
+    getSourceBucket(key);
+    applyLimits();
+}
+
+std::map<std::string, uint64_t> BandwidthManager::getSourceLimits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sourceOverrides_;
+}
+
+bool BandwidthManager::setProfiles(const std::vector<BandwidthProfile>& profiles) {
+    for (const auto& profile : profiles) {
+        if (profile.startHour < 0 || profile.startHour > 23 || profile.endHour < 0 || profile.endHour > 24 ||
+            profile.startMinute < 0 || profile.startMinute > 59 || profile.endMinute < 0 || profile.endMinute > 59) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lastError_ = "Invalid time window in bandwidth profile " + profile.name;
+            return false;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        profiles_ = profiles;
+        for (size_t i = 0; i < profiles_.size(); i++) {
+            if (profiles_[i].name.empty()) {
+                profiles_[i].name = "profile-" + std::to_string(i + 1);
+            }
+        }
+    }
+    refresh();
+    return true;
+}
+
+std::vector<BandwidthProfile> BandwidthManager::getProfiles() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return profiles_;
+}
+
+std::shared_ptr<RateLimiter> BandwidthManager::createLimiter(const std::string& source,
+                                                             uint64_t jobBytesPerSecond) {
+    refreshIfDue();
+    std::vector<std::shared_ptr<TokenBucket>> parents;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        parents.push_back(getSourceBucket(source));
+        parents.push_back(global_);
+    }
+    return std::make_shared<RateLimiter>(shared_from_this(), std::move(parents), jobBytesPerSecond);
+}
+
+void BandwidthManager::refresh() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    nextRefresh_ = steadyNowNs() +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(PROFILE_CHECK_INTERVAL).count();
+
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+    int minuteOfDay = local.tm_hour * 60 + local.tm_min;
+
+    std::string active;
+    for (const auto& profile : profiles_) {
+        if (inWindow(profile, minuteOfDay)) {
+            active = profile.name;
+            break;
+        }
+    }
+    if (active != activeProfile_) {
+        Logger::info(active.empty() ? "Bandwidth profile ended, using base limits"
+                                    : "Bandwidth profile " + active + " is now active");
+        activeProfile_ = active;
+    }
+    applyLimits();
+}
+
+void BandwidthManager::refreshIfDue() {
+    if (steadyNowNs() >= nextRefresh_.load(std::memory_order_relaxed)) {
+        refresh();
+    }
+}
+
+std::string BandwidthManager::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+std::shared_ptr<TokenBucket> BandwidthManager::getSourceBucket(const std::string& source) {
+    std::string key = source.empty() ? "default" : source;
+    auto it = sources_.find(key);
+    if (it != sources_.end()) {
+        return it->second;
+    }
+    auto override = sourceOverrides_.find(key);
+    uint64_t rate = override != sourceOverrides_.end() ? override->second
+                                                       : currentLimits().perSourceBytesPerSecond;
+    auto bucket = std::make_shared<TokenBucket>(rate);
+    sources_[key] = bucket;
+    return bucket;
+}
+
+const BandwidthLimits& BandwidthManager::currentLimits() const {
+    for (const auto& profile : profiles_) {
+        if (!activeProfile_.empty() && profile.name == activeProfile_) {
+            return profile.limits;
+        }
+    }
+    return limits_;
+}
+
+void BandwidthManager::applyLimits() {
+    const BandwidthLimits& limits = currentLimits();
+
+    // Only touch buckets whose rate changes, so their accumulated tokens survive
+    if (global_->getRate() != limits.globalBytesPerSecond) {
+        global_->setRate(limits.globalBytesPerSecond);
+    }
+    for (auto& pair : sources_) {
+        auto override = sourceOverrides_.find(pair.first);
+        uint64_t rate = override != sourceOverrides_.end() ? override->second : limits.perSourceBytesPerSecond;
+        if (pair.second->getRate() != rate) {
+            pair.second->setRate(rate);
+        }
+    }
+}
+
+bool parseByteRate(const std::string& text, uint64_t& bytesPerSecond) {
+    // A digit first: stod also takes whitespace, signs, hex, "inf" and "nan"
+    if (text.empty() || !(std::isdigit(static_cast<unsigned char>(text[0])) || text[0] == '.')) {
+        return false;
+    }
+    size_t end = 0;
+    double value = 0.0;
+    try {
+        value = std::stod(text, &end);
+    } catch (const std::exception&) {
+        return false;
+    }
+    // Decimal only, so "0x10" is no rate either
+    if (text.find_first_not_of("0123456789.eE+-") < end || !std::isfinite(value) || value < 0.0) {
+        return false;
+    }
+
+    // Accept "M", "MB", "MiB" and "M/s" alike, and nothing else after the number
+    std::string suffix = text.substr(end);
+    if (suffix.size() >= 2 && suffix.compare(suffix.size() - 2, 2, "/s") == 0) {
+        suffix.resize(suffix.size() - 2);
+    }
+    double multiplier = 1.0;
+    if (!suffix.empty()) {
+        char prefix = static_cast<char>(std::toupper(static_cast<unsigned char>(suffix[0])));
+        std::string unit = suffix.substr(1);
+        std::transform(unit.begin(), unit.end(), unit.begin(), [](unsigned char c) { return std::tolower(c); });
+        switch (prefix) {
+            case 'B': multiplier = 1.0; break;
+            case 'K': multiplier = 1024.0; break;
+            case 'M': multiplier = 1024.0 * 1024.0; break;
+            case 'G': multiplier = 1024.0 * 1024.0 * 1024.0; break;
+            default: return false;
+        }
+        bool validUnit = prefix == 'B' ? unit.empty() : unit.empty() || unit == "b" || unit == "ib";
+        if (!validUnit) {
+            return false;
+        }
+    }
+    // llround is undefined past the range of long long
+    double bytes = value * multiplier;
+    if (bytes >= static_cast<double>(std::numeric_limits<long long>::max())) {
+        return false;
+    }
+    bytesPerSecond = static_cast<uint64_t>(std::llround(bytes));
+    return true;
+}
+
+std::string formatByteRate(uint64_t bytesPerSecond) {
+    if (bytesPerSecond == 0) {
+        return "unlimited";
+    }
+    const char* units[] = {"B", "KiB", "MiB", "GiB"};
+    double value = static_cast<double>(bytesPerSecond);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 3) {
+        value /= 1024.0;
+        unit++;
+    }
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << " " << units[unit] << "/s";
+    return ss.str();
+}
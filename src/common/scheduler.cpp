@@ -5,8 +5,11 @@
 #include <algorithm>
 #include <sstream>
 
-Scheduler::Scheduler()
-    : running_(false) {
+Scheduler::Scheduler(size_t workerThreads, std::chrono::milliseconds tick)
+    : epoch_(std::chrono::steady_clock::now())
+    , tick_(std::max(tick, std::chrono::milliseconds(1)))
+    , workers_(std::make_unique<ParallelTaskManager>(std::max<size_t>(1, workerThreads)))
+    , running_(false) {
 }
 
 Scheduler::~Scheduler() {
@@ -14,30 +17,43 @@ Scheduler::~Scheduler() {
     if (schedulerThread_.joinable()) {
         schedulerThread_.join();
     }
+    // Let callbacks that are already queued finish before the wheel goes away
+    workers_.reset();
 }
 
-bool Scheduler::scheduleTask(const std::string& taskId, 
+bool Scheduler::scheduleTask(const std::string& taskId,
                            TimePoint scheduledTime,
                            TaskCallback callback) {
-    std::unique_lock<std::mutex> lock(tasksMutex_);
-    tasks_[taskId] = {scheduledTime, 0, callback, false};
-    condition_.notify_one();
-    return true;
+    auto delay = std::max<TimePoint>(0, scheduledTime - std::time(nullptr));
+    return addTask(taskId, toTicks(std::chrono::seconds(delay)), 0, std::move(callback));
+}
+
+bool Scheduler::scheduleTaskAfter(const std::string& taskId,
+                                  std::chrono::milliseconds delay,
+                                  TaskCallback callback) {
+    return addTask(taskId, toTicks(delay), 0, std::move(callback));
 }
 
 bool Scheduler::schedulePeriodicTask(const std::string& taskId,
                                    Duration interval,
                                    TaskCallback callback) {
-    std::unique_lock<std::mutex> lock(tasksMutex_);
-    auto now = std::time(nullptr);
-    tasks_[taskId] = {now + interval, interval, callback, true};
-    condition_.notify_one();
-    return true;
+    if (interval <= 0) {
+        Logger::error("Invalid interval for periodic task " + taskId);
+        return false;
+    }
+    uint64_t intervalTicks = std::max<uint64_t>(1, toTicks(std::chrono::seconds(interval)));
+    return addTask(taskId, intervalTicks, intervalTicks, std::move(callback));
 }
 
 bool Scheduler::cancelTask(const std::string& taskId) {
     std::unique_lock<std::mutex> lock(tasksMutex_);
-    return tasks_.erase(taskId) > 0;
+    auto it = tasks_.find(taskId);
+    if (it == tasks_.end()) {
+        return false;
+    }
+    unlinkTask(it->second);
+    tasks_.erase(it);
+    return true;
 }
 
 void Scheduler::start() {
@@ -49,40 +65,151 @@ void Scheduler::start() {
 
 void Scheduler::stop() {
     if (running_) {
-        running_ = false;
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex_);
+            running_ = false;
+        }
         condition_.notify_one();
     }
 }
 
 void Scheduler::processTasks() {
+    std::vector<DueTask> due;
+    {
+        std::unique_lock<std::mutex> lock(tasksMutex_);
+        advanceTo(currentClockTick(), due);
+    }
+    dispatch(due);
+}
+
+size_t Scheduler::getTaskCount() const {
+    std::lock_guard<std::mutex> lock(tasksMutex_);
+    return tasks_.size();
+}
+
+bool Scheduler::addTask(const std::string& taskId, uint64_t delayTicks, uint64_t intervalTicks,
+                        TaskCallback callback) {
     std::unique_lock<std::mutex> lock(tasksMutex_);
-    auto now = std::time(nullptr);
-    
-    for (auto it = tasks_.begin(); it != tasks_.end();) {
-        if (it->second.scheduledTime <= now) {
-            auto taskId = it->first;
-            auto task = it->second;
-            
-            if (task.isPeriodic) {
-                task.scheduledTime = now + task.interval;
-                it->second = task;
-                ++it;
+    uint64_t now = currentClockTick();
+    if (tasks_.empty()) {
+        // Nothing to cascade, so an idle wheel can jump straight to the present
+        currentTick_ = std::max(currentTick_, now);
+    }
+
+    auto existing = tasks_.find(taskId);
+    if (existing != tasks_.end()) {
+        unlinkTask(existing->second);
+        tasks_.erase(existing);
+    }
+
+    Task task;
+    // Part of the current tick has passed already, so count from the next one;
+    // a task never runs before its delay is over
+    task.expiryTick = std::max(now + delayTicks + 1, currentTick_ + 1);
+    task.intervalTicks = intervalTicks;
+    task.callback = std::move(callback);
+    task.running = std::make_shared<std::atomic<bool>>(false);
+    auto& stored = tasks_[taskId] = std::move(task);
+    placeTask(taskId, stored);
+
+    condition_.notify_one();
+    return true;
+}
+
+void Scheduler::placeTask(const std::string& taskId, Task& task) {
+    uint64_t expiry = std::max(task.expiryTick, currentTick_);
+    uint64_t delta = expiry - currentTick_;
+
+    // Level n holds tasks due within 64^(n+1) ticks, indexed by the matching bits of the expiry
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (uint64_t(1) << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (uint64_t(1) << (WHEEL_BITS * WHEEL_LEVELS))) {
+        // Beyond the wheel's range: park in the last slot reachable and re-place on cascade
+        expiry = currentTick_ + (uint64_t(1) << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    task.level = level;
+    task.slot = (expiry >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+    auto& slot = wheel_[level][task.slot];
+    task.position = slot.insert(slot.end(), taskId);
+}
+
+void Scheduler::unlinkTask(Task& task) {
+    wheel_[task.level][task.slot].erase(task.position);
+}
+
+void Scheduler::cascade(int level) {
+    size_t index = (currentTick_ >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+    Slot pending;
+    pending.swap(wheel_[level][index]);
+    for (const auto& taskId : pending) {
+        placeTask(taskId, tasks_[taskId]);
+    }
+}
+
+void Scheduler::advanceTo(uint64_t tick, std::vector<DueTask>& due) {
+    if (tasks_.empty()) {
+        currentTick_ = std::max(currentTick_, tick);
+        return;
+    }
+
+    while (currentTick_ < tick) {
+        currentTick_++;
+
+        // Entering a new block of a higher level: spread its slot over the lower levels
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((currentTick_ & ((uint64_t(1) << (WHEEL_BITS * level)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+
+        Slot expired;
+        expired.swap(wheel_[0][currentTick_ & (WHEEL_SIZE - 1)]);
+        for (const auto& taskId : expired) {
+            auto it = tasks_.find(taskId);
+            Task& task = it->second;
+            if (task.expiryTick > currentTick_) {
+                placeTask(taskId, task);
+                continue;
+            }
+
+            due.push_back({taskId, task.callback, task.running});
+            if (task.intervalTicks > 0) {
+                // Keep the period anchored to the original schedule, not to the dispatch time
+                task.expiryTick = std::max(task.expiryTick + task.intervalTicks, currentTick_ + 1);
+                placeTask(taskId, task);
             } else {
-                it = tasks_.erase(it);
+                tasks_.erase(it);
             }
-            
-            lock.unlock();
-            executeTask(taskId, task);
-            lock.lock();
-        } else {
-            ++it;
         }
     }
 }
 
-void Scheduler::executeTask(const std::string& taskId, const Task& task) {
+void Scheduler::dispatch(std::vector<DueTask>& due) {
+    for (auto& task : due) {
+        // A periodic task whose previous run is still executing skips this run
+        if (task.running->exchange(true)) {
+            Logger::debug("Task " + task.taskId + " is still running, skipping this run");
+            continue;
+        }
+        try {
+            workers_->addTask([this, task]() {
+                executeTask(task.taskId, task.callback);
+                task.running->store(false);
+            });
+        } catch (const std::exception& e) {
+            task.running->store(false);
+            Logger::error("Failed to dispatch task " + task.taskId + ": " + e.what());
+        }
+    }
+    due.clear();
+}
+
+void Scheduler::executeTask(const std::string& taskId, const TaskCallback& callback) {
     try {
-        task.callback();
+        callback();
     } catch (const std::exception& e) {
         std::stringstream ss;
         ss << "Task " << taskId << " failed: " << e.what();
@@ -90,45 +217,36 @@ void Scheduler::executeTask(const std::string& taskId, const Task& task) {
     }
 }
 
-Scheduler::TimePoint Scheduler::getNextExecutionTime(const Task& task) {
-    return task.scheduledTime;
+uint64_t Scheduler::currentClockTick() const {
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - epoch_) / tick_);
+}
+
+uint64_t Scheduler::toTicks(std::chrono::milliseconds duration) const {
+    if (duration.count() <= 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>((duration.count() + tick_.count() - 1) / tick_.count());
 }
 
 void Scheduler::schedulerLoop() {
+    std::vector<DueTask> due;
     while (running_) {
-        std::unique_lock<std::mutex> lock(tasksMutex_);
-        
-        if (tasks_.empty()) {
-            condition_.wait(lock, [this] {
-                return !running_ || !tasks_.empty();
-            });
-            continue;
-        }
-        
-        auto now = std::time(nullptr);
-        auto nextTask = std::min_element(tasks_.begin(), tasks_.end(),
-            [](const auto& a, const auto& b) {
-                return a.second.scheduledTime < b.second.scheduledTime;
-            });
-        
-        if (nextTask->second.scheduledTime <= now) {
-            auto taskId = nextTask->first;
-            auto task = nextTask->second;
-            
-            if (task.isPeriodic) {
-                task.scheduledTime = now + task.interval;
-                nextTask->second = task;
-            } else {
-                tasks_.erase(nextTask);
+        {
+            std::unique_lock<std::mutex> lock(tasksMutex_);
+            if (tasks_.empty()) {
+                condition_.wait(lock, [this] {
+                    return !running_ || !tasks_.empty();
+                });
+                continue;
+            }
+
+            advanceTo(currentClockTick(), due);
+            if (due.empty()) {
+                auto nextTick = epoch_ + tick_ * (currentTick_ + 1);
+                condition_.wait_until(lock, nextTick, [this] { return !running_; });
+                continue;
             }
-            
-            lock.unlock();
-            executeTask(taskId, task);
-            lock.lock();
-        } else {
-            condition_.wait_for(lock, 
-                std::chrono::seconds(nextTask->second.scheduledTime - now),
-                [this] { return !running_; });
         }
+        dispatch(due);
     }
-} 
\ No newline at end of file
+}
@@ -0,0 +1,115 @@
+#include "common/stream_controller.hpp"
+#include "common/logger.hpp"
+#include <algorithm>
+#include <sstream>
+
+AdaptiveStreamController::AdaptiveStreamController(const StreamControllerConfig& config)
+    : config_(config)
+    , windowStart_(std::chrono::steady_clock::now()) {
+    config_.minStreams = std::max<size_t>(1, config_.minStreams);
+    config_.maxStreams = std::max(config_.minStreams, config_.maxStreams);
+    streams_ = std::clamp(config_.initialStreams, config_.minStreams, config_.maxStreams);
+}
+
+StreamControllerConfig AdaptiveStreamController::fixed(size_t streams) {
+    StreamControllerConfig config;
+    config.initialStreams = config.minStreams = config.maxStreams = std::max<size_t>(1, streams);
+    return config;
+}
+
+size_t AdaptiveStreamController::getMaxStreams() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_.maxStreams;
+}
+
+bool AdaptiveStreamController::isAdaptive() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return adaptive();
+}
+
+void AdaptiveStreamController::limitMaxStreams(size_t streams) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!adaptive()) {
+        return;
+    }
+    config_.maxStreams = std::max(config_.minStreams, std::min(config_.maxStreams, streams));
+    if (streams_.load(std::memory_order_relaxed) > config_.maxStreams) {
+        streams_.store(config_.maxStreams, std::memory_order_relaxed);
+    }
+}
+
+void AdaptiveStreamController::recordRead(uint64_t bytes, std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    windowBytes_ += bytes;
+    windowReads_++;
+    windowLatencyUs_ += latency.count();
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - windowStart_ >= config_.interval) {
+        decide(now);
+    }
+}
+
+double AdaptiveStreamController::getThroughput() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastThroughput_;
+}
+
+std::chrono::microseconds AdaptiveStreamController::getLatency() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::microseconds(lastLatencyUs_);
+}
+
+void AdaptiveStreamController::decide(std::chrono::steady_clock::time_point now) {
+    double seconds = std::chrono::duration<double>(now - windowStart_).count();
+    double throughput = windowBytes_ / seconds;
+    int64_t latencyUs = windowReads_ > 0 ? windowLatencyUs_ / static_cast<int64_t>(windowReads_) : 0;
+
+    lastThroughput_ = throughput;
+    lastLatencyUs_ = latencyUs;
+    windowStart_ = now;
+    windowBytes_ = 0;
+    windowReads_ = 0;
+    windowLatencyUs_ = 0;
+
+    if (!adaptive()) {
+        return;
+    }
+
+    size_t streams = streams_.load(std::memory_order_relaxed);
+    size_t next = streams;
+    auto latencyTargetUs = std::chrono::duration_cast<std::chrono::microseconds>(config_.latencyTarget).count();
+
+    if (latencyUs > latencyTargetUs) {
+        // Multiplicative decrease: the source is struggling
+        next = std::max(config_.minStreams, streams / 2);
+        increased_ = false;
+        steadyWindows_ = 0;
+    } else if (increased_ && throughput < baselineThroughput_ * (1.0 + config_.minGain)) {
+        // The last stream bought nothing, give it back
+        next = std::max(config_.minStreams, streams - 1);
+        increased_ = false;
+        steadyWindows_ = 0;
+    } else if (streams < config_.maxStreams && (increased_ || ++steadyWindows_ >= config_.probeAfterWindows ||
+                                                baselineThroughput_ == 0.0)) {
+        // Additive increase while it pays off, or a periodic probe once settled
+        next = streams + 1;
+        baselineThroughput_ = throughput;
+        increased_ = true;
+        steadyWindows_ = 0;
+    } else {
+        increased_ = false;
+    }
+
+    if (next != streams) {
+        streams_.store(next, std::memory_order_relaxed);
+        std::ostringstream ss;
+        ss << "Read streams " << streams << " -> " << next << " (" << static_cast<uint64_t>(throughput / (1024 * 1024))
+           << " MiB/s, mean read latency " << latencyUs / 1000.0 << " ms)";
+        if (next < streams) {
+            Logger::info(ss.str());
+        } else {
+            Logger::debug(ss.str());
+        }
+    }
+}
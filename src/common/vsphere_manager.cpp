@@ -745,6 +745,37 @@ bool VSphereManager::getChangedDiskAreas(const std::string& vmName, const std::s
     return success;
 }
 
+bool VSphereManager::getChangedDiskAreas(const std::string& vmName, const std::string& diskName,
+                                       const std::string& changeId, int64_t startOffset,
+                                       int64_t length, nlohmann::json& response) {
+    // Validate inputs
+    if (vmName.empty() || diskName.empty() || changeId.empty() || startOffset < 0 || length <= 0) {
+        Logger::error("Invalid input parameters for getting changed disk areas");
+        return false;
+    }
+
+    // Get VM ID
+    std::string vmId;
+    if (!getVM(vmName, vmId)) {
+        Logger::error("Failed to get VM ID for " + vmName);
+        return false;
+    }
+
+    // Get disk ID
+    std::string diskId;
+    if (!getDiskId(vmName, diskName, diskId)) {
+        Logger::error("Failed to get disk ID for " + diskName);
+        return false;
+    }
+
+    // Changed areas since the given change ID
+    bool success = restClient_->getChangedDiskAreas(vmId, diskId, changeId, startOffset, length, response);
+    if (success) {
+        Logger::info("Successfully retrieved changed areas for disk " + diskName + " since " + changeId);
+    }
+    return success;
+}
+
 bool VSphereManager::getDiskLayout(const std::string& vmName, const std::string& diskName, nlohmann::json& response) {
     // Validate inputs
     if (vmName.empty() || diskName.empty()) {
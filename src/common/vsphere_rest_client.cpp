@@ -476,7 +476,10 @@ bool VSphereRestClient::getVMInfo(const std::string& vmId, nlohmann::json& vmInf
     curl_easy_setopt(curl_, CURLOPT_HTTPGET, 1L);
     curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, "GET");
 
-    bool success = makeRequest("GET", endpoint, nlohmann::json(), response);
+    if (!makeRequest("GET", endpoint, nlohmann::json(), response)) {
+        Logger::error("Failed to look up VM: " + vmId);
+        return false;
+    }
 
     // The response should contain the VM info directly
     if (response.contains("value") && !response["value"].empty()) {
@@ -549,10 +552,84 @@ bool VSphereRestClient::getVMDiskPaths(const std::string& vmName, std::vector<st
     }
 }
 
+bool VSphereRestClient::getVMDiskCapacities(const std::string& vmName, std::map<std::string, uint64_t>& capacities) {
+    nlohmann::json vmInfo;
+    if (!getVMInfo(vmName, vmInfo)) {
+        Logger::error("Failed to get VM ID for VM: " + vmName);
+        return false;
+    }
+    std::string vmId = vmInfo["vm"].get<std::string>();
+
+    nlohmann::json response;
+    if (!makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/hardware/disk", nlohmann::json(), response)) {
+        Logger::error("Failed to get disk numbers for VM: " + vmId);
+        return false;
+    }
+
+    try {
+        capacities.clear();
+        for (const auto& disk : response["value"]) {
+            std::string diskNumber = disk["disk"].get<std::string>();
+            nlohmann::json diskResponse;
+            if (!makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/hardware/disk/" + diskNumber, nlohmann::json(), diskResponse)) {
+                Logger::error("Failed to get disk " + diskNumber + " of VM " + vmId);
+                return false;
+            }
+            const auto& value = diskResponse["value"];
+            if (value.contains("backing") && value["backing"].contains("vmdk_file")) {
+                capacities[value["backing"]["vmdk_file"].get<std::string>()] =
+                    value.value("capacity", static_cast<uint64_t>(0));
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        Logger::error("Failed to parse response: " + std::string(e.what()));
+        return false;
+    }
+}
+
 bool VSphereRestClient::getVMDiskInfo(const std::string& vmId, const std::string& diskPath, nlohmann::json& diskInfo) {
     return makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/hardware/disk/" + diskPath, nlohmann::json(), diskInfo);
 }
 
+bool VSphereRestClient::getVMDiskId(const std::string& vmName, const std::string& diskPath,
+                                    std::string& vmId, std::string& diskId) {
+    nlohmann::json vmInfo;
+    if (!getVMInfo(vmName, vmInfo)) {
+        Logger::error("Failed to get VM ID for VM: " + vmName);
+        return false;
+    }
+    vmId = vmInfo["vm"].get<std::string>();
+
+    nlohmann::json response;
+    if (!makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/hardware/disk", nlohmann::json(), response)) {
+        Logger::error("Failed to get disk numbers for VM: " + vmId);
+        return false;
+    }
+
+    try {
+        for (const auto& disk : response["value"]) {
+            std::string diskNumber = disk["disk"].get<std::string>();
+            nlohmann::json diskResponse;
+            if (!makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/hardware/disk/" + diskNumber, nlohmann::json(), diskResponse)) {
+                continue;
+            }
+            if (diskResponse["value"].contains("backing") &&
+                diskResponse["value"]["backing"].contains("vmdk_file") &&
+                diskResponse["value"]["backing"]["vmdk_file"].get<std::string>() == diskPath) {
+                diskId = diskNumber;
+                return true;
+            }
+        }
+    } catch (const std::exception& e) {
+        Logger::error("Failed to parse response: " + std::string(e.what()));
+        return false;
+    }
+
+    Logger::error("Disk not found for VM " + vmName + ": " + diskPath);
+    return false;
+}
+
 bool VSphereRestClient::enableCBT(const std::string& vmId) {
     Logger::info("Enabling CBT for VM: " + vmId);
     try {
@@ -655,7 +732,8 @@ bool VSphereRestClient::rebootVM(const std::string& vmId) {
     return makeRequest("POST", "/rest/vcenter/vm/" + vmId + "/power/reboot", nlohmann::json(), response);
 }
 
-bool VSphereRestClient::createSnapshot(const std::string& vmId, const std::string& name, const std::string& description) {
+bool VSphereRestClient::createSnapshot(const std::string& /*vmId*/, const std::string& /*name*/,
+                                       const std::string& /*description*/) {
     // FixMe: For now, we don't create snapshots, we just return true
     //nlohmann::json data = {
     //    {"name", name},
@@ -667,7 +745,7 @@ bool VSphereRestClient::createSnapshot(const std::string& vmId, const std::strin
     return true;
 }
 
-bool VSphereRestClient::removeSnapshot(const std::string& vmId, const std::string& snapshotId) {
+bool VSphereRestClient::removeSnapshot(const std::string& /*vmId*/, const std::string& /*snapshotId*/) {
     // FixMe: For now, we don't remove snapshots, we just return true
     //nlohmann::json response;
     //return makeRequest("DELETE", "/rest/vcenter/vm/" + vmId + "/snapshot/" + snapshotId, nlohmann::json(), response);
@@ -683,6 +761,41 @@ bool VSphereRestClient::getSnapshots(const std::string& vmId, nlohmann::json& sn
     return makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/snapshot", nlohmann::json(), snapshots);
 }
 
+bool VSphereRestClient::getSnapshotDiskChangeId(const std::string& vmId, const std::string& snapshot,
+                                                const std::string& diskId, std::string& changeId) {
+    // Snapshots are known by name to the callers; the API wants their identifier
+    std::string snapshotId = snapshot;
+    nlohmann::json snapshots;
+    if (getSnapshots(vmId, snapshots) && snapshots.contains("value")) {
+        for (const auto& entry : snapshots["value"]) {
+            if (entry.value("name", std::string()) == snapshot && entry.contains("snapshot")) {
+                snapshotId = entry["snapshot"].get<std::string>();
+                break;
+            }
+        }
+    }
+
+    nlohmann::json response;
+    if (!makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/snapshot/" + snapshotId + "/hardware/disk/" + diskId,
+                     nlohmann::json(), response)) {
+        Logger::error("Failed to get disk " + diskId + " of snapshot " + snapshot);
+        return false;
+    }
+
+    try {
+        const auto& value = response.contains("value") ? response["value"] : response;
+        if (!value.contains("backing") || !value["backing"].contains("change_id")) {
+            Logger::error("Disk " + diskId + " of snapshot " + snapshot + " has no change ID");
+            return false;
+        }
+        changeId = value["backing"]["change_id"].get<std::string>();
+        return !changeId.empty();
+    } catch (const std::exception& e) {
+        Logger::error("Failed to parse response: " + std::string(e.what()));
+        return false;
+    }
+}
+
 bool VSphereRestClient::getVMNetworks(const std::string& vmId, std::vector<std::string>& networks) {
     nlohmann::json response;
     if (!makeRequest("GET", "/rest/vcenter/vm/" + vmId + "/hardware/ethernet", nlohmann::json(), response)) {
@@ -935,6 +1048,31 @@ bool VSphereRestClient::getChangedDiskAreas(const std::string& vmId, const std::
     return success;
 }
 
+bool VSphereRestClient::getChangedDiskAreas(const std::string& vmId, const std::string& diskId,
+                                          const std::string& changeId, int64_t startOffset,
+                                          int64_t length, nlohmann::json& response) {
+    // Validate inputs
+    if (vmId.empty() || diskId.empty() || changeId.empty() || startOffset < 0 || length <= 0) {
+        Logger::error("Invalid input parameters for getting changed disk areas");
+        return false;
+    }
+
+    // GET requests carry no body, so the query goes into the URL
+    std::string endpoint = "/rest/vcenter/vm/" + vmId + "/hardware/disk/" + diskId + "/changed-areas" +
+                           "?change_id=" + urlEncode(changeId) +
+                           "&start_offset=" + std::to_string(startOffset) +
+                           "&length=" + std::to_string(length);
+
+    curl_easy_setopt(curl_, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, "GET");
+
+    bool success = makeRequest("GET", endpoint, nlohmann::json(), response);
+    if (success) {
+        Logger::debug("Retrieved changed areas for disk " + diskId + " since change ID " + changeId);
+    }
+    return success;
+}
+
 bool VSphereRestClient::getDiskLayout(const std::string& vmId, const std::string& diskId, nlohmann::json& response) {
     // Validate inputs
     if (vmId.empty() || diskId.empty()) {
@@ -12,6 +12,12 @@ void printBackupUsage() {
               << "  list      - List scheduled backups\n"
               << "  verify    - Verify a backup\n"
               << "  restore   - Restore from a backup\n"
+              << "  replicate - Copy the backups another repository lacks, sending only differences\n"
+              << "  daemon    - Run as a daemon accepting jobs on a control socket\n"
+              << "  status    - Show jobs of a running daemon (optionally one job ID)\n"
+              << "  cancel    - Cancel a job of a running daemon\n"
+              << "  watch     - Stream job events of a running daemon (optionally one job ID)\n"
+              << "  bandwidth - Show or change bandwidth limits of a running daemon\n"
               << "\n"
               << "Options:\n"
               << "  -h, --help           Show this help message\n"
@@ -23,13 +29,33 @@ void printBackupUsage() {
               << "  -i, --incremental    Enable incremental backup\n"
               << "  --schedule           Schedule time (HH:MM)\n"
               << "  --interval           Interval in minutes\n"
-              << "  --parallel           Number of parallel disk operations\n"
+              << "  --stagger            Schedule: spread same-time runs (none/hash/jitter/spread)\n"
+              << "  --stagger-window     Schedule: stagger window in minutes\n"
+              << "  --parallel           Read/write streams per disk, or \"auto\" to adapt\n"
               << "  --compression        Compression level (0-9)\n"
-              << "  --retention          Retention period in days\n"
-              << "  --max-backups        Maximum number of backups to keep\n"
+              << "  --retention          Days during which every backup is kept\n"
+              << "  --max-backups        Number of newest backups to keep\n"
+              << "  --keep-daily, --keep-weekly, --keep-monthly, --keep-yearly N\n"
+              << "                       Keep the newest backup of each of the last N days/weeks/...\n"
               << "  --disable-cbt        Disable Changed Block Tracking\n"
               << "  --exclude-disk       Exclude disk from backup\n"
-              << "  --vm-type            Backup provider type (vmware/kvm)\n";
+              << "  --bandwidth          Backup/restore: read rate limit for the job (e.g. 50M)\n"
+              << "  --copy-to            Backup: also write the backup to this repository (repeatable)\n"
+              << "  --copy-policy        Backup: a failing or stalled copy fails the backup or is dropped (fail/degrade)\n"
+              << "  --copy-stall         Backup: seconds a copy may hold the source reads back (default: 60)\n"
+              << "  --from, --to         Replicate: source and destination repositories\n"
+              << "  --vm-type            Backup provider type (vmware/kvm)\n"
+              << "  --socket             Daemon control socket; submits jobs to the daemon\n"
+              << "  --detach             Return after submitting a job to the daemon\n"
+              << "  --endpoints          Daemon: JSON file of endpoints to connect at startup\n"
+              << "  --workers            Daemon: worker threads per endpoint\n"
+              << "  --max-jobs           Daemon: concurrent jobs per endpoint\n"
+              << "  --global, --per-source RATE\n"
+              << "                       Bandwidth: global and default per-endpoint limits (0 = unlimited)\n"
+              << "  --source NAME --limit RATE\n"
+              << "                       Bandwidth: fixed limit for one endpoint\n"
+              << "  --job ID --limit RATE\n"
+              << "                       Bandwidth: limit of one running job\n";
 }
 
 int main(int argc, char** argv) {
@@ -1,8 +1,11 @@
 #include "backup/restore_job.hpp"
 #include "backup/backup_provider.hpp"
 #include "backup/vm_config.hpp"
+#include "backup/backup_manifest.hpp"
 #include "common/parallel_task_manager.hpp"
 #include "common/logger.hpp"
+#include "common/rate_limiter.hpp"
+#include "common/latency_monitor.hpp"
 #include <filesystem>
 #include <fstream>
 #include <sstream>
@@ -13,12 +16,15 @@ using namespace std::filesystem;
 
 RestoreJob::RestoreJob(BackupProvider* provider,
                       std::shared_ptr<ParallelTaskManager> taskManager,
-                      const RestoreConfig& config)
+                      const RestoreConfig& config,
+                      const RestoreContext& context)
     : provider_(provider)
     , taskManager_(taskManager)
-    , config_(config) {
+    , config_(config)
+    , context_(context) {
     // Generate a unique job ID
     setId(generateId());
+    jobClass_ = JobClass::RESTORE;
     setStatus("pending");
 }
 
@@ -39,11 +45,30 @@ bool RestoreJob::start() {
     updateProgress(0);
 
     // Start restore in a separate thread
-    std::thread([this]() {
+    startWorker([this]() {
         try {
-            bool success = true;
+            // Without a disk list every disk in the backup is restored,
+            // whether it is stored as a file or in the chunk store
+            std::vector<std::string> diskPaths;
             for (const auto& diskConfig : config_.diskConfigs) {
-                if (!restoreDisk(diskConfig.path)) {
+                diskPaths.push_back(diskConfig.path);
+            }
+            ManifestReader manifest;
+            if (diskPaths.empty() && manifest.open((path(config_.backupId) / "manifest.bin").string())) {
+                for (size_t i = 0; i < manifest.getDiskCount(); i++) {
+                    diskPaths.push_back(manifest.getDisk(i).path);
+                }
+            }
+
+            if (diskPaths.empty()) {
+                setError("Restore failed: no disks to restore from " + config_.backupId);
+                setState(State::FAILED);
+                return;
+            }
+
+            bool success = true;
+            for (const auto& diskPath : diskPaths) {
+                if (!restoreDisk(diskPath)) {
                     success = false;
                     break;
                 }
@@ -62,14 +87,14 @@ bool RestoreJob::start() {
             setError(std::string("Restore failed: ") + e.what());
             setState(State::FAILED);
         }
-    }).detach();
+    });
 
     return true;
 }
 
 bool RestoreJob::cancel() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning()) {
+    if (!isRunning() && !isPaused()) {
         return false;
     }
     setState(State::CANCELLED);
@@ -89,7 +114,7 @@ bool RestoreJob::pause() {
 
 bool RestoreJob::resume() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!isRunning() || !isPaused()) {
+    if (!isPaused()) {
         return false;
     }
     setState(State::RUNNING);
@@ -141,6 +166,18 @@ std::string RestoreJob::getBackupId() const {
     return config_.backupId;
 }
 
+ThrottleTimes RestoreJob::getThrottleTimes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThrottleTimes times;
+    if (context_.rateLimiter) {
+        times.bandwidth = context_.rateLimiter->getThrottledTime();
+    }
+    if (context_.latencyThrottle) {
+        times.latency = context_.latencyThrottle->getThrottledTime();
+    }
+    return times;
+}
+
 bool RestoreJob::restoreDisk(const std::string& diskPath) {
     try {
         // Check if job is paused
@@ -153,8 +190,11 @@ bool RestoreJob::restoreDisk(const std::string& diskPath) {
             return false;
         }
 
-        // Perform restore
-        if (!provider_->restoreDisk(config_.vmId, diskPath, config_)) {
+        // Perform restore on the shared pool, where restores get the largest share
+        bool restored = taskManager_->addSharedTask(static_cast<size_t>(getJobClass()), [&]() {
+            return provider_->restoreDisk(config_.vmId, diskPath, config_, context_);
+        }).get();
+        if (!restored) {
             return false;
         }
 
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include "backup/backup_catalog.hpp"
+#include "temp_directory.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+class BackupCatalogTest : public ::testing::Test {
+protected:
+    CatalogEntry entry(const std::string& vmId, int64_t timestamp) const {
+        CatalogEntry entry;
+        entry.vmId = vmId;
+        entry.backupId = repository_ + "/" + vmId + "_" + std::to_string(timestamp);
+        entry.timestamp = timestamp;
+        entry.type = timestamp % 2 ? BackupType::INCREMENTAL : BackupType::FULL;
+        entry.size = static_cast<uint64_t>(timestamp) * 10;
+        return entry;
+    }
+
+    std::string logPath() const { return repository_ + "/.catalog/catalog.log"; }
+
+    TempDirectory directory_{"catalog_test"};
+    std::string repository_{directory_.string()};
+};
+
+TEST_F(BackupCatalogTest, ListsNewestFirst) {
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    for (int64_t t = 1; t <= 5; t++) {
+        ASSERT_TRUE(catalog.add(entry("vm1", t)));
+        ASSERT_TRUE(catalog.add(entry("vm2", t + 100)));
+    }
+
+    auto backups = catalog.list("vm1", 2, 4);
+    ASSERT_EQ(backups.size(), 3u);
+    EXPECT_EQ(backups[0].timestamp, 4);
+    EXPECT_EQ(backups[2].timestamp, 2);
+    EXPECT_EQ(backups[0].type, BackupType::FULL);
+    EXPECT_EQ(backups[1].type, BackupType::INCREMENTAL);
+    ASSERT_TRUE(catalog.latest("vm2").has_value());
+    EXPECT_EQ(catalog.latest("vm2")->timestamp, 105);
+    EXPECT_FALSE(catalog.latest("vm3").has_value());
+}
+
+TEST_F(BackupCatalogTest, CompactionFoldsLogIntoIndex) {
+    {
+        BackupCatalog catalog(repository_);
+        ASSERT_TRUE(catalog.open());
+        for (int64_t t = 1; t <= 10; t++) {
+            ASSERT_TRUE(catalog.add(entry("vm1", t)));
+        }
+        ASSERT_TRUE(catalog.compact());
+        // Changes after the fold live in the log tail until the next one
+        ASSERT_TRUE(catalog.remove("vm1", entry("vm1", 3).backupId));
+        ASSERT_TRUE(catalog.add(entry("vm1", 11)));
+        ASSERT_TRUE(catalog.add(entry("vm0", 7)));
+    }
+
+    EXPECT_TRUE(fs::exists(repository_ + "/.catalog/catalog.idx"));
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    auto backups = catalog.list("vm1");
+    ASSERT_EQ(backups.size(), 10u);
+    EXPECT_EQ(backups.front().timestamp, 11);
+    for (const auto& backup : backups) {
+        EXPECT_NE(backup.timestamp, 3);
+        EXPECT_EQ(backup.size, static_cast<uint64_t>(backup.timestamp) * 10);
+    }
+
+    auto all = catalog.listAll();
+    ASSERT_EQ(all.size(), 11u);
+    EXPECT_EQ(all.front().vmId, "vm0");
+
+    // A second fold merges the tail, including the removal
+    ASSERT_TRUE(catalog.compact());
+    EXPECT_EQ(catalog.list("vm1").size(), 10u);
+    EXPECT_EQ(catalog.listAll().size(), 11u);
+}
+
+TEST_F(BackupCatalogTest, LongTailIsFoldedOnItsOwn) {
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    std::string indexPath = repository_ + "/.catalog/catalog.idx";
+    for (int64_t t = 1; t <= 4200; t++) {
+        ASSERT_TRUE(catalog.add(entry("vm" + std::to_string(t % 3), t)));
+    }
+    EXPECT_TRUE(fs::exists(indexPath));
+    EXPECT_EQ(catalog.listAll().size(), 4200u);
+    EXPECT_EQ(catalog.list("vm1", 100, 199).size(), 34u);
+}
+
+TEST_F(BackupCatalogTest, TornRecordIsCutOff) {
+    {
+        BackupCatalog catalog(repository_);
+        ASSERT_TRUE(catalog.open());
+        ASSERT_TRUE(catalog.add(entry("vm1", 1)));
+        ASSERT_TRUE(catalog.add(entry("vm1", 2)));
+    }
+    uintmax_t intact = fs::file_size(logPath());
+    {
+        BackupCatalog catalog(repository_);
+        ASSERT_TRUE(catalog.open());
+        ASSERT_TRUE(catalog.add(entry("vm1", 3)));
+    }
+    // A crash in the middle of the last append
+    fs::resize_file(logPath(), intact + 7);
+
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    EXPECT_EQ(fs::file_size(logPath()), intact);
+    auto backups = catalog.list("vm1");
+    ASSERT_EQ(backups.size(), 2u);
+    EXPECT_EQ(backups.front().timestamp, 2);
+
+    // Appends continue behind the last intact record
+    ASSERT_TRUE(catalog.add(entry("vm1", 4)));
+    BackupCatalog reopened(repository_);
+    ASSERT_TRUE(reopened.open());
+    EXPECT_EQ(reopened.list("vm1").size(), 3u);
+}
+
+TEST_F(BackupCatalogTest, CorruptRecordEndsReplay) {
+    {
+        BackupCatalog catalog(repository_);
+        ASSERT_TRUE(catalog.open());
+        ASSERT_TRUE(catalog.add(entry("vm1", 1)));
+        ASSERT_TRUE(catalog.add(entry("vm1", 2)));
+    }
+    // Flip the last byte of the last record so its crc no longer matches
+    uintmax_t size = fs::file_size(logPath());
+    {
+        std::fstream log(logPath(), std::ios::in | std::ios::out | std::ios::binary);
+        log.seekg(static_cast<std::streamoff>(size - 1));
+        char byte = 0;
+        log.get(byte);
+        log.seekp(static_cast<std::streamoff>(size - 1));
+        log.put(static_cast<char>(byte ^ 0x5A));
+    }
+
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    auto backups = catalog.list("vm1");
+    ASSERT_EQ(backups.size(), 1u);
+    EXPECT_EQ(backups.front().timestamp, 1);
+    EXPECT_LT(fs::file_size(logPath()), size);
+}
+
+TEST_F(BackupCatalogTest, CompactionShrinksTheLogToLiveEntries) {
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    for (int64_t t = 1; t <= 100; t++) {
+        ASSERT_TRUE(catalog.add(entry("vm1", t)));
+    }
+    uintmax_t full = fs::file_size(logPath());
+    for (int64_t t = 1; t <= 90; t++) {
+        ASSERT_TRUE(catalog.remove("vm1", entry("vm1", t).backupId));
+    }
+    ASSERT_TRUE(catalog.compact());
+    EXPECT_LT(fs::file_size(logPath()), full / 5);
+
+    // The rewritten log rebuilds the catalog without the index
+    fs::remove(repository_ + "/.catalog/catalog.idx");
+    BackupCatalog reopened(repository_);
+    ASSERT_TRUE(reopened.open());
+    auto backups = reopened.list("vm1");
+    ASSERT_EQ(backups.size(), 10u);
+    EXPECT_EQ(backups.back().timestamp, 91);
+}
+
+TEST_F(BackupCatalogTest, OtherInstancesFollowTheRewrittenLog) {
+    BackupCatalog writer(repository_);
+    BackupCatalog compactor(repository_);
+    ASSERT_TRUE(writer.open());
+    ASSERT_TRUE(compactor.open());
+    ASSERT_TRUE(writer.add(entry("vm1", 1)));
+    ASSERT_TRUE(writer.add(entry("vm1", 2)));
+    ASSERT_TRUE(compactor.remove("vm1", entry("vm1", 1).backupId));
+    ASSERT_TRUE(compactor.compact());
+
+    // Appends after the rewrite land in the new log
+    ASSERT_TRUE(writer.add(entry("vm1", 3)));
+    EXPECT_EQ(writer.list("vm1").size(), 2u);
+    EXPECT_EQ(compactor.list("vm1").size(), 2u);
+    BackupCatalog reopened(repository_);
+    ASSERT_TRUE(reopened.open());
+    auto backups = reopened.list("vm1");
+    ASSERT_EQ(backups.size(), 2u);
+    EXPECT_EQ(backups.front().timestamp, 3);
+    EXPECT_EQ(backups.back().timestamp, 2);
+}
+
+TEST_F(BackupCatalogTest, IndexOfAReplacedLogIsIgnored) {
+    std::string indexPath = repository_ + "/.catalog/catalog.idx";
+    {
+        BackupCatalog catalog(repository_);
+        ASSERT_TRUE(catalog.open());
+        for (int64_t t = 1; t <= 5; t++) {
+            ASSERT_TRUE(catalog.add(entry("vm1", t)));
+        }
+        ASSERT_TRUE(catalog.compact());
+        fs::copy_file(indexPath, indexPath + ".old");
+        ASSERT_TRUE(catalog.add(entry("vm1", 6)));
+        ASSERT_TRUE(catalog.compact());
+    }
+    // As if a crash came between rewriting the log and the index
+    fs::rename(indexPath + ".old", indexPath);
+
+    BackupCatalog catalog(repository_);
+    ASSERT_TRUE(catalog.open());
+    auto backups = catalog.list("vm1");
+    ASSERT_EQ(backups.size(), 6u);
+    EXPECT_EQ(backups.front().timestamp, 6);
+    EXPECT_EQ(backups.back().timestamp, 1);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include "backup/backup_history.hpp"
+#include "temp_directory.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace std::chrono;
+
+class BackupHistoryTest : public ::testing::Test {
+protected:
+    size_t lineCount() const {
+        std::ifstream file(path_);
+        size_t lines = 0;
+        for (std::string line; std::getline(file, line);) {
+            lines++;
+        }
+        return lines;
+    }
+
+    TempDirectory temp_{"backup_history_test"};
+    std::string path_{(temp_.path() / "history.json").string()};
+};
+
+TEST_F(BackupHistoryTest, PredictsExpectedBytesAtObservedThroughput) {
+    BackupHistory history;
+    EXPECT_EQ(history.predictDuration("vm1", seconds(1800)), seconds(1800));
+
+    // 100 MB/s throughout, while the amount written doubles
+    ASSERT_TRUE(history.record("vm1", seconds(100), 10000000000ULL));
+    EXPECT_EQ(history.predictDuration("vm1", seconds(1800)), seconds(100));
+    ASSERT_TRUE(history.record("vm1", seconds(200), 20000000000ULL));
+    auto record = history.get("vm1");
+    ASSERT_TRUE(record.has_value());
+    EXPECT_DOUBLE_EQ(record->throughput, 100000000.0);
+    EXPECT_DOUBLE_EQ(record->bytes, 13000000000.0);
+    // 130 s for the bytes expected, plus two deviations of 30 s
+    EXPECT_EQ(history.predictDuration("vm1", seconds(1800)), seconds(190));
+
+    // A run that wrote nothing leaves the throughput alone
+    ASSERT_TRUE(history.record("vm1", seconds(5), 0));
+    EXPECT_DOUBLE_EQ(history.get("vm1")->throughput, 100000000.0);
+}
+
+TEST_F(BackupHistoryTest, AppendsUpdatesAndRewritesOnceTheyPileUp) {
+    {
+        BackupHistory history(path_);
+        ASSERT_TRUE(history.load());
+        ASSERT_TRUE(history.record("vm1", seconds(10), 1000));
+        ASSERT_TRUE(history.record("vm2", seconds(20), 2000));
+        ASSERT_TRUE(history.record("vm1", seconds(30), 3000));
+        ASSERT_TRUE(history.remove("vm2"));
+    }
+    // The first update writes a snapshot, the rest are appended
+    EXPECT_EQ(lineCount(), 4u);
+
+    BackupHistory history(path_);
+    ASSERT_TRUE(history.load());
+    ASSERT_TRUE(history.get("vm1").has_value());
+    EXPECT_EQ(history.get("vm1")->samples, 2u);
+    EXPECT_FALSE(history.get("vm2").has_value());
+
+    for (int i = 0; i < 100; i++) {
+        ASSERT_TRUE(history.record("vm1", seconds(10), 1000));
+    }
+    EXPECT_LE(lineCount(), 66u);
+    BackupHistory reloaded(path_);
+    ASSERT_TRUE(reloaded.load());
+    EXPECT_EQ(reloaded.get("vm1")->samples, 102u);
+}
+
+TEST_F(BackupHistoryTest, SkipsATornLastLine) {
+    {
+        BackupHistory history(path_);
+        ASSERT_TRUE(history.record("vm1", seconds(10), 1000));
+        ASSERT_TRUE(history.record("vm1", seconds(10), 1000));
+    }
+    {
+        std::ofstream file(path_, std::ios::app);
+        file << "{\"vmId\": \"vm1\", \"samp";
+    }
+
+    BackupHistory history(path_);
+    ASSERT_TRUE(history.load());
+    EXPECT_EQ(history.get("vm1")->samples, 2u);
+
+    // Later updates still read back
+    ASSERT_TRUE(history.record("vm1", seconds(10), 1000));
+    BackupHistory reloaded(path_);
+    ASSERT_TRUE(reloaded.load());
+    EXPECT_EQ(reloaded.get("vm1")->samples, 3u);
+}
+
+TEST_F(BackupHistoryTest, ReadsThePrettyPrintedFormat) {
+    {
+        std::ofstream file(path_);
+        file << "{\n    \"version\": 1,\n    \"vms\": [\n        {\n            \"vmId\": \"vm1\",\n"
+                "            \"samples\": 3,\n            \"durationSeconds\": 60.0,\n"
+                "            \"durationDeviation\": 5.0,\n            \"bytes\": 1000.0,\n"
+                "            \"lastRun\": 1700000000\n        }\n    ]\n}\n";
+    }
+
+    BackupHistory history(path_);
+    ASSERT_TRUE(history.load());
+    auto record = history.get("vm1");
+    ASSERT_TRUE(record.has_value());
+    EXPECT_EQ(record->samples, 3u);
+    // Without a throughput yet the average run time stands in
+    EXPECT_EQ(history.predictDuration("vm1", seconds(1)), seconds(70));
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include "backup/backup_job.hpp"
+#include "common/job_event_ring.hpp"
+#include "fake_backup_provider.hpp"
+#include "temp_directory.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace std::chrono;
+
+class BackupJobTest : public ::testing::Test {
+protected:
+    std::shared_ptr<BackupJob> createJob(const std::string& vmId) {
+        BackupConfig config;
+        config.vmId = vmId;
+        config.backupPath = (temp_.path() / (vmId + "_20240101_000000")).string();
+        auto job = std::make_shared<BackupJob>(&provider_, taskManager_, config);
+        auto exited = std::make_shared<std::promise<void>>();
+        exited_ = exited->get_future();
+        job->addExitCallback([exited](const Job&) { exited->set_value(); });
+        return job;
+    }
+
+    // The job's worker is done with the provider once it returns
+    bool waitForExit() {
+        return exited_.wait_for(seconds(10)) == std::future_status::ready;
+    }
+
+    TempDirectory temp_{"backup_job_test"};
+    FakeBackupProvider provider_;
+    std::shared_ptr<ParallelTaskManager> taskManager_{std::make_shared<ParallelTaskManager>(2)};
+    std::future<void> exited_;
+};
+
+TEST_F(BackupJobTest, SnapshotOnlyCoversTheDiskReads) {
+    provider_.setDisks("vm1", {"small", "large", "medium"});
+    provider_.setCapacity("small", 1);
+    provider_.setCapacity("large", 100);
+    provider_.setCapacity("medium", 10);
+    // Nothing of the backup's metadata may exist while the snapshot is open
+    bool metadataBeforeRemoval = true;
+    provider_.onRemoveSnapshot([&](const std::string&) {
+        metadataBeforeRemoval = fs::exists(temp_.path() / "vm1_20240101_000000" / "metadata.json");
+    });
+
+    auto job = createJob("vm1");
+    provider_.hold();
+    ASSERT_TRUE(job->start());
+    std::this_thread::sleep_for(milliseconds(100));
+    provider_.release();
+    ASSERT_TRUE(waitForExit());
+    ASSERT_TRUE(job->isCompleted()) << job->getError();
+
+    // Disks are listed and sized before the snapshot, and copied largest first
+    EXPECT_EQ(provider_.getCalls(), (std::vector<std::string>{
+        "disks vm1", "capacities vm1", "snapshot vm1", "backup vm1 large", "backup vm1 medium",
+        "backup vm1 small", "remove vm1", "finish vm1 succeeded"}));
+    EXPECT_FALSE(metadataBeforeRemoval);
+    EXPECT_TRUE(fs::exists(temp_.path() / "vm1_20240101_000000" / "metadata.json"));
+
+    auto timings = job->getSnapshotTimings();
+    EXPECT_GE(timings.openDuration, milliseconds(100));
+    EXPECT_LT(timings.createTime, timings.openDuration);
+    EXPECT_LT(timings.removeTime, timings.openDuration);
+}
+
+TEST_F(BackupJobTest, FailedDiskRemovesTheSnapshot) {
+    provider_.setDisks("vm1", {"disk1", "disk2"});
+    provider_.failDisk("disk1");
+
+    auto job = createJob("vm1");
+    ASSERT_TRUE(job->start());
+    ASSERT_TRUE(waitForExit());
+    EXPECT_TRUE(job->isFailed());
+
+    // The snapshot goes before the backup is given up, and nothing of it is kept
+    auto calls = provider_.getCalls();
+    ASSERT_GE(calls.size(), 2u);
+    EXPECT_EQ(calls[calls.size() - 2], "remove vm1");
+    EXPECT_EQ(calls.back(), "finish vm1 failed");
+    EXPECT_EQ(std::count(calls.begin(), calls.end(), "backup vm1 disk2"), 0);
+}
+
+TEST_F(BackupJobTest, PublishesItsProgressToTheEventRing) {
+    provider_.setDisks("vm1", {"disk1", "disk2"});
+    auto ring = std::make_shared<JobEventRing>();
+    auto job = createJob("vm1");
+    job->setEventRing(ring, "backup");
+    ASSERT_TRUE(job->start());
+    ASSERT_TRUE(waitForExit());
+    ASSERT_TRUE(job->isCompleted());
+
+    uint64_t next = 0;
+    uint64_t dropped = 0;
+    std::vector<JobEvent> events;
+    ring->read(next, events, ring->getCapacity(), dropped);
+    ASSERT_FALSE(events.empty());
+    for (const auto& event : events) {
+        EXPECT_EQ(event.jobId, job->getId());
+        EXPECT_EQ(event.jobType, "backup");
+    }
+    // Progress only moves forward, and the last event is the job finishing
+    int progress = 0;
+    for (const auto& event : events) {
+        if (event.kind == JobEventKind::PROGRESS) {
+            EXPECT_GE(event.progress, progress);
+            progress = event.progress;
+        }
+    }
+    EXPECT_EQ(progress, 100);
+    auto finished = std::find_if(events.rbegin(), events.rend(),
+                                 [](const JobEvent& event) { return event.kind == JobEventKind::STATE; });
+    ASSERT_NE(finished, events.rend());
+    EXPECT_EQ(finished->state, Job::State::COMPLETED);
+}
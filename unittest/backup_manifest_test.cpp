@@ -0,0 +1,220 @@
+#include <gtest/gtest.h>
+#include "backup/backup_manifest.hpp"
+#include "common/file_utils.hpp"
+#include "temp_directory.hpp"
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <string>
+
+class BackupManifestTest : public ::testing::Test {
+protected:
+    // Extents spread over several blocks, with gaps and lengths that need
+    // multi-byte varints
+    static std::vector<ManifestExtent> makeExtents(size_t count) {
+        std::vector<ManifestExtent> extents;
+        uint64_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            ManifestExtent extent;
+            offset += (i % 7) * 4096 + (i % 3 == 0 ? (1ULL << 33) : 0);
+            extent.offset = offset;
+            extent.length = 512 * (1 + i % 300);
+            for (size_t b = 0; b < extent.digest.size(); b++) {
+                extent.digest[b] = static_cast<uint8_t>(i * 31 + b);
+            }
+            extents.push_back(extent);
+            offset += extent.length;
+        }
+        return extents;
+    }
+
+    std::string readFile() const {
+        std::ifstream file(path_, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& data) const {
+        std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    TempDirectory directory_{"manifest_test"};
+    std::string path_{(directory_.path() / "manifest.bin").string()};
+};
+
+TEST_F(BackupManifestTest, RoundTripsAtEveryCompressionLevel) {
+    auto extents = makeExtents(10000);
+    for (int level : {0, 1, 9}) {
+        ManifestWriter writer(level, true);
+        size_t disk = writer.addDisk("[ds1] vm/vm.vmdk", "vm.vmdk", 1ULL << 40);
+        size_t empty = writer.addDisk("[ds1] vm/vm_1.vmdk", "vm_1.vmdk", 1ULL << 30, "/repo/vm_full");
+        for (const auto& extent : extents) {
+            ASSERT_TRUE(writer.addExtent(disk, extent));
+        }
+        EXPECT_TRUE(writer.isIncremental());
+        std::string error;
+        ASSERT_TRUE(writer.write(path_, error)) << error;
+
+        ManifestReader reader;
+        ASSERT_TRUE(reader.open(path_));
+        ASSERT_EQ(reader.getDiskCount(), 2u);
+        EXPECT_TRUE(reader.hasDigests());
+        ManifestDisk info = reader.getDisk(disk);
+        EXPECT_EQ(info.path, "[ds1] vm/vm.vmdk");
+        EXPECT_EQ(info.file, "vm.vmdk");
+        EXPECT_TRUE(info.parent.empty());
+        EXPECT_EQ(info.capacity, 1ULL << 40);
+        EXPECT_EQ(info.extentCount, extents.size());
+        EXPECT_EQ(reader.getDisk(empty).parent, "/repo/vm_full");
+
+        size_t i = 0;
+        ASSERT_TRUE(reader.forEachExtent(disk, [&](const ManifestExtent& extent) {
+            EXPECT_EQ(extent.offset, extents[i].offset);
+            EXPECT_EQ(extent.length, extents[i].length);
+            EXPECT_EQ(extent.digest, extents[i].digest);
+            i++;
+            return true;
+        }));
+        EXPECT_EQ(i, extents.size()) << "level " << level;
+
+        std::vector<ManifestExtent> none;
+        ASSERT_TRUE(reader.findExtents(empty, 0, UINT64_MAX, none));
+        EXPECT_TRUE(none.empty());
+    }
+}
+
+TEST_F(BackupManifestTest, RangedDecodeReturnsOverlappingExtents) {
+    auto extents = makeExtents(9000);
+    ManifestWriter writer(6);
+    size_t disk = writer.addDisk("disk", "disk.vmdk", 0);
+    for (const auto& extent : extents) {
+        ASSERT_TRUE(writer.addExtent(disk, extent));
+    }
+    std::string error;
+    ASSERT_TRUE(writer.write(path_, error)) << error;
+
+    ManifestReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    EXPECT_FALSE(reader.hasDigests());
+
+    // Ranges inside one extent, across block boundaries and past the end
+    std::vector<std::pair<uint64_t, uint64_t>> ranges = {
+        {extents[10].offset + 1, 1},
+        {extents[4090].offset, extents[4100].offset - extents[4090].offset},
+        {extents[8990].offset + extents[8990].length - 1, UINT64_MAX},
+        {0, extents[0].offset},
+    };
+    for (const auto& range : ranges) {
+        uint64_t end = range.second > UINT64_MAX - range.first ? UINT64_MAX : range.first + range.second;
+        std::vector<ManifestExtent> expected;
+        for (const auto& extent : extents) {
+            if (extent.offset < end && extent.offset + extent.length > range.first) {
+                expected.push_back(extent);
+            }
+        }
+        std::vector<ManifestExtent> found;
+        ASSERT_TRUE(reader.findExtents(disk, range.first, range.second, found));
+        ASSERT_EQ(found.size(), expected.size()) << "range at " << range.first;
+        for (size_t i = 0; i < found.size(); i++) {
+            EXPECT_EQ(found[i].offset, expected[i].offset);
+            EXPECT_EQ(found[i].length, expected[i].length);
+        }
+    }
+}
+
+TEST_F(BackupManifestTest, RejectsExtentsOutOfOrder) {
+    ManifestWriter writer;
+    size_t disk = writer.addDisk("disk", "disk.vmdk", 0);
+    ManifestExtent extent;
+    extent.offset = 4096;
+    extent.length = 4096;
+    ASSERT_TRUE(writer.addExtent(disk, extent));
+    extent.offset = 6144;
+    EXPECT_FALSE(writer.addExtent(disk, extent));
+    extent.offset = 0;
+    EXPECT_FALSE(writer.addExtent(disk, extent));
+}
+
+TEST_F(BackupManifestTest, ReadsVersionOneWithoutParent) {
+    auto extents = makeExtents(5000);
+    ManifestWriter writer(1);
+    size_t disk = writer.addDisk("disk", "disk.vmdk", 1ULL << 36, "/repo/parent");
+    for (const auto& extent : extents) {
+        ASSERT_TRUE(writer.addExtent(disk, extent));
+    }
+    std::string error;
+    ASSERT_TRUE(writer.write(path_, error)) << error;
+
+    // Rewrite as version 1: 64-byte disk records ending before the parent
+    // field, block data moved up accordingly
+    const size_t headerSize = 64;
+    const size_t blockRecordSize = 40;
+    const size_t v1RecordSize = 64;
+    const size_t v2RecordSize = 80;
+    std::string v2 = readFile();
+    uint64_t diskCount = 0;
+    uint64_t blockCount = 0;
+    uint64_t stringsSize = 0;
+    std::memcpy(&diskCount, &v2[16], sizeof(diskCount));
+    std::memcpy(&blockCount, &v2[24], sizeof(blockCount));
+    std::memcpy(&stringsSize, &v2[32], sizeof(stringsSize));
+    ASSERT_EQ(diskCount, 1u);
+    ASSERT_GT(blockCount, 1u);
+
+    std::string v1 = v2.substr(0, headerSize) + v2.substr(headerSize, v1RecordSize);
+    std::string blocks = v2.substr(headerSize + v2RecordSize, blockCount * blockRecordSize);
+    for (uint64_t i = 0; i < blockCount; i++) {
+        uint64_t dataOffset = 0;
+        std::memcpy(&dataOffset, &blocks[i * blockRecordSize + 16], sizeof(dataOffset));
+        dataOffset -= v2RecordSize - v1RecordSize;
+        std::memcpy(&blocks[i * blockRecordSize + 16], &dataOffset, sizeof(dataOffset));
+    }
+    v1 += blocks;
+    v1 += v2.substr(headerSize + v2RecordSize + blocks.size());
+    uint32_t version = 1;
+    std::memcpy(&v1[8], &version, sizeof(version));
+    uint32_t tablesCrc = crc32(v1.data() + headerSize, v1RecordSize + blocks.size() + stringsSize);
+    std::memcpy(&v1[40], &tablesCrc, sizeof(tablesCrc));
+    writeFile(v1);
+
+    ManifestReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    ManifestDisk info = reader.getDisk(disk);
+    EXPECT_EQ(info.path, "disk");
+    EXPECT_EQ(info.file, "disk.vmdk");
+    EXPECT_TRUE(info.parent.empty());
+    EXPECT_EQ(info.capacity, 1ULL << 36);
+    std::vector<ManifestExtent> found;
+    ASSERT_TRUE(reader.findExtents(disk, 0, UINT64_MAX, found));
+    ASSERT_EQ(found.size(), extents.size());
+    EXPECT_EQ(found.back().offset, extents.back().offset);
+}
+
+TEST_F(BackupManifestTest, DetectsDamage) {
+    ManifestWriter writer;
+    size_t disk = writer.addDisk("disk", "disk.vmdk", 0);
+    for (const auto& extent : makeExtents(100)) {
+        ASSERT_TRUE(writer.addExtent(disk, extent));
+    }
+    std::string error;
+    ASSERT_TRUE(writer.write(path_, error)) << error;
+    std::string data = readFile();
+
+    // Damaged block data fails on decode, damaged tables at open
+    std::string damaged = data;
+    damaged.back() ^= 0x01;
+    writeFile(damaged);
+    ManifestReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    std::vector<ManifestExtent> found;
+    EXPECT_FALSE(reader.findExtents(disk, 0, UINT64_MAX, found));
+    reader.close();
+
+    damaged = data;
+    damaged[64] ^= 0x01;
+    writeFile(damaged);
+    EXPECT_FALSE(reader.open(path_));
+
+    writeFile(data.substr(0, 40));
+    EXPECT_FALSE(reader.open(path_));
+}
@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+#include "backup/backup_scheduler.hpp"
+#include "common/job_manager.hpp"
+#include <chrono>
+#include <ctime>
+#include <string>
+
+using namespace std::chrono;
+
+class BackupSchedulerTest : public ::testing::Test {
+protected:
+    // A daily schedule `ahead` from now, rounded down to the minute
+    static BackupConfig dailyConfig(const std::string& vmId, minutes ahead) {
+        time_t at = system_clock::to_time_t(system_clock::now() + ahead);
+        std::tm tm;
+        localtime_r(&at, &tm);
+        BackupConfig config;
+        config.vmId = vmId;
+        config.scheduleType = "daily";
+        config.schedule.hour = tm.tm_hour;
+        config.schedule.minute = tm.tm_min;
+        return config;
+    }
+
+    static std::tm localTime(system_clock::time_point at) {
+        time_t time = system_clock::to_time_t(at);
+        std::tm tm;
+        localtime_r(&time, &tm);
+        return tm;
+    }
+
+    // The scheduler is never started, so runs are only queued
+    JobManager jobManager_;
+    BackupScheduler scheduler_{&jobManager_};
+};
+
+TEST_F(BackupSchedulerTest, QueuesEachVMAtItsNextRun) {
+    auto now = system_clock::now();
+    auto early = dailyConfig("vm1", minutes(120));
+    auto late = dailyConfig("vm2", minutes(300));
+    ASSERT_TRUE(scheduler_.scheduleBackup("vm2", late));
+    ASSERT_TRUE(scheduler_.scheduleBackup("vm1", early));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm1"), scheduler_.getNextRunTime(early, now));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm2"), scheduler_.getNextRunTime(late, now));
+    EXPECT_LT(*scheduler_.getScheduledRunTime("vm1"), *scheduler_.getScheduledRunTime("vm2"));
+
+    // Rescheduling moves the VM's one queued run instead of adding another
+    auto later = dailyConfig("vm1", minutes(600));
+    ASSERT_TRUE(scheduler_.scheduleBackup("vm1", later));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm1"), scheduler_.getNextRunTime(later, now));
+    EXPECT_EQ(scheduler_.getScheduledBackups().size(), 2u);
+
+    EXPECT_TRUE(scheduler_.cancelBackup("vm1"));
+    EXPECT_FALSE(scheduler_.getScheduledRunTime("vm1").has_value());
+    EXPECT_FALSE(scheduler_.cancelBackup("vm1"));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm2"), scheduler_.getNextRunTime(late, now));
+}
+
+TEST_F(BackupSchedulerTest, ComputesTheNextRunOfEachScheduleType) {
+    auto after = system_clock::now();
+    BackupConfig config;
+    config.schedule.hour = 3;
+    config.schedule.minute = 30;
+
+    config.scheduleType = "daily";
+    auto daily = scheduler_.getNextRunTime(config, after);
+    EXPECT_GT(daily, after);
+    EXPECT_LE(daily, after + hours(25));
+    EXPECT_EQ(localTime(daily).tm_hour, 3);
+    EXPECT_EQ(localTime(daily).tm_min, 30);
+
+    config.scheduleType = "weekly";
+    config.schedule.day = 2;
+    auto weekly = scheduler_.getNextRunTime(config, after);
+    EXPECT_GT(weekly, after);
+    EXPECT_LE(weekly, after + hours(7 * 24 + 1));
+    EXPECT_EQ(localTime(weekly).tm_wday, 2);
+    EXPECT_EQ(localTime(weekly).tm_hour, 3);
+
+    // Day 31 falls back to the last day of shorter months
+    config.scheduleType = "monthly";
+    config.schedule.day = 31;
+    auto monthly = scheduler_.getNextRunTime(config, after);
+    EXPECT_GT(monthly, after);
+    auto nextDay = localTime(monthly + hours(24));
+    EXPECT_EQ(nextDay.tm_mday, 1);
+
+    config.scheduleType = "interval";
+    config.schedule.hour = 1;
+    config.schedule.minute = 15;
+    EXPECT_EQ(scheduler_.getNextRunTime(config, after), after + minutes(75));
+    config.schedule.hour = 0;
+    config.schedule.minute = 0;
+    EXPECT_EQ(scheduler_.getNextRunTime(config, after), after + minutes(1));
+}
+
+TEST_F(BackupSchedulerTest, StaggerKeepsRunsInsideTheWindow) {
+    auto config = dailyConfig("vm1", minutes(120));
+    config.staggerWindowMinutes = 60;
+    auto slot = scheduler_.getNextRunTime(config, system_clock::now());
+
+    // A hashed offset is the same for every scheduler
+    config.staggerPolicy = "hash";
+    ASSERT_TRUE(scheduler_.scheduleBackup("vm1", config));
+    auto hashed = *scheduler_.getScheduledRunTime("vm1");
+    EXPECT_GE(hashed, slot);
+    EXPECT_LT(hashed, slot + minutes(60));
+    BackupScheduler other(&jobManager_);
+    ASSERT_TRUE(other.scheduleBackup("vm1", config));
+    EXPECT_EQ(other.getScheduledRunTime("vm1"), hashed);
+
+    config.staggerPolicy = "jitter";
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(scheduler_.scheduleBackup("vm1", config));
+        auto jittered = *scheduler_.getScheduledRunTime("vm1");
+        EXPECT_GE(jittered, slot);
+        EXPECT_LT(jittered, slot + minutes(60));
+    }
+
+    config.staggerPolicy = "sometimes";
+    EXPECT_FALSE(scheduler_.scheduleBackup("vm2", config));
+    EXPECT_FALSE(scheduler_.getScheduledRunTime("vm2").has_value());
+}
+
+TEST_F(BackupSchedulerTest, SpreadSpacesTheVMsOfASlotEvenly) {
+    auto config = dailyConfig("", minutes(120));
+    config.staggerPolicy = "spread";
+    config.staggerWindowMinutes = 60;
+    auto slot = scheduler_.getNextRunTime(config, system_clock::now());
+    for (const auto& vmId : {"vm1", "vm2", "vm3", "vm4"}) {
+        config.vmId = vmId;
+        ASSERT_TRUE(scheduler_.scheduleBackup(vmId, config));
+    }
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm1"), slot);
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm2"), slot + minutes(15));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm4"), slot + minutes(45));
+
+    // Runs queued before the fifth VM joined move once their slot arrives
+    config.vmId = "vm5";
+    ASSERT_TRUE(scheduler_.scheduleBackup("vm5", config));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm2"), slot + minutes(12));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm5"), slot + minutes(48));
+
+    // Leaving the slot closes the gap
+    ASSERT_TRUE(scheduler_.cancelBackup("vm1"));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm2"), slot);
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm5"), slot + minutes(45));
+
+    // A VM with another schedule time has a slot of its own
+    auto other = dailyConfig("vm6", minutes(300));
+    other.staggerPolicy = "spread";
+    other.staggerWindowMinutes = 60;
+    ASSERT_TRUE(scheduler_.scheduleBackup("vm6", other));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm6"), scheduler_.getNextRunTime(other, system_clock::now()));
+    EXPECT_EQ(scheduler_.getScheduledRunTime("vm3"), slot + minutes(15));
+}
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+#include "backup/block_delta.hpp"
+#include "temp_directory.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+class BlockDeltaTest : public ::testing::Test {
+protected:
+    static constexpr uint32_t BLOCK_SIZE = 4096;
+
+    static std::vector<uint8_t> randomBytes(size_t size, uint32_t seed) {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes) {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    std::string writeFile(const std::string& name, const std::vector<uint8_t>& content) const {
+        std::string path = (directory_ / name).string();
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(content.data()), static_cast<std::streamsize>(content.size()));
+        return path;
+    }
+
+    static std::vector<uint8_t> readFile(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // The source is rebuilt from the basis through deltas of segment bytes
+    // each, applied last segment first
+    std::vector<uint8_t> rebuild(const std::vector<uint8_t>& basis, const std::vector<uint8_t>& source,
+                                 uint64_t segment, int compressionLevel, DeltaStats& stats) const {
+        std::string basisPath = writeFile("basis", basis);
+        std::string sourcePath = writeFile("source", source);
+        std::string outputPath = (directory_ / "output").string();
+        fs::remove(outputPath);
+
+        BlockSignature signature;
+        std::string error;
+        EXPECT_TRUE(computeSignature(basisPath, BLOCK_SIZE, signature, error)) << error;
+        // Signatures cross the transport as bytes
+        BlockSignature received;
+        EXPECT_TRUE(received.parse(signature.serialize(), error)) << error;
+        EXPECT_EQ(received.weak, signature.weak);
+        EXPECT_EQ(received.strong, signature.strong);
+        BlockMatcher matcher(received);
+
+        int sourceFd = ::open(sourcePath.c_str(), O_RDONLY);
+        int basisFd = ::open(basisPath.c_str(), O_RDONLY);
+        int outputFd = ::open(outputPath.c_str(), O_WRONLY | O_CREAT, 0644);
+        std::vector<std::string> deltas;
+        for (uint64_t offset = 0; offset < source.size(); offset += segment) {
+            std::string delta;
+            EXPECT_TRUE(computeDelta(sourceFd, source.size(), offset, segment, matcher, BLOCK_SIZE,
+                                     compressionLevel, delta, stats, error)) << error;
+            deltas.push_back(delta);
+        }
+        for (auto delta = deltas.rbegin(); delta != deltas.rend(); ++delta) {
+            EXPECT_TRUE(applyDelta(*delta, basisFd, BLOCK_SIZE, outputFd, error)) << error;
+        }
+        ::close(sourceFd);
+        ::close(basisFd);
+        ::close(outputFd);
+        return readFile(outputPath);
+    }
+
+    TempDirectory temp_{"block_delta_test"};
+    const fs::path& directory_{temp_.path()};
+};
+
+TEST_F(BlockDeltaTest, RollingMatchesReset) {
+    auto data = randomBytes(20000, 1);
+    for (size_t window : {size_t(1), size_t(7), size_t(BLOCK_SIZE)}) {
+        RollingChecksum rolling;
+        rolling.reset(data.data(), window);
+        for (size_t start = 1; start + window <= data.size(); start++) {
+            rolling.roll(data[start - 1], data[start + window - 1]);
+            RollingChecksum fresh;
+            fresh.reset(data.data() + start, window);
+            ASSERT_EQ(rolling.value(), fresh.value()) << "window " << window << " at " << start;
+        }
+    }
+
+    // Windows of equal bytes in a different order differ
+    std::vector<uint8_t> ab = {1, 2, 3, 4};
+    std::vector<uint8_t> ba = {4, 3, 2, 1};
+    RollingChecksum first;
+    RollingChecksum second;
+    first.reset(ab.data(), ab.size());
+    second.reset(ba.data(), ba.size());
+    EXPECT_NE(first.value(), second.value());
+}
+
+TEST_F(BlockDeltaTest, RebuildsEditedFile) {
+    auto basis = randomBytes(64 * BLOCK_SIZE + 1000, 2);
+    auto source = basis;
+    // An overwritten range, bytes inserted and removed off block boundaries,
+    // a moved block and new data at the end
+    auto noise = randomBytes(3 * BLOCK_SIZE, 3);
+    std::copy(noise.begin(), noise.begin() + 5000, source.begin() + 10 * BLOCK_SIZE + 17);
+    source.insert(source.begin() + 20 * BLOCK_SIZE + 100, noise.begin() + 5000, noise.begin() + 5123);
+    source.erase(source.begin() + 40 * BLOCK_SIZE + 9, source.begin() + 40 * BLOCK_SIZE + 2009);
+    source.insert(source.begin() + 2 * BLOCK_SIZE, basis.begin() + 50 * BLOCK_SIZE,
+                  basis.begin() + 51 * BLOCK_SIZE);
+    source.insert(source.end(), noise.begin() + 6000, noise.end());
+
+    for (int level : {0, 6}) {
+        DeltaStats stats;
+        EXPECT_EQ(rebuild(basis, source, source.size(), level, stats), source) << "level " << level;
+        EXPECT_EQ(stats.matchedBytes + stats.literalBytes, source.size());
+        // Only blocks the edits touch are sent as data
+        EXPECT_GE(stats.matchedBytes, 55u * BLOCK_SIZE);
+        EXPECT_LT(stats.literalBytes, 11u * BLOCK_SIZE);
+    }
+}
+
+TEST_F(BlockDeltaTest, SegmentsRebuildIndependently) {
+    auto basis = randomBytes(100 * BLOCK_SIZE, 4);
+    auto source = basis;
+    source.insert(source.begin() + 3 * BLOCK_SIZE + 1, 77, 0xAB);
+    source[70 * BLOCK_SIZE] ^= 0xFF;
+
+    // Segments that split blocks, so matches run past their range
+    for (uint64_t segment : {uint64_t(10 * BLOCK_SIZE + 123), uint64_t(BLOCK_SIZE - 1)}) {
+        DeltaStats stats;
+        auto rebuilt = rebuild(basis, source, segment, 1, stats);
+        rebuilt.resize(std::min(rebuilt.size(), source.size()));
+        EXPECT_EQ(rebuilt, source) << "segment " << segment;
+    }
+}
+
+TEST_F(BlockDeltaTest, WithoutBasisEverythingIsLiteral) {
+    BlockSignature signature;
+    std::string error;
+    ASSERT_TRUE(computeSignature((directory_ / "missing").string(), BLOCK_SIZE, signature, error)) << error;
+    EXPECT_EQ(signature.basisSize, 0u);
+    EXPECT_TRUE(signature.weak.empty());
+    BlockMatcher matcher(signature);
+    EXPECT_TRUE(matcher.empty());
+
+    auto source = randomBytes(3 * BLOCK_SIZE + 5, 5);
+    std::string sourcePath = writeFile("source", source);
+    std::string outputPath = (directory_ / "output").string();
+    int sourceFd = ::open(sourcePath.c_str(), O_RDONLY);
+    int outputFd = ::open(outputPath.c_str(), O_WRONLY | O_CREAT, 0644);
+    std::string delta;
+    DeltaStats stats;
+    ASSERT_TRUE(computeDelta(sourceFd, source.size(), 0, source.size(), matcher, BLOCK_SIZE, 0, delta, stats,
+                             error)) << error;
+    EXPECT_EQ(stats.literalBytes, source.size());
+    EXPECT_EQ(stats.matchedBytes, 0u);
+    EXPECT_TRUE(applyDelta(delta, -1, BLOCK_SIZE, outputFd, error)) << error;
+    ::close(sourceFd);
+    ::close(outputFd);
+    EXPECT_EQ(readFile(outputPath), source);
+}
+
+TEST_F(BlockDeltaTest, RejectsMalformedInput) {
+    BlockSignature signature;
+    std::string error;
+    EXPECT_FALSE(signature.parse("not a signature", error));
+    EXPECT_FALSE(error.empty());
+
+    std::string outputPath = (directory_ / "output").string();
+    int outputFd = ::open(outputPath.c_str(), O_WRONLY | O_CREAT, 0644);
+    EXPECT_FALSE(applyDelta("garbage", -1, BLOCK_SIZE, outputFd, error));
+    ::close(outputFd);
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "backup/vmware/change_id_store.hpp"
+#include "temp_directory.hpp"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+class ChangeIdStoreTest : public ::testing::Test {
+protected:
+    static ChangeIdRecord record(const std::string& vmId, const std::string& diskPath, const std::string& changeId) {
+        ChangeIdRecord record;
+        record.vmId = vmId;
+        record.diskPath = diskPath;
+        record.changeId = changeId;
+        record.backupId = vmId + "_20240101_000000";
+        record.capacity = 1ULL << 30;
+        record.timestamp = 1700000000;
+        return record;
+    }
+
+    TempDirectory temp_{"change_id_store_test"};
+    std::string path_{(temp_.path() / "change_ids.json").string()};
+};
+
+TEST_F(ChangeIdStoreTest, KeepsOneRecordPerDiskAcrossReloads) {
+    {
+        ChangeIdStore store(path_);
+        ASSERT_TRUE(store.load());
+        EXPECT_FALSE(store.get("vm1", "disk1").has_value());
+        ASSERT_TRUE(store.update({record("vm1", "disk1", "52 de/1"), record("vm1", "disk2", "52 de/2"),
+                                  record("vm2", "disk1", "61 aa/7")}));
+        ASSERT_TRUE(store.update(record("vm1", "disk1", "52 de/5")));
+        ASSERT_TRUE(store.remove("vm1", "disk2"));
+    }
+
+    ChangeIdStore store(path_);
+    ASSERT_TRUE(store.load()) << store.getLastError();
+    auto disk1 = store.get("vm1", "disk1");
+    ASSERT_TRUE(disk1.has_value());
+    EXPECT_EQ(disk1->changeId, "52 de/5");
+    EXPECT_EQ(disk1->backupId, "vm1_20240101_000000");
+    EXPECT_EQ(disk1->capacity, 1ULL << 30);
+    EXPECT_FALSE(store.get("vm1", "disk2").has_value());
+    // The same disk path of another VM is a record of its own
+    EXPECT_EQ(store.get("vm2", "disk1")->changeId, "61 aa/7");
+
+    ASSERT_TRUE(store.removeVM("vm1"));
+    ChangeIdStore reloaded(path_);
+    ASSERT_TRUE(reloaded.load());
+    EXPECT_FALSE(reloaded.get("vm1", "disk1").has_value());
+    EXPECT_TRUE(reloaded.get("vm2", "disk1").has_value());
+}
+
+TEST_F(ChangeIdStoreTest, FailedWriteKeepsThePreviousState) {
+    ChangeIdStore store(path_);
+    ASSERT_TRUE(store.load());
+    // A directory in the way, so the store cannot be replaced
+    std::filesystem::create_directory(path_);
+    EXPECT_FALSE(store.update(record("vm1", "disk1", "52 de/1")));
+    EXPECT_FALSE(store.getLastError().empty());
+    EXPECT_FALSE(store.get("vm1", "disk1").has_value());
+    EXPECT_FALSE(store.update({record("vm1", "disk1", "52 de/1"), record("vm1", "disk2", "52 de/2")}));
+    EXPECT_FALSE(store.get("vm1", "disk2").has_value());
+}
+
+TEST_F(ChangeIdStoreTest, DecidesWhenAFullBackupIsNeeded) {
+    auto previous = record("vm1", "disk1", "52 de/10");
+    std::string reason;
+
+    EXPECT_FALSE(ChangeIdStore::requiresFullBackup(previous, "52 de/12", previous.capacity, reason));
+    EXPECT_TRUE(reason.empty());
+    EXPECT_FALSE(ChangeIdStore::requiresFullBackup(previous, "52 de/10", previous.capacity, reason));
+
+    EXPECT_TRUE(ChangeIdStore::requiresFullBackup(std::nullopt, "52 de/12", previous.capacity, reason));
+    EXPECT_EQ(reason, "no previous change ID");
+    EXPECT_TRUE(ChangeIdStore::requiresFullBackup(previous, "", previous.capacity, reason));
+    EXPECT_EQ(reason, "change tracking is disabled");
+    EXPECT_TRUE(ChangeIdStore::requiresFullBackup(previous, "52 de/12", previous.capacity * 2, reason));
+    EXPECT_NE(reason.find("capacity changed"), std::string::npos);
+    EXPECT_TRUE(ChangeIdStore::requiresFullBackup(previous, "77 ff/12", previous.capacity, reason));
+    EXPECT_EQ(reason, "change tracking was reset");
+    EXPECT_TRUE(ChangeIdStore::requiresFullBackup(previous, "52 de/9", previous.capacity, reason));
+    EXPECT_EQ(reason, "change ID sequence went backwards");
+    EXPECT_TRUE(ChangeIdStore::requiresFullBackup(previous, "*", previous.capacity, reason));
+    EXPECT_EQ(reason, "unrecognized change ID format");
+}
@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+#include "backup/chunk_gc.hpp"
+#include "temp_directory.hpp"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+class ChunkGcTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // Small packs, so every chunk gets a sealed pack of its own
+        ChunkRepositoryConfig config;
+        config.packSize = 4096;
+        chunks_ = std::make_shared<ChunkRepository>(directory_ + "/.chunks", config);
+        ASSERT_TRUE(chunks_->open());
+
+        config_.sweepBatch = 1;
+        config_.markBatch = 2;
+        config_.compactBelow = 0.0;
+    }
+
+    static std::vector<uint8_t> data(int i) {
+        return std::vector<uint8_t>(4096, static_cast<uint8_t>(i));
+    }
+
+    ChunkId put(const ChunkSession& session, int i, bool* stored = nullptr) {
+        auto content = data(i);
+        ChunkId id{};
+        EXPECT_TRUE(chunks_->put(session, content.data(), content.size(), id, stored)) << chunks_->getLastError();
+        return id;
+    }
+
+    bool has(const ChunkId& id) {
+        std::vector<uint8_t> content;
+        return chunks_->get(id, content);
+    }
+
+    GcStats collect() {
+        GcCycle cycle(chunks_, config_);
+        while (cycle.step()) {
+        }
+        EXPECT_TRUE(cycle.getLastError().empty()) << cycle.getLastError();
+        return cycle.getStats();
+    }
+
+    TempDirectory temp_{"chunk_gc_test"};
+    std::string directory_{temp_.string()};
+    std::shared_ptr<ChunkRepository> chunks_;
+    GcConfig config_;
+};
+
+TEST_F(ChunkGcTest, ReclaimsWhatNoRootReaches) {
+    std::vector<ChunkId> ids;
+    {
+        auto session = chunks_->beginSession();
+        for (int i = 0; i < 6; i++) {
+            ids.push_back(put(*session, i));
+        }
+        ASSERT_TRUE(chunks_->flush());
+        ASSERT_TRUE(chunks_->commitRoot(*session, "vm1_20240101_000000", {ids[0], ids[1], ids[2]}));
+    }
+
+    GcStats stats = collect();
+    EXPECT_TRUE(stats.completed);
+    EXPECT_EQ(stats.roots, 1u);
+    EXPECT_EQ(stats.liveChunks, 3u);
+    EXPECT_EQ(stats.chunksReclaimed, 3u);
+    for (int i = 0; i < 6; i++) {
+        EXPECT_EQ(has(ids[i]), i < 3) << "chunk " << i;
+    }
+
+    // Dropping the root frees the rest
+    ASSERT_TRUE(chunks_->dropRoot("vm1_20240101_000000"));
+    collect();
+    for (const auto& id : ids) {
+        EXPECT_FALSE(has(id));
+    }
+}
+
+TEST_F(ChunkGcTest, OpenSessionKeepsUncommittedChunks) {
+    auto session = chunks_->beginSession();
+    ChunkId id = put(*session, 1);
+    ASSERT_TRUE(chunks_->flush());
+
+    // The backup has not committed its root yet
+    collect();
+    EXPECT_TRUE(has(id));
+
+    session.reset();
+    collect();
+    EXPECT_FALSE(has(id));
+}
+
+TEST_F(ChunkGcTest, PutDuringSweepIsNeverSwept) {
+    std::vector<ChunkId> ids;
+    {
+        auto session = chunks_->beginSession();
+        for (int i = 0; i < 8; i++) {
+            ids.push_back(put(*session, i));
+        }
+        ASSERT_TRUE(chunks_->flush());
+        ASSERT_TRUE(chunks_->commitRoot(*session, "vm1_20240101_000000", {ids[0], ids[1]}));
+    }
+
+    // Step until the sweep has examined its first pack
+    GcCycle cycle(chunks_, config_);
+    while (cycle.getStats().packsScanned == 0) {
+        ASSERT_TRUE(cycle.step());
+    }
+
+    // A backup starting now deduplicates garbage chunks the sweep has not
+    // reached yet and stores a new one
+    auto session = chunks_->beginSession();
+    bool stored = true;
+    EXPECT_EQ(put(*session, 6, &stored), ids[6]);
+    EXPECT_FALSE(stored);
+    EXPECT_EQ(put(*session, 7, &stored), ids[7]);
+    ChunkId added = put(*session, 100);
+    ASSERT_TRUE(chunks_->flush());
+
+    while (cycle.step()) {
+    }
+    EXPECT_TRUE(cycle.getLastError().empty()) << cycle.getLastError();
+    for (int i = 2; i < 6; i++) {
+        EXPECT_FALSE(has(ids[i])) << "chunk " << i;
+    }
+    EXPECT_TRUE(has(ids[6]));
+    EXPECT_TRUE(has(ids[7]));
+    EXPECT_TRUE(has(added));
+
+    // Once committed, the root keeps them after the session is gone
+    ASSERT_TRUE(chunks_->commitRoot(*session, "vm1_20240102_000000", {ids[6], ids[7], added}));
+    session.reset();
+    collect();
+    EXPECT_TRUE(has(ids[0]));
+    EXPECT_TRUE(has(ids[6]));
+    EXPECT_TRUE(has(ids[7]));
+    EXPECT_TRUE(has(added));
+}
+
+TEST_F(ChunkGcTest, RejectsSessionsOfOtherRepositories) {
+    auto other = std::make_shared<ChunkRepository>(directory_ + "/other");
+    ASSERT_TRUE(other->open());
+    auto session = other->beginSession();
+
+    auto content = data(1);
+    ChunkId id{};
+    EXPECT_FALSE(chunks_->put(*session, content.data(), content.size(), id));
+    EXPECT_FALSE(chunks_->commitRoot(*session, "vm1_20240101_000000", {}));
+}
+
+class ChunkCompactionTest : public ChunkGcTest {
+protected:
+    // Incompressible, so four chunks fill a pack
+    static std::vector<uint8_t> noise(int i) {
+        std::mt19937 random(static_cast<unsigned>(i));
+        std::vector<uint8_t> content(1024);
+        for (auto& byte : content) {
+            byte = static_cast<uint8_t>(random());
+        }
+        return content;
+    }
+
+    std::vector<ChunkId> putNoise(const ChunkSession& session, int count) {
+        std::vector<ChunkId> ids;
+        for (int i = 0; i < count; i++) {
+            auto content = noise(i);
+            ChunkId id{};
+            EXPECT_TRUE(chunks_->put(session, content.data(), content.size(), id)) << chunks_->getLastError();
+            ids.push_back(id);
+        }
+        EXPECT_TRUE(chunks_->flush());
+        return ids;
+    }
+
+    // Chunks of the pack holding `id`, in pack order
+    std::vector<ChunkId> packOf(const ChunkId& id) {
+        for (const auto& pack : chunks_->listPacks()) {
+            auto located = chunks_->getPackChunks(pack.id);
+            std::sort(located.begin(), located.end(),
+                      [](const ChunkLocation& a, const ChunkLocation& b) { return a.offset < b.offset; });
+            std::vector<ChunkId> ids;
+            for (const auto& chunk : located) {
+                ids.push_back(chunk.id);
+            }
+            if (std::find(ids.begin(), ids.end(), id) != ids.end()) {
+                return ids;
+            }
+        }
+        return {};
+    }
+};
+
+TEST_F(ChunkCompactionTest, RewritesSparsePacks) {
+    std::vector<ChunkId> ids;
+    {
+        auto session = chunks_->beginSession();
+        ids = putNoise(*session, 12);
+        ASSERT_GT(chunks_->listPacks().size(), 2u);
+        ASSERT_TRUE(chunks_->commitRoot(*session, "vm1_20240101_000000", {ids[0], ids[5], ids[10]}));
+    }
+
+    config_.compactBelow = 0.5;
+    GcStats stats = collect();
+    EXPECT_TRUE(stats.completed);
+    // No pack was all garbage, so compaction reclaimed every dead byte
+    EXPECT_EQ(stats.packsDeleted, 0u);
+    EXPECT_GE(stats.packsCompacted, 2u);
+    EXPECT_GT(stats.bytesReclaimed, 0u);
+    EXPECT_EQ(stats.deadBytesRemaining, 0u);
+    EXPECT_EQ(stats.bytesRewritten, 3u * 1024);
+
+    // The survivors now share one pack, in the order the backup lists them
+    EXPECT_EQ(packOf(ids[0]), (std::vector<ChunkId>{ids[0], ids[5], ids[10]}));
+    for (int i = 0; i < 12; i++) {
+        EXPECT_EQ(has(ids[i]), i == 0 || i == 5 || i == 10) << "chunk " << i;
+    }
+    std::vector<uint8_t> content;
+    ASSERT_TRUE(chunks_->get(ids[5], content));
+    EXPECT_EQ(content, noise(5));
+
+    // Nothing is left to compact
+    stats = collect();
+    EXPECT_EQ(stats.packsCompacted, 0u);
+    EXPECT_EQ(stats.bytesRewritten, 0u);
+}
+
+TEST_F(ChunkCompactionTest, LatestBackupDecidesTheLayout) {
+    std::vector<ChunkId> ids;
+    {
+        auto session = chunks_->beginSession();
+        ids = putNoise(*session, 12);
+        ASSERT_TRUE(chunks_->commitRoot(*session, "vm1_20240101_000000", {ids[0], ids[5], ids[10]}));
+        ASSERT_TRUE(chunks_->commitRoot(*session, "vm1_20240102_000000", {ids[10], ids[5], ids[0]}));
+    }
+
+    config_.compactBelow = 0.5;
+    collect();
+    EXPECT_EQ(packOf(ids[0]), (std::vector<ChunkId>{ids[10], ids[5], ids[0]}));
+}
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include "backup/chunk_repository.hpp"
+#include "backup/local_backend.hpp"
+#include "temp_directory.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace {
+
+// Local objects behind a gate: uploads wait while it is closed, and the
+// reads and failures tests ask for are counted or injected
+class GatedBackend : public StorageBackend {
+public:
+    explicit GatedBackend(const std::string& root) : local_(root) {}
+
+    std::string describe() const override { return "gated " + local_.describe(); }
+
+    bool put(const std::string& key, const void* data, size_t size) override {
+        if (!waitForGate()) {
+            return false;
+        }
+        return local_.put(key, data, size);
+    }
+    std::unique_ptr<ObjectWriter> createWriter(const std::string& key) override {
+        if (!waitForGate()) {
+            return nullptr;
+        }
+        return local_.createWriter(key);
+    }
+    bool read(const std::string& key, uint64_t offset, uint64_t length, std::vector<uint8_t>& data) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reads_.push_back({key, length});
+        }
+        return local_.read(key, offset, length, data);
+    }
+    bool stat(const std::string& key, bool& exists, uint64_t& size) override { return local_.stat(key, exists, size); }
+    bool remove(const std::string& key) override { return local_.remove(key); }
+    bool list(const std::string& prefix, std::vector<std::string>& keys) override { return local_.list(prefix, keys); }
+
+    std::string getLastError() const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return failing_ ? "injected failure" : local_.getLastError();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = false;
+    }
+    void open() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_ = true;
+        }
+        changed_.notify_all();
+    }
+    void fail() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failing_ = true;
+    }
+
+    // Key and length of every read so far
+    std::vector<std::pair<std::string, uint64_t>> getReads() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return reads_;
+    }
+
+private:
+    bool waitForGate() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return open_; });
+        return !failing_;
+    }
+
+    LocalBackend local_;
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<std::pair<std::string, uint64_t>> reads_;
+    bool open_{true};
+    bool failing_{false};
+};
+
+} // namespace
+
+class ChunkRepositoryTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        backend_ = std::make_shared<GatedBackend>(temp_.string());
+        config_.packSize = 16 * 1024;
+        config_.maxPendingPacks = 1;
+        config_.uploadThreads = 1;
+    }
+
+    void TearDown() override {
+        backend_->open();
+    }
+
+    std::shared_ptr<ChunkRepository> openRepository() {
+        auto repository = std::make_shared<ChunkRepository>(backend_, config_);
+        EXPECT_TRUE(repository->open()) << repository->getLastError();
+        return repository;
+    }
+
+    // Incompressible, so sixteen chunks fill a pack
+    static std::vector<uint8_t> noise(int i) {
+        std::mt19937 random(static_cast<unsigned>(i));
+        std::vector<uint8_t> content(1024);
+        for (auto& byte : content) {
+            byte = static_cast<uint8_t>(random());
+        }
+        return content;
+    }
+
+    static bool put(ChunkRepository& repository, const ChunkSession& session, int i, ChunkId& id) {
+        auto content = noise(i);
+        return repository.put(session, content.data(), content.size(), id);
+    }
+
+    size_t countObjects(const std::string& suffix) {
+        std::vector<std::string> keys;
+        EXPECT_TRUE(backend_->list("packs/", keys));
+        size_t count = 0;
+        for (const auto& key : keys) {
+            if (key.size() >= suffix.size() && key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    TempDirectory temp_{"chunk_repository_test"};
+    std::shared_ptr<GatedBackend> backend_;
+    ChunkRepositoryConfig config_;
+};
+
+TEST_F(ChunkRepositoryTest, SmallChunksShareFewObjects) {
+    std::vector<ChunkId> ids(100);
+    {
+        auto repository = openRepository();
+        auto session = repository->beginSession();
+        for (int i = 0; i < 100; i++) {
+            ASSERT_TRUE(put(*repository, *session, i, ids[i])) << repository->getLastError();
+        }
+        ASSERT_TRUE(repository->flush()) << repository->getLastError();
+        ASSERT_TRUE(repository->commitRoot(*session, "vm1_20240101_000000", ids));
+    }
+
+    size_t packs = countObjects(".pack");
+    EXPECT_GE(packs, 6u);
+    EXPECT_LE(packs, 8u);
+    EXPECT_EQ(countObjects(".idx"), packs);
+
+    // A reopened repository reads single chunks with ranged reads
+    auto repository = openRepository();
+    std::vector<uint8_t> content;
+    ASSERT_TRUE(repository->get(ids[42], content)) << repository->getLastError();
+    EXPECT_EQ(content, noise(42));
+    auto reads = backend_->getReads();
+    ASSERT_FALSE(reads.empty());
+    EXPECT_NE(reads.back().first.find(".pack"), std::string::npos);
+    EXPECT_GT(reads.back().second, 0u);
+    EXPECT_LT(reads.back().second, config_.packSize);
+}
+
+TEST_F(ChunkRepositoryTest, WritersWaitForUploadsToCatchUp) {
+    auto repository = openRepository();
+    auto session = repository->beginSession();
+    ChunkId first{};
+    ASSERT_TRUE(put(*repository, *session, 0, first));
+
+    // Sealed packs wait in memory for the closed backend, and stay readable
+    backend_->close();
+    auto writer = std::async(std::launch::async, [&]() {
+        for (int i = 1; i < 100; i++) {
+            ChunkId id{};
+            if (!put(*repository, *session, i, id)) {
+                return false;
+            }
+        }
+        return repository->flush();
+    });
+    EXPECT_EQ(writer.wait_for(milliseconds(200)), std::future_status::timeout);
+    std::vector<uint8_t> content;
+    ASSERT_TRUE(repository->get(first, content));
+    EXPECT_EQ(content, noise(0));
+    EXPECT_EQ(countObjects(".pack"), 0u);
+
+    backend_->open();
+    ASSERT_EQ(writer.wait_for(seconds(10)), std::future_status::ready);
+    EXPECT_TRUE(writer.get()) << repository->getLastError();
+    EXPECT_GE(countObjects(".pack"), 6u);
+}
+
+TEST_F(ChunkRepositoryTest, FailedUploadKeepsThePackInMemory) {
+    auto repository = openRepository();
+    auto session = repository->beginSession();
+    ChunkId id{};
+    ASSERT_TRUE(put(*repository, *session, 0, id));
+
+    backend_->fail();
+    EXPECT_FALSE(repository->flush());
+    EXPECT_NE(repository->getLastError().find("Failed to upload pack"), std::string::npos);
+    // Nothing references a chunk that is not stored
+    EXPECT_FALSE(repository->commitRoot(*session, "vm1_20240101_000000", {id}));
+    std::vector<uint8_t> content;
+    ASSERT_TRUE(repository->get(id, content));
+    EXPECT_EQ(content, noise(0));
+}
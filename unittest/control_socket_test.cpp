@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include "common/control_client.hpp"
+#include "common/control_protocol.hpp"
+#include "common/control_server.hpp"
+#include "temp_directory.hpp"
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+class ControlSocketTest : public ::testing::Test {
+protected:
+    // Answers "ping" once, "count" with as many replies as asked for, and
+    // closes the connection on "quit"
+    static bool handle(const json& request, const ControlReply& reply) {
+        std::string command = request.value("command", "");
+        if (command == "ping") {
+            return reply({{"ok", true}, {"pong", request.value("n", 0)}});
+        }
+        if (command == "count") {
+            for (int i = 0; i < request.value("n", 0); i++) {
+                if (!reply({{"ok", true}, {"i", i}})) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (command == "quit") {
+            return false;
+        }
+        return reply({{"ok", false}, {"error", "Unknown command: " + command}});
+    }
+
+    TempDirectory temp_{"control_socket_test"};
+    std::string socketPath_{(temp_.path() / "control.sock").string()};
+};
+
+TEST_F(ControlSocketTest, MessagesAreSplitAndJoinedAcrossReads) {
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    std::string data = "{\"a\":1}\n{\"b\":2}\n{\"c\":";
+    ASSERT_EQ(::write(fds[1], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+
+    std::string buffer;
+    std::string message;
+    ASSERT_TRUE(readControlMessage(fds[0], buffer, message));
+    EXPECT_EQ(message, "{\"a\":1}");
+    ASSERT_TRUE(readControlMessage(fds[0], buffer, message));
+    EXPECT_EQ(message, "{\"b\":2}");
+
+    ASSERT_TRUE(writeControlMessage(fds[1], json(3)));
+    ASSERT_TRUE(readControlMessage(fds[0], buffer, message));
+    EXPECT_EQ(message, "{\"c\":3");
+
+    // A peer that never ends its message is cut off at the size limit
+    std::string endless(MAX_CONTROL_MESSAGE_SIZE / 16, 'x');
+    std::thread writer([&]() {
+        for (int i = 0; i < 17; i++) {
+            if (::send(fds[1], endless.data(), endless.size(), MSG_NOSIGNAL) < 0) {
+                break;
+            }
+        }
+    });
+    EXPECT_FALSE(readControlMessage(fds[0], buffer, message));
+    ::close(fds[0]);
+    writer.join();
+    ::close(fds[1]);
+}
+
+TEST_F(ControlSocketTest, ServerAnswersRequestsInOrder) {
+    ControlServer server(socketPath_, handle);
+    ASSERT_TRUE(server.start()) << server.getLastError();
+    // A second daemon may not take over the socket of a live one
+    ControlServer second(socketPath_, handle);
+    EXPECT_FALSE(second.start());
+
+    ControlClient client;
+    ASSERT_TRUE(client.connect(socketPath_)) << client.getLastError();
+    json response;
+    for (int n = 0; n < 3; n++) {
+        ASSERT_TRUE(client.request({{"command", "ping"}, {"n", n}}, response));
+        EXPECT_EQ(response["pong"], n);
+    }
+
+    ASSERT_TRUE(client.send({{"command", "count"}, {"n", 3}}));
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(client.receive(response));
+        EXPECT_EQ(response["i"], i);
+    }
+
+    ASSERT_TRUE(client.request({{"command", "unknown"}}, response));
+    EXPECT_FALSE(response["ok"].get<bool>());
+    ASSERT_TRUE(client.send(json("not an object")));
+    ASSERT_TRUE(client.receive(response));
+    EXPECT_EQ(response["error"], "Malformed request");
+
+    ASSERT_TRUE(client.send({{"command", "quit"}}));
+    EXPECT_FALSE(client.receive(response));
+}
+
+TEST_F(ControlSocketTest, StopDisconnectsClients) {
+    ControlServer server(socketPath_, handle);
+    ASSERT_TRUE(server.start()) << server.getLastError();
+    ControlClient client;
+    ASSERT_TRUE(client.connect(socketPath_));
+    json response;
+    ASSERT_TRUE(client.request({{"command", "ping"}}, response));
+
+    // Returns although the client keeps its connection open
+    server.stop();
+    EXPECT_FALSE(server.isRunning());
+    EXPECT_FALSE(client.receive(response));
+    ControlClient late;
+    EXPECT_FALSE(late.connect(socketPath_));
+}
+
+TEST_F(ControlSocketTest, BackupConfigsRoundTrip) {
+    BackupConfig config;
+    config.vmId = "vm-42";
+    config.endpoint = "vc1";
+    config.backupPath = "/backups/vm-42_20240101_000000";
+    config.maxConcurrentDisks = 0;
+    config.bandwidthLimit = 10ULL << 20;
+    config.copyRepositories = {"/copies/a", "/copies/b"};
+    config.copyPolicy = "degrade";
+    config.chunkStore = true;
+
+    BackupConfig parsed;
+    ASSERT_TRUE(backupConfigFromJson(json::parse(backupConfigToJson(config).dump()), parsed));
+    EXPECT_EQ(parsed.vmId, config.vmId);
+    EXPECT_EQ(parsed.endpoint, config.endpoint);
+    EXPECT_EQ(parsed.backupPath, config.backupPath);
+    EXPECT_EQ(parsed.maxConcurrentDisks, 0);
+    EXPECT_EQ(parsed.bandwidthLimit, config.bandwidthLimit);
+    EXPECT_EQ(parsed.copyRepositories, config.copyRepositories);
+    EXPECT_EQ(parsed.copyPolicy, "degrade");
+    EXPECT_TRUE(parsed.chunkStore);
+
+    json invalid = backupConfigToJson(config);
+    invalid["copyPolicy"] = "sometimes";
+    EXPECT_FALSE(backupConfigFromJson(invalid, parsed));
+}
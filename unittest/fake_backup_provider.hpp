@@ -0,0 +1,155 @@
+#pragma once
+
+#include "backup/backup_provider.hpp"
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Provider without a hypervisor: it records the calls jobs make and holds
+// disk copies for as long as a test needs them to run
+class FakeBackupProvider : public BackupProvider {
+public:
+    bool connect(const std::string&, const std::string&, const std::string&) override { return true; }
+    void disconnect() override {}
+    bool isConnected() const override { return true; }
+
+    bool getVMDiskPaths(const std::string& vmId, std::vector<std::string>& diskPaths) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        record("disks " + vmId);
+        auto found = disks_.find(vmId);
+        diskPaths = found != disks_.end() ? found->second : std::vector<std::string>{"[datastore1] " + vmId + "/disk.vmdk"};
+        return true;
+    }
+
+    bool getDiskCapacities(const std::string& vmId, std::map<std::string, uint64_t>& capacities) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        record("capacities " + vmId);
+        capacities = capacities_;
+        return true;
+    }
+
+    bool createSnapshot(const std::string& vmId, std::string& snapshotId) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        record("snapshot " + vmId);
+        snapshotId = "snapshot-" + vmId;
+        return true;
+    }
+
+    bool removeSnapshot(const std::string& vmId, const std::string&) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        record("remove " + vmId);
+        if (onRemoveSnapshot_) {
+            onRemoveSnapshot_(vmId);
+        }
+        return true;
+    }
+
+    bool getChangedBlocks(const std::string&, const std::string&,
+                          std::vector<std::pair<uint64_t, uint64_t>>&) override {
+        return true;
+    }
+
+    bool backupDisk(const std::string& vmId, const std::string& diskPath, const BackupConfig&,
+                    const BackupContext&) override {
+        return copyDisk("backup " + vmId + " " + diskPath, diskPath);
+    }
+
+    bool finishBackup(const std::string& vmId, const BackupConfig&, const BackupContext&, bool succeeded) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        record("finish " + vmId + (succeeded ? " succeeded" : " failed"));
+        return true;
+    }
+
+    bool verifyDisk(const std::string&) override { return true; }
+    bool listBackups(std::vector<std::string>&) override { return true; }
+    bool deleteBackup(const std::string&) override { return true; }
+    bool verifyBackup(const std::string&) override { return true; }
+
+    bool restoreDisk(const std::string& vmId, const std::string& diskPath, const RestoreConfig&,
+                     const RestoreContext&) override {
+        return copyDisk("restore " + vmId + " " + diskPath, diskPath);
+    }
+
+    std::string getLastError() const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lastError_;
+    }
+    void clearLastError() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_.clear();
+    }
+    double getProgress() const override { return 0.0; }
+
+    void setDisks(const std::string& vmId, const std::vector<std::string>& diskPaths) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        disks_[vmId] = diskPaths;
+    }
+    void setCapacity(const std::string& diskPath, uint64_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacities_[diskPath] = capacity;
+    }
+    // Copies of this disk fail
+    void failDisk(const std::string& diskPath) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failDisk_ = diskPath;
+    }
+    // Called with the provider's lock held when a snapshot is removed
+    void onRemoveSnapshot(std::function<void(const std::string&)> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        onRemoveSnapshot_ = std::move(callback);
+    }
+
+    // Disk copies started from now on wait until release()
+    void hold() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_ = true;
+    }
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            held_ = false;
+        }
+        released_.notify_all();
+    }
+
+    // Disk copies started and not finished yet
+    int getActiveCopies() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return activeCopies_;
+    }
+
+    std::vector<std::string> getCalls() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return calls_;
+    }
+
+private:
+    void record(const std::string& call) { calls_.push_back(call); }
+
+    bool copyDisk(const std::string& call, const std::string& diskPath) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        record(call);
+        activeCopies_++;
+        released_.wait(lock, [this] { return !held_; });
+        activeCopies_--;
+        if (diskPath == failDisk_) {
+            lastError_ = "Copy of " + diskPath + " failed";
+            return false;
+        }
+        return true;
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+    std::map<std::string, std::vector<std::string>> disks_;
+    std::map<std::string, uint64_t> capacities_;
+    std::function<void(const std::string&)> onRemoveSnapshot_;
+    std::string failDisk_;
+    std::string lastError_;
+    std::vector<std::string> calls_;
+    int activeCopies_{0};
+    bool held_{false};
+};
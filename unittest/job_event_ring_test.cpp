@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include "common/job_event_ring.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace {
+
+JobEvent progressEvent(int progress) {
+    JobEvent event;
+    event.jobId = "job1";
+    event.progress = progress;
+    return event;
+}
+
+} // namespace
+
+TEST(JobEventRingTest, SubscribersReadInOrder) {
+    JobEventRing ring(8);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(ring.publish(progressEvent(i * 10)), static_cast<uint64_t>(i));
+    }
+
+    uint64_t next = 0;
+    uint64_t dropped = 0;
+    std::vector<JobEvent> events;
+    EXPECT_EQ(ring.read(next, events, 3, dropped), 3u);
+    EXPECT_EQ(ring.read(next, events, 10, dropped), 2u);
+    EXPECT_EQ(dropped, 0u);
+    EXPECT_EQ(next, 5u);
+    ASSERT_EQ(events.size(), 5u);
+    for (size_t i = 0; i < events.size(); i++) {
+        EXPECT_EQ(events[i].sequence, i);
+        EXPECT_EQ(events[i].progress, static_cast<int>(i * 10));
+    }
+    EXPECT_EQ(ring.read(next, events, 10, dropped), 0u);
+}
+
+TEST(JobEventRingTest, SlowSubscriberLearnsWhatItMissed) {
+    JobEventRing ring(4);
+    for (int i = 0; i < 10; i++) {
+        ring.publish(progressEvent(i));
+    }
+    EXPECT_EQ(ring.getOldestSequence(), 6u);
+    EXPECT_EQ(ring.getNextSequence(), 10u);
+
+    // Publishing never waited for the subscriber, whose first six events are gone
+    uint64_t next = 0;
+    uint64_t dropped = 0;
+    std::vector<JobEvent> events;
+    EXPECT_EQ(ring.read(next, events, 10, dropped), 4u);
+    EXPECT_EQ(dropped, 6u);
+    EXPECT_EQ(events.front().sequence, 6u);
+    EXPECT_EQ(events.back().progress, 9);
+}
+
+TEST(JobEventRingTest, WaitReturnsOnPublish) {
+    JobEventRing ring;
+    EXPECT_FALSE(ring.wait(0, milliseconds(10)));
+
+    std::thread publisher([&ring]() {
+        std::this_thread::sleep_for(milliseconds(20));
+        ring.publish(progressEvent(1));
+    });
+    auto start = steady_clock::now();
+    EXPECT_TRUE(ring.wait(0, seconds(10)));
+    EXPECT_LT(steady_clock::now() - start, seconds(5));
+    publisher.join();
+    // Already published events do not satisfy a wait for later ones
+    EXPECT_FALSE(ring.wait(1, milliseconds(10)));
+}
@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+#include "common/job_manager.hpp"
+#include "fake_backup_provider.hpp"
+#include "temp_directory.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+class JobManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        manager_ = std::make_unique<JobManager>();
+        manager_->setProvider(&provider_);
+    }
+
+    void TearDown() override {
+        // Workers call back into the manager until they return
+        for (auto* provider : {&provider_, &vc1_, &vc2_}) {
+            provider->release();
+        }
+        manager_->stopAllJobs();
+        EXPECT_TRUE(waitFor([this] {
+            return manager_->getResourceUsage().empty() && manager_->getQueuedJobCount() == 0 &&
+                   provider_.getActiveCopies() + vc1_.getActiveCopies() + vc2_.getActiveCopies() == 0;
+        }));
+        std::this_thread::sleep_for(milliseconds(50));
+        manager_.reset();
+    }
+
+    BackupConfig backupConfig(const std::string& vmId, const std::string& endpoint = "") const {
+        BackupConfig config;
+        config.vmId = vmId;
+        config.endpoint = endpoint;
+        config.backupPath = (temp_.path() / (vmId + "_20240101_000000")).string();
+        return config;
+    }
+
+    std::string createBackup(const std::string& vmId, const std::string& endpoint = "") {
+        auto job = manager_->createBackupJob(backupConfig(vmId, endpoint));
+        EXPECT_TRUE(job) << manager_->getLastError();
+        jobs_.push_back(job);
+        return job ? job->getId() : "";
+    }
+
+    static bool waitFor(const std::function<bool()>& condition, milliseconds timeout = milliseconds(10000)) {
+        auto deadline = steady_clock::now() + timeout;
+        while (!condition()) {
+            if (steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(milliseconds(5));
+        }
+        return true;
+    }
+
+    bool waitForCompletion(const std::string& jobId) {
+        auto job = manager_->getBackupJob(jobId);
+        return job && waitFor([&job] { return job->isCompleted() || job->isFailed() || job->isCancelled(); });
+    }
+
+    TempDirectory temp_{"job_manager_test"};
+    FakeBackupProvider provider_;
+    FakeBackupProvider vc1_;
+    FakeBackupProvider vc2_;
+    std::unique_ptr<JobManager> manager_;
+    // Kept alive past the manager's registry, for the workers still winding down
+    std::vector<std::shared_ptr<Job>> jobs_;
+};
+
+TEST_F(JobManagerTest, JobsRunOnTheProviderOfTheirEndpoint) {
+    ASSERT_TRUE(manager_->addProvider("vc1", &vc1_));
+    ASSERT_TRUE(manager_->addProvider("vc2", &vc2_));
+    EXPECT_FALSE(manager_->addProvider("vc1", &vc2_));
+    EXPECT_EQ(manager_->getEndpoints(), (std::vector<std::string>{"vc1", "vc2"}));
+
+    std::string onVc1 = createBackup("vm1", "vc1");
+    std::string onDefault = createBackup("vm2");
+    ASSERT_TRUE(manager_->startJob(onVc1)) << manager_->getLastError();
+    ASSERT_TRUE(manager_->startJob(onDefault)) << manager_->getLastError();
+    ASSERT_TRUE(waitForCompletion(onVc1));
+    ASSERT_TRUE(waitForCompletion(onDefault));
+    EXPECT_TRUE(manager_->getBackupJob(onVc1)->isCompleted());
+
+    auto contains = [](const std::vector<std::string>& calls, const std::string& call) {
+        return std::find(calls.begin(), calls.end(), call) != calls.end();
+    };
+    EXPECT_TRUE(contains(vc1_.getCalls(), "snapshot vm1"));
+    EXPECT_FALSE(contains(vc1_.getCalls(), "snapshot vm2"));
+    EXPECT_TRUE(contains(provider_.getCalls(), "snapshot vm2"));
+    EXPECT_TRUE(vc2_.getCalls().empty());
+
+    // A job for an endpoint that is not registered is refused up front
+    EXPECT_FALSE(manager_->createBackupJob(backupConfig("vm3", "vc3")));
+    EXPECT_EQ(manager_->getLastError(), "Unknown endpoint: vc3");
+}
+
+TEST_F(JobManagerTest, EndpointRunsAtMostItsConcurrentJobs) {
+    EndpointLimits limits;
+    limits.maxConcurrentJobs = 1;
+    ASSERT_TRUE(manager_->addProvider("vc1", &vc1_, limits));
+
+    vc1_.hold();
+    std::string first = createBackup("vm1", "vc1");
+    std::string second = createBackup("vm2", "vc1");
+    std::string third = createBackup("vm3", "vc1");
+    ASSERT_TRUE(manager_->submitJob(first));
+    ASSERT_TRUE(waitFor([this] { return vc1_.getActiveCopies() == 1; }));
+    ASSERT_TRUE(manager_->submitJob(second));
+    EXPECT_TRUE(manager_->isJobQueued(second));
+    EXPECT_EQ(manager_->getRunningJobCount("vc1"), 1u);
+    // Starting outright fails instead of queueing
+    EXPECT_FALSE(manager_->startJob(third));
+    EXPECT_NE(manager_->getLastError().find("concurrent job limit"), std::string::npos);
+    EXPECT_FALSE(manager_->removeProvider("vc1"));
+
+    vc1_.release();
+    ASSERT_TRUE(waitForCompletion(first));
+    ASSERT_TRUE(waitForCompletion(second));
+    EXPECT_TRUE(manager_->getBackupJob(second)->isCompleted());
+    ASSERT_TRUE(waitFor([this] { return manager_->getRunningJobCount("vc1") == 0; }));
+    EXPECT_TRUE(manager_->removeProvider("vc1"));
+}
+
+TEST_F(JobManagerTest, FinishedJobsArePrunedOnceTheirEventsAreGone) {
+    JobRetention retention;
+    retention.maxFinishedJobs = 1;
+    manager_->setJobRetention(retention);
+
+    std::string first = createBackup("vm1");
+    std::string second = createBackup("vm2");
+    for (const auto& jobId : {first, second}) {
+        ASSERT_TRUE(manager_->startJob(jobId)) << manager_->getLastError();
+        ASSERT_TRUE(waitForCompletion(jobId));
+        ASSERT_TRUE(waitFor([this] { return manager_->getResourceUsage().empty(); }));
+    }
+    // Subscribers may still read the first job's events
+    EXPECT_EQ(manager_->pruneFinishedJobs(), 0u);
+    EXPECT_TRUE(manager_->getBackupJob(first));
+
+    auto ring = manager_->getEventRing();
+    for (size_t i = 0; i < ring->getCapacity(); i++) {
+        ring->publish(JobEvent());
+    }
+    EXPECT_EQ(manager_->pruneFinishedJobs(), 1u);
+    EXPECT_FALSE(manager_->getBackupJob(first));
+    EXPECT_TRUE(manager_->getBackupJob(second));
+}
+
+TEST_F(JobManagerTest, JobsWaitForRoomOnTheirDatastore) {
+    AdmissionLimits limits;
+    limits.streamsPerDatastore = 1;
+    manager_->setAdmissionLimits(limits);
+
+    provider_.hold();
+    std::string first = createBackup("vm1");
+    std::string second = createBackup("vm2");
+    ASSERT_TRUE(manager_->submitJob(first));
+    ASSERT_TRUE(manager_->submitJob(second));
+    EXPECT_FALSE(manager_->isJobQueued(first));
+    EXPECT_TRUE(manager_->isJobQueued(second));
+    EXPECT_EQ(manager_->getResourceUsage()["datastore:datastore1"], 1u);
+
+    provider_.release();
+    ASSERT_TRUE(waitForCompletion(first));
+    ASSERT_TRUE(waitForCompletion(second));
+    EXPECT_TRUE(manager_->getBackupJob(second)->isCompleted());
+    EXPECT_TRUE(waitFor([this] { return manager_->getResourceUsage().empty(); }));
+}
+
+TEST_F(JobManagerTest, LeastLoadedDatastoreIsAdmittedFirst) {
+    AdmissionLimits limits;
+    limits.streamsPerDatastore = 0;
+    limits.streamsPerRepository = 1;
+    manager_->setAdmissionLimits(limits);
+    provider_.setDisks("vm3", {"[datastore2] vm3/disk.vmdk"});
+
+    // All three share one repository, which admits one job at a time
+    auto createInRepository = [this](const std::string& vmId) {
+        auto config = backupConfig(vmId);
+        config.backupDir = temp_.string();
+        auto job = manager_->createBackupJob(config);
+        jobs_.push_back(job);
+        return job->getId();
+    };
+    provider_.hold();
+    std::string running = createInRepository("vm1");
+    std::string sameDatastore = createInRepository("vm2");
+    std::string otherDatastore = createInRepository("vm3");
+    for (const auto& jobId : {running, sameDatastore, otherDatastore}) {
+        ASSERT_TRUE(manager_->submitJob(jobId));
+    }
+    ASSERT_TRUE(waitFor([this] { return provider_.getActiveCopies() == 1; }));
+    EXPECT_EQ(manager_->getQueuedJobCount(), 2u);
+
+    // Room for one more goes to the job on the idle datastore, although it came later
+    limits.streamsPerRepository = 2;
+    manager_->setAdmissionLimits(limits);
+    EXPECT_FALSE(manager_->isJobQueued(otherDatastore));
+    EXPECT_TRUE(manager_->isJobQueued(sameDatastore));
+    auto usage = manager_->getResourceUsage();
+    EXPECT_EQ(usage["repository:" + temp_.string()], 2u);
+    EXPECT_EQ(usage["datastore:datastore1"], 1u);
+    EXPECT_EQ(usage["datastore:datastore2"], 1u);
+}
+
+TEST_F(JobManagerTest, RestoreThrottlesAndHoldsBackups) {
+    ASSERT_TRUE(manager_->addProvider("vc1", &vc1_));
+    QosPolicy policy;
+    policy.lowerClassAction = "throttle";
+    policy.throttledBytesPerSecond = 1ULL << 20;
+    ASSERT_TRUE(manager_->setQosPolicy(policy));
+
+    provider_.hold();
+    vc1_.hold();
+    std::string running = createBackup("vm1");
+    std::string later = createBackup("vm2");
+    ASSERT_TRUE(manager_->submitJob(running));
+    ASSERT_TRUE(waitFor([this] { return provider_.getActiveCopies() == 1; }));
+
+    RestoreConfig config;
+    config.vmId = "vm3";
+    config.endpoint = "vc1";
+    config.backupId = (temp_.path() / "vm3_20240101_000000").string();
+    config.datastore = "datastore1";
+    DiskConfig disk;
+    disk.path = "[datastore1] vm3/disk.vmdk";
+    config.diskConfigs.push_back(disk);
+    auto restore = manager_->createRestoreJob(config);
+    ASSERT_TRUE(restore) << manager_->getLastError();
+    jobs_.push_back(restore);
+    ASSERT_TRUE(manager_->submitJob(restore->getId()));
+    EXPECT_FALSE(manager_->isJobQueued(restore->getId()));
+
+    // The running backup keeps copying, slowly; the next one waits for the restore
+    auto limiter = manager_->getBackupJob(running)->getRateLimiter();
+    ASSERT_TRUE(limiter);
+    EXPECT_EQ(manager_->getPreemptedJobCount(), 1u);
+    EXPECT_EQ(limiter->getRate(), 1ULL << 20);
+    ASSERT_TRUE(manager_->submitJob(later));
+    EXPECT_TRUE(manager_->isJobQueued(later));
+
+    vc1_.release();
+    ASSERT_TRUE(waitFor([&restore] { return restore->isCompleted() || restore->isFailed(); }));
+    EXPECT_TRUE(restore->isCompleted()) << restore->getError();
+    ASSERT_TRUE(waitFor([this, &later] {
+        return !manager_->isJobQueued(later) && manager_->getPreemptedJobCount() == 0;
+    }));
+    EXPECT_EQ(limiter->getRate(), 0u);
+
+    policy.lowerClassAction = "sometimes";
+    EXPECT_FALSE(manager_->setQosPolicy(policy));
+    EXPECT_EQ(manager_->getQosPolicy().lowerClassAction, "throttle");
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "common/latency_monitor.hpp"
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace std::chrono;
+
+namespace {
+
+// The pause changes at most once per 100 ms
+void waitForAdjust() {
+    std::this_thread::sleep_for(milliseconds(110));
+}
+
+} // namespace
+
+TEST(LatencyMonitorTest, PauseGrowsWhileTheTargetIsMissed) {
+    auto monitor = std::make_shared<LatencyMonitor>();
+    LatencySlo slo;
+    slo.target = milliseconds(10);
+    slo.maxDelay = milliseconds(2);
+    monitor->setSlo(slo);
+    auto source = monitor->getSource("datastore1");
+
+    source->record(milliseconds(50));
+    EXPECT_EQ(source->getDelay(), milliseconds(1));
+    // Slow reads within the same interval do not double it again
+    source->record(milliseconds(50));
+    EXPECT_EQ(source->getDelay(), milliseconds(1));
+    waitForAdjust();
+    source->record(milliseconds(50));
+    EXPECT_EQ(source->getDelay(), milliseconds(2));
+    waitForAdjust();
+    source->record(milliseconds(50));
+    EXPECT_EQ(source->getDelay(), milliseconds(2));
+
+    // It shrinks once the smoothed latency is well under target
+    for (int i = 0; i < 20; i++) {
+        source->record(microseconds(0));
+    }
+    EXPECT_EQ(source->getDelay(), milliseconds(2));
+    waitForAdjust();
+    source->record(microseconds(0));
+    EXPECT_EQ(source->getDelay(), microseconds(1500));
+    EXPECT_LT(source->getLatency(), milliseconds(8));
+}
+
+TEST(LatencyMonitorTest, SourceTargetsOverrideTheGlobalSlo) {
+    auto monitor = std::make_shared<LatencyMonitor>();
+    EXPECT_FALSE(monitor->isEnabled());
+    auto fast = monitor->getSource("fast");
+    auto slow = monitor->getSource("slow");
+    monitor->setSourceTarget("slow", milliseconds(10));
+    EXPECT_TRUE(monitor->isEnabled());
+    EXPECT_EQ(monitor->getSourceTargets().size(), 1u);
+
+    fast->record(milliseconds(50));
+    slow->record(milliseconds(50));
+    EXPECT_EQ(fast->getDelay(), microseconds(0));
+    EXPECT_EQ(slow->getDelay(), milliseconds(1));
+
+    // Removing the target ends the throttling at once
+    monitor->setSourceTarget("slow", milliseconds(0));
+    EXPECT_FALSE(monitor->isEnabled());
+    EXPECT_EQ(slow->getDelay(), microseconds(0));
+}
+
+TEST(LatencyMonitorTest, ThrottlePacesReadsOfSlowSources) {
+    auto monitor = std::make_shared<LatencyMonitor>();
+    LatencySlo slo;
+    slo.target = milliseconds(10);
+    monitor->setSlo(slo);
+    auto throttle = monitor->createThrottle();
+    EXPECT_TRUE(throttle->isEnabled());
+
+    // Disks of one datastore share its source
+    auto source = throttle->getSource("[datastore1] vm1/disk.vmdk");
+    EXPECT_EQ(source, throttle->getSource("[datastore1] vm2/disk.vmdk"));
+    EXPECT_EQ(source->getName(), "datastore1");
+
+    throttle->pace(*source);
+    EXPECT_EQ(throttle->getThrottledTime(), milliseconds(0));
+    throttle->record(*source, milliseconds(50));
+    for (int i = 0; i < 5; i++) {
+        throttle->pace(*source);
+    }
+    EXPECT_EQ(throttle->getThrottledTime(), milliseconds(5));
+
+    auto status = monitor->getStatus();
+    ASSERT_EQ(status.size(), 1u);
+    EXPECT_EQ(status[0].latency, milliseconds(50));
+    EXPECT_EQ(status[0].delay, milliseconds(1));
+}
+
+TEST(LatencyMonitorTest, DatastoreOfDiskPaths) {
+    EXPECT_EQ(datastoreOf("[datastore1] vm/vm.vmdk"), "datastore1");
+    EXPECT_EQ(datastoreOf("[shared nfs] vm/vm_1.vmdk"), "shared nfs");
+    EXPECT_EQ(datastoreOf("/var/lib/libvirt/images/vm.qcow2"), "/var/lib/libvirt/images");
+}
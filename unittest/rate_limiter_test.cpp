@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include "common/rate_limiter.hpp"
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace std::chrono;
+
+class TokenBucketTest : public ::testing::Test {
+protected:
+    // Waits are computed from the wall clock, so allow for the time the
+    // test itself takes between calls
+    static void expectWait(nanoseconds wait, milliseconds expected) {
+        double waited = duration_cast<microseconds>(wait).count() / 1000.0;
+        EXPECT_NEAR(waited, static_cast<double>(expected.count()), 20.0);
+    }
+};
+
+TEST_F(TokenBucketTest, UnlimitedNeverWaits) {
+    TokenBucket bucket;
+    EXPECT_TRUE(bucket.isUnlimited());
+    EXPECT_EQ(bucket.reserve(1ULL << 40).count(), 0);
+}
+
+TEST_F(TokenBucketTest, BurstIsAQuarterSecond) {
+    TokenBucket bucket(1000);
+    EXPECT_EQ(bucket.getRate(), 1000u);
+    EXPECT_EQ(bucket.reserve(200).count(), 0);
+    // 50 tokens left; the other 450 bytes are paid off at 1000 per second
+    expectWait(bucket.reserve(500), milliseconds(450));
+    // Debt accumulates across callers
+    expectWait(bucket.reserve(1000), milliseconds(1450));
+}
+
+TEST_F(TokenBucketTest, ExplicitBurst) {
+    TokenBucket bucket;
+    bucket.setRate(1000, 2000);
+    EXPECT_EQ(bucket.reserve(2000).count(), 0);
+    expectWait(bucket.reserve(100), milliseconds(100));
+}
+
+TEST_F(TokenBucketTest, RefillsWithElapsedTimeUpToBurst) {
+    TokenBucket bucket(10000);
+    EXPECT_EQ(bucket.reserve(2500).count(), 0);
+    std::this_thread::sleep_for(milliseconds(100));
+    // About 1000 tokens came back: the first 1000 bytes go through at once
+    expectWait(bucket.reserve(1000), milliseconds(0));
+    expectWait(bucket.reserve(1000), milliseconds(100));
+
+    // An idle bucket holds no more than its burst
+    std::this_thread::sleep_for(milliseconds(500));
+    expectWait(bucket.reserve(3500), milliseconds(100));
+}
+
+TEST_F(TokenBucketTest, RateChangeKeepsDebt) {
+    TokenBucket bucket(1000);
+    bucket.reserve(1250);
+    // 1000 bytes of debt, paid off at the new rate
+    bucket.setRate(4000, 1000);
+    expectWait(bucket.reserve(0), milliseconds(250));
+
+    // Dropping the limit forgets the debt
+    bucket.setRate(0);
+    EXPECT_EQ(bucket.reserve(1ULL << 30).count(), 0);
+    // and the next limit starts with a full burst
+    bucket.setRate(1000);
+    EXPECT_EQ(bucket.reserve(250).count(), 0);
+}
+
+TEST_F(TokenBucketTest, SlowestBucketOfTheChainDecides) {
+    auto endpoint = std::make_shared<TokenBucket>(1000);
+    auto global = std::make_shared<TokenBucket>(1ULL << 30);
+    RateLimiter limiter(nullptr, {endpoint, global}, 4000);
+
+    limiter.acquire(250);  // Within every burst
+    EXPECT_LT(limiter.getThrottledTime().count(), 5);
+    // The job's own bucket would wait 0.1 s, the endpoint's 0.25 s
+    limiter.acquire(250);
+    EXPECT_NEAR(static_cast<double>(limiter.getThrottledTime().count()), 250.0, 20.0);
+}
+
+TEST(ByteRateTest, ParsesSuffixes) {
+    uint64_t rate = 0;
+    ASSERT_TRUE(parseByteRate("512K", rate));
+    EXPECT_EQ(rate, 512u * 1024);
+    ASSERT_TRUE(parseByteRate("1.5G", rate));
+    EXPECT_EQ(rate, 3ULL << 29);
+    ASSERT_TRUE(parseByteRate("100MB/s", rate));
+    EXPECT_EQ(rate, 100ULL << 20);
+    ASSERT_TRUE(parseByteRate("4096", rate));
+    EXPECT_EQ(rate, 4096u);
+    EXPECT_FALSE(parseByteRate("", rate));
+    EXPECT_FALSE(parseByteRate("-1M", rate));
+    EXPECT_FALSE(parseByteRate("10T", rate));
+    EXPECT_FALSE(parseByteRate("fast", rate));
+}
+
+TEST(ByteRateTest, RejectsTrailingGarbageAndNonFiniteValues) {
+    uint64_t rate = 0;
+    ASSERT_TRUE(parseByteRate("2MiB/s", rate));
+    EXPECT_EQ(rate, 2ULL << 20);
+    ASSERT_TRUE(parseByteRate("8b", rate));
+    EXPECT_EQ(rate, 8u);
+    for (const char* text : {"10Mxyz", "10MBs", "10M/h", "10BB", "10 M", " 10M", "+10M", "0x10", "nan", "inf",
+                             "infM", "1e30G", "1e300"}) {
+        EXPECT_FALSE(parseByteRate(text, rate)) << text;
+    }
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include "backup/replication_job.hpp"
+#include "temp_directory.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class ReplicationJobTest : public ::testing::Test {
+protected:
+    static constexpr uint32_t BLOCK_SIZE = 4096;
+
+    static std::vector<uint8_t> randomBytes(size_t size, uint32_t seed) {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> bytes(size);
+        for (auto& byte : bytes) {
+            byte = static_cast<uint8_t>(random());
+        }
+        return bytes;
+    }
+
+    static void writeFile(const fs::path& path, const std::vector<uint8_t>& content) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(content.data()), static_cast<std::streamsize>(content.size()));
+    }
+
+    static std::vector<uint8_t> readFile(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // A cataloged backup of vm1 in the source, with a chunk root of the
+    // given chunks when there are any
+    void addBackup(const std::string& name, int64_t timestamp, const std::vector<uint8_t>& disk,
+                   const std::vector<int>& chunks = {}) {
+        fs::path directory = fs::path(source_) / name;
+        fs::create_directories(directory);
+        writeFile(directory / "disk.img", disk);
+        writeFile(directory / "disk.json", std::vector<uint8_t>(100, '{'));
+
+        if (!chunks.empty()) {
+            auto store = ChunkRepository::forRepository(source_, true);
+            ASSERT_TRUE(store);
+            auto session = store->beginSession();
+            std::vector<ChunkId> ids;
+            for (int i : chunks) {
+                auto content = randomBytes(BLOCK_SIZE, 1000 + i);
+                ChunkId id{};
+                ASSERT_TRUE(store->put(*session, content.data(), content.size(), id)) << store->getLastError();
+                ids.push_back(id);
+            }
+            ASSERT_TRUE(store->flush());
+            ASSERT_TRUE(store->commitRoot(*session, name, ids));
+        }
+
+        auto catalog = BackupCatalog::forRepository(source_);
+        ASSERT_TRUE(catalog);
+        CatalogEntry entry;
+        entry.vmId = "vm1";
+        entry.backupId = directory.string();
+        entry.timestamp = timestamp;
+        entry.size = disk.size();
+        ASSERT_TRUE(catalog->add(entry));
+    }
+
+    std::unique_ptr<ReplicationJob> replicate() {
+        ReplicationConfig config;
+        config.source = source_;
+        config.destination = destination_;
+        config.streams = 3;
+        config.blockSize = BLOCK_SIZE;
+        config.segmentSize = 8 * BLOCK_SIZE;
+        auto job = std::make_unique<ReplicationJob>(config);
+        EXPECT_TRUE(job->start());
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (job->isRunning() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_FALSE(job->isRunning());
+        return job;
+    }
+
+    std::vector<std::string> destinationRoots() const {
+        auto store = ChunkRepository::forRepository(destination_);
+        if (!store) {
+            return {};
+        }
+        auto roots = store->listRoots();
+        std::sort(roots.begin(), roots.end());
+        return roots;
+    }
+
+    TempDirectory temp_{"replication_job_test"};
+    std::string source_{(temp_.path() / "source").string()};
+    std::string destination_{(temp_.path() / "destination").string()};
+};
+
+TEST_F(ReplicationJobTest, ReplicatesBackupsAndTheirChunks) {
+    auto first = randomBytes(40 * BLOCK_SIZE + 123, 1);
+    addBackup("vm1_20240101_000000", 1, first, {1, 2, 3});
+    // The second backup mostly repeats the first and shares a chunk with it
+    auto second = first;
+    auto noise = randomBytes(2 * BLOCK_SIZE, 2);
+    std::copy(noise.begin(), noise.end(), second.begin() + 10 * BLOCK_SIZE + 7);
+    addBackup("vm1_20240102_000000", 2, second, {3, 4});
+
+    auto job = replicate();
+    ASSERT_TRUE(job->isCompleted()) << job->getError();
+    auto stats = job->getStats();
+    EXPECT_EQ(stats.backupsReplicated, 2u);
+    EXPECT_EQ(stats.backupsSkipped, 0u);
+    EXPECT_EQ(stats.chunksSent, 4u);
+    EXPECT_EQ(stats.chunksPresent, 1u);
+    // The second disk was rebuilt from the first, sending little more than the edit
+    EXPECT_GE(stats.matchedBytes, 35u * BLOCK_SIZE);
+    EXPECT_LT(stats.sentBytes, stats.sourceBytes);
+
+    EXPECT_EQ(readFile(fs::path(destination_) / "vm1_20240101_000000" / "disk.img"), first);
+    EXPECT_EQ(readFile(fs::path(destination_) / "vm1_20240102_000000" / "disk.img"), second);
+    auto catalog = BackupCatalog::forRepository(destination_);
+    ASSERT_TRUE(catalog);
+    auto backups = catalog->list("vm1");
+    ASSERT_EQ(backups.size(), 2u);
+    EXPECT_EQ(fs::path(backups[0].backupId), fs::path(destination_) / "vm1_20240102_000000");
+    EXPECT_EQ(destinationRoots(), (std::vector<std::string>{"vm1_20240101_000000", "vm1_20240102_000000"}));
+
+    // Nothing is left to send on a second run
+    job = replicate();
+    ASSERT_TRUE(job->isCompleted()) << job->getError();
+    EXPECT_EQ(job->getStats().backupsReplicated, 0u);
+    EXPECT_EQ(job->getStats().backupsSkipped, 2u);
+    EXPECT_EQ(job->getStats().sentBytes, 0u);
+}
+
+TEST_F(ReplicationJobTest, FailedFilesLeaveNoChunkRoot) {
+    auto first = randomBytes(8 * BLOCK_SIZE, 3);
+    addBackup("vm1_20240101_000000", 1, first);
+    auto job = replicate();
+    ASSERT_TRUE(job->isCompleted()) << job->getError();
+
+    // The basis of the next backup's disk cannot be read
+    fs::path basis = fs::path(destination_) / "vm1_20240101_000000" / "disk.img";
+    fs::remove(basis);
+    fs::create_directory(basis);
+    addBackup("vm1_20240102_000000", 2, randomBytes(8 * BLOCK_SIZE, 4), {1, 2});
+
+    job = replicate();
+    EXPECT_TRUE(job->isFailed());
+    EXPECT_FALSE(fs::exists(fs::path(destination_) / "vm1_20240102_000000"));
+    EXPECT_TRUE(destinationRoots().empty());
+
+    fs::remove(basis);
+    writeFile(basis, first);
+    job = replicate();
+    ASSERT_TRUE(job->isCompleted()) << job->getError();
+    EXPECT_EQ(job->getStats().backupsReplicated, 1u);
+    EXPECT_EQ(destinationRoots(), (std::vector<std::string>{"vm1_20240102_000000"}));
+}
@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include "backup/retention_policy.hpp"
+#include <set>
+#include <string>
+#include <cstdlib>
+#include <ctime>
+
+class RetentionPolicyTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // Periods are cut in local time
+        const char* tz = std::getenv("TZ");
+        savedTz_ = tz ? tz : "";
+        hadTz_ = tz != nullptr;
+        setenv("TZ", "UTC", 1);
+        tzset();
+    }
+
+    void TearDown() override {
+        if (hadTz_) {
+            setenv("TZ", savedTz_.c_str(), 1);
+        } else {
+            unsetenv("TZ");
+        }
+        tzset();
+    }
+
+    static int64_t at(int year, int month, int day, int hour = 12) {
+        std::tm tm{};
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        return static_cast<int64_t>(timegm(&tm));
+    }
+
+    // One full backup a day at noon, the last one on the given day
+    static std::vector<CatalogEntry> daily(int64_t last, int days) {
+        std::vector<CatalogEntry> backups;
+        for (int i = days - 1; i >= 0; i--) {
+            CatalogEntry entry;
+            entry.vmId = "vm1";
+            entry.timestamp = last - static_cast<int64_t>(i) * 24 * 60 * 60;
+            entry.backupId = "vm1_" + std::to_string(entry.timestamp);
+            backups.push_back(entry);
+        }
+        return backups;
+    }
+
+    static std::set<int64_t> kept(const RetentionPolicy& policy, const std::vector<CatalogEntry>& backups,
+                                  int64_t now) {
+        std::set<int64_t> timestamps;
+        for (const auto& backup : backups) {
+            timestamps.insert(backup.timestamp);
+        }
+        auto expired = selectExpired(policy, backups, std::chrono::system_clock::from_time_t(now));
+        for (size_t i = 1; i < expired.size(); i++) {
+            EXPECT_LT(expired[i - 1].timestamp, expired[i].timestamp) << "expired backups come oldest first";
+        }
+        for (const auto& backup : expired) {
+            timestamps.erase(backup.timestamp);
+        }
+        return timestamps;
+    }
+
+    static std::tm utc(int64_t timestamp) {
+        time_t time = static_cast<time_t>(timestamp);
+        std::tm tm{};
+        gmtime_r(&time, &tm);
+        return tm;
+    }
+
+    std::string savedTz_;
+    bool hadTz_{false};
+};
+
+TEST_F(RetentionPolicyTest, KeepsNewestOfEachDay) {
+    int64_t last = at(2024, 6, 30);
+    auto backups = daily(last, 30);
+    // A second backup on the last day; only the newer one counts for it
+    CatalogEntry early = backups.back();
+    early.timestamp = at(2024, 6, 30, 3);
+    early.backupId = "vm1_early";
+    backups.push_back(early);
+
+    RetentionPolicy policy;
+    policy.keepDaily = 7;
+    auto keep = kept(policy, backups, last);
+    ASSERT_EQ(keep.size(), 7u);
+    EXPECT_EQ(*keep.rbegin(), last);
+    EXPECT_EQ(*keep.begin(), at(2024, 6, 24));
+    EXPECT_EQ(keep.count(early.timestamp), 0u);
+}
+
+TEST_F(RetentionPolicyTest, KeepsNewestOfEachWeekStartingMonday) {
+    // 2024-06-30 is a Sunday
+    int64_t last = at(2024, 6, 30);
+    RetentionPolicy policy;
+    policy.keepWeekly = 4;
+    auto keep = kept(policy, daily(last, 60), last);
+    ASSERT_EQ(keep.size(), 4u);
+    for (int64_t timestamp : keep) {
+        EXPECT_EQ(utc(timestamp).tm_wday, 0) << "kept " << timestamp;
+    }
+    EXPECT_EQ(*keep.begin(), at(2024, 6, 9));
+
+    // Mid-week, the current week's newest backup is the newest overall
+    last = at(2024, 7, 3);
+    keep = kept(policy, daily(last, 60), last);
+    ASSERT_EQ(keep.size(), 4u);
+    EXPECT_EQ(*keep.rbegin(), last);
+    EXPECT_EQ(*keep.begin(), at(2024, 6, 16));
+}
+
+TEST_F(RetentionPolicyTest, KeepsNewestOfEachMonthAndYear) {
+    int64_t last = at(2024, 3, 15);
+    auto backups = daily(last, 800);
+
+    RetentionPolicy monthly;
+    monthly.keepMonthly = 4;
+    std::set<int64_t> expected = {at(2023, 12, 31), at(2024, 1, 31), at(2024, 2, 29), last};
+    EXPECT_EQ(kept(monthly, backups, last), expected);
+
+    RetentionPolicy yearly;
+    yearly.keepYearly = 3;
+    expected = {at(2022, 12, 31), at(2023, 12, 31), last};
+    EXPECT_EQ(kept(yearly, backups, last), expected);
+}
+
+TEST_F(RetentionPolicyTest, TiersCombine) {
+    int64_t last = at(2024, 3, 15);
+    RetentionPolicy policy;
+    policy.keepLast = 2;
+    policy.keepDaily = 3;
+    policy.keepMonthly = 2;
+    std::set<int64_t> expected = {at(2024, 2, 29), at(2024, 3, 13), at(2024, 3, 14), last};
+    EXPECT_EQ(kept(policy, daily(last, 100), last), expected);
+
+    // Backups younger than keepWithinDays are kept on top
+    policy.keepWithinDays = 5;
+    expected.insert({at(2024, 3, 10), at(2024, 3, 11), at(2024, 3, 12)});
+    EXPECT_EQ(kept(policy, daily(last, 100), last), expected);
+}
+
+TEST_F(RetentionPolicyTest, AgeAloneExpiresNothing) {
+    int64_t last = at(2024, 3, 15);
+    RetentionPolicy policy;
+    policy.keepWithinDays = 1;
+    EXPECT_FALSE(policy.isEnabled());
+    EXPECT_EQ(kept(policy, daily(last, 30), last).size(), 30u);
+}
+
+TEST_F(RetentionPolicyTest, KeepsWhatKeptBackupsDependOn) {
+    int64_t last = at(2024, 3, 15);
+    auto backups = daily(last, 10);
+    // Full on the 6th and 10th, incrementals after the 6th, differentials after the 10th
+    for (auto& backup : backups) {
+        int day = utc(backup.timestamp).tm_mday;
+        backup.type = day == 6 || day == 10 ? BackupType::FULL
+                    : day > 10              ? BackupType::DIFFERENTIAL
+                                            : BackupType::INCREMENTAL;
+    }
+
+    RetentionPolicy policy;
+    policy.keepLast = 1;
+    // A differential needs only its full
+    std::set<int64_t> expected = {at(2024, 3, 10), last};
+    EXPECT_EQ(kept(policy, backups, last), expected);
+
+    // An incremental needs every backup back to its full
+    backups.resize(4);
+    expected = {at(2024, 3, 6), at(2024, 3, 7), at(2024, 3, 8), at(2024, 3, 9)};
+    EXPECT_EQ(kept(policy, backups, at(2024, 3, 9)), expected);
+}
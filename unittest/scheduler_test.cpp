@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "common/scheduler.hpp"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+class SchedulerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // One worker runs callbacks in dispatch order; 1 ms ticks put the
+        // level boundaries at 64 ms and 4096 ms
+        scheduler_ = std::make_unique<Scheduler>(1, milliseconds(1));
+        start_ = steady_clock::now();
+    }
+
+    void TearDown() override {
+        scheduler_.reset();
+    }
+
+    Scheduler::TaskCallback record(const std::string& taskId) {
+        return [this, taskId]() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fired_.push_back(taskId);
+            firedAt_[taskId] = duration_cast<milliseconds>(steady_clock::now() - start_);
+        };
+    }
+
+    bool waitFor(size_t count, milliseconds timeout) {
+        auto deadline = steady_clock::now() + timeout;
+        while (steady_clock::now() < deadline) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (fired_.size() >= count) {
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(milliseconds(5));
+        }
+        return false;
+    }
+
+    std::unique_ptr<Scheduler> scheduler_;
+    steady_clock::time_point start_;
+    std::vector<std::string> fired_;
+    std::map<std::string, milliseconds> firedAt_;
+    std::mutex mutex_;
+};
+
+TEST_F(SchedulerTest, CascadedTasksFireInOrderAndOnTime) {
+    // Level 0, the first slots of level 1 and 2, and both sides of each boundary
+    std::vector<int> delays = {5, 63, 64, 65, 130, 1000, 4095, 4100, 4300};
+    for (int delay : delays) {
+        ASSERT_TRUE(scheduler_->scheduleTaskAfter(std::to_string(delay), milliseconds(delay),
+                                                  record(std::to_string(delay))));
+    }
+    EXPECT_EQ(scheduler_->getTaskCount(), delays.size());
+    scheduler_->start();
+
+    ASSERT_TRUE(waitFor(delays.size(), milliseconds(6000)));
+    std::lock_guard<std::mutex> lock(mutex_);
+    ASSERT_EQ(fired_.size(), delays.size());
+    for (size_t i = 0; i < delays.size(); i++) {
+        EXPECT_EQ(fired_[i], std::to_string(delays[i]));
+        milliseconds at = firedAt_[fired_[i]];
+        EXPECT_GE(at.count(), delays[i]) << "task " << fired_[i] << " fired early";
+        EXPECT_LE(at.count(), delays[i] + 100) << "task " << fired_[i] << " fired late";
+    }
+    EXPECT_EQ(scheduler_->getTaskCount(), 0u);
+}
+
+TEST_F(SchedulerTest, CancelReachesCascadedTasks) {
+    ASSERT_TRUE(scheduler_->scheduleTaskAfter("cancelled", milliseconds(300), record("cancelled")));
+    ASSERT_TRUE(scheduler_->scheduleTaskAfter("kept", milliseconds(310), record("kept")));
+    scheduler_->start();
+
+    // By now both have moved from level 1 down to level 0
+    std::this_thread::sleep_for(milliseconds(270));
+    EXPECT_TRUE(scheduler_->cancelTask("cancelled"));
+    EXPECT_FALSE(scheduler_->cancelTask("cancelled"));
+
+    ASSERT_TRUE(waitFor(1, milliseconds(1000)));
+    std::this_thread::sleep_for(milliseconds(50));
+    std::lock_guard<std::mutex> lock(mutex_);
+    ASSERT_EQ(fired_.size(), 1u);
+    EXPECT_EQ(fired_[0], "kept");
+}
+
+TEST_F(SchedulerTest, SchedulingAgainReplacesTheTask) {
+    ASSERT_TRUE(scheduler_->scheduleTaskAfter("task", milliseconds(20), record("early")));
+    ASSERT_TRUE(scheduler_->scheduleTaskAfter("task", milliseconds(150), record("late")));
+    EXPECT_EQ(scheduler_->getTaskCount(), 1u);
+    scheduler_->start();
+
+    ASSERT_TRUE(waitFor(1, milliseconds(1000)));
+    std::this_thread::sleep_for(milliseconds(50));
+    std::lock_guard<std::mutex> lock(mutex_);
+    ASSERT_EQ(fired_.size(), 1u);
+    EXPECT_EQ(fired_[0], "late");
+    EXPECT_GE(firedAt_["late"].count(), 150);
+}
+
+TEST_F(SchedulerTest, TasksBeyondTheWheelWaitTheirTurn) {
+    // 64^4 ticks is about 4.7 hours at 1 ms
+    ASSERT_TRUE(scheduler_->scheduleTaskAfter("far", hours(6), record("far")));
+    ASSERT_TRUE(scheduler_->scheduleTaskAfter("near", milliseconds(10), record("near")));
+    std::this_thread::sleep_for(milliseconds(30));
+    // Driven without the timer thread
+    scheduler_->processTasks();
+
+    ASSERT_TRUE(waitFor(1, milliseconds(1000)));
+    std::this_thread::sleep_for(milliseconds(20));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ASSERT_EQ(fired_.size(), 1u);
+        EXPECT_EQ(fired_[0], "near");
+    }
+    EXPECT_EQ(scheduler_->getTaskCount(), 1u);
+    EXPECT_TRUE(scheduler_->cancelTask("far"));
+}
+
+TEST_F(SchedulerTest, PeriodicTasksKeepTheirSchedule) {
+    scheduler_ = std::make_unique<Scheduler>(1, milliseconds(10));
+    std::atomic<int> runs{0};
+    ASSERT_TRUE(scheduler_->schedulePeriodicTask("periodic", 1, [&runs]() { runs++; }));
+    EXPECT_FALSE(scheduler_->schedulePeriodicTask("invalid", 0, []() {}));
+    scheduler_->start();
+
+    std::this_thread::sleep_for(milliseconds(2500));
+    EXPECT_EQ(runs.load(), 2);
+    EXPECT_EQ(scheduler_->getTaskCount(), 1u);
+    EXPECT_TRUE(scheduler_->cancelTask("periodic"));
+}
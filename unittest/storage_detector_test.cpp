@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "backup/kvm/storage_detector.hpp"
+#include "temp_directory.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace fs = std::filesystem;
+
+class StorageDetectorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        fs::create_directories(data_);
+        fs::create_directories(sysfs_ / "dev" / "block");
+        fs::create_directories(sysfs_ / "class" / "block");
+    }
+
+    static void writeValue(const fs::path& file, const std::string& value) {
+        fs::create_directories(file.parent_path());
+        std::ofstream(file) << value << "\n";
+    }
+
+    // sysfs entry of a block device, linked from class/block like the real one
+    fs::path addDevice(const std::string& relative) {
+        fs::path dir = sysfs_ / "devices" / relative;
+        fs::create_directories(dir / "queue");
+        fs::create_symlink(dir, sysfs_ / "class" / "block" / dir.filename());
+        return dir;
+    }
+
+    // Makes `dir` the device the data directory's filesystem lives on
+    void mountDataOn(const fs::path& dir) {
+        struct stat st;
+        ASSERT_EQ(::stat(data_.c_str(), &st), 0);
+        std::string devNumber = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+        fs::create_symlink(dir, sysfs_ / "dev" / "block" / devNumber);
+    }
+
+    TempDirectory temp_{"storage_detector_test"};
+    fs::path sysfs_{temp_.path() / "sys"};
+    fs::path data_{temp_.path() / "data"};
+};
+
+TEST_F(StorageDetectorTest, ResolvesTheLeavesOfADeviceMapperStack) {
+    // A striped volume over a partition of a disk and an NVMe namespace
+    fs::path disk = addDevice("pci0/host0/sda");
+    writeValue(disk / "queue" / "rotational", "1");
+    writeValue(disk / "queue" / "max_sectors_kb", "1280");
+    writeValue(disk / "device" / "numa_node", "0");
+    fs::path partition = disk / "sda1";
+    writeValue(partition / "partition", "1");
+    fs::create_symlink(partition, sysfs_ / "class" / "block" / "sda1");
+    fs::path nvme = addDevice("pci1/nvme0/nvme0n1");
+    writeValue(nvme / "queue" / "rotational", "0");
+    writeValue(nvme / "queue" / "logical_block_size", "4096");
+    writeValue(nvme / "device" / "device" / "numa_node", "1");
+    fs::path volume = addDevice("virtual/block/dm-0");
+    writeValue(volume / "queue" / "optimal_io_size", "524288");
+    writeValue(volume / "slaves" / "sda1", "");
+    writeValue(volume / "slaves" / "nvme0n1", "");
+    mountDataOn(volume);
+
+    // A target that does not exist yet is on the device of its parent
+    auto devices = StorageDetector::resolveDevices((data_ / "vm1" / "disk.img").string(), sysfs_.string());
+    ASSERT_EQ(devices.size(), 2u);
+    auto& hdd = devices[0].name == "sda" ? devices[0] : devices[1];
+    auto& flash = devices[0].name == "sda" ? devices[1] : devices[0];
+    EXPECT_EQ(hdd.name, "sda");
+    EXPECT_TRUE(hdd.rotational);
+    EXPECT_FALSE(hdd.nvme);
+    EXPECT_EQ(hdd.maxSectorsKb, 1280u);
+    EXPECT_EQ(hdd.numaNode, 0);
+    // The stripe width of the volume carries down to its leaves
+    EXPECT_EQ(hdd.optimalIoSize, 524288u);
+    EXPECT_EQ(flash.name, "nvme0n1");
+    EXPECT_TRUE(flash.nvme);
+    EXPECT_EQ(flash.logicalBlockSize, 4096u);
+    EXPECT_EQ(flash.numaNode, 1);
+
+    auto profile = StorageDetector::probeIoProfile({data_.string(), (data_ / "other").string()}, sysfs_.string());
+    EXPECT_EQ(profile.description, "hdd x2");
+    EXPECT_EQ(profile.queueDepth, 2u);
+    EXPECT_EQ(profile.blockSize, 4u << 20);
+    EXPECT_EQ(profile.numaNode, -1);
+}
+
+TEST_F(StorageDetectorTest, UnknownDevicesGetNoRecommendation) {
+    EXPECT_TRUE(StorageDetector::resolveDevices(data_.string(), sysfs_.string()).empty());
+    auto profile = StorageDetector::probeIoProfile({data_.string()}, sysfs_.string());
+    EXPECT_EQ(profile.description, "unknown");
+    EXPECT_EQ(profile.queueDepth, 0u);
+    EXPECT_EQ(profile.blockSize, 1u << 20);
+}
+
+TEST_F(StorageDetectorTest, RecommendsDeeperQueuesForFlash) {
+    StorageDetector::DeviceTopology nvme;
+    nvme.name = "nvme0n1";
+    nvme.nvme = true;
+    nvme.numaNode = 1;
+    auto second = nvme;
+    second.name = "nvme1n1";
+    auto profile = StorageDetector::recommendIoProfile({nvme, second});
+    EXPECT_EQ(profile.description, "nvme x2");
+    EXPECT_EQ(profile.queueDepth, 16u);
+    EXPECT_EQ(profile.blockSize, 1u << 20);
+    EXPECT_EQ(profile.numaNode, 1);
+
+    // Whole stripes of a 768 KiB wide array
+    StorageDetector::DeviceTopology ssd;
+    ssd.name = "sdb";
+    ssd.optimalIoSize = 768 * 1024;
+    profile = StorageDetector::recommendIoProfile({ssd});
+    EXPECT_EQ(profile.description, "ssd");
+    EXPECT_EQ(profile.queueDepth, 4u);
+    EXPECT_EQ(profile.blockSize, 1536u * 1024);
+
+    // The queue depth is capped however many devices there are
+    std::vector<StorageDetector::DeviceTopology> many(10, nvme);
+    EXPECT_EQ(StorageDetector::recommendIoProfile(many).queueDepth, 32u);
+}
+
+TEST_F(StorageDetectorTest, ReadsTheCpusOfANumaNode) {
+    writeValue(sysfs_ / "devices" / "system" / "node" / "node1" / "cpulist", "0-3,8,10-11");
+    EXPECT_EQ(StorageDetector::getNodeCpus(1, sysfs_.string()), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_TRUE(StorageDetector::getNodeCpus(0, sysfs_.string()).empty());
+    EXPECT_TRUE(StorageDetector::getNodeCpus(-1, sysfs_.string()).empty());
+}
+
+TEST_F(StorageDetectorTest, RecognizesLogicalVolumePaths) {
+    EXPECT_TRUE(StorageDetector::isLVM("/dev/mapper/vg0-root"));
+    EXPECT_TRUE(StorageDetector::isLVM("/dev/vg0/root"));
+    EXPECT_FALSE(StorageDetector::isLVM("/dev/sda"));
+    EXPECT_FALSE(StorageDetector::isLVM("/dev/disk/by-id/wwn-0x5000"));
+    EXPECT_FALSE(StorageDetector::isLVM("/var/lib/libvirt/images/vm.qcow2"));
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include "common/stream_controller.hpp"
+#include <chrono>
+#include <thread>
+
+using namespace std::chrono;
+
+class StreamControllerTest : public ::testing::Test {
+protected:
+    // One read per window, recorded once the window is over so it decides
+    static void window(AdaptiveStreamController& controller, uint64_t bytes, microseconds latency) {
+        std::this_thread::sleep_for(milliseconds(15));
+        controller.recordRead(bytes, latency);
+    }
+
+    static StreamControllerConfig config() {
+        StreamControllerConfig config;
+        config.initialStreams = 2;
+        config.minStreams = 1;
+        config.maxStreams = 4;
+        config.latencyTarget = milliseconds(50);
+        config.interval = milliseconds(10);
+        return config;
+    }
+};
+
+TEST_F(StreamControllerTest, AddsStreamsWhileThroughputRises) {
+    AdaptiveStreamController controller(config());
+    EXPECT_TRUE(controller.isAdaptive());
+    EXPECT_EQ(controller.getStreamCount(), 2u);
+
+    // The first window always probes another stream
+    window(controller, 1ULL << 20, milliseconds(1));
+    EXPECT_EQ(controller.getStreamCount(), 3u);
+    window(controller, 1ULL << 30, milliseconds(1));
+    EXPECT_EQ(controller.getStreamCount(), 4u);
+    EXPECT_GT(controller.getThroughput(), 1e9);
+
+    // The last stream bought nothing, so it is taken back
+    window(controller, 1024, milliseconds(1));
+    EXPECT_EQ(controller.getStreamCount(), 3u);
+}
+
+TEST_F(StreamControllerTest, HalvesStreamsWhenLatencyIsOverTarget) {
+    auto slow = config();
+    slow.initialStreams = 4;
+    AdaptiveStreamController controller(slow);
+    window(controller, 1ULL << 20, milliseconds(100));
+    EXPECT_EQ(controller.getStreamCount(), 2u);
+    EXPECT_EQ(controller.getLatency(), milliseconds(100));
+    window(controller, 1ULL << 20, milliseconds(100));
+    window(controller, 1ULL << 20, milliseconds(100));
+    EXPECT_EQ(controller.getStreamCount(), 1u);
+
+    // Reads within a window do not decide anything
+    AdaptiveStreamController steady(config());
+    for (int i = 0; i < 100; i++) {
+        steady.recordRead(1ULL << 20, milliseconds(100));
+    }
+    EXPECT_EQ(steady.getStreamCount(), 2u);
+}
+
+TEST_F(StreamControllerTest, FixedCountsStayPut) {
+    AdaptiveStreamController controller(AdaptiveStreamController::fixed(3));
+    EXPECT_FALSE(controller.isAdaptive());
+    window(controller, 1ULL << 20, milliseconds(100));
+    controller.limitMaxStreams(1);
+    EXPECT_EQ(controller.getStreamCount(), 3u);
+
+    // An adaptive count is capped by what the storage can use
+    AdaptiveStreamController adaptive(config());
+    adaptive.limitMaxStreams(1);
+    EXPECT_EQ(adaptive.getMaxStreams(), 1u);
+    EXPECT_EQ(adaptive.getStreamCount(), 1u);
+    EXPECT_FALSE(adaptive.isAdaptive());
+}
@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include "backup/tee_writer.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace {
+
+// Shared with the test after the writer takes the target over
+struct TargetState {
+    std::mutex mutex;
+    std::condition_variable opened;
+    std::map<uint64_t, std::vector<uint8_t>> blocks;
+    bool open{true};
+    int failAfter{-1};  // Writes that succeed before the rest fail (-1 = none fail)
+
+    void setOpen(bool value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            open = value;
+        }
+        opened.notify_all();
+    }
+};
+
+class MemoryTarget : public TeeTarget {
+public:
+    MemoryTarget(std::string name, std::shared_ptr<TargetState> state)
+        : name_(std::move(name)), state_(std::move(state)) {}
+
+    std::string describe() const override { return name_; }
+
+    bool write(uint64_t offset, const uint8_t* data, size_t size, std::string& error) override {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        state_->opened.wait(lock, [this] { return state_->open; });
+        if (state_->failAfter == 0) {
+            error = "disk full";
+            return false;
+        }
+        if (state_->failAfter > 0) {
+            state_->failAfter--;
+        }
+        state_->blocks[offset].assign(data, data + size);
+        return true;
+    }
+
+private:
+    std::string name_;
+    std::shared_ptr<TargetState> state_;
+};
+
+std::vector<uint8_t> block(uint64_t i, size_t size = 1024) {
+    return std::vector<uint8_t>(size, static_cast<uint8_t>(i));
+}
+
+} // namespace
+
+class TeeWriterTest : public ::testing::Test {
+protected:
+    // A closed target has to be opened before the writer finishes
+    static std::shared_ptr<TargetState> addTarget(TeeWriter& writer, const std::string& name,
+                                                  bool required = false) {
+        auto state = std::make_shared<TargetState>();
+        writer.addTarget(std::make_unique<MemoryTarget>(name, state), required);
+        return state;
+    }
+};
+
+TEST_F(TeeWriterTest, EveryTargetGetsEveryWrite) {
+    TeeWriter writer;
+    std::vector<std::shared_ptr<TargetState>> targets;
+    for (const auto& name : {"a", "b", "c"}) {
+        targets.push_back(addTarget(writer, name));
+    }
+
+    // Two writers, with their areas interleaved
+    auto writeEvery = [&writer](uint64_t first) {
+        for (uint64_t i = first; i < 100; i += 2) {
+            auto data = block(i);
+            if (!writer.write(i * 1024, data.data(), data.size())) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto even = std::async(std::launch::async, writeEvery, 0);
+    auto odd = std::async(std::launch::async, writeEvery, 1);
+    EXPECT_TRUE(even.get());
+    EXPECT_TRUE(odd.get());
+    ASSERT_TRUE(writer.finish());
+
+    for (const auto& target : targets) {
+        ASSERT_EQ(target->blocks.size(), 100u);
+        for (uint64_t i = 0; i < 100; i++) {
+            EXPECT_EQ(target->blocks[i * 1024], block(i));
+        }
+    }
+    for (const auto& status : writer.getStatus()) {
+        EXPECT_EQ(status.bytesWritten, 100u * 1024);
+        EXPECT_EQ(status.queuedBytes, 0u);
+        EXPECT_FALSE(status.dropped);
+    }
+}
+
+TEST_F(TeeWriterTest, SlowTargetHoldsWritersOnlyOnceItsQueueIsFull) {
+    TeeConfig config;
+    config.queueBytes = 4096;
+    TeeWriter writer(config);
+    auto slow = addTarget(writer, "slow");
+    addTarget(writer, "fast");
+
+    slow->setOpen(false);
+    for (uint64_t i = 0; i < 4; i++) {
+        auto data = block(i);
+        ASSERT_TRUE(writer.write(i * 1024, data.data(), data.size()));
+    }
+    auto data = block(4);
+    auto blocked = std::async(std::launch::async, [&]() { return writer.write(4 * 1024, data.data(), data.size()); });
+    EXPECT_EQ(blocked.wait_for(milliseconds(100)), std::future_status::timeout);
+
+    slow->setOpen(true);
+    EXPECT_TRUE(blocked.get());
+    ASSERT_TRUE(writer.finish());
+    auto status = writer.getStatus();
+    EXPECT_GE(status[0].blockedTime, milliseconds(100));
+    EXPECT_EQ(status[0].bytesWritten, 5u * 1024);
+    EXPECT_EQ(status[1].bytesWritten, 5u * 1024);
+}
+
+TEST_F(TeeWriterTest, DegradeDropsFailedAndStalledTargets) {
+    TeeConfig config;
+    config.policy = TeePolicy::DEGRADE;
+    config.queueBytes = 1024;
+    config.stallTimeout = milliseconds(50);
+    TeeWriter writer(config);
+    auto primary = addTarget(writer, "primary", true);
+    auto failing = addTarget(writer, "failing");
+    auto stalled = addTarget(writer, "stalled");
+    failing->failAfter = 1;
+    stalled->setOpen(false);
+
+    for (uint64_t i = 0; i < 4; i++) {
+        auto data = block(i);
+        ASSERT_TRUE(writer.write(i * 1024, data.data(), data.size())) << writer.getLastError();
+    }
+    // finish() waits for the write the dropped target is stuck in
+    stalled->setOpen(true);
+    ASSERT_TRUE(writer.finish());
+    EXPECT_EQ(primary->blocks.size(), 4u);
+    EXPECT_EQ(stalled->blocks.size(), 1u);
+
+    auto status = writer.getStatus();
+    EXPECT_FALSE(status[0].dropped);
+    EXPECT_TRUE(status[1].dropped);
+    EXPECT_EQ(status[1].error, "failing: disk full");
+    EXPECT_TRUE(status[2].dropped);
+    EXPECT_NE(status[2].error.find("fell behind"), std::string::npos);
+}
+
+TEST_F(TeeWriterTest, FailedRequiredTargetFailsTheCopy) {
+    TeeConfig config;
+    config.policy = TeePolicy::DEGRADE;
+    TeeWriter writer(config);
+    auto primary = addTarget(writer, "primary", true);
+    addTarget(writer, "copy");
+    primary->failAfter = 0;
+
+    auto data = block(0);
+    writer.write(0, data.data(), data.size());
+    EXPECT_FALSE(writer.finish());
+    EXPECT_TRUE(writer.hasFailed());
+    EXPECT_EQ(writer.getLastError(), "primary: disk full");
+    EXPECT_FALSE(writer.write(1024, data.data(), data.size()));
+
+    // Without targets there is nothing to copy to
+    TeeWriter empty;
+    EXPECT_FALSE(empty.write(0, data.data(), data.size()));
+    EXPECT_EQ(empty.getLastError(), "No copy targets");
+}
+
+TEST(BackupCopiesTest, DroppedCopiesAreLeftOut) {
+    BackupCopies copies({"/copies/a", "/copies/b"}, TeeConfig());
+    copies.drop("/copies/a", "disk full");
+    copies.drop("/copies/c", "unknown");
+    EXPECT_EQ(copies.getActive(), std::vector<std::string>{"/copies/b"});
+    ASSERT_EQ(copies.getDropped().size(), 1u);
+    EXPECT_EQ(copies.getDropped()[0].first, "/copies/a");
+    EXPECT_EQ(copies.getDropped()[0].second, "disk full");
+}
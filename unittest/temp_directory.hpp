@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+// Empty directory under the system temp directory, removed with everything
+// in it on destruction. Declare it before the members that keep files in it
+// open, so they are destroyed first.
+class TempDirectory {
+public:
+    explicit TempDirectory(const std::string& name) {
+        static std::atomic<unsigned> sequence{0};
+        path_ = std::filesystem::temp_directory_path() /
+                (name + "_" + std::to_string(::getpid()) + "_" + std::to_string(sequence++));
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+
+    ~TempDirectory() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+
+    TempDirectory(const TempDirectory&) = delete;
+    TempDirectory& operator=(const TempDirectory&) = delete;
+
+    const std::filesystem::path& path() const { return path_; }
+    std::string string() const { return path_.string(); }
+
+private:
+    std::filesystem::path path_;
+};
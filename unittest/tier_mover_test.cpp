@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include "backup/local_backend.hpp"
+#include "backup/tier_mover.hpp"
+#include "temp_directory.hpp"
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+class TierMoverTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        config_.packSize = 16 * 1024;
+        repository_ = openRepository();
+    }
+
+    std::shared_ptr<ChunkRepository> openRepository() {
+        auto repository = std::make_shared<ChunkRepository>(landing_, config_);
+        EXPECT_TRUE(repository->open()) << repository->getLastError();
+        EXPECT_TRUE(repository->attachCapacityTier(capacity_)) << repository->getLastError();
+        return repository;
+    }
+
+    // Incompressible, so sixteen chunks fill a pack
+    static std::vector<uint8_t> noise(int i) {
+        std::mt19937 random(static_cast<unsigned>(i));
+        std::vector<uint8_t> content(1024);
+        for (auto& byte : content) {
+            byte = static_cast<uint8_t>(random());
+        }
+        return content;
+    }
+
+    // Four sealed packs of sixteen chunks
+    std::vector<ChunkId> store() {
+        auto session = repository_->beginSession();
+        std::vector<ChunkId> ids(64);
+        for (int i = 0; i < 64; i++) {
+            auto content = noise(i);
+            EXPECT_TRUE(repository_->put(*session, content.data(), content.size(), ids[i]));
+        }
+        EXPECT_TRUE(repository_->flush());
+        EXPECT_TRUE(repository_->commitRoot(*session, "vm1_20240101_000000", ids));
+        return ids;
+    }
+
+    static size_t countPacks(StorageBackend& backend) {
+        std::vector<std::string> keys;
+        EXPECT_TRUE(backend.list("packs/", keys));
+        size_t count = 0;
+        for (const auto& key : keys) {
+            count += key.find(".pack") != std::string::npos ? 1 : 0;
+        }
+        return count;
+    }
+
+    TempDirectory temp_{"tier_mover_test"};
+    std::shared_ptr<LocalBackend> landing_{std::make_shared<LocalBackend>((temp_.path() / "landing").string())};
+    std::shared_ptr<LocalBackend> capacity_{std::make_shared<LocalBackend>((temp_.path() / "capacity").string())};
+    ChunkRepositoryConfig config_;
+    std::shared_ptr<ChunkRepository> repository_;
+};
+
+TEST_F(TierMoverTest, MovesOldPacksAndKeepsThemReadable) {
+    auto ids = store();
+    size_t packs = countPacks(*landing_);
+    ASSERT_GE(packs, 4u);
+
+    // Nothing is old enough yet
+    TierPolicy policy;
+    TierMover mover(policy);
+    TierStats stats = mover.moveDue(repository_);
+    EXPECT_TRUE(stats.completed);
+    EXPECT_EQ(stats.packsMoved, 0u);
+    EXPECT_EQ(stats.landingPacks, packs);
+
+    policy.moveAfter = seconds(0);
+    mover.setPolicy(policy);
+    stats = mover.moveDue(repository_);
+    EXPECT_TRUE(stats.completed);
+    EXPECT_EQ(stats.packsMoved, packs);
+    EXPECT_EQ(stats.landingPacks, 0u);
+    EXPECT_EQ(stats.capacityPacks, packs);
+    EXPECT_EQ(countPacks(*landing_), 0u);
+    EXPECT_EQ(countPacks(*capacity_), packs);
+    EXPECT_EQ(mover.getLastStats(repository_->getDirectory())->packsMoved, packs);
+
+    std::vector<uint8_t> content;
+    ASSERT_TRUE(repository_->get(ids[7], content)) << repository_->getLastError();
+    EXPECT_EQ(content, noise(7));
+
+    // Reopened, each pack is read from the tier holding it
+    repository_->close();
+    repository_ = openRepository();
+    ASSERT_TRUE(repository_->get(ids[63], content)) << repository_->getLastError();
+    EXPECT_EQ(content, noise(63));
+}
+
+TEST_F(TierMoverTest, LandingLimitMovesTheOldestPacksEarly) {
+    store();
+    auto before = repository_->listPacks();
+    uint64_t landingBytes = 0;
+    for (const auto& pack : before) {
+        landingBytes += pack.size;
+    }
+
+    // Room for all but about one pack
+    TierPolicy policy;
+    policy.landingLimit = landingBytes - before.back().size;
+    TierMover mover(policy);
+    TierStats stats = mover.moveDue(repository_);
+    EXPECT_EQ(stats.packsMoved, 1u);
+    EXPECT_LE(stats.landingBytes, policy.landingLimit);
+
+    auto after = repository_->listPacks();
+    ASSERT_EQ(after.size(), before.size());
+    EXPECT_TRUE(after.front().offloaded);
+    for (size_t i = 1; i < after.size(); i++) {
+        EXPECT_FALSE(after[i].offloaded) << "pack " << after[i].id;
+    }
+}
+
+TEST_F(TierMoverTest, NeedsACapacityTierAttachedBeforeUse) {
+    TierMover mover;
+    EXPECT_TRUE(mover.add(repository_));
+
+    auto plain = std::make_shared<ChunkRepository>((temp_.path() / "plain").string());
+    ASSERT_TRUE(plain->open());
+    EXPECT_FALSE(mover.add(plain));
+
+    // The landing tier has been written to
+    auto session = plain->beginSession();
+    auto content = noise(1);
+    ChunkId id{};
+    ASSERT_TRUE(plain->put(*session, content.data(), content.size(), id));
+    EXPECT_FALSE(plain->attachCapacityTier(capacity_));
+}